@@ -15,8 +15,39 @@
 #include <openssl/evp.h>
 
 namespace cipher {
+
+static const unsigned char s_ZeroIV[EVP_MAX_IV_LENGTH] = { 0 };
+
+COpenSSLCipher::~COpenSSLCipher()
+{
+    FreeContexts();
+    if ( m_pKey )
+        delete[] m_pKey;
+}
+
+void COpenSSLCipher::FreeContexts()
+{
+    for (int i = 0; i < 2; ++i)
+    {
+        if (m_pCtx[i])
+        {
+            EVP_CIPHER_CTX_free(m_pCtx[i]);
+            m_pCtx[i] = NULL;
+        }
+    }
+}
+
 int COpenSSLCipher::SetKey(const void *pKey, unsigned int KeyLen)
 {
+    // New key invalidates both keyed contexts
+    FreeContexts();
+
+    if (m_pKey)
+    {
+        delete[] m_pKey;
+        m_pKey = NULL;
+    }
+
     m_keyLen = KeyLen;
     m_pKey = new unsigned char[KeyLen];
     if (m_pKey)
@@ -28,56 +59,82 @@ int COpenSSLCipher::SetKey(const void *pKey, unsigned int KeyLen)
     return ERR_NOMEMORY;
 }
 
-int COpenSSLCipher::CryptInternal(const void *pInBuff, unsigned int InSize, void *pOutBuff, unsigned int *pOutSize, void *pIV, int enc) const
+int COpenSSLCipher::GetContext(int enc, EVP_CIPHER_CTX** ppCtx)
 {
-    EVP_CIPHER_CTX *pCtx = EVP_CIPHER_CTX_new();
-
-    if (!pCtx)
+    if (m_pCtx[enc])
     {
-        return ERR_NOMEMORY;
+        *ppCtx = m_pCtx[enc];
+        return ERR_NOERROR;
     }
 
-    int sslErr = 1;
+    const EVP_CIPHER* pType;
 
     switch (m_method)
     {
     case I_CIPHER_AES128:
-        sslErr = EVP_CipherInit_ex(pCtx, EVP_aes_128_cbc(), NULL, m_pKey, (const unsigned char*)pIV, enc);
+        pType = EVP_aes_128_cbc();
         break;
 
     case I_CIPHER_AES192:
-        sslErr = EVP_CipherInit_ex(pCtx, EVP_aes_192_cbc(), NULL, m_pKey, (const unsigned char*)pIV, enc);
+        pType = EVP_aes_192_cbc();
         break;
 
     case I_CIPHER_AES256:
-        sslErr = EVP_CipherInit_ex(pCtx, EVP_aes_256_cbc(), NULL, m_pKey, (const unsigned char*)pIV, enc);
+        pType = EVP_aes_256_cbc();
         break;
 
     /*case I_CIPHER_SHA256:
-        sslErr = EVP_CipherInit_ex(pCtx, EVP_sha256(), NULL, (const unsigned char*)m_pKey, (const unsigned char*)pIV, enc);
+        pType = EVP_sha256();
         break;*/
     //I_CIPHER_HMAC_SHA256
 
     case I_CIPHER_AES_XTS:
-        sslErr = EVP_CipherInit_ex(pCtx, EVP_aes_128_xts(), NULL, m_pKey, (const unsigned char*)pIV, enc);
+        pType = EVP_aes_128_xts();
         break;
 
     default:
-        EVP_CIPHER_CTX_free(pCtx);
         return ERR_BADPARAMS;
     }
 
-    if (1 != sslErr)
+    EVP_CIPHER_CTX *pCtx = EVP_CIPHER_CTX_new();
+
+    if (!pCtx)
+    {
+        return ERR_NOMEMORY;
+    }
+
+    // Key schedule is computed once here, IV is loaded on every call
+    if (1 != EVP_CipherInit_ex(pCtx, pType, NULL, m_pKey, NULL, enc))
     {
         EVP_CIPHER_CTX_free(pCtx);
         return ERR_ENCRYPTION;
     }
 
+    *ppCtx = m_pCtx[enc] = pCtx;
+    return ERR_NOERROR;
+}
+
+int COpenSSLCipher::CryptInternal(const void *pInBuff, unsigned int InSize, void *pOutBuff, unsigned int *pOutSize, const void *pIV, int enc)
+{
+    EVP_CIPHER_CTX *pCtx;
+    int Status = GetContext(enc, &pCtx);
+
+    if (ERR_NOERROR != Status)
+    {
+        return Status;
+    }
+
+    // A fresh context always started from zero IV, keep this for the reused one
+    int sslErr = EVP_CipherInit_ex(pCtx, NULL, NULL, NULL, pIV ? (const unsigned char*)pIV : s_ZeroIV, enc);
+    if (1 != sslErr)
+    {
+        return ERR_ENCRYPTION;
+    }
+
     int outLen = 0;
     sslErr = EVP_CipherUpdate(pCtx, (unsigned char*)pOutBuff, &outLen, (unsigned char*)pInBuff, InSize);
     if (1 != sslErr)
     {
-        EVP_CIPHER_CTX_free(pCtx);
         return ERR_ENCRYPTION;
     }
 
@@ -86,7 +143,6 @@ int COpenSSLCipher::CryptInternal(const void *pInBuff, unsigned int InSize, void
     {
         sslErr = EVP_CipherFinal_ex(pCtx, (unsigned char*)pOutBuff + outLen, &finalLen);
     }
-    EVP_CIPHER_CTX_free(pCtx);
 
     if (pOutSize)
     {
@@ -106,4 +162,40 @@ int COpenSSLCipher::Decrypt(const void *pInBuff, unsigned int InSize, void *pOut
     return CryptInternal(pInBuff, InSize, pOutBuff, pOutSize, pIV, 0/*decrypt*/);
 }
 
+int COpenSSLCipher::DecryptUnits(const void *pInBuff, void *pOutBuff, unsigned int UnitSize, size_t Units, UINT64 StartTweak)
+{
+    if (I_CIPHER_AES_XTS != m_method)
+    {
+        return api::ICipher::DecryptUnits(pInBuff, pOutBuff, UnitSize, Units, StartTweak);
+    }
+
+    EVP_CIPHER_CTX *pCtx;
+    int Status = GetContext(0/*decrypt*/, &pCtx);
+
+    if (ERR_NOERROR != Status)
+    {
+        return Status;
+    }
+
+    const unsigned char* pIn = (const unsigned char*)pInBuff;
+    unsigned char* pOut = (unsigned char*)pOutBuff;
+
+    for (size_t i = 0; i < Units; ++i, ++StartTweak, pIn += UnitSize, pOut += UnitSize)
+    {
+        unsigned char iv[16] = { 0 };
+        for (unsigned int j = 0; j < sizeof(UINT64); ++j)
+            iv[j] = (unsigned char)(StartTweak >> (8 * j));
+
+        int outLen = 0;
+        if (1 != EVP_CipherInit_ex(pCtx, NULL, NULL, NULL, iv, 0)
+         || 1 != EVP_CipherUpdate(pCtx, pOut, &outLen, pIn, UnitSize)
+         || (unsigned int)outLen != UnitSize)
+        {
+            return ERR_ENCRYPTION;
+        }
+    }
+
+    return ERR_NOERROR;
+}
+
 } // namespace cipher
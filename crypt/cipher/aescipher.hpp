@@ -15,6 +15,8 @@
 #include <api/memory_mgm.hpp>
 #include <memory>
 
+struct evp_cipher_ctx_st;
+
 namespace cipher {
 
 class COpenSSLCipher : public api::ICipher
@@ -22,20 +24,25 @@ class COpenSSLCipher : public api::ICipher
     int                                 m_method;
     unsigned int                        m_keyLen;
     unsigned char*                      m_pKey;
+    // Keyed contexts kept for the object lifetime, [0] - decrypt, [1] - encrypt
+    // Each call only reloads IV instead of allocating and keying a new context
+    evp_cipher_ctx_st*                  m_pCtx[2];
 
-    virtual ~COpenSSLCipher()
-    {
-        if ( m_pKey )
-            delete m_pKey;
-    }
+    virtual ~COpenSSLCipher();
 
-    int CryptInternal(const void *pInBuff, unsigned int InSize, void *pOutBuff, unsigned int *pOutSize, void *pIV, int enc) const;
+    void FreeContexts();
+    int GetContext(int enc, evp_cipher_ctx_st** ppCtx);
+    int CryptInternal(const void *pInBuff, unsigned int InSize, void *pOutBuff, unsigned int *pOutSize, const void *pIV, int enc);
 public:
     COpenSSLCipher(int method) : m_method(method), m_keyLen(0), m_pKey(NULL)
-    {}
+    {
+        m_pCtx[0] = m_pCtx[1] = NULL;
+    }
 
     COpenSSLCipher() : m_method(0), m_keyLen(0), m_pKey(NULL)
-    {}
+    {
+        m_pCtx[0] = m_pCtx[1] = NULL;
+    }
 
     virtual void Destroy()
     {
@@ -45,6 +52,7 @@ public:
     virtual int SetKey(const void *pKey, unsigned int KeyLen);
     virtual int Encrypt(const void *pInBuff, unsigned int InSize, void *pOutBuff, unsigned int *pOutSize, void *pIV);
     virtual int Decrypt(const void *pInBuff, unsigned int InSize, void *pOutBuff, unsigned int *pOutSize, void *pIV);
+    virtual int DecryptUnits(const void *pInBuff, void *pOutBuff, unsigned int UnitSize, size_t Units, UINT64 StartTweak);
 };
 
 } // namespace cipher
@@ -0,0 +1,849 @@
+// <copyright file="apfsselftest.cpp" company="Paragon Software Group">
+//
+// Copyright (c) 2002-2019 Paragon Software Group, All rights reserved.
+//
+// The license for this file is defined in a separate document "LICENSE.txt"
+// located at the root of the project.
+//
+// </copyright>
+////////////////////////////////////////////////////////////////
+//
+// This file contains self tests of UFSD library which compare
+// fast paths of APFS code with the plain ones on generated data:
+// - omap   FindOmapIndexT (scalar and vector key counters) against FindDataIndexT
+// - hash   NormalizeAndCalcHash (16 byte ascii runs) against per character hashing
+// - fsum   variants of ApfsFletcher64 (SSE2, AVX2) against ApfsFletcher64Scalar
+//
+// Usage: apfsselftest <test> [--bench]
+// Returns 0 if all results are the same. --bench also measures speed of paths
+//
+////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "h/versions.h"
+
+#include <ufsd.h>
+
+#include "h/utrace.h"
+#include "h/ucommon.h"
+#include "h/uswap.h"
+#include "h/assert.h"
+#include "h/uerrors.h"
+#include "h/uavl.h"
+
+#include "unixfs/unixblock.h"
+
+#include "apfs/apfs_struct.h"
+#include "apfs/apfssuper.h"
+#include "apfs/apfstable.h"
+#include "apfs/apfsbplustree.h"
+#include "apfs/apfshash.h"
+#include "apfs/apfsfsum.h"
+
+#include "funcs.h"
+
+#ifndef UFSD_APFS_SELFTEST
+# error "Library must be built with UFSD_APFS_SELFTEST"
+#endif
+
+using namespace UFSD;
+using namespace UFSD::apfs;
+
+api::ILog* UFSD_GetLog();
+
+#define SELFTEST_BLOCK_SIZE   4096
+#define SELFTEST_MAX_ERRORS   5
+
+
+namespace UFSD {
+
+namespace apfs {
+
+//Access to internals of library for self tests
+struct CApfsSelfTest
+{
+  //Superblock with block size and checkpoint only, enough for tables in memory
+  static CApfsSuperBlock* CreateSuper(api::IBaseMemoryManager* Mm)
+  {
+    CApfsSuperBlock* pSuper = new(Mm) CApfsSuperBlock(Mm, UFSD_GetLog());
+    if (pSuper == NULL)
+      return NULL;
+
+    pSuper->m_BlockSize = SELFTEST_BLOCK_SIZE;
+    pSuper->m_Log2OfCluster = 12;
+    pSuper->m_pCSB = reinterpret_cast<apfs_sb*>(Mm->Malloc(SELFTEST_BLOCK_SIZE, BASE_MEMORY_FLAG_ZERO));
+    if (pSuper->m_pCSB == NULL)
+    {
+      delete pSuper;
+      return NULL;
+    }
+    pSuper->m_pCSB->header.checkpoint_id = 10;
+    return pSuper;
+  }
+
+  //Table over node in memory
+  static int AttachTable(CApfsTable* pTable, apfs_table* pNode)
+  {
+    pTable->m_pTable = pNode;
+    return pTable->ReInit();
+  }
+
+  static void DetachTable(CApfsTable* pTable)
+  {
+    pTable->m_pTable = NULL;
+  }
+
+  static int FindDataIndexBy(CApfsTable* pTable, const CCommonSearchKey* pSearchKey, unsigned short SearchRegime, int Path)
+  {
+    return pTable->FindDataIndexBy(pSearchKey, SearchRegime, Path);
+  }
+};
+
+} // namespace apfs
+
+} // namespace UFSD
+
+
+///////////////////////////////////////////////////////////
+// Now
+//
+// Returns monotonic time in seconds
+///////////////////////////////////////////////////////////
+static double
+Now()
+{
+  timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+///////////////////////////////////////////////////////////
+// Random
+//
+// Deterministic generator, the same data on every platform
+///////////////////////////////////////////////////////////
+static unsigned int s_Seed = 12345;
+
+static unsigned int
+Random()
+{
+  s_Seed = s_Seed * 1103515245 + 12345;
+  return ( s_Seed >> 8 ) & 0xFFFFFF;
+}
+
+
+///////////////////////////////////////////////////////////
+// OmapMaxKeys
+//
+// Max number of keys in omap node of level Level
+///////////////////////////////////////////////////////////
+static unsigned int
+OmapMaxKeys(
+    IN unsigned int Level
+    )
+{
+  const unsigned int DataSize = Level != 0 ? sizeof(UINT64) : sizeof(apfs_location_table_data);
+  unsigned int Count = 1;
+  while ( sizeof(apfs_block_header) + sizeof(apfs_table_header) + ( ( Count * sizeof(apfs_table_fixed_item) + 63 ) & ~63u )
+        + Count * ( sizeof(apfs_location_table_key) + DataSize ) + sizeof(apfs_table_footer) <= SELFTEST_BLOCK_SIZE )
+    Count += 1;
+  return Count - 1;
+}
+
+
+///////////////////////////////////////////////////////////
+// OmapBuildNode
+//
+// Fills omap root node with Count sorted keys
+// If bShuffle then keys are placed in key area in random order
+///////////////////////////////////////////////////////////
+static void
+OmapBuildNode(
+    OUT void*                           pNode,
+    IN  const apfs_location_table_key*  Keys,
+    IN  unsigned int                    Count,
+    IN  unsigned int                    Level,
+    IN  bool                            bShuffle
+    )
+{
+  const unsigned int DataSize = Level != 0 ? sizeof(UINT64) : sizeof(apfs_location_table_data);
+  const unsigned int IndexSize = ( Count * sizeof(apfs_table_fixed_item) + 63 ) & ~63u;
+  unsigned char* p = reinterpret_cast<unsigned char*>(pNode);
+  apfs_table* t = reinterpret_cast<apfs_table*>(pNode);
+
+  memset( pNode, 0, SELFTEST_BLOCK_SIZE );
+  t->header.id = 1000;
+  t->header.checkpoint_id = 1;
+  t->header.block_type = APFS_TYPE_ROOT_NODE_BLOCK;
+  t->header.content_type = APFS_CONTENT_LOCATION;
+  t->table_header.flags = APFS_TABLE_HAS_FOOTER | APFS_TABLE_FIXED_ENTRY_SIZE | ( Level != 0 ? 0 : APFS_TABLE_LEAF_NODE );
+  t->table_header.level = static_cast<unsigned short>(Level);
+  t->table_header.count = Count;
+  t->table_header.index_area_size = static_cast<unsigned short>(IndexSize);
+  t->table_header.key_area_size = static_cast<unsigned short>(Count * sizeof(apfs_location_table_key));
+  t->table_header.free_area_size = static_cast<unsigned short>(SELFTEST_BLOCK_SIZE - sizeof(apfs_table_footer) - sizeof(apfs_block_header) - sizeof(apfs_table_header)
+                                 - IndexSize - Count * ( sizeof(apfs_location_table_key) + DataSize ));
+  t->table_header.empty_key_offset = t->table_header.empty_data_offset = EMPTY_OFFSET;
+
+  unsigned short Slots[SELFTEST_BLOCK_SIZE / sizeof(apfs_location_table_key)];
+  for ( unsigned int i = 0; i < Count; i++ )
+    Slots[i] = static_cast<unsigned short>(i);
+  for ( unsigned int i = Count; bShuffle && i > 1; i-- )
+  {
+    unsigned int j = Random() % i;
+    unsigned short s = Slots[i - 1];
+    Slots[i - 1] = Slots[j];
+    Slots[j] = s;
+  }
+
+  apfs_table_fixed_item* Items = reinterpret_cast<apfs_table_fixed_item*>(p + sizeof(apfs_block_header) + sizeof(apfs_table_header));
+  unsigned char* KeyArea = p + sizeof(apfs_block_header) + sizeof(apfs_table_header) + IndexSize;
+  for ( unsigned int i = 0; i < Count; i++ )
+  {
+    Items[i].key_offset = static_cast<unsigned short>(Slots[i] * sizeof(apfs_location_table_key));
+    Items[i].data_offset = static_cast<unsigned short>(( i + 1 ) * DataSize);
+    memcpy( KeyArea + Items[i].key_offset, &Keys[i], sizeof(apfs_location_table_key) );
+  }
+
+  apfs_table_footer* f = reinterpret_cast<apfs_table_footer*>(p + SELFTEST_BLOCK_SIZE - sizeof(apfs_table_footer));
+  f->tf_block_size = SELFTEST_BLOCK_SIZE;
+  f->tf_key_size = sizeof(apfs_location_table_key);
+  f->tf_data_size = sizeof(apfs_location_table_data);
+  f->tf_count = Count;
+}
+
+
+///////////////////////////////////////////////////////////
+// OmapKeyLess
+//
+// Order of keys in omap nodes of volume object trees (id with type in low bits)
+///////////////////////////////////////////////////////////
+static bool
+OmapKeyLess(
+    IN const apfs_location_table_key& k1,
+    IN const apfs_location_table_key& k2
+    )
+{
+  const UINT64 Hi1 = ( GET_ID(k1.ltk_id) << 4 ) | GET_TYPE(k1.ltk_id);
+  const UINT64 Hi2 = ( GET_ID(k2.ltk_id) << 4 ) | GET_TYPE(k2.ltk_id);
+  return Hi1 < Hi2 || ( k1.ltk_id == k2.ltk_id && k1.ltk_checkpoint < k2.ltk_checkpoint );
+}
+
+
+///////////////////////////////////////////////////////////
+// OmapCompare
+//
+// Searches Key in Table through all paths. Returns number of different results
+// Raw is the value of Key for messages (checkpoint is 0 for simple keys)
+///////////////////////////////////////////////////////////
+static int
+OmapCompare(
+    IN CApfsTable*                      pTable,
+    IN const CCommonSearchKey*          pKey,
+    IN const apfs_location_table_key&   Raw,
+    IN unsigned short                   Regime,
+    IN size_t                           Errors
+    )
+{
+  static const int Paths[] = { SELFTEST_SEARCH_OMAP_SCALAR, SELFTEST_SEARCH_OMAP };
+  const int Expected = CApfsSelfTest::FindDataIndexBy( pTable, pKey, Regime, SELFTEST_SEARCH_GENERIC );
+  int Diff = 0;
+
+  for ( unsigned int i = 0; i < sizeof(Paths) / sizeof(Paths[0]); i++ )
+  {
+    const int Index = CApfsSelfTest::FindDataIndexBy( pTable, pKey, Regime, Paths[i] );
+    if ( Index == Expected )
+      continue;
+
+    if ( Errors + Diff < SELFTEST_MAX_ERRORS )
+      printf( "omap: %u keys, level %u, key %d (%" PLL "x, %" PLL "x), regime %x, path %d: %x instead of %x\n",
+              pTable->GetRecordsCount(), pTable->GetLevel(), pKey->m_Type, Raw.ltk_id, Raw.ltk_checkpoint,
+              Regime, Paths[i], Index, Expected );
+    Diff += 1;
+  }
+
+  return Diff;
+}
+
+
+///////////////////////////////////////////////////////////
+// OmapBench
+//
+// Measures ns per search of each path on full nodes
+///////////////////////////////////////////////////////////
+static void
+OmapBench(
+    IN api::IBaseMemoryManager* Mm,
+    IN CApfsTable*              pTable,
+    IN void*                    pNode
+    )
+{
+  static const char* Names[] = { "generic", "omap scalar", "omap" };
+  static apfs_location_table_key Keys[SELFTEST_BLOCK_SIZE / sizeof(apfs_location_table_key)];
+  static apfs_location_table_key Search[2048];
+  static CCommonSearchKey* SearchKeys[2048];
+  static unsigned short Regimes[2048];
+  const unsigned int SearchCount = sizeof(Search) / sizeof(Search[0]);
+
+  for ( unsigned int Level = 0; Level < 2; Level++ )
+  {
+    for ( int Kind = 0; Kind < 2; Kind++ )
+    {
+      //Pairs of keys with the same id and two checkpoints
+      const unsigned int Count = OmapMaxKeys( Level );
+      for ( unsigned int i = 0; i < Count; i++ )
+      {
+        Keys[i].ltk_id = 1000 + 2 * ( i / 2 );
+        Keys[i].ltk_checkpoint = 1 + i % 2;
+      }
+      OmapBuildNode( pNode, Keys, Count, Level, false );
+      if ( !UFSD_SUCCESS( CApfsSelfTest::AttachTable( pTable, reinterpret_cast<apfs_table*>(pNode) ) ) )
+        return;
+
+      for ( unsigned int i = 0; i < SearchCount; i++ )
+      {
+        Search[i].ltk_id = 999 + Random() % ( Count + 4 );
+        Search[i].ltk_checkpoint = 1 + Random() % 3;
+        if ( Kind == 0 )
+          SearchKeys[i] = new(Mm) CSimpleSearchKey( Mm, Search[i].ltk_id );
+        else
+          SearchKeys[i] = new(Mm) CLocationSearchKey( Mm, &Search[i] );
+        Regimes[i] = Level != 0 || ( Random() & 1 ) ? SEARCH_KEY_LE : SEARCH_KEY_EQ;
+      }
+
+      printf( "omap bench: %s, %s keys, %u keys:", Level != 0 ? "index" : "leaf", Kind != 0 ? "location" : "simple", Count );
+      for ( int Path = SELFTEST_SEARCH_GENERIC; Path <= SELFTEST_SEARCH_OMAP; Path++ )
+      {
+        //Best of runs
+        double Best = 1e9;
+        unsigned int Sum = 0;
+        for ( int Run = 0; Run < 200; Run++ )
+        {
+          const double Start = Now();
+          for ( unsigned int i = 0; i < SearchCount; i++ )
+            Sum += static_cast<unsigned int>(CApfsSelfTest::FindDataIndexBy( pTable, SearchKeys[i], Regimes[i], Path ));
+          const double Ns = ( Now() - Start ) * 1e9 / SearchCount;
+          if ( Ns < Best )
+            Best = Ns;
+        }
+        printf( "  %s %.1f ns", Names[Path], Best + ( Sum == 12345 ? 1e-9 : 0 ) );
+      }
+      printf( "\n" );
+
+      for ( unsigned int i = 0; i < SearchCount; i++ )
+        delete SearchKeys[i];
+      CApfsSelfTest::DetachTable( pTable );
+    }
+  }
+}
+
+
+///////////////////////////////////////////////////////////
+// TestOmap
+//
+// Random omap nodes (leaf and index, 1 to max keys, shuffled key areas,
+// duplicate ids, ids with types) searched by simple and location keys
+// in EQ, LE and LOW regimes with and without SEARCH_ALL_TYPES
+///////////////////////////////////////////////////////////
+static int
+TestOmap(
+    IN api::IBaseMemoryManager* Mm,
+    IN bool                     bBench
+    )
+{
+  static const unsigned short Regimes[] = { SEARCH_KEY_EQ, SEARCH_KEY_LE, SEARCH_KEY_LOW };
+  static apfs_location_table_key Keys[SELFTEST_BLOCK_SIZE / sizeof(apfs_location_table_key)];
+  CApfsSuperBlock* pSuper = CApfsSelfTest::CreateSuper( Mm );
+  CApfsTree* pTree = pSuper != NULL ? new(Mm) CApfsTree( pSuper ) : NULL;
+  CApfsTable* pTable = pTree != NULL ? new(Mm) CApfsTable( pTree ) : NULL;
+  void* pNode = Mm->Malloc( SELFTEST_BLOCK_SIZE );
+  UINT64 Searches = 0;
+  size_t Errors = 0;
+  int Status = ERR_NOERROR;
+
+  if ( pTable == NULL || pNode == NULL )
+  {
+    Status = ERR_NOMEMORY;
+    goto Exit;
+  }
+
+  for ( unsigned int Node = 0; Node < 20000; Node++ )
+  {
+    const unsigned int Level = Random() % 2;
+    const unsigned int Count = Node % 10 == 0 ? 1 + Random() % 6 : 1 + Random() % OmapMaxKeys( Level );
+    //Ids with type bits are sorted like in object trees of volumes
+    const bool bTyped = Node % 4 == 3;
+    UINT64 Oid = 50 + Random() % 20, Xid = 1;
+
+    for ( unsigned int i = 0; i < Count; i++ )
+    {
+      const unsigned int Step = Random() % 4;
+      if ( Step == 0 )
+        Xid += 1 + Random() % 3;
+      else
+      {
+        Oid += Step;
+        Xid = 1 + Random() % 5;
+      }
+      Keys[i].ltk_id = bTyped ? ( static_cast<UINT64>(Random() % 16) << TYPE_SHIFT ) | Oid : Oid;
+      Keys[i].ltk_checkpoint = Xid;
+    }
+
+    //Insertion sort: keys are nearly sorted
+    for ( unsigned int i = 1; bTyped && i < Count; i++ )
+    {
+      const apfs_location_table_key k = Keys[i];
+      unsigned int j = i;
+      for ( ; j > 0 && OmapKeyLess( k, Keys[j - 1] ); j-- )
+        Keys[j] = Keys[j - 1];
+      Keys[j] = k;
+    }
+
+    OmapBuildNode( pNode, Keys, Count, Level, Node % 3 == 0 );
+    Status = CApfsSelfTest::AttachTable( pTable, reinterpret_cast<apfs_table*>(pNode) );
+    if ( !UFSD_SUCCESS( Status ) )
+      goto Exit;
+
+    const UINT64 FirstId = GET_ID(Keys[0].ltk_id);
+    const UINT64 IdRange = GET_ID(Keys[Count - 1].ltk_id) - FirstId + 7;
+
+    for ( int s = 0; s < 64; s++ )
+    {
+      const unsigned int r = Random();
+      unsigned short Regime = Regimes[r % 3];
+      if ( r & 8 )
+        Regime |= SEARCH_ALL_TYPES;
+
+      //Ids around the node and exact ids of keys
+      UINT64 Id = FirstId - 3 + Random() % IdRange;
+      if ( ( r >> 4 ) % 4 == 0 )
+        Id = GET_ID(Keys[Random() % Count].ltk_id);
+
+      if ( bTyped || ( r & 16 ) )
+      {
+        CSimpleSearchKey Key( Mm, Id, static_cast<unsigned char>(( r >> 6 ) % 3 != 0 ? ApfsDefaultKey : Random() % 16) );
+        if ( bTyped && ( r >> 8 ) % 2 != 0 )
+          Key.id = Keys[Random() % Count].ltk_id;
+        apfs_location_table_key Raw;
+        Raw.ltk_id = Key.id;
+        Raw.ltk_checkpoint = 0;
+        Errors += OmapCompare( pTable, &Key, Raw, Regime, Errors );
+      }
+      else
+      {
+        apfs_location_table_key Search;
+        Search.ltk_id = Id;
+        Search.ltk_checkpoint = Random() % 12;
+        if ( ( r >> 8 ) % 3 == 0 )
+          Search = Keys[Random() % Count];
+        CLocationSearchKey Key( Mm, &Search );
+        Errors += OmapCompare( pTable, &Key, Search, Regime, Errors );
+      }
+      Searches += 1;
+    }
+
+    CApfsSelfTest::DetachTable( pTable );
+  }
+
+  printf( "omap: %" PLL "u searches, %" PZZ "u differences\n", Searches, Errors );
+
+  if ( bBench && Errors == 0 )
+    OmapBench( Mm, pTable, pNode );
+
+Exit:
+  if ( !UFSD_SUCCESS( Status ) )
+    printf( "omap: failed to set up tables, error %x\n", Status );
+  if ( pTable != NULL )
+    CApfsSelfTest::DetachTable( pTable );
+  delete pTable;
+  delete pTree;
+  delete pSuper;
+  Mm->Free( pNode );
+  return UFSD_SUCCESS( Status ) && Errors == 0 ? 0 : 1;
+}
+
+
+///////////////////////////////////////////////////////////
+// PutUtf8
+//
+// Appends code point Cp in utf-8 to Name. Returns new length
+///////////////////////////////////////////////////////////
+static size_t
+PutUtf8(
+    OUT unsigned char*  Name,
+    IN  size_t          Len,
+    IN  unsigned int    Cp
+    )
+{
+  if ( Cp < 0x80 )
+    Name[Len++] = static_cast<unsigned char>(Cp);
+  else if ( Cp < 0x800 )
+  {
+    Name[Len++] = static_cast<unsigned char>(0xC0 | ( Cp >> 6 ));
+    Name[Len++] = static_cast<unsigned char>(0x80 | ( Cp & 0x3F ));
+  }
+  else if ( Cp < 0x10000 )
+  {
+    Name[Len++] = static_cast<unsigned char>(0xE0 | ( Cp >> 12 ));
+    Name[Len++] = static_cast<unsigned char>(0x80 | ( ( Cp >> 6 ) & 0x3F ));
+    Name[Len++] = static_cast<unsigned char>(0x80 | ( Cp & 0x3F ));
+  }
+  else
+  {
+    Name[Len++] = static_cast<unsigned char>(0xF0 | ( Cp >> 18 ));
+    Name[Len++] = static_cast<unsigned char>(0x80 | ( ( Cp >> 12 ) & 0x3F ));
+    Name[Len++] = static_cast<unsigned char>(0x80 | ( ( Cp >> 6 ) & 0x3F ));
+    Name[Len++] = static_cast<unsigned char>(0x80 | ( Cp & 0x3F ));
+  }
+  return Len;
+}
+
+
+///////////////////////////////////////////////////////////
+// HashMakeName
+//
+// Name of ascii runs of any length mixed with Latin-1, Greek,
+// CJK, Hangul, ligatures, 4 byte characters, zeros and broken utf-8
+// Returns length of name, at most 255 bytes
+///////////////////////////////////////////////////////////
+static size_t
+HashMakeName(
+    OUT unsigned char*  Name,
+    IN  bool            bAsciiOnly
+    )
+{
+  //Characters with special cases of case folding and decomposition
+  static const unsigned int Special[] = { 0xDF, 0xC0, 0xE9, 0xC5, 0x398, 0x3D1, 0x1FC2, 0x41F, 0x4E2D, 0xFB01, 0x1F600 };
+  static const char Ascii[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 .-_~@[]{}^`";
+  const size_t Max = 255 - 4;
+  size_t Len = 0;
+
+  while ( Len < Max )
+  {
+    const unsigned int r = Random();
+
+    //Ascii run, often longer than 16 bytes
+    size_t Run = r % 48;
+    for ( ; Run != 0 && Len < Max; Run-- )
+      Name[Len++] = Ascii[Random() % ( sizeof(Ascii) - 1 )];
+
+    if ( bAsciiOnly )
+    {
+      if ( ( r >> 6 ) % 3 == 0 )
+        break;
+      continue;
+    }
+
+    switch ( ( r >> 6 ) % 12 )
+    {
+    case 0:
+      return Len;
+    case 1:
+      Len = PutUtf8( Name, Len, Special[Random() % ( sizeof(Special) / sizeof(Special[0]) )] );
+      break;
+    case 2:
+      Len = PutUtf8( Name, Len, 0xAC00 + Random() % ( 0xD7A4 - 0xAC00 ) );
+      break;
+    case 3:
+      Len = PutUtf8( Name, Len, 0x80 + Random() % 0x780 );
+      break;
+    case 4:
+      Len = PutUtf8( Name, Len, 0x800 + Random() % 0xD000 );
+      break;
+    case 5:
+      //Embedded zero ends the name for hash
+      if ( ( r >> 10 ) % 8 == 0 )
+        Name[Len++] = 0;
+      break;
+    case 6:
+      //Broken utf-8: lone continuation byte or truncated sequence
+      if ( ( r >> 10 ) % 16 == 0 )
+        Name[Len++] = ( r >> 14 ) & 1 ? 0x80 : 0xE4;
+      break;
+    default:
+      break;
+    }
+  }
+
+  return Len;
+}
+
+
+///////////////////////////////////////////////////////////
+// HashBench
+//
+// Measures ns per ascii name of both paths
+///////////////////////////////////////////////////////////
+static void
+HashBench()
+{
+  static unsigned char Names[20000][256];
+  static size_t Lens[20000];
+  const unsigned int Count = sizeof(Lens) / sizeof(Lens[0]);
+  int (*Paths[])( const unsigned char*, size_t, bool, unsigned int* ) = { NormalizeAndCalcHashScalar, NormalizeAndCalcHash };
+  static const char* PathNames[] = { "scalar", "ascii16" };
+
+  for ( unsigned int i = 0; i < Count; i++ )
+    Lens[i] = HashMakeName( Names[i], true );
+
+  printf( "hash bench: %u ascii names:", Count );
+  for ( unsigned int p = 0; p < sizeof(Paths) / sizeof(Paths[0]); p++ )
+  {
+    //Best of runs
+    double Best = 1e9;
+    unsigned int Sum = 0;
+    for ( int Run = 0; Run < 10; Run++ )
+    {
+      const double Start = Now();
+      for ( unsigned int i = 0; i < Count; i++ )
+      {
+        unsigned int Hash = ~0u;
+        (*Paths[p])( Names[i], Lens[i], false, &Hash );
+        Sum += Hash;
+      }
+      const double Ns = ( Now() - Start ) * 1e9 / Count;
+      if ( Ns < Best )
+        Best = Ns;
+    }
+    printf( "  %s %.1f ns", PathNames[p], Best + ( Sum == 12345 ? 1e-9 : 0 ) );
+  }
+  printf( "\n" );
+}
+
+
+///////////////////////////////////////////////////////////
+// TestHash
+//
+// Generated names hashed in both case modes through both paths
+// Statuses must be equal, hashes are compared only on success:
+// on error the partial hash may differ by design (see CalcNameHash),
+// which is safe only because callers drop it
+///////////////////////////////////////////////////////////
+static int
+TestHash(
+    IN api::IBaseMemoryManager* /*Mm*/,
+    IN bool                     bBench
+    )
+{
+  unsigned char Name[256];
+  size_t Names = 0, Succeeded = 0, Errors = 0;
+
+  for ( unsigned int i = 0; i < 200000; i++ )
+  {
+    const size_t Len = HashMakeName( Name, i % 4 == 0 );
+
+    for ( int CaseSensitive = 0; CaseSensitive < 2; CaseSensitive++ )
+    {
+      unsigned int Hash = ~0u, Expected = ~0u;
+      const int Status = NormalizeAndCalcHash( Name, Len, CaseSensitive != 0, &Hash );
+      const int ExpectedStatus = NormalizeAndCalcHashScalar( Name, Len, CaseSensitive != 0, &Expected );
+
+      Names += 1;
+      if ( Status == ExpectedStatus && ( !UFSD_SUCCESS( Status ) || Hash == Expected ) )
+      {
+        Succeeded += UFSD_SUCCESS( Status ) ? 1 : 0;
+        continue;
+      }
+
+      if ( Errors < SELFTEST_MAX_ERRORS )
+      {
+        printf( "hash: name of %" PZZ "u bytes, case %s: %x/%08x instead of %x/%08x:", Len,
+                CaseSensitive ? "sensitive" : "insensitive", Status, Hash, ExpectedStatus, Expected );
+        for ( size_t j = 0; j < Len; j++ )
+          printf( " %02x", Name[j] );
+        printf( "\n" );
+      }
+      Errors += 1;
+    }
+  }
+
+  printf( "hash: %" PZZ "u names, %" PZZ "u hashed, %" PZZ "u differences\n", Names, Succeeded, Errors );
+
+  if ( bBench && Errors == 0 )
+    HashBench();
+
+  return Errors == 0 ? 0 : 1;
+}
+
+
+///////////////////////////////////////////////////////////
+// FsumFill
+//
+// Fills Count words with pattern Mode (random, all ones,
+// near modulus, zeros, long run of ones before random words)
+///////////////////////////////////////////////////////////
+#define FSUM_MODES  5
+
+static void
+FsumFill(
+    OUT unsigned int* p,
+    IN  size_t        Count,
+    IN  unsigned int  Mode
+    )
+{
+  for ( size_t i = 0; i < Count; i++ )
+  {
+    const unsigned int r = Random() ^ ( Random() << 8 );
+    switch ( Mode )
+    {
+    case 0:  p[i] = r; break;
+    case 1:  p[i] = 0xFFFFFFFFu; break;
+    case 2:  p[i] = r & 1 ? 0xFFFFFFFFu : 0xFFFFFFFEu; break;
+    case 3:  p[i] = r % 3 == 0 ? 0 : r; break;
+    default: p[i] = i < Count / 2 ? 0xFFFFFFFFu : r >> 12; break;
+    }
+  }
+}
+
+
+///////////////////////////////////////////////////////////
+// FsumBench
+//
+// Measures GB/s of reference and every variant on blocks
+///////////////////////////////////////////////////////////
+static void
+FsumBench(
+    IN const unsigned int* pData
+    )
+{
+  for ( size_t Size = 4096; Size <= 65536; Size *= 4 )
+  {
+    printf( "fsum bench: %6" PZZ "u bytes:", Size );
+    ApfsFletcher64Func Func = ApfsFletcher64Scalar;
+    const char* Name = "scalar";
+
+    for ( unsigned int v = 0; Name != NULL; Name = ApfsFletcher64Variant( v++, &Func ) )
+    {
+      //Best of runs over 16 MiB
+      const unsigned int Count = static_cast<unsigned int>(( 16u << 20 ) / Size);
+      double Best = 1e9;
+      UINT64 Sum = 0;
+      for ( int Run = 0; Run < 5; Run++ )
+      {
+        const double Start = Now();
+        for ( unsigned int i = 0; i < Count; i++ )
+          Sum += (*Func)( pData, Size );
+        const double Time = Now() - Start;
+        if ( Time < Best )
+          Best = Time;
+      }
+      printf( "  %s %.2f GB/s", Name, Count * static_cast<double>(Size) / Best / 1e9 + ( Sum == 12345 ? 1e-9 : 0 ) );
+    }
+    printf( "\n" );
+  }
+}
+
+
+///////////////////////////////////////////////////////////
+// TestFsum
+//
+// Every size from 8 bytes to 2 KiB (all tails of vector loops)
+// and blocks of 4 KiB to 64 KiB, filled with every pattern,
+// at aligned and unaligned addresses. Every variant and
+// ApfsFletcher64 must give the same value as ApfsFletcher64Scalar
+///////////////////////////////////////////////////////////
+static int
+TestFsum(
+    IN api::IBaseMemoryManager* Mm,
+    IN bool                     bBench
+    )
+{
+  const size_t MaxSize = 65536;
+  unsigned int* pBuffer = reinterpret_cast<unsigned int*>(Mm->Malloc( MaxSize + 64 ));
+  size_t Blocks = 0, Errors = 0;
+
+  if ( pBuffer == NULL )
+    return 1;
+
+  for ( size_t Size = 8; Size <= MaxSize; Size += Size < 2048 ? 4 : Size )
+  {
+    const unsigned int Repeat = Size < 2048 ? 4 : 200;
+    for ( unsigned int r = 0; r < Repeat; r++ )
+    {
+      for ( unsigned int Mode = 0; Mode < FSUM_MODES; Mode++ )
+      {
+        //Odd words of buffer start 4 bytes after 16 byte alignment
+        unsigned int* p = pBuffer + ( r & 1 );
+        FsumFill( p, Size / sizeof(unsigned int), Mode );
+
+        const UINT64 Expected = ApfsFletcher64Scalar( p, Size );
+        ApfsFletcher64Func Func = ApfsFletcher64;
+        const char* Name = "selected";
+
+        for ( unsigned int v = 0; Name != NULL; Name = ApfsFletcher64Variant( v++, &Func ) )
+        {
+          const UINT64 Sum = (*Func)( p, Size );
+          if ( Sum == Expected )
+            continue;
+
+          if ( Errors < SELFTEST_MAX_ERRORS )
+            printf( "fsum: %" PZZ "u bytes, pattern %u, offset %u, %s: %" PLL "x instead of %" PLL "x\n",
+                    Size, Mode, static_cast<unsigned int>(( r & 1 ) * sizeof(unsigned int)), Name, Sum, Expected );
+          Errors += 1;
+        }
+        Blocks += 1;
+      }
+    }
+  }
+
+  printf( "fsum: %" PZZ "u blocks, variants:", Blocks );
+  ApfsFletcher64Func Func;
+  for ( unsigned int v = 0; ; v++ )
+  {
+    const char* Name = ApfsFletcher64Variant( v, &Func );
+    if ( Name == NULL )
+      break;
+    printf( " %s", Name );
+  }
+  printf( ", %" PZZ "u differences\n", Errors );
+
+  if ( bBench && Errors == 0 )
+  {
+    FsumFill( pBuffer, MaxSize / sizeof(unsigned int), 0 );
+    FsumBench( pBuffer );
+  }
+
+  Mm->Free( pBuffer );
+  return Errors == 0 ? 0 : 1;
+}
+
+
+///////////////////////////////////////////////////////////
+// main
+///////////////////////////////////////////////////////////
+int
+main(
+    IN int          argc,
+    IN const char*  argv[]
+    )
+{
+  static const struct
+  {
+    const char* Name;
+    int (*Test)( api::IBaseMemoryManager* Mm, bool bBench );
+  } Tests[] =
+  {
+    { "omap", TestOmap },
+    { "hash", TestHash },
+    { "fsum", TestFsum },
+  };
+
+  const bool bBench = argc > 2 && 0 == strcmp( argv[2], "--bench" );
+  api::IBaseMemoryManager* Mm = UFSD_GetMemoryManager();
+
+  for ( unsigned int i = 0; argc > 1 && i < sizeof(Tests) / sizeof(Tests[0]); i++ )
+  {
+    if ( 0 == strcmp( argv[1], Tests[i].Name ) )
+      return Tests[i].Test( Mm, bBench );
+  }
+
+  printf( "Usage: apfsselftest <test> [--bench]\nTests:" );
+  for ( unsigned int i = 0; i < sizeof(Tests) / sizeof(Tests[0]); i++ )
+    printf( " %s", Tests[i].Name );
+  printf( "\n" );
+  return 2;
+}
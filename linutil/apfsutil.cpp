@@ -118,6 +118,24 @@ struct apfsutil_options
   const char* pass[MAX_APFS_VOLUMES];
   // TODO: options
   bool subvolumes;
+  bool iostats;
+  const char* readahead;
+  bool memstats;
+  const char* mempool;
+  bool cachestats;
+  const char* blockcache;
+  unsigned int blockpolicy;
+  unsigned int pinlevels;
+  const char* pinbytes;
+  const char* extentmap;
+  const char* maxio;
+  const char* ramin;
+  const char* ramax;
+  const char* rasize;
+  unsigned int iodepth;
+  bool aio;
+  unsigned int aiobackend;
+  bool direct;
 };
 
 #ifdef _WIN32
@@ -296,6 +314,7 @@ OnUsage()
 "\ntest_name:\n"
 "   enumroot        root folder enumeration\n"
 "   enumfolder      readdir example\n"
+"   statfolder      readdir example with inode records read in batches\n"
 "   readfile        read selected file\n"
 "   listea          list and show all file extended attributes\n"
 "   listsubvolumes  sub-volumes enumeration\n"
@@ -309,6 +328,23 @@ RW_CASES
 "                     APFS volumes are listed from N=1 to 100\n"
 "   --trace         turn on UFSD trace\n"
 "   --subvolumes    mount all APFS subvolumes\n"
+"   --readahead=size  use private read-ahead buffer of given size (e.g. 1M, 0 - off)\n"
+"   --iostats       print device i/o statistics\n"
+"   --mempool=size  keep up to size bytes of freed small blocks for reuse (e.g. 4M)\n"
+"   --memstats      print memory pool statistics\n"
+"   --blockcache=size  keep up to size bytes of metadata blocks in cache (e.g. 64M)\n"
+"   --blockpolicy=lru|2q|arc  replacement policy of metadata blocks cache\n"
+"   --cachestats    print metadata blocks cache statistics\n"
+"   --pinlevels=N   keep N upper levels of fs and omap trees in memory\n"
+"   --pinbytes=size  keep up to size bytes of upper levels of trees in memory (e.g. 16M)\n"
+"   --extentmap=size  keep up to size bytes of extent maps of randomly read files (e.g. 16M)\n"
+"   --maxio=size    read up to size bytes of adjacent file extents at once (e.g. 1M)\n"
+"   --ramin=size    first read-ahead window of sequentially read files (e.g. 64K)\n"
+"   --ramax=size    max read-ahead window, less than --ramin turns read-ahead off (e.g. 1M)\n"
+"   --rasize=size   keep up to size bytes of read-ahead buffers of all open files (e.g. 16M)\n"
+"   --iodepth=N     keep up to N reads of file data in flight (1 - synchronous reads)\n"
+"   --aio=uring|threads  backend of asynchronous reads\n"
+"   --direct        read device bypassing page cache (O_DIRECT)\n"
 "   --version       show version and exit\n"
 ) );
 #ifdef _WIN32
@@ -322,6 +358,46 @@ _("E.g. " NLS_CAT_NAME " enumfolder f:\\testfolder\n"
 }
 
 
+///////////////////////////////////////////////////////////
+// PrintEntry
+//
+// helper function for EnumerateFolder and OnStatFolder
+///////////////////////////////////////////////////////////
+static void
+PrintEntry(
+    IN unsigned int Mode,
+    IN unsigned int Links,
+    IN unsigned int Uid,
+    IN unsigned int Gid,
+    IN UINT64       Size,
+    IN const char*  Name
+    )
+{
+  // set attributes
+  char Attr[] = "-rwxrw-rw-";
+  Attr[0] = U_ISDIR(Mode) ? 'd' :
+            U_ISLNK(Mode) ? 'l' :
+            U_ISSOCK(Mode)? 's' :
+            U_ISBLK(Mode) ? 'b' :
+            U_ISCHR(Mode) ? 'c' : '-';
+
+  Attr[1] = FlagOn(Mode, U_IRUSR) ? 'r' : '-';
+  Attr[2] = FlagOn(Mode, U_IWUSR) ? 'w' : '-';
+  Attr[3] = FlagOn(Mode, U_IXUSR) ? 'x' : '-';
+
+  Attr[4] = FlagOn(Mode, U_IRGRP) ? 'r' : '-';
+  Attr[5] = FlagOn(Mode, U_IWGRP) ? 'w' : '-';
+  Attr[6] = FlagOn(Mode, U_IXGRP) ? 'x' : '-';
+
+  Attr[7] = FlagOn(Mode, U_IROTH) ? 'r' : '-';
+  Attr[8] = FlagOn(Mode, U_IWOTH) ? 'w' : '-';
+  Attr[9] = FlagOn(Mode, U_IXOTH) ? 'x' : '-';
+
+  fprintf( stdout, "%s %o %5u %4u %4u %8" PLL "u %s\n",
+    Attr, Mode & 0x1FF, Links, Uid, Gid, Size, Name);
+}
+
+
 ///////////////////////////////////////////////////////////
 // EnumerateFolder
 //
@@ -353,30 +429,9 @@ EnumerateFolder(
       continue;
     }
 
-    // set attributes
-    char Attr[] = "-rwxrw-rw-";
-    Attr[0] = U_ISDIR(Info.Mode) ? 'd' :
-              U_ISLNK(Info.Mode) ? 'l' :
-              U_ISSOCK(Info.Mode)? 's' :
-              U_ISBLK(Info.Mode) ? 'b' :
-              U_ISCHR(Info.Mode) ? 'c' : '-';
-
-    Attr[1] = FlagOn(Info.Mode, U_IRUSR) ? 'r' : '-';
-    Attr[2] = FlagOn(Info.Mode, U_IWUSR) ? 'w' : '-';
-    Attr[3] = FlagOn(Info.Mode, U_IXUSR) ? 'x' : '-';
-
-    Attr[4] = FlagOn(Info.Mode, U_IRGRP) ? 'r' : '-';
-    Attr[5] = FlagOn(Info.Mode, U_IWGRP) ? 'w' : '-';
-    Attr[6] = FlagOn(Info.Mode, U_IXGRP) ? 'x' : '-';
-
-    Attr[7] = FlagOn(Info.Mode, U_IROTH) ? 'r' : '-';
-    Attr[8] = FlagOn(Info.Mode, U_IWOTH) ? 'w' : '-';
-    Attr[9] = FlagOn(Info.Mode, U_IXOTH) ? 'x' : '-';
-
     // print file info
     assert( Info.NameType == api::StrUTF8 );
-    fprintf( stdout, "%s %o %5u %4u %4u %8" PLL "u %s\n",
-      Attr, Info.Mode & 0x1FF, Info.HardLinks, Info.Uid, Info.Gid, Info.FileSize, (char*)Info.Name);
+    PrintEntry( Info.Mode, Info.HardLinks, Info.Uid, Info.Gid, Info.FileSize, (char*)Info.Name );
   }
 
   if ( bBrief )
@@ -529,6 +584,97 @@ OnEnumFolder(
 }
 
 
+#define STAT_FOLDER_BATCH 256
+
+///////////////////////////////////////////////////////////
+// OnStatFolder
+//
+// enumerate selected folder by names and read inode records
+// of each STAT_FOLDER_BATCH entries at once
+///////////////////////////////////////////////////////////
+static int
+OnStatFolder(
+    IN CFileSystem* fs,
+    IN const char*  Path
+    )
+{
+  CDir* pWorkDir = NULL;
+  int Status = ERR_NOERROR;
+
+  if ( NULL == Path )
+    pWorkDir = fs->m_RootDir;
+  else
+  {
+    CDir* Parent = GetParent( fs->m_RootDir, Path );
+
+    if ( NULL == Parent || NULL == Path )
+      return ERR_BADPARAMS;
+
+    Status = Parent->OpenDir( api::StrUTF8, Path, fs->m_Strings->strlen( api::StrUTF8, Path ), pWorkDir );
+  }
+
+  if ( !UFSD_SUCCESS( Status ) )
+    return Status;
+
+  fprintf( stdout, "Dir content:\n" );
+
+  // names and ids of entries waiting for their inode records
+  static char Names[STAT_FOLDER_BATCH][MAX_FILENAME];
+  static UINT64 Ids[STAT_FOLDER_BATCH];
+  static UFSD_INODE_RECORD Records[STAT_FOLDER_BATCH];
+  size_t Count = 0;
+
+  CEntryNumerator* Enum = NULL;
+  Status = pWorkDir->StartFind( Enum, UFSD_ENUM_NAME_ID_ATTR_ONLY );
+
+  FileInfo Info;
+  bool bEnd = !UFSD_SUCCESS( Status );
+
+  while ( !bEnd )
+  {
+    Status = pWorkDir->FindNext( Enum, Info );
+    bEnd = !UFSD_SUCCESS( Status );
+
+    if ( !bEnd )
+    {
+      assert( Info.NameType == api::StrUTF8 );
+      size_t Len = Info.NameLen < MAX_FILENAME ? Info.NameLen : MAX_FILENAME - 1;
+      memcpy( Names[Count], Info.Name, Len );
+      Names[Count][Len] = 0;
+      Ids[Count++] = Info.Id;
+    }
+
+    if ( Count == 0 || ( !bEnd && Count < STAT_FOLDER_BATCH ) )
+      continue;
+
+    int IoStatus = fs->IoControl( IOCTL_GET_INODE_RECORDS, Ids, Count * sizeof(UINT64), Records, Count * sizeof(UFSD_INODE_RECORD) );
+    if ( !UFSD_SUCCESS( IoStatus ) )
+    {
+      Status = IoStatus;
+      break;
+    }
+
+    for ( size_t i = 0; i < Count; i++ )
+    {
+      // entries without inode record (e.g. emulated folder of volumes) are shown by name
+      if ( 0 == Records[i].Id )
+        fprintf( stdout, "%s\n", Names[i] );
+      else
+        PrintEntry( Records[i].Mode, Records[i].Links, Records[i].Uid, Records[i].Gid, Records[i].FileSize, Names[i] );
+    }
+    Count = 0;
+  }
+
+  if ( NULL != Enum )
+    Enum->Destroy();
+
+  if ( NULL != pWorkDir->m_Parent )
+    pWorkDir->Destroy();
+
+  return Status == ERR_NOFILEEXISTS ? ERR_NOERROR : Status;
+}
+
+
 ///////////////////////////////////////////////////////////
 // OnReadFile
 //
@@ -902,6 +1048,7 @@ struct t_CmdHandler{
 static const t_CmdHandler s_Cmd[] = {
   { "enumroot"        , OnEnumRoot         },   // readdir example
   { "enumfolder"      , OnEnumFolder       },   // enumerate folder
+  { "statfolder"      , OnStatFolder       },   // enumerate folder with batched inode lookups
   { "readfile"        , OnReadFile         },   // file reading
   { "listea"          , OnListEa           },   // list all extended attributes
   { "listsubvolumes"  , OnEnumSubvolumes   },   // sub-volumes enumeration
@@ -950,6 +1097,52 @@ parse_options(
       EnableLogTrace( NLS_CAT_NAME );
     else if ( 0 == strcmp( "--subvolumes", a ) )
       opts->subvolumes = true;
+    else if ( 0 == strcmp( "--iostats", a ) )
+      opts->iostats = true;
+    else if ( 0 == strncmp( "--readahead=", a, 12 ) )
+      opts->readahead = a + 12;
+    else if ( 0 == strcmp( "--memstats", a ) )
+      opts->memstats = true;
+    else if ( 0 == strncmp( "--mempool=", a, 10 ) )
+      opts->mempool = a + 10;
+    else if ( 0 == strcmp( "--cachestats", a ) )
+      opts->cachestats = true;
+    else if ( 0 == strncmp( "--blockcache=", a, 13 ) )
+      opts->blockcache = a + 13;
+    else if ( 0 == strcmp( "--blockpolicy=lru", a ) )
+      opts->blockpolicy = UFSD_BLOCK_CACHE_LRU;
+    else if ( 0 == strcmp( "--blockpolicy=2q", a ) )
+      opts->blockpolicy = UFSD_BLOCK_CACHE_2Q;
+    else if ( 0 == strcmp( "--blockpolicy=arc", a ) )
+      opts->blockpolicy = UFSD_BLOCK_CACHE_ARC;
+    else if ( 0 == strncmp( "--pinlevels=", a, 12 ) )
+      opts->pinlevels = (unsigned int)strtoul( a + 12, NULL, 10 );
+    else if ( 0 == strncmp( "--pinbytes=", a, 11 ) )
+      opts->pinbytes = a + 11;
+    else if ( 0 == strncmp( "--extentmap=", a, 12 ) )
+      opts->extentmap = a + 12;
+    else if ( 0 == strncmp( "--maxio=", a, 8 ) )
+      opts->maxio = a + 8;
+    else if ( 0 == strncmp( "--ramin=", a, 8 ) )
+      opts->ramin = a + 8;
+    else if ( 0 == strncmp( "--ramax=", a, 8 ) )
+      opts->ramax = a + 8;
+    else if ( 0 == strncmp( "--rasize=", a, 9 ) )
+      opts->rasize = a + 9;
+    else if ( 0 == strncmp( "--iodepth=", a, 10 ) )
+      opts->iodepth = (unsigned int)strtoul( a + 10, NULL, 10 );
+    else if ( 0 == strcmp( "--aio=uring", a ) )
+    {
+      opts->aio = true;
+      opts->aiobackend = UFSD_RWB_ASYNC_URING;
+    }
+    else if ( 0 == strcmp( "--aio=threads", a ) )
+    {
+      opts->aio = true;
+      opts->aiobackend = UFSD_RWB_ASYNC_THREADS;
+    }
+    else if ( 0 == strcmp( "--direct", a ) )
+      opts->direct = true;
     else if ( 0 == strncmp( "--pass", a, 6 ) )
     {
 #ifndef UFSD_WITH_OPENSSL
@@ -1107,10 +1300,16 @@ main(
     return -4;
   }
 
+  //
+  // Memory pool should be turned on before UFSD allocates anything
+  //
+  if ( NULL != opts.mempool && !UFSD_MemoryPoolSetup( ParseSize( opts.mempool ) ) )
+    fprintf( stderr, "Memory pool can't be turned on\n" );
+
   //
   // Try device
   //
-  int Status = UFSD_IOHandlerCreate( szDevice, bReadOnly, false, &Rw, NULL, false, false, 0 );
+  int Status = UFSD_IOHandlerCreate( szDevice, bReadOnly, false, &Rw, NULL, false, false, 0, bReadOnly && opts.direct );
 
   if ( !UFSD_SUCCESS( Status ) )
   {
@@ -1122,6 +1321,15 @@ main(
   {
     assert( NULL != Rw );
 
+    if ( NULL != opts.readahead )
+    {
+      size_t Bytes = ParseSize( opts.readahead );
+      Rw->IoControl( UFSD_RWB_IOCTL_SET_PREFETCH_BUFFER, &Bytes, sizeof(Bytes) );
+    }
+
+    if ( opts.aio )
+      Rw->IoControl( UFSD_RWB_IOCTL_SET_ASYNC_BACKEND, &opts.aiobackend, sizeof(opts.aiobackend) );
+
     //
     // Call UFSD code
     //
@@ -1148,6 +1356,23 @@ main(
       params.FsType = FS_APFS;
       params.PwdList = const_cast<char**>(opts.pass);
       params.PwdSize = MAX_APFS_VOLUMES;
+      if ( NULL != opts.blockcache )
+        params.BlockCacheSize = ParseSize( opts.blockcache );
+      params.BlockCachePolicy = opts.blockpolicy;
+      params.TreePinLevels = opts.pinlevels;
+      if ( NULL != opts.pinbytes )
+        params.TreePinBytes = ParseSize( opts.pinbytes );
+      if ( NULL != opts.extentmap )
+        params.ExtentMapSize = ParseSize( opts.extentmap );
+      if ( NULL != opts.maxio )
+        params.MaxIoSize = ParseSize( opts.maxio );
+      if ( NULL != opts.ramin )
+        params.ReadAheadMin = ParseSize( opts.ramin );
+      if ( NULL != opts.ramax )
+        params.ReadAheadMax = ParseSize( opts.ramax );
+      if ( NULL != opts.rasize )
+        params.ReadAheadSize = ParseSize( opts.rasize );
+      params.IoQueueDepth = opts.iodepth;
 #ifdef UFSD_WITH_OPENSSL
       cipher::CCipherFactory factory(NULL);
       params.Cf = &factory;
@@ -1195,6 +1420,13 @@ main(
         Status = (*h)(fs, s_szFile);
         fprintf( stdout, "APFS: %s returns %x. finished in %u ms\n",
                  szCmdName, Status, static_cast<unsigned int>((Tt->Time() - T0) * 1000U / api::ITime::TicksPerSecond) );
+
+        UFSD_BLOCK_CACHE_STATS Stats;
+        if ( opts.cachestats && ERR_NOERROR == fs->IoControl( IOCTL_GET_BLOCK_CACHE_STATS, NULL, 0, &Stats, sizeof(Stats) ) )
+        {
+          fprintf( stdout, "Block cache: %" PLL "u of %" PLL "u bytes, %" PLL "u closed blocks, %" PLL "u hits, %" PLL "u misses, %" PLL "u evictions\n",
+                   Stats.UsedBytes, Stats.CacheSize, Stats.ClosedBlocks, Stats.Hits, Stats.Misses, Stats.Evictions );
+        }
       }
 
       //
@@ -1214,7 +1446,37 @@ main(
   // Free all resources
   //
   if ( NULL != Rw )
+  {
+    t_RWBlockStats Stats;
+    if ( opts.iostats && ERR_NOERROR == Rw->IoControl( UFSD_RWB_IOCTL_GET_STATS, NULL, 0, &Stats, sizeof(Stats) ) )
+    {
+      fprintf( stdout, "I/O: %" PLL "u reads, %" PLL "u bytes, %" PLL "u us\n"
+                       "Read-ahead: %" PLL "u requests, %" PLL "u bytes, %" PLL "u hints, %" PLL "u fills, %" PLL "u hits, %" PLL "u hit bytes, %" PLL "u waits\n"
+                       "Async: %" PLL "u reads, %" PLL "u bytes, %" PLL "u max in flight\n"
+                       "Bounce: %" PLL "u reads, %" PLL "u bytes\n",
+               Stats.Reads, Stats.ReadBytes, Stats.ReadTimeUs,
+               Stats.PrefetchRequests, Stats.PrefetchBytes, Stats.PrefetchHints,
+               Stats.PrefetchFills, Stats.PrefetchHits, Stats.PrefetchHitBytes, Stats.PrefetchWaits,
+               Stats.AsyncReads, Stats.AsyncReadBytes, Stats.AsyncMaxInFlight,
+               Stats.BounceReads, Stats.BounceBytes );
+    }
     Rw->Destroy();
+  }
+
+  if ( opts.memstats )
+  {
+    t_MemPoolStats Stats;
+    UFSD_MemoryPoolGetStats( &Stats );
+    fprintf( stdout, "Memory pool: %" PZZ "u of %" PZZ "u bytes retained, %" PLL "u large allocations\n",
+             Stats.Retained, Stats.MaxRetained, Stats.LargeAllocs );
+    for ( size_t i = 0; i < UFSD_MEMPOOL_CLASSES; i++ )
+    {
+      const t_MemPoolClassStats* c = &Stats.Classes[i];
+      if ( 0 != c->Allocs )
+        fprintf( stdout, "  %4" PZZ "u: %" PLL "u allocs, %" PLL "u hits, %" PLL "u frees, %" PZZ "u retained\n",
+                 c->Size, c->Allocs, c->Hits, c->Frees, c->Retained );
+    }
+  }
 
   //
   // Translate error code to string
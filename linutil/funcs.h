@@ -59,6 +59,47 @@ UFSD_GetStringsService();
 api::IBaseMemoryManager*
 UFSD_GetMemoryManager();
 
+///////////////////////////////////////////////////////////
+// UFSD_MemoryPoolSetup
+//
+// Turns on the pool of small blocks in memory manager from UFSD_GetMemoryManager
+// MaxRetained is the max number of free bytes kept in the pool by every thread
+// Free blocks of finished thread go back to heap
+// The pool can be turned on only before the first allocation,
+// after that only MaxRetained can be changed. See ufsdmmgr.cpp
+///////////////////////////////////////////////////////////
+bool
+UFSD_MemoryPoolSetup(
+    IN size_t MaxRetained
+    );
+
+#define UFSD_MEMPOOL_CLASSES  16
+
+struct t_MemPoolClassStats{
+  size_t  Size;               // Size of blocks in this class
+  UINT64  Allocs;             // Allocations of this class
+  UINT64  Hits;               // Allocations served from the pool
+  UINT64  Frees;              // Blocks returned to the pool
+  size_t  Retained;           // Free blocks kept in the pool
+};
+
+struct t_MemPoolStats{
+  size_t  MaxRetained;        // Max bytes kept in the pool by every thread (0 - pool is off)
+  size_t  Retained;           // Bytes kept in the pool by all threads
+  UINT64  LargeAllocs;        // Allocations which are bigger than any class
+  t_MemPoolClassStats Classes[UFSD_MEMPOOL_CLASSES];
+};
+
+///////////////////////////////////////////////////////////
+// UFSD_MemoryPoolGetStats
+//
+// Returns statistics of the pool of small blocks. See ufsdmmgr.cpp
+///////////////////////////////////////////////////////////
+void
+UFSD_MemoryPoolGetStats(
+    OUT t_MemPoolStats* Stats
+    );
+
 ///////////////////////////////////////////////////////////
 // UFSD_IOHandlerCreate
 //
@@ -73,9 +114,41 @@ UFSD_IOHandlerCreate(
     OUT int*                 fd,
     IN bool                  bForceDismount,
     IN bool                  bVerbose,
-    IN unsigned int          BytesPerSector
+    IN unsigned int          BytesPerSector,
+    IN bool                  bDirect = false  // Read-only mode: reads bypass page cache (O_DIRECT)
     );
 
+//
+// IoControl codes supported by objects from UFSD_IOHandlerCreate
+//
+#define UFSD_RWB_IOCTL_GET_STATS            0x52570001  // OutBuffer is t_RWBlockStats
+#define UFSD_RWB_IOCTL_SET_PREFETCH_BUFFER  0x52570002  // InBuffer is size_t - bytes of private read-ahead buffer (0 - off)
+// RWB_IOCTL_CREATE_ASYNC_IO                0x52570003  // see api/rwb.hpp
+#define UFSD_RWB_IOCTL_SET_ASYNC_BACKEND    0x52570004  // InBuffer is unsigned int - UFSD_RWB_ASYNC_XXX for new async queues
+
+//Backends of asynchronous reads (UFSD_RWB_IOCTL_SET_ASYNC_BACKEND)
+#define UFSD_RWB_ASYNC_ANY      0   //  io_uring if kernel supports it, else thread pool
+#define UFSD_RWB_ASYNC_URING    1   //  io_uring only
+#define UFSD_RWB_ASYNC_THREADS  2   //  Thread pool with blocking reads
+
+struct t_RWBlockStats{
+  UINT64  PrefetchRequests;   // ReadBytes calls with RWB_FLAGS_PREFETCH
+  UINT64  PrefetchBytes;      // Bytes requested with RWB_FLAGS_PREFETCH
+  UINT64  PrefetchHints;      // Requests passed to kernel (posix_fadvise/readahead)
+  UINT64  PrefetchFills;      // Requests read into private read-ahead buffer
+  UINT64  PrefetchHits;       // Reads served from private read-ahead buffer
+  UINT64  PrefetchHitBytes;   // Bytes served from private read-ahead buffer
+  UINT64  PrefetchWaits;      // Reads that waited for fill of private read-ahead buffer
+  UINT64  Reads;              // Reads passed to device
+  UINT64  ReadBytes;          // Bytes read from device
+  UINT64  ReadTimeUs;         // Time spent in device reads, microseconds
+  UINT64  AsyncReads;         // Requests submitted to async queues
+  UINT64  AsyncReadBytes;     // Bytes requested through async queues
+  UINT64  AsyncMaxInFlight;   // Max number of requests in flight in one queue
+  UINT64  BounceReads;        // Unaligned reads bypassing page cache through bounce buffer
+  UINT64  BounceBytes;        // Bytes copied from bounce buffer
+};
+
 ///////////////////////////////////////////////////////////
 // UFSD_FSDumpIOCreate
 //
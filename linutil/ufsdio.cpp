@@ -36,6 +36,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
 
 #ifdef _WIN32
   //
@@ -151,6 +152,7 @@
   // Linux specific headers and defines are declared here
   //
   #include <string.h> // strerror
+  #include <stdlib.h> // posix_memalign
   #include <unistd.h>
   #ifdef __APPLE__
     #undef BLKSSZGET
@@ -165,6 +167,12 @@
     #endif
   #endif
   #include <sys/ioctl.h>
+  #include <pthread.h>
+  #ifdef UFSD_WITH_IO_URING
+    #include <sys/syscall.h>
+    #include <sys/mman.h>
+    #include <linux/io_uring.h>
+  #endif
 
 #ifndef __FreeBSD__ // Set "#if 0" to turn off default ioctl values
   #ifndef BLKPBSZGET
@@ -204,6 +212,7 @@
 
 #include <api/assert.hpp>
 #include <ufsd.h>
+#include "funcs.h"
 
 #ifndef _Trace
   #define _Trace(a) do{}while((void)0,0)
@@ -235,6 +244,503 @@
   #endif
 #endif
 
+//
+// Kernel read-ahead hints.
+// Without them RWB_FLAGS_PREFETCH is served by private read-ahead buffer
+//
+#if !defined _WIN32 && defined POSIX_FADV_WILLNEED
+  #define UFSD_RWB_FADVISE
+#endif
+#if defined __linux__ && defined _GNU_SOURCE && !defined __ANDROID__
+  #define UFSD_RWB_READAHEAD
+#endif
+
+#if defined UFSD_RWB_FADVISE || defined UFSD_RWB_READAHEAD
+  #define UFSD_RWB_PREFETCH_BUFFER  0
+#else
+  #define UFSD_RWB_PREFETCH_BUFFER  0x100000
+#endif
+
+//
+// io_uring is used through raw system calls.
+// IORING_OP_READ came with IORING_FEAT_RW_CUR_POS (Linux 5.6)
+//
+#if defined UFSD_WITH_IO_URING && defined __NR_io_uring_setup && defined IORING_FEAT_RW_CUR_POS
+  #define UFSD_RWB_IO_URING
+#endif
+
+// Max number of requests in flight in one async queue
+#define UFSD_RWB_ASYNC_MAX_DEPTH  256
+
+//
+// Reads that bypass page cache (O_DIRECT, or F_NOCACHE on Mac).
+// Offsets, sizes and buffers of such reads are aligned, others go through bounce buffer
+//
+#if !defined _WIN32 && (defined O_DIRECT || defined F_NOCACHE)
+  #define UFSD_RWB_DIRECT
+#endif
+#define UFSD_RWB_DIRECT_ALIGN     4096
+#define UFSD_RWB_BOUNCE_BUFFER    0x100000
+
+
+///////////////////////////////////////////////////////////
+// GetTimeUs
+//
+// Returns monotonic time in microseconds
+///////////////////////////////////////////////////////////
+static UINT64
+GetTimeUs()
+{
+#ifdef _WIN32
+  LARGE_INTEGER Freq, Cnt;
+  ::QueryPerformanceFrequency( &Freq );
+  ::QueryPerformanceCounter( &Cnt );
+  return (Cnt.QuadPart / Freq.QuadPart) * 1000000 + (Cnt.QuadPart % Freq.QuadPart) * 1000000 / Freq.QuadPart;
+#else
+  struct timespec ts;
+  if ( 0 != clock_gettime( CLOCK_MONOTONIC, &ts ) )
+    return 0;
+  return (UINT64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+
+#ifndef _WIN32
+///////////////////////////////////////////////////////////
+// ReadAll
+//
+// Blocking read of whole range. Continues short reads
+///////////////////////////////////////////////////////////
+static int
+ReadAll(
+    IN int          hFile,
+    IN UINT64       Offset,
+    IN void*        Buffer,
+    IN size_t       Bytes
+    )
+{
+  while ( 0 != Bytes )
+  {
+    ssize_t r = pread64( hFile, Buffer, Bytes, Offset );
+    if ( r < 0 )
+    {
+      if ( EINTR == errno )
+        continue;
+      return errno;
+    }
+    if ( 0 == r )
+      return ERR_READFILE;
+
+    Buffer  = Add2Ptr( Buffer, r );
+    Offset += r;
+    Bytes  -= r;
+  }
+  return ERR_NOERROR;
+}
+
+
+//=============================================================================
+//                        CThreadAsyncIo
+//
+// Async queue served by pool of threads with blocking reads
+//=============================================================================
+struct CThreadAsyncIo : public api::IDeviceAsyncIo, public base_noncopyable
+{
+  int                           m_hFile;
+  unsigned int                  m_Depth;
+  size_t                        m_Align;        // offsets, sizes and buffers of requests are aligned to it (0 - any)
+  t_RWBlockStats*               m_pStats;
+
+  pthread_mutex_t               m_Mutex;
+  pthread_cond_t                m_Work;         // signaled when request is queued or pool stops
+  pthread_cond_t                m_Done;         // signaled when request is completed
+  pthread_t*                    m_Threads;
+  unsigned int                  m_ThreadsCount;
+
+  api::t_RWBlockAsyncRequest**  m_Queued;       // ring of m_Depth requests waiting for thread
+  unsigned int                  m_QueuedHead;
+  unsigned int                  m_QueuedCount;
+  api::t_RWBlockAsyncRequest**  m_Completed;    // ring of m_Depth requests to be reaped
+  unsigned int                  m_CompletedHead;
+  unsigned int                  m_CompletedCount;
+  unsigned int                  m_InFlight;     // submitted and not reaped yet
+  bool                          m_bStop;
+
+  CThreadAsyncIo( IN int hFile, IN size_t Align, IN t_RWBlockStats* pStats )
+    : m_hFile(hFile)
+    , m_Depth(0)
+    , m_Align(Align)
+    , m_pStats(pStats)
+    , m_Threads(NULL)
+    , m_ThreadsCount(0)
+    , m_Queued(NULL)
+    , m_QueuedHead(0)
+    , m_QueuedCount(0)
+    , m_Completed(NULL)
+    , m_CompletedHead(0)
+    , m_CompletedCount(0)
+    , m_InFlight(0)
+    , m_bStop(false)
+  {
+    pthread_mutex_init( &m_Mutex, NULL );
+    pthread_cond_init( &m_Work, NULL );
+    pthread_cond_init( &m_Done, NULL );
+  }
+
+  virtual ~CThreadAsyncIo()
+  {
+    pthread_mutex_lock( &m_Mutex );
+    m_bStop = true;
+    pthread_cond_broadcast( &m_Work );
+    pthread_mutex_unlock( &m_Mutex );
+
+    for ( unsigned int i = 0; i < m_ThreadsCount; i++ )
+      pthread_join( m_Threads[i], NULL );
+
+    pthread_cond_destroy( &m_Done );
+    pthread_cond_destroy( &m_Work );
+    pthread_mutex_destroy( &m_Mutex );
+    free( m_Threads );
+    free( m_Queued );
+    free( m_Completed );
+  }
+
+  int Init( IN unsigned int Depth )
+  {
+    m_Threads   = (pthread_t*)malloc( Depth * sizeof(pthread_t) );
+    m_Queued    = (api::t_RWBlockAsyncRequest**)malloc( Depth * sizeof(api::t_RWBlockAsyncRequest*) );
+    m_Completed = (api::t_RWBlockAsyncRequest**)malloc( Depth * sizeof(api::t_RWBlockAsyncRequest*) );
+    if ( NULL == m_Threads || NULL == m_Queued || NULL == m_Completed )
+      return ERR_NOMEMORY;
+
+    m_Depth = Depth;
+    for ( ; m_ThreadsCount < Depth; m_ThreadsCount++ )
+    {
+      if ( 0 != pthread_create( &m_Threads[m_ThreadsCount], NULL, ThreadProc, this ) )
+        break;
+    }
+
+    return 0 == m_ThreadsCount? ERR_CREATE_THREAD : ERR_NOERROR;
+  }
+
+  static void* ThreadProc( IN void* Arg )
+  {
+    CThreadAsyncIo* This = (CThreadAsyncIo*)Arg;
+    pthread_mutex_lock( &This->m_Mutex );
+    for ( ;; )
+    {
+      while ( 0 == This->m_QueuedCount && !This->m_bStop )
+        pthread_cond_wait( &This->m_Work, &This->m_Mutex );
+      if ( 0 == This->m_QueuedCount )
+        break;
+
+      api::t_RWBlockAsyncRequest* Req = This->m_Queued[This->m_QueuedHead];
+      This->m_QueuedHead = (This->m_QueuedHead + 1) % This->m_Depth;
+      This->m_QueuedCount -= 1;
+      pthread_mutex_unlock( &This->m_Mutex );
+
+      Req->Status = ReadAll( This->m_hFile, Req->Offset, Req->Buffer, Req->Bytes );
+
+      pthread_mutex_lock( &This->m_Mutex );
+      This->m_Completed[(This->m_CompletedHead + This->m_CompletedCount) % This->m_Depth] = Req;
+      This->m_CompletedCount += 1;
+      pthread_cond_signal( &This->m_Done );
+    }
+    pthread_mutex_unlock( &This->m_Mutex );
+    return NULL;
+  }
+
+  //=============================================
+  //    api::IDeviceAsyncIo virtual functions
+  //=============================================
+
+  virtual unsigned int GetQueueDepth() const
+  {
+    return m_Depth;
+  }
+
+  virtual int Submit( IN api::t_RWBlockAsyncRequest* Req )
+  {
+    if ( m_InFlight >= m_Depth || (0 != m_Align && 0 != ((Req->Offset | (size_t)Req->Buffer | Req->Bytes) & (m_Align - 1))) )
+      return ERR_BADPARAMS;
+
+    pthread_mutex_lock( &m_Mutex );
+    m_Queued[(m_QueuedHead + m_QueuedCount) % m_Depth] = Req;
+    m_QueuedCount += 1;
+    pthread_cond_signal( &m_Work );
+    pthread_mutex_unlock( &m_Mutex );
+
+    m_InFlight += 1;
+    m_pStats->AsyncReads     += 1;
+    m_pStats->AsyncReadBytes += Req->Bytes;
+    if ( m_InFlight > m_pStats->AsyncMaxInFlight )
+      m_pStats->AsyncMaxInFlight = m_InFlight;
+    return ERR_NOERROR;
+  }
+
+  virtual int Reap(
+      OUT api::t_RWBlockAsyncRequest** Completed,
+      IN  size_t                       MaxCount,
+      IN  size_t                       MinCount,
+      OUT size_t*                      Count
+      )
+  {
+    size_t n = 0;
+    if ( MinCount > m_InFlight )
+      MinCount = m_InFlight;
+
+    pthread_mutex_lock( &m_Mutex );
+    for ( ;; )
+    {
+      while ( 0 != m_CompletedCount && n < MaxCount )
+      {
+        Completed[n++]   = m_Completed[m_CompletedHead];
+        m_CompletedHead  = (m_CompletedHead + 1) % m_Depth;
+        m_CompletedCount -= 1;
+      }
+      if ( n >= MinCount )
+        break;
+      pthread_cond_wait( &m_Done, &m_Mutex );
+    }
+    pthread_mutex_unlock( &m_Mutex );
+
+    m_InFlight -= (unsigned int)n;
+    *Count = n;
+    return ERR_NOERROR;
+  }
+
+  virtual void Destroy()
+  {
+    // Threads finish queued requests before exit
+    delete this;
+  }
+};
+
+
+#ifdef UFSD_RWB_IO_URING
+//=============================================================================
+//                        CUringAsyncIo
+//
+// Async queue served by io_uring
+//=============================================================================
+struct CUringAsyncIo : public api::IDeviceAsyncIo, public base_noncopyable
+{
+  int                   m_hRing;
+  int                   m_hFile;
+  unsigned int          m_Depth;
+  size_t                m_Align;        // offsets, sizes and buffers of requests are aligned to it (0 - any)
+  unsigned int          m_InFlight;     // submitted and not reaped yet
+  unsigned int          m_ToSubmit;     // in submission ring but not passed to kernel
+  t_RWBlockStats*       m_pStats;
+
+  void*                 m_pSqRing;
+  size_t                m_SqRingSize;
+  void*                 m_pCqRing;      // the same as m_pSqRing for IORING_FEAT_SINGLE_MMAP
+  size_t                m_CqRingSize;
+  struct io_uring_sqe*  m_Sqes;
+  size_t                m_SqesSize;
+
+  unsigned int*         m_SqTail;
+  unsigned int*         m_SqMask;
+  unsigned int*         m_SqArray;
+  unsigned int*         m_CqHead;
+  unsigned int*         m_CqTail;
+  unsigned int*         m_CqMask;
+  struct io_uring_cqe*  m_Cqes;
+
+  CUringAsyncIo( IN int hFile, IN size_t Align, IN t_RWBlockStats* pStats )
+    : m_hRing(-1)
+    , m_hFile(hFile)
+    , m_Depth(0)
+    , m_Align(Align)
+    , m_InFlight(0)
+    , m_ToSubmit(0)
+    , m_pStats(pStats)
+    , m_pSqRing(MAP_FAILED)
+    , m_SqRingSize(0)
+    , m_pCqRing(MAP_FAILED)
+    , m_CqRingSize(0)
+    , m_Sqes((struct io_uring_sqe*)MAP_FAILED)
+    , m_SqesSize(0)
+  {
+  }
+
+  virtual ~CUringAsyncIo()
+  {
+    if ( MAP_FAILED != (void*)m_Sqes )
+      munmap( m_Sqes, m_SqesSize );
+    if ( MAP_FAILED != m_pCqRing && m_pCqRing != m_pSqRing )
+      munmap( m_pCqRing, m_CqRingSize );
+    if ( MAP_FAILED != m_pSqRing )
+      munmap( m_pSqRing, m_SqRingSize );
+    if ( -1 != m_hRing )
+      close( m_hRing );
+  }
+
+  int Init( IN unsigned int Depth )
+  {
+    struct io_uring_params p;
+    memset( &p, 0, sizeof(p) );
+    m_hRing = (int)syscall( __NR_io_uring_setup, Depth, &p );
+    if ( -1 == m_hRing )
+      return errno;
+
+    // IORING_OP_READ is not supported
+    if ( !FlagOn( p.features, IORING_FEAT_RW_CUR_POS ) )
+      return ERR_NOTIMPLEMENTED;
+
+    m_SqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    m_CqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ( FlagOn( p.features, IORING_FEAT_SINGLE_MMAP ) && m_CqRingSize > m_SqRingSize )
+      m_SqRingSize = m_CqRingSize;
+
+    m_pSqRing = mmap( NULL, m_SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_hRing, IORING_OFF_SQ_RING );
+    if ( MAP_FAILED == m_pSqRing )
+      return errno;
+
+    if ( FlagOn( p.features, IORING_FEAT_SINGLE_MMAP ) )
+      m_pCqRing = m_pSqRing;
+    else
+    {
+      m_pCqRing = mmap( NULL, m_CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_hRing, IORING_OFF_CQ_RING );
+      if ( MAP_FAILED == m_pCqRing )
+        return errno;
+    }
+
+    m_SqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    m_Sqes = (struct io_uring_sqe*)mmap( NULL, m_SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_hRing, IORING_OFF_SQES );
+    if ( MAP_FAILED == (void*)m_Sqes )
+      return errno;
+
+    m_SqTail  = (unsigned int*)Add2Ptr( m_pSqRing, p.sq_off.tail );
+    m_SqMask  = (unsigned int*)Add2Ptr( m_pSqRing, p.sq_off.ring_mask );
+    m_SqArray = (unsigned int*)Add2Ptr( m_pSqRing, p.sq_off.array );
+    m_CqHead  = (unsigned int*)Add2Ptr( m_pCqRing, p.cq_off.head );
+    m_CqTail  = (unsigned int*)Add2Ptr( m_pCqRing, p.cq_off.tail );
+    m_CqMask  = (unsigned int*)Add2Ptr( m_pCqRing, p.cq_off.ring_mask );
+    m_Cqes    = (struct io_uring_cqe*)Add2Ptr( m_pCqRing, p.cq_off.cqes );
+
+    // Kernel rounds the number of entries up to power of 2
+    m_Depth = Depth;
+    return ERR_NOERROR;
+  }
+
+  // Passes queued entries to kernel and waits for MinComplete completions
+  int Enter( IN unsigned int MinComplete )
+  {
+    for ( ;; )
+    {
+      int r = (int)syscall( __NR_io_uring_enter, m_hRing, m_ToSubmit, MinComplete, 0 != MinComplete? IORING_ENTER_GETEVENTS : 0, NULL, 0 );
+      if ( r >= 0 )
+      {
+        m_ToSubmit -= r;
+        return ERR_NOERROR;
+      }
+      if ( EINTR != errno )
+        return errno;
+    }
+  }
+
+  //=============================================
+  //    api::IDeviceAsyncIo virtual functions
+  //=============================================
+
+  virtual unsigned int GetQueueDepth() const
+  {
+    return m_Depth;
+  }
+
+  virtual int Submit( IN api::t_RWBlockAsyncRequest* Req )
+  {
+    if ( m_InFlight >= m_Depth || Req->Bytes > 0x7ffff000 || (0 != m_Align && 0 != ((Req->Offset | (size_t)Req->Buffer | Req->Bytes) & (m_Align - 1))) )
+      return ERR_BADPARAMS;
+
+    // Only this thread moves the tail
+    unsigned int Tail  = *m_SqTail;
+    unsigned int Index = Tail & *m_SqMask;
+    struct io_uring_sqe* sqe = m_Sqes + Index;
+    memset( sqe, 0, sizeof(*sqe) );
+    sqe->opcode    = IORING_OP_READ;
+    sqe->fd        = m_hFile;
+    sqe->off       = Req->Offset;
+    sqe->addr      = (UINT64)(size_t)Req->Buffer;
+    sqe->len       = (unsigned int)Req->Bytes;
+    sqe->user_data = (UINT64)(size_t)Req;
+    m_SqArray[Index] = Index;
+    __atomic_store_n( m_SqTail, Tail + 1, __ATOMIC_RELEASE );
+
+    m_ToSubmit += 1;
+    m_InFlight += 1;
+    m_pStats->AsyncReads     += 1;
+    m_pStats->AsyncReadBytes += Req->Bytes;
+    if ( m_InFlight > m_pStats->AsyncMaxInFlight )
+      m_pStats->AsyncMaxInFlight = m_InFlight;
+
+    // Entry stays in the ring if kernel is busy. Reap passes it again
+    Enter( 0 );
+    return ERR_NOERROR;
+  }
+
+  virtual int Reap(
+      OUT api::t_RWBlockAsyncRequest** Completed,
+      IN  size_t                       MaxCount,
+      IN  size_t                       MinCount,
+      OUT size_t*                      Count
+      )
+  {
+    size_t n = 0;
+    int err  = ERR_NOERROR;
+    if ( MinCount > m_InFlight )
+      MinCount = m_InFlight;
+
+    for ( ;; )
+    {
+      unsigned int Head = *m_CqHead;
+      unsigned int Tail = __atomic_load_n( m_CqTail, __ATOMIC_ACQUIRE );
+      for ( ; Head != Tail && n < MaxCount; Head++ )
+      {
+        struct io_uring_cqe* cqe = m_Cqes + (Head & *m_CqMask);
+        api::t_RWBlockAsyncRequest* Req = (api::t_RWBlockAsyncRequest*)(size_t)cqe->user_data;
+        if ( cqe->res < 0 )
+          Req->Status = -cqe->res;
+        else if ( (size_t)cqe->res < Req->Bytes )
+          Req->Status = ReadAll( m_hFile, Req->Offset + cqe->res, Add2Ptr( Req->Buffer, cqe->res ), Req->Bytes - cqe->res );
+        else
+          Req->Status = ERR_NOERROR;
+        Completed[n++] = Req;
+      }
+      __atomic_store_n( m_CqHead, Head, __ATOMIC_RELEASE );
+
+      if ( n >= MinCount )
+        break;
+
+      err = Enter( (unsigned int)(MinCount - n) );
+      if ( ERR_NOERROR != err )
+        break;
+    }
+
+    if ( 0 != m_ToSubmit && ERR_NOERROR == err )
+      err = Enter( 0 );
+
+    m_InFlight -= (unsigned int)n;
+    *Count = n;
+    return 0 != n? ERR_NOERROR : err;
+  }
+
+  virtual void Destroy()
+  {
+    // Kernel may still write to buffers of requests in flight
+    api::t_RWBlockAsyncRequest* Completed[16];
+    size_t n;
+    while ( 0 != m_InFlight && ERR_NOERROR == Reap( Completed, ARRSIZE(Completed), 1, &n ) )
+    {
+    }
+    delete this;
+  }
+};
+#endif // #ifdef UFSD_RWB_IO_URING
+#endif // #ifndef _WIN32
+
 
 //=============================================================================
 //                        CUFSD_RWBlock
@@ -258,6 +764,19 @@ struct CUFSD_RWBlock : public api::IDeviceRWBlock, public base_noncopyable
   UINT64            m_Size;         // In bytes
   char*             m_szDevice;     // copy of device name
 
+  void*             m_pPrefetch;        // private read-ahead buffer
+  size_t            m_PrefetchSize;     // size of m_pPrefetch (0 - use kernel hints only)
+  size_t            m_PrefetchValid;    // valid bytes in m_pPrefetch
+  UINT64            m_PrefetchOffset;   // device offset of m_pPrefetch
+  api::IDeviceAsyncIo*        m_pPrefetchIo;      // queue that fills m_pPrefetch in background (created on first fill)
+  api::t_RWBlockAsyncRequest  m_PrefetchReq;      // fill of m_pPrefetch
+  bool              m_bPrefetchPending; // m_PrefetchReq is in flight
+  bool              m_bPrefetchHints;   // m_pPrefetchIo can't be created, kernel hints are used instead
+  unsigned int      m_AsyncBackend;     // UFSD_RWB_ASYNC_XXX for new async queues
+  size_t            m_DirectAlign;      // alignment of reads bypassing page cache (0 - page cache is used)
+  void*             m_pBounce;          // aligned buffer for unaligned reads bypassing page cache
+  t_RWBlockStats    m_Stats;
+
   CUFSD_RWBlock( IN bool bReadOnly, IN bool bNoDiscard )
     : m_hFile(-1)
     , m_bReadOnly(bReadOnly)
@@ -274,11 +793,27 @@ struct CUFSD_RWBlock : public api::IDeviceRWBlock, public base_noncopyable
     , m_BytesPerSector(512)
     , m_Size(0)
     , m_szDevice(NULL)
+    , m_pPrefetch(NULL)
+    , m_PrefetchSize(UFSD_RWB_PREFETCH_BUFFER)
+    , m_PrefetchValid(0)
+    , m_PrefetchOffset(0)
+    , m_pPrefetchIo(NULL)
+    , m_bPrefetchPending(false)
+    , m_bPrefetchHints(false)
+    , m_AsyncBackend(UFSD_RWB_ASYNC_ANY)
+    , m_DirectAlign(0)
+    , m_pBounce(NULL)
   {
+    memset( &m_Stats, 0, sizeof(m_Stats) );
+    memset( &m_PrefetchReq, 0, sizeof(m_PrefetchReq) );
   }
 
   virtual ~CUFSD_RWBlock()
   {
+    // Fill in flight reads m_hFile into m_pPrefetch
+    if ( NULL != m_pPrefetchIo )
+      m_pPrefetchIo->Destroy();
+
     if ( -1 != m_hFile )
     {
 #ifdef _WIN32
@@ -300,6 +835,8 @@ struct CUFSD_RWBlock : public api::IDeviceRWBlock, public base_noncopyable
       close( m_hFile );
     }
     free( m_szDevice );
+    free( m_pPrefetch );
+    free( m_pBounce );
   }
 
   int Init(
@@ -307,7 +844,8 @@ struct CUFSD_RWBlock : public api::IDeviceRWBlock, public base_noncopyable
       IN bool         bForceDismount,
       IN bool         bVerbose,
       OUT int*        fd,
-      IN unsigned int NewBytesPerSector
+      IN unsigned int NewBytesPerSector,
+      IN bool         bDirect
       );
 
   //=============================================
@@ -366,16 +904,13 @@ struct CUFSD_RWBlock : public api::IDeviceRWBlock, public base_noncopyable
 
   // Function like DeviceIoControl
   virtual int IoControl(
-      IN  size_t          ,//IoControlCode,
-      IN  const void*     ,//InBuffer        = NULL, // OPTIONAL
-      IN  size_t          ,//InBuffSize      = 0,    // OPTIONAL
-      OUT void*           ,//OutBuffer       = NULL, // OPTIONAL
-      IN  size_t          ,//OutBuffSize     = 0,    // OPTIONAL
-      OUT size_t*         //BytesReturned   = NULL  // OPTIONAL
-      )
-  {
-    return ERR_NOTIMPLEMENTED;
-  }
+      IN  size_t          IoControlCode,
+      IN  const void*     InBuffer        = NULL, // OPTIONAL
+      IN  size_t          InBuffSize      = 0,    // OPTIONAL
+      OUT void*           OutBuffer       = NULL, // OPTIONAL
+      IN  size_t          OutBuffSize     = 0,    // OPTIONAL
+      OUT size_t*         BytesReturned   = NULL  // OPTIONAL
+      );
 
   virtual int Close()
   {
@@ -390,6 +925,61 @@ struct CUFSD_RWBlock : public api::IDeviceRWBlock, public base_noncopyable
   //=============================================
   //   End of api::IDeviceRWBlock
   //=============================================
+
+  // Starts read-ahead of range
+  void Prefetch(
+      IN const UINT64&  Offset,
+      IN size_t         Bytes
+      );
+
+  // Passes read-ahead of range to kernel. Returns false if kernel does not accept hints
+  bool PrefetchHint(
+      IN const UINT64&  Offset,
+      IN size_t         Bytes
+      );
+
+  // Reaps fill of m_pPrefetch started by Prefetch. Returns false if it is still in flight (bWait == false only)
+  bool ReapPrefetch(
+      IN bool           bWait
+      );
+
+  // Creates queue of asynchronous reads
+  int CreateAsyncIo(
+      IN  unsigned int          Depth,
+      OUT api::IDeviceAsyncIo** ppAsyncIo
+      );
+
+  // Returns true if read may bypass page cache without bounce buffer
+  bool IsDirectAligned(
+      IN const UINT64&  Offset,
+      IN const void*    Buffer,
+      IN size_t         Bytes
+      ) const
+  {
+    return 0 == ((Offset | (size_t)Buffer | Bytes) & (m_DirectAlign - 1));
+  }
+
+#ifdef UFSD_RWB_DIRECT
+  // Reads unaligned range through m_pBounce
+  int ReadBounced(
+      IN UINT64         Offset,
+      IN void*          Buffer,
+      IN size_t         Bytes
+      );
+#endif
+
+  // Drops private read-ahead buffer if it intersects with range
+  void DropPrefetch(
+      IN const UINT64&  Offset,
+      IN const UINT64&  Bytes
+      )
+  {
+    // Fill in flight may return old data of the range
+    if ( m_bPrefetchPending && Offset < m_PrefetchReq.Offset + m_PrefetchReq.Bytes && m_PrefetchReq.Offset < Offset + Bytes )
+      ReapPrefetch( true );
+    if ( 0 != m_PrefetchValid && Offset < m_PrefetchOffset + m_PrefetchValid && m_PrefetchOffset < Offset + Bytes )
+      m_PrefetchValid = 0;
+  }
 };
 
 
@@ -404,7 +994,8 @@ CUFSD_RWBlock::Init(
     IN bool         bForceDismount,
     IN bool         bVerbose,
     OUT int*        fd,
-    IN unsigned int NewBytesPerSector
+    IN unsigned int NewBytesPerSector,
+    IN bool         bDirect
     )
 {
 #ifdef _WIN32
@@ -419,13 +1010,41 @@ CUFSD_RWBlock::Init(
 #endif
 
   m_bVerbose = bVerbose;
+
+  int OpenFlags = O_BINARY | (m_bReadOnly? O_RDONLY : O_RDWR);
+#ifdef UFSD_RWB_DIRECT
+  // Page cache is bypassed by reads only
+  if ( bDirect && !m_bReadOnly )
+  {
+    _Trace(( stderr, "\"%s\": direct access is supported in read-only mode only\n", szDevice ));
+    bDirect = false;
+  }
+  #ifdef O_DIRECT
+  if ( bDirect )
+    OpenFlags |= O_DIRECT;
+  #endif
+#else
+  if ( bDirect )
+  {
+    _Trace(( stderr, "\"%s\": direct access is not supported\n", szDevice ));
+    bDirect = false;
+  }
+#endif
+
 #if defined _WIN32 & defined _CONSOLE
   int Attempts = 0;
 Again:
 #endif
-  m_hFile = open64( szName,
-                    O_BINARY | (m_bReadOnly? O_RDONLY : O_RDWR),
-                    S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP );
+  m_hFile = open64( szName, OpenFlags, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP );
+#if defined UFSD_RWB_DIRECT && defined O_DIRECT
+  if ( -1 == m_hFile && bDirect && EINVAL == errno )
+  {
+    _Trace(( stderr, "\"%s\": O_DIRECT is not supported, page cache is used\n", szDevice ));
+    bDirect   = false;
+    OpenFlags &= ~O_DIRECT;
+    m_hFile   = open64( szName, OpenFlags, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP );
+  }
+#endif
   if ( -1 == m_hFile )
   {
     int err = errno;
@@ -696,6 +1315,21 @@ Error:
   // Make a copy of device name to check for ejected media
   m_szDevice = strdup( szName );
 
+#ifdef UFSD_RWB_DIRECT
+  if ( bDirect )
+  {
+  #ifndef O_DIRECT
+    fcntl( m_hFile, F_NOCACHE, 1 );
+  #endif
+    m_DirectAlign = m_BytesPerSector > UFSD_RWB_DIRECT_ALIGN? m_BytesPerSector : UFSD_RWB_DIRECT_ALIGN;
+    // Kernel read-ahead hints would fill page cache, so prefetch uses private buffer
+    if ( 0 == m_PrefetchSize )
+      m_PrefetchSize = UFSD_RWB_BOUNCE_BUFFER;
+    if ( bVerbose )
+      _Trace(( stdout, "\"%s\": page cache is bypassed, reads are aligned to 0x%" PZZ "x\n", szDevice, m_DirectAlign ));
+  }
+#endif
+
   if ( 0 != NewBytesPerSector && NewBytesPerSector != m_BytesPerSector )
   {
     m_BytesPerSector  = NewBytesPerSector;
@@ -727,6 +1361,8 @@ CUFSD_RWBlock::DiscardRange(
   if ( 0 == Bytes )
     return ERR_NOERROR;
 
+  DropPrefetch( Offset, Bytes );
+
 #ifdef _WIN32
 
 #if 0
@@ -810,7 +1446,8 @@ CUFSD_RWBlock::ReadBytes(
   if ( FlagOn( Flags, RWB_FLAGS_PREFETCH ) )
   {
     assert( NULL == Buffer );
-    // Not implemented yet
+    // Read-ahead is a hint only, errors are ignored
+    Prefetch( Offset, Bytes );
     return ERR_NOERROR;
   }
 
@@ -842,6 +1479,20 @@ CUFSD_RWBlock::ReadBytes(
       while( 0 != ToProcess )
       {
         size_t part = ToProcess < BlockSize? ToProcess : BlockSize;
+#ifdef UFSD_RWB_DIRECT
+        if ( 0 != m_DirectAlign )
+        {
+          int err = ReadBounced( Offset + Done, Tmp, part );
+          if ( ERR_NOERROR != err )
+          {
+            free( Tmp );
+            return err;
+          }
+          ToProcess -= part;
+          Done      += part;
+          continue;
+        }
+#endif
         int r = pread64( m_hFile, Tmp, part, Offset + Done );
         if ( -1 == r || (size_t)r != part )
         {
@@ -859,10 +1510,53 @@ CUFSD_RWBlock::ReadBytes(
     return ERR_NOERROR;
   }
 
+  //
+  // Try read-ahead buffer. Wait for its fill only if it covers the range
+  //
+  if ( m_bPrefetchPending
+    && Offset >= m_PrefetchReq.Offset
+    && Offset + Bytes <= m_PrefetchReq.Offset + m_PrefetchReq.Bytes )
+  {
+    m_Stats.PrefetchWaits += 1;
+    ReapPrefetch( true );
+  }
+
+  if ( 0 != m_PrefetchValid
+    && Offset >= m_PrefetchOffset
+    && Offset + Bytes <= m_PrefetchOffset + m_PrefetchValid )
+  {
+    memcpy( Buffer, Add2Ptr( m_pPrefetch, (size_t)(Offset - m_PrefetchOffset) ), Bytes );
+    m_Stats.PrefetchHits     += 1;
+    m_Stats.PrefetchHitBytes += Bytes;
+    return ERR_NOERROR;
+  }
+
+#ifdef UFSD_RWB_DIRECT
+  if ( 0 != m_DirectAlign && !IsDirectAligned( Offset, Buffer, Bytes ) )
+  {
+    int err = ReadBounced( Offset, Buffer, Bytes );
+    if ( ERR_NOERROR == err || ERR_NOMEMORY == err )
+      return err;
+
+    _Trace(( stderr, "\"%s\": error reading 0x%" PZZ "x bytes at offset 0x%" PLL "x through bounce buffer, error=%d\n",
+             m_szDevice, Bytes, Offset, err ));
+    if ( NULL != m_szDevice && access( m_szDevice, R_OK ) )
+    {
+      m_bNoMedia = true;
+      return ERR_NOMEDIA;
+    }
+    return err;
+  }
+#endif
+
   //
   // Try to read in one request
   //
+  UINT64 T0 = GetTimeUs();
   int r = pread64( m_hFile, Buffer, Bytes, Offset );
+  m_Stats.ReadTimeUs += GetTimeUs() - T0;
+  m_Stats.Reads      += 1;
+  m_Stats.ReadBytes  += Bytes;
   if ( (size_t)r == Bytes )
     return ERR_NOERROR;
 
@@ -949,6 +1643,8 @@ CUFSD_RWBlock::WriteBytes(
   if ( Offset + Bytes > m_Size )
     return ERR_BADPARAMS;
 
+  DropPrefetch( Offset, Bytes );
+
   if ( FlagOn( Flags, RWB_FLAGS_ZERO ) )
   {
     assert( NULL == Buffer );
@@ -1039,6 +1735,334 @@ CUFSD_RWBlock::WriteBytes(
 }
 
 
+///////////////////////////////////////////////////////////
+// CUFSD_RWBlock::PrefetchHint
+//
+// Asks kernel to read range in background
+///////////////////////////////////////////////////////////
+bool
+CUFSD_RWBlock::PrefetchHint(
+    IN const UINT64&  Offset,
+    IN size_t         Bytes
+    )
+{
+#ifdef UFSD_RWB_FADVISE
+  if ( 0 == posix_fadvise( m_hFile, Offset, Bytes, POSIX_FADV_WILLNEED ) )
+  {
+    m_Stats.PrefetchHints += 1;
+    return true;
+  }
+#endif
+#ifdef UFSD_RWB_READAHEAD
+  if ( 0 == readahead( m_hFile, Offset, Bytes ) )
+  {
+    m_Stats.PrefetchHints += 1;
+    return true;
+  }
+#endif
+  UNREFERENCED_PARAMETER( Offset );
+  UNREFERENCED_PARAMETER( Bytes );
+  return false;
+}
+
+
+///////////////////////////////////////////////////////////
+// CUFSD_RWBlock::ReapPrefetch
+//
+// Makes the fill of private buffer valid when it is completed
+///////////////////////////////////////////////////////////
+bool
+CUFSD_RWBlock::ReapPrefetch(
+    IN bool bWait
+    )
+{
+  if ( !m_bPrefetchPending )
+    return true;
+
+  api::t_RWBlockAsyncRequest* Done;
+  size_t Count = 0;
+  UINT64 T0 = GetTimeUs();
+  int err = m_pPrefetchIo->Reap( &Done, 1, bWait? 1 : 0, &Count );
+  if ( bWait )
+    m_Stats.ReadTimeUs += GetTimeUs() - T0;
+
+  if ( 0 == Count )
+  {
+    if ( !bWait )
+      return false;
+    // Queue is broken, its buffer can't be reused
+    _Trace(( stderr, "\"%s\": read-ahead queue failed, error=%d\n", m_szDevice, err ));
+    m_pPrefetchIo->Destroy();
+    m_pPrefetchIo    = NULL;
+    m_bPrefetchHints = true;
+  }
+  else if ( ERR_NOERROR == m_PrefetchReq.Status )
+  {
+    m_PrefetchOffset = m_PrefetchReq.Offset;
+    m_PrefetchValid  = m_PrefetchReq.Bytes;
+    m_Stats.PrefetchFills += 1;
+  }
+
+  m_bPrefetchPending = false;
+  return true;
+}
+
+
+///////////////////////////////////////////////////////////
+// CUFSD_RWBlock::Prefetch
+//
+// Asks kernel to read range in background.
+// If private buffer is set then starts asynchronous read of the head of range into it.
+// Caller waits only if it reads from that range before the fill is completed
+///////////////////////////////////////////////////////////
+void
+CUFSD_RWBlock::Prefetch(
+    IN const UINT64&  Offset,
+    IN size_t         Bytes
+    )
+{
+  m_Stats.PrefetchRequests += 1;
+  m_Stats.PrefetchBytes    += Bytes;
+
+  if ( 0 == m_PrefetchSize || m_bPrefetchHints )
+  {
+    PrefetchHint( Offset, Bytes );
+    return;
+  }
+
+  size_t ToRead = Bytes < m_PrefetchSize? Bytes : m_PrefetchSize;
+
+  // Being read into buffer?
+  if ( m_bPrefetchPending
+    && Offset >= m_PrefetchReq.Offset
+    && Offset + ToRead <= m_PrefetchReq.Offset + m_PrefetchReq.Bytes )
+  {
+    return;
+  }
+
+  // Read-ahead never waits: previous fill is still in flight
+  if ( !ReapPrefetch( false ) )
+    return;
+
+  // Already in buffer?
+  if ( 0 != m_PrefetchValid
+    && Offset >= m_PrefetchOffset
+    && Offset + ToRead <= m_PrefetchOffset + m_PrefetchValid )
+  {
+    return;
+  }
+
+  UINT64 Start = Offset;
+  if ( 0 != m_DirectAlign )
+  {
+    // Aligned range that covers the head of requested one
+    size_t BufSize = m_PrefetchSize & ~(m_DirectAlign - 1);
+    if ( 0 == BufSize )
+      return;
+    Start  = Offset & ~(UINT64)(m_DirectAlign - 1);
+    ToRead = (size_t)(Offset - Start) + ToRead;
+    ToRead = ToRead < BufSize? ((ToRead + m_DirectAlign - 1) & ~(m_DirectAlign - 1)) : BufSize;
+  }
+
+  // Aligned read may stop at the end of device
+  if ( Start + ToRead > m_Size )
+    ToRead = (size_t)(m_Size - Start);
+
+  if ( NULL == m_pPrefetch )
+  {
+#ifdef UFSD_RWB_DIRECT
+    if ( 0 != m_DirectAlign )
+    {
+      if ( 0 != posix_memalign( &m_pPrefetch, m_DirectAlign, m_PrefetchSize ) )
+        m_pPrefetch = NULL;
+    }
+    else
+#endif
+      m_pPrefetch = malloc( m_PrefetchSize );
+    if ( NULL == m_pPrefetch )
+      return;
+  }
+
+  if ( NULL == m_pPrefetchIo && ERR_NOERROR != CreateAsyncIo( 1, &m_pPrefetchIo ) )
+  {
+    // Blocking fill would stall the caller, so kernel hints are used instead
+    m_pPrefetchIo    = NULL;
+    m_bPrefetchHints = true;
+    PrefetchHint( Offset, Bytes );
+    return;
+  }
+
+  m_PrefetchValid       = 0;
+  m_PrefetchReq.Offset  = Start;
+  m_PrefetchReq.Buffer  = m_pPrefetch;
+  m_PrefetchReq.Bytes   = ToRead;
+  m_PrefetchReq.Status  = ERR_NOERROR;
+  m_bPrefetchPending    = ERR_NOERROR == m_pPrefetchIo->Submit( &m_PrefetchReq );
+}
+
+
+#ifdef UFSD_RWB_DIRECT
+///////////////////////////////////////////////////////////
+// CUFSD_RWBlock::ReadBounced
+//
+// Reads aligned blocks that cover the range into m_pBounce
+// and copies the range from it
+///////////////////////////////////////////////////////////
+int
+CUFSD_RWBlock::ReadBounced(
+    IN UINT64         Offset,
+    IN void*          Buffer,
+    IN size_t         Bytes
+    )
+{
+  if ( NULL == m_pBounce && 0 != posix_memalign( &m_pBounce, m_DirectAlign, UFSD_RWB_BOUNCE_BUFFER ) )
+  {
+    m_pBounce = NULL;
+    return ERR_NOMEMORY;
+  }
+
+  while ( 0 != Bytes )
+  {
+    size_t Head   = (size_t)Offset & (m_DirectAlign - 1);
+    size_t ToRead = Head + Bytes < UFSD_RWB_BOUNCE_BUFFER? ((Head + Bytes + m_DirectAlign - 1) & ~(m_DirectAlign - 1)) : UFSD_RWB_BOUNCE_BUFFER;
+    size_t Part   = ToRead - Head < Bytes? ToRead - Head : Bytes;
+
+    UINT64 T0 = GetTimeUs();
+    ssize_t r = pread64( m_hFile, m_pBounce, ToRead, Offset - Head );
+    m_Stats.ReadTimeUs  += GetTimeUs() - T0;
+    m_Stats.Reads       += 1;
+    m_Stats.ReadBytes   += ToRead;
+    m_Stats.BounceReads += 1;
+    m_Stats.BounceBytes += Part;
+
+    // The last block of device may be read partially
+    if ( r < 0 )
+      return errno;
+    if ( (size_t)r < Head + Part )
+      return ERR_READFILE;
+
+    memcpy( Buffer, Add2Ptr( m_pBounce, Head ), Part );
+    Buffer  = Add2Ptr( Buffer, Part );
+    Offset += Part;
+    Bytes  -= Part;
+  }
+
+  return ERR_NOERROR;
+}
+#endif
+
+
+///////////////////////////////////////////////////////////
+// CUFSD_RWBlock::CreateAsyncIo
+//
+// Tries io_uring first (if allowed) then thread pool.
+// Queue must be destroyed before this object
+///////////////////////////////////////////////////////////
+int
+CUFSD_RWBlock::CreateAsyncIo(
+    IN  unsigned int          Depth,
+    OUT api::IDeviceAsyncIo** ppAsyncIo
+    )
+{
+  *ppAsyncIo = NULL;
+  if ( 0 == Depth )
+    return ERR_BADPARAMS;
+  if ( Depth > UFSD_RWB_ASYNC_MAX_DEPTH )
+    Depth = UFSD_RWB_ASYNC_MAX_DEPTH;
+
+#ifdef _WIN32
+  return ERR_NOTIMPLEMENTED;
+#else
+  int err = ERR_NOTIMPLEMENTED;
+
+#ifdef UFSD_RWB_IO_URING
+  if ( UFSD_RWB_ASYNC_THREADS != m_AsyncBackend )
+  {
+    CUringAsyncIo* Uring = new CUringAsyncIo( m_hFile, m_DirectAlign, &m_Stats );
+    if ( NULL == Uring )
+      return ERR_NOMEMORY;
+    err = Uring->Init( Depth );
+    if ( ERR_NOERROR == err )
+    {
+      *ppAsyncIo = Uring;
+      return ERR_NOERROR;
+    }
+    delete Uring;
+  }
+#endif
+
+  if ( UFSD_RWB_ASYNC_URING == m_AsyncBackend )
+    return err;
+
+  CThreadAsyncIo* Pool = new CThreadAsyncIo( m_hFile, m_DirectAlign, &m_Stats );
+  if ( NULL == Pool )
+    return ERR_NOMEMORY;
+  err = Pool->Init( Depth );
+  if ( ERR_NOERROR != err )
+  {
+    delete Pool;
+    return err;
+  }
+
+  *ppAsyncIo = Pool;
+  return ERR_NOERROR;
+#endif
+}
+
+
+///////////////////////////////////////////////////////////
+// CUFSD_RWBlock::IoControl
+//
+//
+///////////////////////////////////////////////////////////
+int
+CUFSD_RWBlock::IoControl(
+    IN  size_t          IoControlCode,
+    IN  const void*     InBuffer,
+    IN  size_t          InBuffSize,
+    OUT void*           OutBuffer,
+    IN  size_t          OutBuffSize,
+    OUT size_t*         BytesReturned
+    )
+{
+  switch( IoControlCode )
+  {
+  case UFSD_RWB_IOCTL_GET_STATS:
+    if ( NULL == OutBuffer || OutBuffSize < sizeof(m_Stats) )
+      return ERR_INSUFFICIENT_BUFFER;
+    memcpy( OutBuffer, &m_Stats, sizeof(m_Stats) );
+    if ( NULL != BytesReturned )
+      *BytesReturned = sizeof(m_Stats);
+    return ERR_NOERROR;
+
+  case UFSD_RWB_IOCTL_SET_PREFETCH_BUFFER:
+    if ( NULL == InBuffer || InBuffSize < sizeof(size_t) )
+      return ERR_BADPARAMS;
+    ReapPrefetch( true );
+    free( m_pPrefetch );
+    m_pPrefetch     = NULL;
+    m_PrefetchValid = 0;
+    m_PrefetchSize  = *(const size_t*)InBuffer;
+    return ERR_NOERROR;
+
+  case RWB_IOCTL_CREATE_ASYNC_IO:
+    if ( NULL == InBuffer || InBuffSize < sizeof(unsigned int) || NULL == OutBuffer || OutBuffSize < sizeof(api::IDeviceAsyncIo*) )
+      return ERR_BADPARAMS;
+    if ( NULL != BytesReturned )
+      *BytesReturned = sizeof(api::IDeviceAsyncIo*);
+    return CreateAsyncIo( *(const unsigned int*)InBuffer, (api::IDeviceAsyncIo**)OutBuffer );
+
+  case UFSD_RWB_IOCTL_SET_ASYNC_BACKEND:
+    if ( NULL == InBuffer || InBuffSize < sizeof(unsigned int) || *(const unsigned int*)InBuffer > UFSD_RWB_ASYNC_THREADS )
+      return ERR_BADPARAMS;
+    m_AsyncBackend = *(const unsigned int*)InBuffer;
+    return ERR_NOERROR;
+  }
+
+  return ERR_NOTIMPLEMENTED;
+}
+
+
 #ifndef UFSD_DRIVER_LINUX
 ///////////////////////////////////////////////////////////
 // UFSD_IOHandlerCreate
@@ -1057,7 +2081,8 @@ UFSD_IOHandlerCreate(
     OUT int*              fd,
     IN bool               bForceDismount,
     IN bool               bVerbose,
-    IN unsigned int       BytesPerSector
+    IN unsigned int       BytesPerSector,
+    IN bool               bDirect
    )
 {
   // Set the default return value
@@ -1069,7 +2094,7 @@ UFSD_IOHandlerCreate(
     return ERR_NOMEMORY;
 
   // Try to init
-  int err = rw->Init( szDevice, bForceDismount, bVerbose, fd, BytesPerSector );
+  int err = rw->Init( szDevice, bForceDismount, bVerbose, fd, BytesPerSector, bDirect );
 
   // Check error
   if ( !UFSD_SUCCESS( err ) )
@@ -66,6 +66,7 @@
 
   #include <assert.h>
   #include <unistd.h>
+  #include <pthread.h>
   #if defined __APPLE__
     #include <sys/sysctl.h>
   #elif defined __QNX__
@@ -117,8 +118,94 @@
   #define UFSDTrace(a)        ufsd_trace2 a
 #endif // #ifndef UFSDTrace
 
+//
+// Every thread has own cache in the pool of small blocks, so
+// allocations from the pool take no locks. The lock protects the list of caches
+// The key calls PoolThreadExit with the cache of every finished thread
+//
+#if defined _WIN32
+  #define POOL_THREAD       __declspec(thread)
+  typedef volatile LONG t_PoolLock;
+  #define POOL_LOCK( l )    while ( InterlockedExchange( &(l), 1 ) ) {}
+  #define POOL_UNLOCK( l )  InterlockedExchange( &(l), 0 )
+  #define POOL_LOAD_ACQUIRE( v )      (v)
+  #define POOL_STORE_RELEASE( v, x )  ((v) = (x))
+  typedef DWORD t_PoolKey;
+  #define POOL_KEY_CALLBACK           WINAPI
+  #define POOL_KEY_CREATE( k, f )     ( FLS_OUT_OF_INDEXES != ( (k) = FlsAlloc( f ) ) )
+  #define POOL_KEY_SET( k, v )        FlsSetValue( (k), (v) )
+  #define POOL_KEY_DELETE( k )        FlsFree( k )
+#else
+  #define POOL_THREAD       __thread
+  typedef volatile int t_PoolLock;
+  #define POOL_LOCK( l )    while ( __sync_lock_test_and_set( &(l), 1 ) ) {}
+  #define POOL_UNLOCK( l )  __sync_lock_release( &(l) )
+  #define POOL_LOAD_ACQUIRE( v )      __atomic_load_n( &(v), __ATOMIC_ACQUIRE )
+  #define POOL_STORE_RELEASE( v, x )  __atomic_store_n( &(v), (x), __ATOMIC_RELEASE )
+  typedef pthread_key_t t_PoolKey;
+  #define POOL_KEY_CALLBACK
+  #define POOL_KEY_CREATE( k, f )     ( 0 == pthread_key_create( &(k), (f) ) )
+  #define POOL_KEY_SET( k, v )        pthread_setspecific( (k), (v) )
+  #define POOL_KEY_DELETE( k )        pthread_key_delete( k )
+#endif
+
+//
+// Size classes of the pool of small blocks
+// 4096 is for block buffers
+//
+static const size_t s_PoolClassSize[UFSD_MEMPOOL_CLASSES] = {
+  16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096
+};
+
+#define POOL_LARGE_CLASS  ((size_t)-1)
+#define POOL_MAX_SIZE     4096
+
+//
+// Header of every block when the pool is on
+//
+struct PoolHdr{
+  size_t    Class;      // Index in s_PoolClassSize or POOL_LARGE_CLASS
+  size_t    Res[16/sizeof(size_t) - 1];
+};
+
+//
+// Cache of free blocks of one thread
+// Free blocks are linked through their first pointer
+//
+struct PoolCache{
+  PoolCache*  Next;         // Next cache in UFSD_MemoryManager::m_PoolCaches
+  bool        bFree;        // Thread has finished, cache is empty and may be taken by new thread
+  size_t      Retained;     // Bytes kept in Free lists
+  UINT64      LargeAllocs;
+  void*       Free[UFSD_MEMPOOL_CLASSES];
+  t_MemPoolClassStats Stats[UFSD_MEMPOOL_CLASSES];
+};
+
+static POOL_THREAD PoolCache* s_PoolCache;
+
+static void POOL_KEY_CALLBACK PoolThreadExit( void* Cache );
+
 struct UFSD_MemoryManager : public api::IBaseMemoryManager
 {
+    bool          m_bPool;            // Pool is on
+    volatile bool m_bUsed;            // Memory was allocated at least once, set under m_PoolLock
+    bool          m_bPoolKey;         // m_PoolKey is created
+    size_t        m_PoolMaxRetained;  // Max bytes kept by every thread
+    t_PoolLock    m_PoolLock;         // Protects m_PoolCaches, m_bUsed and turning on of m_bPool
+    t_PoolKey     m_PoolKey;          // Value is the cache of thread, released on thread exit
+    PoolCache*    m_PoolCaches;       // Caches of all threads
+    unsigned char m_PoolClass[POOL_MAX_SIZE / 16 + 1];  // Size class by (size + 15) / 16
+
+    void PoolInit();
+    PoolCache* GetPoolCache();
+    void PoolRelease( PoolCache* Cache );
+    void* RawAlloc( size_t size );
+    void RawFree( void* p );
+    void PoolTrim( PoolCache* Cache, size_t MaxRetained );
+    bool PoolSetup( size_t MaxRetained );
+    void PoolGetStats( t_MemPoolStats* Stats );
+    void PoolDestroy();
+
 #ifndef NDEBUG
     unsigned  m_MemsetCnt, m_MemcpyCnt, m_MemmoveCnt, m_MemcmpCnt,
               m_MallocCnt, m_FreeCnt;
@@ -134,7 +221,13 @@ struct UFSD_MemoryManager : public api::IBaseMemoryManager
 #endif
 
     UFSD_MemoryManager()
-      : m_MemsetCnt(0)
+      : m_bPool(false)
+      , m_bUsed(false)
+      , m_bPoolKey(false)
+      , m_PoolMaxRetained(0)
+      , m_PoolLock(0)
+      , m_PoolCaches(NULL)
+      , m_MemsetCnt(0)
       , m_MemcpyCnt(0)
       , m_MemmoveCnt(0)
       , m_MemcmpCnt(0)
@@ -145,6 +238,7 @@ struct UFSD_MemoryManager : public api::IBaseMemoryManager
       , m_UsedMem(0)
       , m_UsedMemMax(0)
     {
+      PoolInit();
 #ifdef USE_HEAP
       m_Heap = HeapCreate( HEAP_NO_SERIALIZE, 0, 0 );
 #else
@@ -201,12 +295,14 @@ struct UFSD_MemoryManager : public api::IBaseMemoryManager
           UFSDTrace(( "**** leak (seq=0x%x, size=0x%x) ***", (unsigned)h->cnt, (unsigned)h->size ));
           pos->remove();
 #ifndef USE_HEAP
-          free( h );
+          RawFree( h );
 #endif
         }
 #endif
       }
 
+      PoolDestroy();
+
 #ifdef USE_HEAP
       verify( HeapDestroy( m_Heap ) );
 #endif
@@ -226,6 +322,22 @@ struct UFSD_MemoryManager : public api::IBaseMemoryManager
       size_t    staff[2];
 #endif
     };
+#else
+    UFSD_MemoryManager()
+      : m_bPool(false)
+      , m_bUsed(false)
+      , m_bPoolKey(false)
+      , m_PoolMaxRetained(0)
+      , m_PoolLock(0)
+      , m_PoolCaches(NULL)
+    {
+      PoolInit();
+    }
+
+    ~UFSD_MemoryManager()
+    {
+      PoolDestroy();
+    }
 #endif //ifndef NDEBUG
 
     //=============================================
@@ -279,7 +391,7 @@ UFSD_MemoryManager::Malloc(
     )
 {
 #ifdef NDEBUG
-  void* p = ::malloc( size );
+  void* p = RawAlloc( size );
   if ( NULL != p && FlagOn( flags, BASE_MEMORY_FLAG_ZERO ) )
     memset( p, 0, size );
   return p;
@@ -304,7 +416,7 @@ UFSD_MemoryManager::Malloc(
 #ifdef USE_HEAP
   Hdr* hdr = (Hdr*)HeapAlloc( m_Heap, HEAP_NO_SERIALIZE, size + sizeof(Hdr) );
 #else
-  Hdr* hdr = (Hdr*)malloc( size + sizeof(Hdr) );
+  Hdr* hdr = (Hdr*)RawAlloc( size + sizeof(Hdr) );
 #endif
   if ( NULL == hdr )
   {
@@ -342,7 +454,7 @@ UFSD_MemoryManager::Free(
     )
 {
 #ifdef NDEBUG
-  ::free( p );
+  RawFree( p );
 #else
   if ( NULL == p )
     return;
@@ -364,7 +476,7 @@ UFSD_MemoryManager::Free(
 #ifdef USE_HEAP
   verify( HeapFree( m_Heap, HEAP_NO_SERIALIZE, hdr ) );
 #else
-  free( hdr );
+  RawFree( hdr );
 #endif
 
   m_UsedMem -= size;
@@ -373,9 +485,327 @@ UFSD_MemoryManager::Free(
 }
 
 
+///////////////////////////////////////////////////////////
+// UFSD_MemoryManager::PoolInit
+//
+//
+///////////////////////////////////////////////////////////
+void
+UFSD_MemoryManager::PoolInit()
+{
+  size_t Class = 0;
+  for ( size_t i = 0; i < ARRSIZE(m_PoolClass); i++ )
+  {
+    while ( s_PoolClassSize[Class] < i * 16 )
+      Class += 1;
+    m_PoolClass[i] = (unsigned char)Class;
+  }
+}
+
+
+///////////////////////////////////////////////////////////
+// UFSD_MemoryManager::GetPoolCache
+//
+// Returns cache of current thread. On the first call takes
+// the cache of finished thread or creates new one
+///////////////////////////////////////////////////////////
+PoolCache*
+UFSD_MemoryManager::GetPoolCache()
+{
+  PoolCache* Cache = s_PoolCache;
+  if ( NULL != Cache )
+    return Cache;
+
+  POOL_LOCK( m_PoolLock );
+  for ( Cache = m_PoolCaches; NULL != Cache && !Cache->bFree; Cache = Cache->Next )
+    ;
+  if ( NULL != Cache )
+    Cache->bFree = false;
+  POOL_UNLOCK( m_PoolLock );
+
+  if ( NULL == Cache )
+  {
+    Cache = (PoolCache*)::calloc( 1, sizeof(PoolCache) );
+    if ( NULL == Cache )
+      return NULL;
+
+    for ( size_t i = 0; i < UFSD_MEMPOOL_CLASSES; i++ )
+      Cache->Stats[i].Size = s_PoolClassSize[i];
+
+    POOL_LOCK( m_PoolLock );
+    Cache->Next  = m_PoolCaches;
+    m_PoolCaches = Cache;
+    POOL_UNLOCK( m_PoolLock );
+  }
+
+  //If the key can't keep the cache, it stays with this thread till PoolDestroy
+  POOL_KEY_SET( m_PoolKey, Cache );
+  s_PoolCache = Cache;
+  return Cache;
+}
+
+
+///////////////////////////////////////////////////////////
+// UFSD_MemoryManager::PoolRelease
+//
+// Called on exit of thread: returns its free blocks to heap
+// Statistics are kept, the cache is given to the next new thread
+///////////////////////////////////////////////////////////
+void
+UFSD_MemoryManager::PoolRelease(
+    IN PoolCache* Cache
+    )
+{
+  PoolTrim( Cache, 0 );
+
+  POOL_LOCK( m_PoolLock );
+  Cache->bFree = true;
+  POOL_UNLOCK( m_PoolLock );
+
+  //Frees in destructors of later keys of this thread get new cache
+  if ( s_PoolCache == Cache )
+    s_PoolCache = NULL;
+}
+
+
+///////////////////////////////////////////////////////////
+// UFSD_MemoryManager::RawAlloc
+//
+// Allocates from the pool if it is on, else from heap
+///////////////////////////////////////////////////////////
+void*
+UFSD_MemoryManager::RawAlloc(
+    IN size_t size
+    )
+{
+  if ( !POOL_LOAD_ACQUIRE( m_bUsed ) )
+  {
+    //Pairs with PoolSetup: the pool is either on before the first block, or never
+    POOL_LOCK( m_PoolLock );
+    POOL_STORE_RELEASE( m_bUsed, true );
+    POOL_UNLOCK( m_PoolLock );
+  }
+
+  if ( !m_bPool )
+    return ::malloc( size );
+
+  PoolCache* Cache = GetPoolCache();
+  size_t Class;
+
+  if ( size > POOL_MAX_SIZE || NULL == Cache )
+  {
+    if ( NULL != Cache )
+      Cache->LargeAllocs += 1;
+    Class = POOL_LARGE_CLASS;
+  }
+  else
+  {
+    Class = m_PoolClass[(size + 15) / 16];
+    size  = s_PoolClassSize[Class];
+
+    t_MemPoolClassStats* Stats = &Cache->Stats[Class];
+    void* p = Cache->Free[Class];
+    Stats->Allocs += 1;
+
+    if ( NULL != p )
+    {
+      Cache->Free[Class] = *(void**)p;
+      Cache->Retained   -= size;
+      Stats->Retained   -= 1;
+      Stats->Hits       += 1;
+      return p;
+    }
+  }
+
+  PoolHdr* hdr = (PoolHdr*)::malloc( size + sizeof(PoolHdr) );
+  if ( NULL == hdr )
+    return NULL;
+  hdr->Class = Class;
+  return hdr + 1;
+}
+
+
+///////////////////////////////////////////////////////////
+// UFSD_MemoryManager::RawFree
+//
+// Returns block to the cache of current thread if it is not full
+///////////////////////////////////////////////////////////
+void
+UFSD_MemoryManager::RawFree(
+    IN void* p
+    )
+{
+  if ( !m_bPool || NULL == p )
+  {
+    ::free( p );
+    return;
+  }
+
+  PoolHdr* hdr  = (PoolHdr*)p - 1;
+  size_t Class  = hdr->Class;
+
+  if ( POOL_LARGE_CLASS != Class )
+  {
+    assert( Class < UFSD_MEMPOOL_CLASSES );
+    PoolCache* Cache = GetPoolCache();
+
+    if ( NULL != Cache )
+    {
+      t_MemPoolClassStats* Stats = &Cache->Stats[Class];
+      Stats->Frees += 1;
+
+      if ( Cache->Retained + Stats->Size <= m_PoolMaxRetained )
+      {
+        *(void**)p          = Cache->Free[Class];
+        Cache->Free[Class]  = p;
+        Cache->Retained    += Stats->Size;
+        Stats->Retained    += 1;
+        return;
+      }
+    }
+  }
+
+  ::free( hdr );
+}
+
+
+///////////////////////////////////////////////////////////
+// UFSD_MemoryManager::PoolTrim
+//
+// Frees blocks from the cache until it keeps no more than MaxRetained bytes
+///////////////////////////////////////////////////////////
+void
+UFSD_MemoryManager::PoolTrim(
+    IN PoolCache* Cache,
+    IN size_t     MaxRetained
+    )
+{
+  //Free the biggest blocks first
+  for ( size_t i = UFSD_MEMPOOL_CLASSES; i-- != 0 && Cache->Retained > MaxRetained; )
+  {
+    t_MemPoolClassStats* Stats = &Cache->Stats[i];
+    while ( NULL != Cache->Free[i] && Cache->Retained > MaxRetained )
+    {
+      void* p = Cache->Free[i];
+      Cache->Free[i]   = *(void**)p;
+      Cache->Retained -= Stats->Size;
+      Stats->Retained -= 1;
+      ::free( (PoolHdr*)p - 1 );
+    }
+  }
+}
+
+
+///////////////////////////////////////////////////////////
+// UFSD_MemoryManager::PoolSetup
+//
+// Caches of other threads are not trimmed, they just stop growing
+///////////////////////////////////////////////////////////
+bool
+UFSD_MemoryManager::PoolSetup(
+    IN size_t MaxRetained
+    )
+{
+  if ( !m_bPool )
+  {
+    if ( 0 == MaxRetained )
+      return true;
+
+    POOL_LOCK( m_PoolLock );
+    //Blocks allocated before have no PoolHdr
+    bool bUsed = m_bUsed;
+    if ( !bUsed && !m_bPoolKey )
+      m_bPoolKey = POOL_KEY_CREATE( m_PoolKey, PoolThreadExit );
+    if ( !bUsed && m_bPoolKey )
+      m_bPool = true;
+    POOL_UNLOCK( m_PoolLock );
+
+    if ( !m_bPool )
+      return false;
+  }
+
+  m_PoolMaxRetained = MaxRetained;
+  if ( NULL != s_PoolCache )
+    PoolTrim( s_PoolCache, MaxRetained );
+  return true;
+}
+
+
+///////////////////////////////////////////////////////////
+// UFSD_MemoryManager::PoolGetStats
+//
+// Sums statistics of all threads. Other threads may change them meanwhile
+///////////////////////////////////////////////////////////
+void
+UFSD_MemoryManager::PoolGetStats(
+    OUT t_MemPoolStats* Stats
+    )
+{
+  memset( Stats, 0, sizeof(t_MemPoolStats) );
+  Stats->MaxRetained = m_PoolMaxRetained;
+  for ( size_t i = 0; i < UFSD_MEMPOOL_CLASSES; i++ )
+    Stats->Classes[i].Size = s_PoolClassSize[i];
+
+  POOL_LOCK( m_PoolLock );
+  for ( const PoolCache* Cache = m_PoolCaches; NULL != Cache; Cache = Cache->Next )
+  {
+    Stats->Retained    += Cache->Retained;
+    Stats->LargeAllocs += Cache->LargeAllocs;
+    for ( size_t i = 0; i < UFSD_MEMPOOL_CLASSES; i++ )
+    {
+      Stats->Classes[i].Allocs   += Cache->Stats[i].Allocs;
+      Stats->Classes[i].Hits     += Cache->Stats[i].Hits;
+      Stats->Classes[i].Frees    += Cache->Stats[i].Frees;
+      Stats->Classes[i].Retained += Cache->Stats[i].Retained;
+    }
+  }
+  POOL_UNLOCK( m_PoolLock );
+}
+
+
+///////////////////////////////////////////////////////////
+// UFSD_MemoryManager::PoolDestroy
+//
+// Frees caches of all threads, including finished ones
+///////////////////////////////////////////////////////////
+void
+UFSD_MemoryManager::PoolDestroy()
+{
+  if ( m_bPoolKey )
+  {
+    POOL_KEY_DELETE( m_PoolKey );
+    m_bPoolKey = false;
+  }
+
+  while ( NULL != m_PoolCaches )
+  {
+    PoolCache* Cache = m_PoolCaches;
+    m_PoolCaches = Cache->Next;
+    PoolTrim( Cache, 0 );
+    ::free( Cache );
+  }
+  s_PoolCache = NULL;
+}
+
+
 // The only memory manager
 static UFSD_MemoryManager s_MemMngr;
 
+
+///////////////////////////////////////////////////////////
+// PoolThreadExit
+//
+// Destructor of UFSD_MemoryManager::m_PoolKey
+///////////////////////////////////////////////////////////
+static void POOL_KEY_CALLBACK
+PoolThreadExit(
+    IN void* Cache
+    )
+{
+  if ( NULL != Cache )
+    s_MemMngr.PoolRelease( (PoolCache*)Cache );
+}
+
 #ifdef STATIC_MEMORY_MANAGER
 
 api::IBaseMemoryManager* api::StaticMemBased::m_Mm = &s_MemMngr;
@@ -516,6 +946,34 @@ UFSD_GetMemoryManager()
 }
 
 
+///////////////////////////////////////////////////////////
+// UFSD_MemoryPoolSetup
+//
+// Turns on the pool of small blocks or changes its size
+///////////////////////////////////////////////////////////
+bool
+UFSD_MemoryPoolSetup(
+    IN size_t MaxRetained
+    )
+{
+  return s_MemMngr.PoolSetup( MaxRetained );
+}
+
+
+///////////////////////////////////////////////////////////
+// UFSD_MemoryPoolGetStats
+//
+//
+///////////////////////////////////////////////////////////
+void
+UFSD_MemoryPoolGetStats(
+    OUT t_MemPoolStats* Stats
+    )
+{
+  s_MemMngr.PoolGetStats( Stats );
+}
+
+
 #if !defined _WIN32 && !defined __APPLE__
 ///////////////////////////////////////////////////////////
 // operator 'new'
@@ -40,6 +40,24 @@ public:
   virtual int       SetKey(const void* Key, unsigned int KeyLen) = 0;
   virtual int       Encrypt(const void* InBuff, unsigned int InSize, void* OutBuff, unsigned int* OutSize = NULL, void* IV = NULL) = 0;
   virtual int       Decrypt(const void* InBuff, unsigned int InSize, void* OutBuff, unsigned int* OutSize = NULL, void* IV = NULL) = 0;
+
+  // Decrypts 'Units' contiguous data units of 'UnitSize' bytes each.
+  // The tweak of the unit 'i' is (StartTweak + i) in little endian form (AES-XTS sectors)
+  // Providers are expected to override it with a version that does not reinitialize per unit
+  virtual int       DecryptUnits(const void* InBuff, void* OutBuff, unsigned int UnitSize, size_t Units, UINT64 StartTweak)
+  {
+    for ( size_t i = 0; i < Units; ++i, ++StartTweak )
+    {
+      unsigned char iv[16] = { 0 };
+      for ( unsigned int j = 0; j < sizeof(UINT64); ++j )
+        iv[j] = (unsigned char)(StartTweak >> (8 * j));
+
+      int Status = Decrypt( (const char*)InBuff + i * UnitSize, UnitSize, (char*)OutBuff + i * UnitSize, NULL, iv );
+      if ( 0 != Status )
+        return Status;
+    }
+    return 0;
+  }
 };
 
 class BASE_ABSTRACT_CLASS ICipherFactory
@@ -90,6 +90,46 @@ struct BASE_ABSTRACT_CLASS IDeviceRWBlock
 };
 
 
+//
+// Asynchronous reads
+// IDeviceAsyncIo is created by IoControl( RWB_IOCTL_CREATE_ASYNC_IO, &QueueDepth, sizeof(unsigned int), &pAsyncIo, sizeof(pAsyncIo) )
+// Every queue is used by one thread at a time. Buffers of queued requests must live until they are reaped
+//
+#define RWB_IOCTL_CREATE_ASYNC_IO       0x52570003
+
+struct t_RWBlockAsyncRequest
+{
+    UINT64          Offset;
+    void*           Buffer;
+    size_t          Bytes;
+    int             Status;     // Set when request is reaped: ERR_NOERROR or error code
+};
+
+
+////////////////////////////////////////////////////////////////
+struct BASE_ABSTRACT_CLASS IDeviceAsyncIo
+{
+    // Max number of requests in flight
+    virtual unsigned int GetQueueDepth() const = 0;
+
+    // Starts read of request. Returns error if request is not queued
+    virtual int Submit(
+        IN t_RWBlockAsyncRequest* Request
+        ) = 0;
+
+    // Waits for at least MinCount completed requests and returns up to MaxCount of them
+    virtual int Reap(
+        OUT t_RWBlockAsyncRequest** Completed,
+        IN  size_t                  MaxCount,
+        IN  size_t                  MinCount,
+        OUT size_t*                 Count
+        ) = 0;
+
+    // Waits for requests in flight and frees queue
+    virtual void Destroy() = 0;
+};
+
+
 #define RWB_DEVTYPE_FILE            1
 #define RWB_DEVTYPE_CONTAINER       2
 #define RWB_DEVTYPE_DEVICE          3//native
@@ -83,6 +83,12 @@ enum SEEKOrig {
 };
 
 
+//Replacement policies of metadata blocks cache (PreInitParams::BlockCachePolicy)
+#define UFSD_BLOCK_CACHE_LRU    0   //  Least recently used block is evicted
+#define UFSD_BLOCK_CACHE_2Q     1   //  Blocks are hot only if reread after eviction from the cold queue (2Q)
+#define UFSD_BLOCK_CACHE_ARC    2   //  Adaptive replacement cache (ARC)
+
+
 //struct for PreInit function
 struct PreInitParams
 {
@@ -91,6 +97,20 @@ struct PreInitParams
   char**                  PwdList;               //Pointer to passwords array. All passwords is NULL-terminated
   unsigned int            PwdSize;               //Number of passwords
   UINT64                  CheckpointsAgo;        //We will try init fs from CurrentCheckpoint - CheckpountsAgo
+  size_t                  LocationCacheSize;     //Bytes for object location cache of every volume (0 - default size)
+  size_t                  ChunkCacheSize;        //Bytes for decompressed chunks cache (0 - default size)
+  unsigned int            InodeCacheLimit;       //Max number of released inodes kept in memory (0 - default number)
+  size_t                  DentryCacheSize;       //Bytes for directory lookups cache of every volume (0 - default size)
+  size_t                  BlockCacheSize;        //Bytes for metadata blocks cache (0 - default size)
+  unsigned int            BlockCachePolicy;      //Replacement policy for metadata blocks cache UFSD_BLOCK_CACHE_XXX (0 - LRU)
+  unsigned int            TreePinLevels;         //Number of upper levels of fs and omap trees kept in memory, root included (0 - not limited if TreePinBytes is set)
+  size_t                  TreePinBytes;          //Bytes for upper levels of trees kept in memory (0 - not limited if TreePinLevels is set)
+  size_t                  ExtentMapSize;         //Bytes for extent maps of randomly read files (0 - default size)
+  size_t                  MaxIoSize;             //Max bytes of one data read merged from adjacent extents (0 - default size)
+  size_t                  ReadAheadMin;          //Bytes of first read-ahead window of sequentially read files (0 - default size)
+  size_t                  ReadAheadMax;          //Max bytes of read-ahead window (0 - default size, less than ReadAheadMin - no read-ahead)
+  size_t                  ReadAheadSize;         //Max bytes of read-ahead buffers of all open files (0 - default size)
+  unsigned int            IoQueueDepth;          //Max number of file data reads in flight (0 - default number, 1 - synchronous reads)
 };
 
 
@@ -234,6 +234,13 @@ enum UFSD_IOCONTROL{
   IOCTL_GET_INODES_COUNT          = 513,
   IOCTL_GET_APFS_INFO             = 514,
 
+  //
+  // Misc UnixFs operations
+  //
+  IOCTL_GET_BLOCK_CACHE_STATS     = 520,
+  IOCTL_SET_BLOCK_CACHE_SIZE      = 521,
+  IOCTL_GET_INODE_RECORDS         = 522,
+
   // Some compilers can use BYTE or WORD for enumerators
   // depending on enumerator values
   IOCTL_PLACEHOLDER           = 0xFFFFFFFFu
@@ -2053,6 +2060,68 @@ struct UFSD_UNIXFS_INODES_COUNT
 };
 
 
+//===================================================================
+//
+// IOCTL_GET_BLOCK_CACHE_STATS
+//
+// input  - none
+//
+// output - struct UFSD_BLOCK_CACHE_STATS
+//
+// This function returns the usage of metadata blocks cache
+//
+
+struct UFSD_BLOCK_CACHE_STATS
+{
+  UINT64  CacheSize;      // Max bytes of cached blocks
+  UINT64  UsedBytes;      // Bytes of cached blocks (opened and closed)
+  UINT64  ClosedBlocks;   // Number of closed blocks which may be evicted
+  UINT64  Hits;           // Number of requests found in cache
+  UINT64  Misses;         // Number of requests read from disk
+  UINT64  Evictions;      // Number of blocks dropped to fit CacheSize
+};
+
+
+//===================================================================
+//
+// IOCTL_SET_BLOCK_CACHE_SIZE
+//
+// input  - pointer to UINT64 (new max bytes of cached blocks, 0 - default size)
+//
+// output - struct UFSD_BLOCK_CACHE_STATS (optional)
+//
+// NOTE: closed blocks above the new size are dropped at once
+//
+
+
+//===================================================================
+//
+// IOCTL_GET_INODE_RECORDS
+//
+// input  - array of UINT64 (FileInfo::Id of objects, e.g. found with UFSD_ENUM_NAME_ID_ATTR_ONLY)
+//
+// output - array of struct UFSD_INODE_RECORD, one entry for each input Id
+//
+// This function reads inode records of many objects in one ordered pass over
+// the file system tree instead of one tree search per object
+//
+
+struct UFSD_INODE_RECORD
+{
+  UINT64        Id;           // Id from input or 0 if there is no inode record for it
+  UINT64        ParentId;     // Id of parent folder
+  UINT64        FileSize;     // Bytes of data stream (size of compressed file if it is kept in inode)
+  UINT64        CrTime;       // Times in the same units as in FileInfo
+  UINT64        ModiffTime;
+  UINT64        ChangeTime;
+  UINT64        ReffTime;
+  unsigned int  Mode;
+  unsigned int  Uid;
+  unsigned int  Gid;
+  unsigned int  Links;        // Number of hard links (number of entries for folder)
+};
+
+
 //===================================================================
 //
 // IOCTL_CREATE_USN_JOURNAL
@@ -221,6 +221,110 @@ int CApfsFileSystem::ReInit(
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+//Fills UFSD_INODE_RECORD by inode record of volume VolId
+static void FillInodeRecord(
+  IN  UINT64              Id,
+  IN  unsigned char       VolId,
+  IN  const apfs_inode*   pInode,
+  OUT UFSD_INODE_RECORD*  Record
+  )
+{
+  Record->Id       = Id;
+  Record->ParentId = APFS_MAKE_INODE_ID(VolId, pInode->ai_parent_id);
+  Record->Mode     = pInode->ai_mode;
+  Record->Uid      = pInode->ai_uid;
+  Record->Gid      = pInode->ai_gid;
+  Record->Links    = pInode->ai_nlinks;
+#ifdef UFSD_DRIVER_LINUX
+  Record->CrTime     = CUnixSuperBlock::TimeUnixToPosixNs(pInode->ai_crtime);
+  Record->ReffTime   = CUnixSuperBlock::TimeUnixToPosixNs(pInode->ai_atime);
+  Record->ModiffTime = CUnixSuperBlock::TimeUnixToPosixNs(pInode->ai_mtime);
+  Record->ChangeTime = CUnixSuperBlock::TimeUnixToPosixNs(pInode->ai_ctime);
+#else
+  Record->CrTime     = CUnixSuperBlock::TimeUnixToUFSDNs(pInode->ai_crtime);
+  Record->ReffTime   = CUnixSuperBlock::TimeUnixToUFSDNs(pInode->ai_atime);
+  Record->ModiffTime = CUnixSuperBlock::TimeUnixToUFSDNs(pInode->ai_mtime);
+  Record->ChangeTime = CUnixSuperBlock::TimeUnixToUFSDNs(pInode->ai_ctime);
+#endif
+
+  //Size of data stream is kept in inode field
+  const void* pField = Add2Ptr(&pInode->field[0], pInode->ai_number_of_fields * sizeof(apfs_inode_field));
+  for (unsigned short i = 0; i < pInode->ai_number_of_fields; i++)
+  {
+    if (pInode->field[i].if_ftype == INODE_FTYPE_SIZE)
+      Record->FileSize = CPU2LE(reinterpret_cast<const apfs_data_size*>(pField)->ds_bytes);
+    pField = Add2Ptr(pField, QuadAlign(CPU2LE(pInode->field[i].if_size)));
+  }
+
+  if (FlagOn(pInode->ai_fs_flags, FS_UFLAG_COMPRESSED) && FlagOn(pInode->ai_fs_flags, FS_IFLAG_FILESIZE))
+    Record->FileSize = pInode->ai_file_size;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+int CApfsFileSystem::OnGetInodeRecords()
+{
+  size_t Count = m_IO.InBufferSize / sizeof(UINT64);
+  if (Count == 0 || m_IO.InBuffer == NULL)
+    return ERR_BADPARAMS;
+
+  if (m_IO.OutBuffer == NULL || m_IO.OutBufferSize < Count * sizeof(UFSD_INODE_RECORD))
+    return ERR_INSUFFICIENT_BUFFER;
+
+  const UINT64* Ids = static_cast<const UINT64*>(m_IO.InBuffer);
+  UFSD_INODE_RECORD* Records = static_cast<UFSD_INODE_RECORD*>(m_IO.OutBuffer);
+  Memzero2(Records, Count * sizeof(UFSD_INODE_RECORD));
+
+  //Inode ids of one volume, their positions in Ids and the found records in one buffer
+  UINT64* VolIds = reinterpret_cast<UINT64*>(Malloc2(Count * (sizeof(UINT64) + sizeof(size_t) + sizeof(apfs_inode*))));
+  CHECK_PTR(VolIds);
+  size_t* Pos = reinterpret_cast<size_t*>(VolIds + Count);
+  apfs_inode** ppRecords = reinterpret_cast<apfs_inode**>(Pos + Count);
+  int Status = ERR_NOERROR;
+
+  for (unsigned char v = 0; v < m_pApfsSuper->GetMountedVolumesCount() && UFSD_SUCCESS(Status); v++)
+  {
+    CApfsVolumeSb* pVol = m_pApfsSuper->GetVolume(v);
+    if (!pVol->CanDecrypt())
+      continue;
+
+    size_t n = 0;
+    for (size_t i = 0; i < Count; i++)
+    {
+      if (APFS_GET_TREE_ID(Ids[i]) != v)
+        continue;
+      //Root of not 0th volume is shown in APFS_VOLUMES_DIR_NAME (see CApfsSuperBlock::GetInode)
+      VolIds[n] = APFS_GET_INODE_ID(Ids[i]) == APFS_VOLUMES_DIR_ID ? APFS_ROOT_INO : APFS_GET_INODE_ID(Ids[i]);
+      Pos[n++] = i;
+    }
+
+    if (n == 0)
+      continue;
+
+    Status = pVol->GetInodeRecords(VolIds, n, ppRecords);
+    if (!UFSD_SUCCESS(Status))
+      break;
+
+    for (size_t j = 0; j < n; j++)
+    {
+      if (ppRecords[j] == NULL)
+        continue;
+      if (Ids[Pos[j]] != APFS_VOLUMES_DIR_ID)
+        FillInodeRecord(Ids[Pos[j]], v, ppRecords[j], Records + Pos[j]);
+      Free2(ppRecords[j]);
+    }
+  }
+
+  Free2(VolIds);
+
+  if (UFSD_SUCCESS(Status) && m_IO.BytesReturned)
+    *m_IO.BytesReturned = Count * sizeof(UFSD_INODE_RECORD);
+
+  return Status;
+}
+
+
 #ifdef UFSD_APFS_RO
 /////////////////////////////////////////////////////////////////////////////
 int CApfsFileSystem::SetVolumeInfo(
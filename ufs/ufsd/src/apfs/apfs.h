@@ -101,6 +101,9 @@ private:
 
 public:
   virtual size_t GetFsType() const { return FS_APFS; }
+
+  // Handler for IOCTL_GET_INODE_RECORDS
+  virtual int OnGetInodeRecords();
   virtual void GetFsVersion(unsigned char* /*Major*/, unsigned char* /*Minor*/) const {}
 
   virtual unsigned char* GetVolumeSerial(OUT size_t* Bytes) const
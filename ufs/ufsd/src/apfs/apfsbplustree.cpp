@@ -39,6 +39,7 @@ static const char s_pFileName[] = __FILE__ ",$Revision: 331828 $";
 #include "apfs.h"  // m_Sb
 #include "apfstable.h"
 #include "apfsbplustree.h"
+#include "apfsloccache.h"
 #ifdef BASE_BIGENDIAN
 #include "apfsbe.h"
 #endif
@@ -59,7 +60,7 @@ CApfsTreeNode::CApfsTreeNode(CApfsTree* pTree, CApfsTree* pLocationTree, bool bE
   , m_Pos(0)
   , m_bEnumerator(bEnumerator)
 {
-  m_pTable = new(m_Mm) CApfsTable(m_pTree);
+  m_pTable = m_pOwnTable = new(m_Mm) CApfsTable(m_pTree);
   assert(m_pTable);
 }
 
@@ -67,7 +68,7 @@ CApfsTreeNode::CApfsTreeNode(CApfsTree* pTree, CApfsTree* pLocationTree, bool bE
 /////////////////////////////////////////////////////////////////////////////
 CApfsTreeNode::~CApfsTreeNode()
 {
-  delete m_pTable;
+  delete m_pOwnTable;
   delete m_pChild;
 }
 
@@ -76,52 +77,91 @@ CApfsTreeNode::~CApfsTreeNode()
 int
 CApfsTreeNode::Init(CApfsTreeNode *Parent, unsigned int Pos)
 {
-  CHECK_PTR(m_pTable);
+  CHECK_PTR(m_pOwnTable);
   if (!Parent || Pos >= Parent->Count())
     return ERR_BADPARAMS;
 
   m_Parent = Parent;
   m_Pos = Pos;
+  m_pTable = m_pOwnTable;
   UINT64 *ObjectId = NULL;
   CHECK_CALL(m_Parent->GetItem(Pos, NULL, reinterpret_cast<void**>(&ObjectId)));
 
+#ifdef UFSD_APFS_RO
+  //Tables of upper levels are loaded once and shared by all nodes of the tree
+  if (m_pTree->IsPinnedLevel(Parent->Depth() - 1))
+  {
+    CApfsTable* pTable = m_pTree->FindPinnedTable(*ObjectId);
+    if (pTable != NULL)
+    {
+      ++m_pTable->GetSuper()->m_TreePinHits;
+      m_pTable = pTable;
+      return ERR_NOERROR;
+    }
+
+    if (m_pTable->GetSuper()->ReserveTreePin())
+    {
+      CHECK_PTR(pTable = new(m_Mm) CApfsTable(m_pTree));
+
+      UINT64 Id = *ObjectId;
+      int Status = LoadTable(pTable, Id);
+      if (!UFSD_SUCCESS(Status))
+      {
+        m_pTable->GetSuper()->ReleaseTreePin();
+        delete pTable;
+        return Status;
+      }
+
+      m_pTree->PinTable(pTable, Id);
+      m_pTable = pTable;
+      return ERR_NOERROR;
+    }
+  }
+#endif
+
+  CHECK_CALL(LoadTable(m_pTable, *ObjectId));
+
+  //Store table buffer only for nodes of location tree and for root node (because they are not copied on tree enumerator creation)
+  //For other nodes unload table buffer and load it from cache or from disk if necessary
+  if (NeedUnloadBuffer())
+    CHECK_CALL(m_pTable->UnloadBuffer());
+
+  return ERR_NOERROR;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+int
+CApfsTreeNode::LoadTable(CApfsTable* pTable, UINT64 ObjectId) const
+{
   if (!IsLocationTree())
   {
     //Search block number for underlying table in location tree
     apfs_location_table_data CurLocation;
     Memzero2( &CurLocation, sizeof( apfs_location_table_data ) );
-    CHECK_CALL(m_pLocationTree->GetActualLocation(CPU2LE(*ObjectId), NULL, &CurLocation));
+    CHECK_CALL(m_pLocationTree->GetActualLocation(CPU2LE(ObjectId), NULL, &CurLocation));
 
     if ( CurLocation.ltd_block == 0 )
       return ERR_NOTFOUND;
 
     //Init table with found block
-    CHECK_CALL(m_pTable->Init(CurLocation.ltd_block, Parent->m_pTable->GetVolumeIndex(), Parent->m_pTable->MayBeEncrypted()));
+    return pTable->Init(CurLocation.ltd_block, m_Parent->m_pTable->GetVolumeIndex(), m_Parent->m_pTable->MayBeEncrypted());
   }
-  else
+
+  UINT64 BlockNumber;
+  if (m_Parent->m_pTable->GetContentType() == APFS_CONTENT_HISTORY)
   {
-    UINT64 BlockNumber;
-    if (m_Parent->m_pTable->GetContentType() == APFS_CONTENT_HISTORY)
+    unsigned int TreeBlockSize = 0;
+    CHECK_CALL(pTable->GetSuper()->GetMetaLocationBlock(ObjectId, APFS_TYPE_NODE_BLOCK, &BlockNumber, &TreeBlockSize));    //using superblock map to find block number
+    if (TreeBlockSize != pTable->GetSuper()->GetBlockSize())
     {
-      unsigned int TreeBlockSize = 0;
-      CHECK_CALL(m_pTable->GetSuper()->GetMetaLocationBlock(*ObjectId, APFS_TYPE_NODE_BLOCK, &BlockNumber, &TreeBlockSize));    //using superblock map to find block number
-      if (TreeBlockSize != m_pTable->GetSuper()->GetBlockSize())
-      {
-        ULOG_ERROR((GetLog(), ERR_NOTIMPLEMENTED, "Block sizes for tree(%x) and for superblock (%x) are different", TreeBlockSize, m_pTable->GetSuper()->GetBlockSize()));
-        return ERR_NOTIMPLEMENTED;
-      }
+      ULOG_ERROR((GetLog(), ERR_NOTIMPLEMENTED, "Block sizes for tree(%x) and for superblock (%x) are different", TreeBlockSize, pTable->GetSuper()->GetBlockSize()));
+      return ERR_NOTIMPLEMENTED;
     }
-    else
-      BlockNumber = CPU2LE(*ObjectId);
-    CHECK_CALL(m_pTable->Init(BlockNumber, Parent->m_pTable->GetVolumeIndex(), Parent->m_pTable->MayBeEncrypted()));
   }
-
-  //Store table buffer only for nodes of location tree and for root node (because they are not copied on tree enumerator creation)
-  //For other nodes unload table buffer and load it from cache or from disk if necessary
-  if (NeedUnloadBuffer())
-    CHECK_CALL(m_pTable->UnloadBuffer());
-
-  return ERR_NOERROR;
+  else
+    BlockNumber = CPU2LE(ObjectId);
+  return pTable->Init(BlockNumber, m_Parent->m_pTable->GetVolumeIndex(), m_Parent->m_pTable->MayBeEncrypted());
 }
 
 
@@ -129,8 +169,8 @@ CApfsTreeNode::Init(CApfsTreeNode *Parent, unsigned int Pos)
 int
 CApfsTreeNode::ReInit(CApfsTreeNode* Parent, unsigned int Pos)
 {
-  if (m_pTable->IsBufferLoaded())
-    CHECK_CALL(m_pTable->UnloadBuffer());
+  if (m_pOwnTable->IsBufferLoaded())
+    CHECK_CALL(m_pOwnTable->UnloadBuffer());
   return Init(Parent, Pos);
 }
 
@@ -429,8 +469,10 @@ CApfsTree::CApfsTree(CApfsSuperBlock* sb)
   : CApfsTreeInternal(sb)
   , m_pRootDesc(NULL)
   , m_pDefaultEnum(NULL)
+  , m_pLocationCache(NULL)
 {
   m_EnumsList.init();
+  m_PinnedList.init();
 }
 
 
@@ -443,6 +485,17 @@ CApfsTree::~CApfsTree()
   Free2(m_pRootDesc);
   delete m_pDefaultEnum;
   assert(m_EnumsList.is_empty());              //All enums for this tree is destroyed
+
+  //Nodes of enumerators refer to pinned tables, so free them after all enumerators
+  while (!m_PinnedList.is_empty())
+  {
+    CApfsTable* pTable = list_entry(m_PinnedList.next, CApfsTable, m_PinListEntry);
+    pTable->m_PinListEntry.remove();
+#ifdef UFSD_APFS_RO
+    m_pSuper->ReleaseTreePin();
+#endif
+    delete pTable;
+  }
 }
 
 
@@ -466,6 +519,10 @@ CApfsTree::Init(UINT64 BlockNumber, unsigned char VolIndex, bool bHasRootDesc, C
     BlockNumber = m_pRootDesc->btree_root;
   }
 
+  //Pinned tables of the old root can't be found anymore. They are freed with the tree because enumerators may still refer to them
+  if (m_pRootNode != NULL && GetRootTable()->GetBlockNumber() != BlockNumber)
+    m_PinnedTables.init();
+
   CHECK_CALL(CApfsTreeInternal::Init(BlockNumber, VolIndex, pLocationTree, this, bMayBeEncrypted));
 
   if (m_pDefaultEnum == NULL)
@@ -476,6 +533,27 @@ CApfsTree::Init(UINT64 BlockNumber, unsigned char VolIndex, bool bHasRootDesc, C
 }
 
 
+#ifdef UFSD_APFS_RO
+/////////////////////////////////////////////////////////////////////////////
+CApfsTable*
+CApfsTree::FindPinnedTable(UINT64 ObjectId) const
+{
+  avl_link* n = avl_lookup(&m_PinnedTables, ObjectId);
+  return n ? avl_entry(n, CApfsTable, m_PinTreeEntry) : NULL;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void
+CApfsTree::PinTable(CApfsTable* pTable, UINT64 ObjectId)
+{
+  pTable->m_PinTreeEntry.key = ObjectId;
+  avl_insert(&m_PinnedTables, &pTable->m_PinTreeEntry);
+  pTable->m_PinListEntry.insert_before(&m_PinnedList);
+}
+#endif
+
+
 /////////////////////////////////////////////////////////////////////////////
 int
 CApfsTree::GetActualLocation(UINT64 Id, apfs_location_table_key* Key, apfs_location_table_data* Data) const
@@ -485,8 +563,14 @@ CApfsTree::GetActualLocation(UINT64 Id, apfs_location_table_key* Key, apfs_locat
   if (!IsLocationTree())
     return ERR_NOTIMPLEMENTED;           //this function is actual only for location tree
 
+  if (m_pLocationCache && m_pLocationCache->Lookup(Id, Key, Data))
+    return ERR_NOERROR;
+
   apfs_location_table_data *pCurLocationData = NULL;
   apfs_location_table_key *pCurLocationKey = NULL;
+  apfs_location_table_data FoundData;
+  UINT64 FoundCheckpoint = 0;
+  bool bFound = false;
   int Status = ERR_NOERROR;
 
   //Search location with max checkpoint (last location)
@@ -502,6 +586,16 @@ CApfsTree::GetActualLocation(UINT64 Id, apfs_location_table_key* Key, apfs_locat
 //      if ( pCurLocationData != NULL )
 //        ULOG_DEBUG1( (GetLog(), "GetActualLocation %" PLL "x --> %" PLL "x", Id, pCurLocationData->ltd_block) );
 
+      //Copy matched record now: enumerator overwrites pointers on the next step and may unload the leaf
+      Memcpy2(&FoundData, pCurLocationData, sizeof(apfs_location_table_data));
+#ifdef BASE_BIGENDIAN
+      SwapBytesInPlace(&FoundData.ltd_block);
+      SwapBytesInPlace(&FoundData.ltd_length);
+      SwapBytesInPlace(&FoundData.ltd_flags);
+#endif
+      FoundCheckpoint = LE2CPU(pCurLocationKey->ltk_checkpoint);
+      bFound = true;
+
       if (Data)
       {
         Memcpy2(Data, pCurLocationData, sizeof(apfs_location_table_data));
@@ -524,10 +618,24 @@ CApfsTree::GetActualLocation(UINT64 Id, apfs_location_table_key* Key, apfs_locat
       return Status;
   }
 
+  if (m_pLocationCache && bFound)
+    m_pLocationCache->Insert(Id, FoundCheckpoint, &FoundData);
+
   return ERR_NOERROR;
 }
 
 
+#ifndef UFSD_APFS_RO
+/////////////////////////////////////////////////////////////////////////////
+void
+CApfsTree::ForgetLocation(const CLocationSearchKey* Key) const
+{
+  if (m_pLocationCache)
+    m_pLocationCache->Remove(Key->m_DiskKey->location.ltk_id);
+}
+#endif
+
+
 /////////////////////////////////////////////////////////////////////////////
 int
 CApfsTree::GetItem(UINT64 index, void** pKey, void** pData, unsigned short* KeyLen, unsigned short *DataLen)
@@ -539,6 +647,125 @@ CApfsTree::GetItem(UINT64 index, void** pKey, void** pData, unsigned short* KeyL
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+//Move Order[Root] down the heap of Count elements (max heap by keys)
+static void SiftKeyDown(CCommonSearchKey** Keys, size_t* Order, size_t Root, size_t Count)
+{
+  const size_t Top = Order[Root];
+
+  for (;;)
+  {
+    size_t Child = 2 * Root + 1;
+    if (Child >= Count)
+      break;
+    if (Child + 1 < Count && *Keys[Order[Child + 1]] > *Keys[Order[Child]])
+      ++Child;
+    if (!(*Keys[Order[Child]] > *Keys[Top]))
+      break;
+    Order[Root] = Order[Child];
+    Root = Child;
+  }
+  Order[Root] = Top;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+//Fill Order with indexes of Keys in ascending order of keys (heap sort)
+static void SortKeys(CCommonSearchKey** Keys, size_t* Order, size_t Count)
+{
+  for (size_t i = 0; i < Count; i++)
+    Order[i] = i;
+
+  for (size_t i = Count / 2; i-- > 0; )
+    SiftKeyDown(Keys, Order, i, Count);
+
+  for (size_t i = Count; i-- > 1; )
+  {
+    const size_t Max = Order[0];
+    Order[0] = Order[i];
+    Order[i] = Max;
+    SiftKeyDown(Keys, Order, 0, i);
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+int
+CApfsTree::GetDataBatch(CCommonSearchKey** Keys, size_t Count, unsigned short SearchRegime, CApfsBatchSink* Sink)
+{
+  if (FlagOn(SearchRegime, SEARCH_KEY_GE | SEARCH_KEY_LOW))
+    return ERR_NOTIMPLEMENTED;               //not needed yet
+
+  if (Count == 0)
+    return ERR_NOERROR;
+
+  size_t* Order = reinterpret_cast<size_t*>(Malloc2(Count * sizeof(size_t)));
+  CHECK_PTR(Order);
+  SortKeys(Keys, Order, Count);
+
+  //Branch of nodes is reloaded, so next GetData searches from root
+  m_pCurNode = m_pRootNode;
+  m_bCurNodeValid = false;
+
+  int Status = GetDataBatch(m_pRootNode, Keys, Order, Count, SearchRegime, Sink);
+
+  Free2(Order);
+  return Status;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+int
+CApfsTree::GetDataBatch(CApfsTreeNode* pNode, CCommonSearchKey** Keys, const size_t* Order, size_t Count, unsigned short SearchRegime, CApfsBatchSink* Sink)
+{
+  unsigned int Index;
+
+  if (pNode->Depth() == 0)
+  {
+    for (size_t i = 0; i < Count; i++)
+    {
+      CHECK_CALL(pNode->FindDataIndex(Keys[Order[i]], SearchRegime, &Index));
+      if (IS_INDEX_NOT_FOUND(Index))
+        continue;
+
+      void* Key;
+      void* Data;
+      unsigned short KeyLen, DataLen;
+      CHECK_CALL(pNode->GetItem(Index, &Key, &Data, &KeyLen, &DataLen));
+      CHECK_CALL(Sink->OnItem(Order[i], Key, Data, KeyLen, DataLen));
+    }
+    return ERR_NOERROR;
+  }
+
+  //Keys are sorted, so keys of one child go in a row and the child is loaded once for them
+  CHECK_CALL(pNode->FindDataIndex(Keys[Order[0]], SearchRegime, &Index));
+
+  for (size_t First = 0; First < Count; )
+  {
+    size_t Last = First + 1;
+    unsigned int NextIndex = Index;
+
+    for (; Last < Count; Last++)
+    {
+      CHECK_CALL(pNode->FindDataIndex(Keys[Order[Last]], SearchRegime, &NextIndex));
+      if (NextIndex != Index)
+        break;
+    }
+
+    if (!IS_INDEX_NOT_FOUND(Index))
+    {
+      CHECK_CALL(pNode->LoadChild(Index));
+      CHECK_CALL(GetDataBatch(pNode->m_pChild, Keys, Order + First, Last - First, SearchRegime, Sink));
+    }
+
+    First = Last;
+    Index = NextIndex;
+  }
+
+  return ERR_NOERROR;
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 CApfsTreeEnum::CApfsTreeEnum(CApfsSuperBlock* pSuper)
   : CApfsTreeInternal(pSuper)
@@ -687,24 +914,87 @@ CApfsTreeEnum::RestoreEnumerator()
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+//Name hash of directory entry key on disk (without swapping of bitfields on big endian)
+static unsigned int GetEntryNameHash(const apfs_direntry_key* pKey)
+{
+  return CPU2LE(*reinterpret_cast<const unsigned int*>(Add2Ptr(pKey, sizeof(pKey->id)))) >> 10;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+int CEntryTreeEnum::EnumNextEntry(apfs_direntry_key** Key, apfs_direntry_data** Data)
+{
+  apfs_direntry_key* pKey;
+  CHECK_CALL_SILENT(EnumNextPtrByKey((void**)&pKey, (void**)Data));
+
+  const unsigned int Hash = GetEntryNameHash(pKey);
+  m_Index = Hash == m_Hash ? m_Index + 1 : 0;
+  m_Hash = Hash;
+  m_Position = APFS_DIR_POS(Hash, m_Index) + 1;
+
+  if (Key)
+    *Key = pKey;
+  return ERR_NOERROR;
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 int CEntryTreeEnum::SetPosition(UINT64 Pos)
 {
+  if (Pos < APFS_DIR_POS_BASE)
+    Pos = 0;
+
   if (Pos == m_Position)
     return ERR_NOERROR;
 
   ULOG_DEBUG1((GetLog(), "CEntryTreeEnum::SetPosition %" PLL "x -> %" PLL "x", m_Position, Pos));
 
-  if (Pos < m_Position)
+  if (Pos == 0)
+    return StartEnum();
+
+  CSimpleSearchKey Key(m_Mm, m_Id, ApfsDirEntry);
+  m_Hash = ~0u;
+
+  if (Pos >= APFS_DIR_POS_END)
   {
-    CHECK_CALL(StartEnum());
-    m_Position = 0;
+    //Start after the last entry
+    CSimpleSearchKey EndKey(m_Mm, m_Id, ApfsDirEntry + 1);
+    CHECK_CALL(StartEnumFromKey(&Key, SEARCH_KEY_EQ, &EndKey));
+    m_Position = Pos;
+    return ERR_NOERROR;
   }
 
-  apfs_direntry_data* dummy;
+  //Start before the first entry with this hash
+  const unsigned int Hash = static_cast<unsigned int>((Pos - APFS_DIR_POS_BASE) >> 32);
+  const unsigned int Index = static_cast<unsigned int>(Pos - APFS_DIR_POS_BASE);
+  CEntrySearchKey StartKey(m_Mm, m_Id, true, Hash);
+  CHECK_CALL(StartEnumFromKey(&Key, SEARCH_KEY_EQ, &StartKey));
+  m_Position = Pos;
 
-  while (m_Position < Pos)
-    CHECK_CALL(EnumNextEntry(NULL, &dummy));
+  //Skip entries with the same hash (collisions are rare)
+  for (unsigned int i = 0; i < Index; i++)
+  {
+    apfs_direntry_key* pKey;
+    apfs_direntry_data* pData;
+    int Status = EnumNextPtrByKey((void**)&pKey, (void**)&pData);
+
+    if (Status == ERR_NOTFOUND)
+      return ERR_NOERROR;
+    CHECK_STATUS(Status);
+
+    const unsigned int NextHash = GetEntryNameHash(pKey);
+    if (NextHash != Hash)
+    {
+      //Fewer entries with this hash now: start before the first entry with next hash
+      CEntrySearchKey NextKey(m_Mm, m_Id, true, NextHash);
+      m_Hash = ~0u;
+      return StartEnumFromKey(&Key, SEARCH_KEY_EQ, &NextKey);
+    }
+
+    m_Hash = Hash;
+    m_Index = i;
+  }
 
   return ERR_NOERROR;
 }
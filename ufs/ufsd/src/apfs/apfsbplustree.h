@@ -27,6 +27,8 @@ namespace apfs
 
 #define APFS_MAX_KEY_LEN              (MAX_FILENAME + sizeof(apfs_direntry_key))
 
+class CApfsLocationCache;
+
 //Node of Tree class
 class CApfsTreeNode : public UMemBased<CApfsTreeNode>
 {
@@ -38,7 +40,8 @@ public:
   CApfsTreeNode*    m_pChild;          //Pointer to children in active branch (NULL for leaves)
   CApfsTree*        m_pLocationTree;   //Location tree used for searching table block by object id. NULL if this tree is location tree
   CApfsTree*        m_pTree;           //Link to tree
-  CApfsTable*       m_pTable;          //Pointer to table object for this node
+  CApfsTable*       m_pTable;          //Pointer to table object for this node (m_pOwnTable or table pinned in m_pTree)
+  CApfsTable*       m_pOwnTable;       //Table object owned by this node
   unsigned int      m_Pos;             //Position in parent node
   bool              m_bEnumerator;     //Tree node belongs to enumerator
 
@@ -115,8 +118,11 @@ private:
   //Checks if this node is root
   bool IsRootNode() const { return m_Parent == NULL; }               //Root node hasn't parents (m_Parent = NULL)
 
-  //Is block need to unload (move disk block to cache)
-  bool NeedUnloadBuffer() const { return !IsLocationTree() && !IsRootNode() && m_bEnumerator && Depth() != 0; }
+  //Is block need to unload (move disk block to cache). Pinned tables are always loaded
+  bool NeedUnloadBuffer() const { return !IsLocationTree() && !IsRootNode() && m_bEnumerator && Depth() != 0 && m_pTable == m_pOwnTable; }
+
+  //Read table referenced by ObjectId from the parent node
+  int LoadTable(CApfsTable* pTable, UINT64 ObjectId) const;
 
   //Get log object for trace
   api::IBaseLog* GetLog() const { return m_pTable->GetLog(); }
@@ -312,11 +318,25 @@ public:
 //forward declaration
 class CApfsTreeEnum;
 
+//Receiver of items found by CApfsTree::GetDataBatch
+class CApfsBatchSink
+{
+public:
+  virtual ~CApfsBatchSink() {}
+
+  //Called for each found key in key order. KeyIndex - index of the key in array passed to GetDataBatch
+  //Key and Data are valid only during the call
+  virtual int OnItem(size_t KeyIndex, void* Key, void* Data, unsigned short KeyLen, unsigned short DataLen) = 0;
+};
+
 //Tree class
 class CApfsTree : public CApfsTreeInternal
 {
   apfs_btreed*           m_pRootDesc;       //Descriptor of tree root. Presented not in all trees
   CApfsTreeEnum*         m_pDefaultEnum;    //default enumerator for tree
+  CApfsLocationCache*    m_pLocationCache;  //Cache of GetActualLocation results (location tree only, not owned)
+  avl_tree               m_PinnedTables;    //Tables of upper levels shared by all nodes of the tree, sorted by object id
+  list_head              m_PinnedList;      //All pinned tables (including ones dropped from m_PinnedTables on reinit)
 
 public:
 
@@ -341,9 +361,28 @@ public:
   //Get item with specified index
   int GetItem(UINT64 index, void** Key, void** Data, unsigned short* KeyLen = NULL, unsigned short *DataLen = NULL);
 
+  //Find items for Count keys in one pass from the root. Each node is read once for all keys under it
+  //Keys are not changed, items are passed to Sink. Keys without items are skipped
+  //Like GetData, use this function only if there are no duplicating keys in the tree
+  int GetDataBatch(CCommonSearchKey** Keys, size_t Count, unsigned short SearchRegime, CApfsBatchSink* Sink);
+
   //Get actual location for location tree
   int GetActualLocation(UINT64 Id, apfs_location_table_key* Key, apfs_location_table_data* Data) const;
 
+  //Set cache used by GetActualLocation
+  void SetLocationCache(CApfsLocationCache* pCache) { m_pLocationCache = pCache; }
+
+#ifdef UFSD_APFS_RO
+  //Checks if tables of specified level are kept pinned
+  bool IsPinnedLevel(unsigned short Level) const { return Level != 0 && m_pSuper->IsTreeLevelPinned(GetLevel(), Level); }
+
+  //Get pinned table by object id. NULL if not pinned yet
+  CApfsTable* FindPinnedTable(UINT64 ObjectId) const;
+
+  //Keep loaded table in memory until the tree is destroyed
+  void PinTable(CApfsTable* pTable, UINT64 ObjectId);
+#endif
+
 #ifndef UFSD_APFS_RO
   int InvalidateEnumerators();
 
@@ -356,7 +395,7 @@ public:
   int AddEntryLeaf(CEntrySearchKey* Key, apfs_direntry_data* Data) { return AddLeafItem(Key, Data, sizeof(apfs_direntry_data)); }
   int AddExtentLeaf(CExtentSearchKey* Key, apfs_extent_data* Data) { return AddLeafItem(Key, Data, sizeof(apfs_extent_data)); }
   int AddXAttrLeaf(CXAttrSearchKey* Key, apfs_xattr_data* Data, unsigned short DataLen) { return AddLeafItem(Key, Data, DataLen); }
-  int AddLocationLeaf(CLocationSearchKey* Key, apfs_location_table_data* Data) { return AddLeafItem(Key, Data, sizeof(apfs_location_table_data)); }
+  int AddLocationLeaf(CLocationSearchKey* Key, apfs_location_table_data* Data) { ForgetLocation(Key); return AddLeafItem(Key, Data, sizeof(apfs_location_table_data)); }
   int AddExtentStatusLeaf(UINT64 ObjectID, unsigned int Data = 1)
   {
     bool bExists;
@@ -375,7 +414,7 @@ public:
   int RemoveEntryLeaf(CEntrySearchKey* Key) { return RemoveLeafItem(Key); }
   int RemoveExtentLeaf(CExtentSearchKey* Key) { return RemoveLeafItem(Key); }
   int RemoveXAttrLeaf(CXAttrSearchKey* Key) { return RemoveLeafItem(Key); }
-  int RemoveLocationLeaf(CLocationSearchKey* Key) { return RemoveLeafItem(Key); }
+  int RemoveLocationLeaf(CLocationSearchKey* Key) { ForgetLocation(Key); return RemoveLeafItem(Key); }
   int RemoveExtentStatusLeaf(UINT64 ObjectID)
   {
     bool bExists;
@@ -396,7 +435,7 @@ public:
   int UpdateEntryLeafData(CEntrySearchKey* Key, apfs_direntry_data* NewData) { return UpdateLeafItemData(Key, NewData, sizeof(apfs_direntry_data)); }
   int UpdateExtentLeafData(CExtentSearchKey* Key, apfs_extent_data* NewData) { return UpdateLeafItemData(Key, NewData, sizeof(apfs_extent_data)); }
   int UpdateXAttrLeafData(CXAttrSearchKey* Key, apfs_xattr_data* NewData, unsigned short NewDataLen) { return UpdateLeafItemData(Key, NewData, NewDataLen); }
-  int UpdateLocationLeafData(CLocationSearchKey* Key, apfs_location_table_data* NewData) { return UpdateLeafItemData(Key, NewData, sizeof(apfs_location_table_data)); }
+  int UpdateLocationLeafData(CLocationSearchKey* Key, apfs_location_table_data* NewData) { ForgetLocation(Key); return UpdateLeafItemData(Key, NewData, sizeof(apfs_location_table_data)); }
 
   //Update leaf item key
   //NewKey shouldn't cross with table buffer
@@ -404,9 +443,16 @@ public:
 
   int UpdateEntryLeafKey(CEntrySearchKey* Key, CEntrySearchKey* NewKey) { return UpdateLeafItemKey(Key, NewKey); }
   int UpdateXAttrLeafKey(CXAttrSearchKey* Key, CXAttrSearchKey* NewKey) { return UpdateLeafItemKey(Key, NewKey); }
+
+private:
+  //Drop cached location of the modified key
+  void ForgetLocation(const CLocationSearchKey* Key) const;
 #endif
 
 private:
+  //Help function for GetDataBatch. Searches Count keys ordered by Order in subtree of pNode
+  int GetDataBatch(CApfsTreeNode* pNode, CCommonSearchKey** Keys, const size_t* Order, size_t Count, unsigned short SearchRegime, CApfsBatchSink* Sink);
+
   virtual bool IsEnumerator() const { return false; }
 };
 
@@ -448,6 +494,12 @@ public:
   //Functions for enumeration
   //Start enumeration by key and regime
   int StartEnumByKey(CCommonSearchKey* Key, unsigned int EnumRegime, bool bCaseSensitive = true)
+  {
+    return StartEnumFromKey(Key, EnumRegime, Key, bCaseSensitive);
+  }
+
+  //Start enumeration by key and regime. Items less than StartKey are skipped
+  int StartEnumFromKey(CCommonSearchKey* Key, unsigned int EnumRegime, CCommonSearchKey* StartKey, bool bCaseSensitive = true)
   {
     Memcpy2(&m_EnumKey, Key->GetKey(), Key->GetBufferLen());
     m_EnumType = Key->m_Type;
@@ -456,12 +508,15 @@ public:
     CHECK_CALL_SILENT(InitEnumerator());
 
     m_EnumRegime = EnumRegime;
-    int Status = GetData(Key, SEARCH_KEY_LOW | SEARCH_ALL_TYPES, NULL);
+    int Status = GetData(StartKey, SEARCH_KEY_LOW | SEARCH_ALL_TYPES, NULL);
     if (Status == ERR_NOTFOUND && (m_PosInCurNode == FIRST_INDEX_ON_LOW_SEARCH || (m_PosInCurNode == INDEX_NOT_FOUND && FlagOn(EnumRegime, SEARCH_KEY_GE))))
     {
       m_PosInCurNode = 0;
       return FindFirstLeaf();
     }
+    //Item found is less than StartKey. StartEnumByKey keeps it for SEARCH_KEY_LE
+    if (UFSD_SUCCESS(Status) && StartKey != Key)
+      m_PosInCurNode += 1;
     return Status;
   }
 
@@ -502,31 +557,43 @@ private:
 };
 
 
+//Positions of directory entries (cookies). Entries are sorted by name hash, so position keeps
+//the hash and index of the entry among entries with the same hash, and SetPosition is a tree search.
+//Positions less than APFS_DIR_POS_BASE mean start of directory (emulated dots use 1 and 2)
+#define APFS_DIR_POS_BASE             4
+#define APFS_DIR_POS(Hash, Index)     (APFS_DIR_POS_BASE + (static_cast<UINT64>(Hash) << 32) + (Index))
+#define APFS_DIR_POS_END              APFS_DIR_POS(0x400000, 0)
+
 class CEntryTreeEnum : public CApfsTreeEnum
 {
-  UINT64      m_Position;
-  UINT64      m_Id;
+  UINT64        m_Position;       //Position of next entry
+  UINT64        m_Id;
+  unsigned int  m_Hash;           //Name hash of last entry (~0 if none)
+  unsigned int  m_Index;          //Index of last entry among entries with the same hash
 public:
   CEntryTreeEnum(CApfsSuperBlock* pSuper, UINT64 Id)
     : CApfsTreeEnum(pSuper)
     , m_Position(0)
     , m_Id(Id)
+    , m_Hash(~0u)
+    , m_Index(0)
   {}
   virtual ~CEntryTreeEnum() {}
 
   virtual int StartEnum()
   {
     CSimpleSearchKey Key(m_Mm, m_Id, ApfsDirEntry);
+    m_Position = 0;
+    m_Hash = ~0u;
     return StartEnumByKey(&Key, SEARCH_KEY_EQ);
   }
 
-  int EnumNextEntry(apfs_direntry_key** Key, apfs_direntry_data** Data)
-  {
-    CHECK_CALL_SILENT(EnumNextPtrByKey((void**)Key, (void**)Data));
-    ++m_Position;
-    return ERR_NOERROR;
-  }
+  int EnumNextEntry(apfs_direntry_key** Key, apfs_direntry_data** Data);
+
+  //Position of the entry returned by last EnumNextEntry
+  UINT64 GetEntryPosition() const { return m_Position - 1; }
 
+  //Next EnumNextEntry returns the first entry with position >= Pos
   int SetPosition(UINT64 Pos);
 };
 
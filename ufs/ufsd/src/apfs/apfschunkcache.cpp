@@ -0,0 +1,182 @@
+// <copyright file="apfschunkcache.cpp" company="Paragon Software Group">
+//
+// Copyright (c) 2002-2019 Paragon Software Group, All rights reserved.
+//
+// The license for this file is defined in a separate document "LICENSE.txt"
+// located at the root of the project.
+//
+// </copyright>
+/////////////////////////////////////////////////////////////////////////////
+//
+// Revision History :
+//
+//     17-October-2026 - created.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "../h/versions.h"
+
+#ifdef UFSD_APFS
+
+#ifdef UFSD_TRACE_ERROR
+static const char s_pFileName[] = __FILE__ ",$Revision: 1 $";
+#endif
+
+#include <ufsd.h>
+
+#include "../h/utrace.h"
+#include "../h/assert.h"
+#include "../h/uerrors.h"
+#include "../h/uavl.h"
+
+#include "apfs_struct.h"
+#include "apfschunkcache.h"
+
+namespace UFSD
+{
+
+namespace apfs
+{
+
+
+/////////////////////////////////////////////////////////////////////////////
+CApfsChunkCache::CApfsChunkCache(api::IBaseMemoryManager* Mm)
+  : UMemBased<CApfsChunkCache>(Mm)
+  , m_MaxEntries(0)
+  , m_AllocatedEntries(0)
+  , m_Hits(0)
+  , m_Misses(0)
+{
+  m_LruList.init();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void
+CApfsChunkCache::Init(size_t MaxBytes)
+{
+  Clear();
+  m_MaxEntries = MaxBytes / APFS_UNCOMPRESS_BUFFER_SIZE;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+bool
+CApfsChunkCache::Lookup(
+    IN  unsigned char Vol,
+    IN  UINT64        Inode,
+    IN  UINT64        Chunk,
+    IN  size_t        Offset,
+    IN  size_t        Bytes,
+    OUT void*         pBuffer
+    )
+{
+  ChunkKey Key;
+  Key.m_Inode = Inode;
+  Key.m_Chunk = Chunk;
+  Key.m_Vol   = Vol;
+
+  avl_linkT<ChunkKey>* n = avl_lookup(&m_Tree, Key);
+  if (n == NULL)
+  {
+    ++m_Misses;
+    return false;
+  }
+
+  Entry* e = avl_entry(n, Entry, m_TreeEntry);
+  if (Offset + Bytes > e->m_Bytes)
+  {
+    ++m_Misses;
+    return false;
+  }
+
+  //Move to the head of lru list
+  e->m_LruEntry.remove();
+  e->m_LruEntry.insert_after(&m_LruList);
+
+  Memcpy2(pBuffer, Add2Ptr(e, sizeof(Entry) + Offset), Bytes);
+
+  ++m_Hits;
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void
+CApfsChunkCache::Insert(
+    IN  unsigned char Vol,
+    IN  UINT64        Inode,
+    IN  UINT64        Chunk,
+    IN  const void*   pData,
+    IN  size_t        Bytes
+    )
+{
+  assert(Bytes <= APFS_UNCOMPRESS_BUFFER_SIZE);
+  if (m_MaxEntries == 0 || Bytes > APFS_UNCOMPRESS_BUFFER_SIZE)
+    return;
+
+  ChunkKey Key;
+  Key.m_Inode = Inode;
+  Key.m_Chunk = Chunk;
+  Key.m_Vol   = Vol;
+
+  Entry* e;
+  avl_linkT<ChunkKey>* n = avl_lookup(&m_Tree, Key);
+
+  if (n != NULL)
+  {
+    e = avl_entry(n, Entry, m_TreeEntry);
+    e->m_LruEntry.remove();
+  }
+  else
+  {
+    e = NULL;
+    if (m_AllocatedEntries < m_MaxEntries)
+    {
+      e = reinterpret_cast<Entry*>(Malloc2(sizeof(Entry) + APFS_UNCOMPRESS_BUFFER_SIZE));
+      if (e != NULL)
+        ++m_AllocatedEntries;
+    }
+
+    if (e == NULL)
+    {
+      if (m_LruList.is_empty())
+        return;
+
+      //Reuse the least recently used entry
+      e = list_entry(m_LruList.prev, Entry, m_LruEntry);
+      e->m_LruEntry.remove();
+      m_Tree.remove(&e->m_TreeEntry);
+    }
+
+    e->m_TreeEntry.key = Key;
+    avl_insert(&m_Tree, &e->m_TreeEntry);
+  }
+
+  e->m_Bytes = Bytes;
+  Memcpy2(Add2Ptr(e, sizeof(Entry)), pData, Bytes);
+  e->m_LruEntry.insert_after(&m_LruList);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void
+CApfsChunkCache::Clear()
+{
+  while (!m_LruList.is_empty())
+  {
+    Entry* e = list_entry(m_LruList.next, Entry, m_LruEntry);
+    e->m_LruEntry.remove();
+    Free2(e);
+  }
+
+  m_Tree.init();
+  m_AllocatedEntries = 0;
+}
+
+} // namespace apfs
+
+} // namespace UFSD
+
+#endif
@@ -0,0 +1,112 @@
+// <copyright file="apfschunkcache.h" company="Paragon Software Group">
+//
+// Copyright (c) 2002-2019 Paragon Software Group, All rights reserved.
+//
+// The license for this file is defined in a separate document "LICENSE.txt"
+// located at the root of the project.
+//
+// </copyright>
+/////////////////////////////////////////////////////////////////////////////
+//
+// Revision History :
+//
+//     17-October-2026 - created.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef __UFSD_APFS_CHUNK_CACHE_H
+#define __UFSD_APFS_CHUNK_CACHE_H
+
+namespace UFSD
+{
+
+namespace apfs
+{
+
+//Default memory budget of decompressed chunks cache for every mount
+#ifndef UFSD_SMALL_CACHE
+#define APFS_CHUNK_CACHE_SIZE       0x400000
+#else
+#define APFS_CHUNK_CACHE_SIZE       0x80000
+#endif
+
+//Cache of decompressed chunks (APFS_UNCOMPRESS_BUFFER_SIZE bytes) of resource fork compressed files
+//Entries are allocated on demand, the least recently used one is reused when budget is exhausted
+class CApfsChunkCache : public UMemBased<CApfsChunkCache>
+{
+  struct ChunkKey
+  {
+    UINT64                    m_Inode;
+    UINT64                    m_Chunk;
+    unsigned char             m_Vol;
+
+    bool operator == (const ChunkKey& k) const
+    {
+      return m_Inode == k.m_Inode && m_Chunk == k.m_Chunk && m_Vol == k.m_Vol;
+    }
+
+    bool operator < (const ChunkKey& k) const
+    {
+      if (m_Inode != k.m_Inode)
+        return m_Inode < k.m_Inode;
+      if (m_Chunk != k.m_Chunk)
+        return m_Chunk < k.m_Chunk;
+      return m_Vol < k.m_Vol;
+    }
+  };
+
+  struct Entry
+  {
+    avl_linkT<ChunkKey>       m_TreeEntry;            //key is (volume, inode, chunk)
+    list_head                 m_LruEntry;             //position in m_LruList
+    size_t                    m_Bytes;                //Valid bytes of decompressed data
+    //Decompressed data follows the entry
+  };
+
+  size_t                 m_MaxEntries;               //Number of entries which fit into budget
+  size_t                 m_AllocatedEntries;         //Number of allocated entries
+  avl_tree               m_Tree;                     //Used entries sorted by key
+  list_head              m_LruList;                  //All allocated entries, most recently used first
+
+public:
+  UINT64                 m_Hits;
+  UINT64                 m_Misses;
+
+  CApfsChunkCache(api::IBaseMemoryManager* Mm);
+  ~CApfsChunkCache() { Clear(); }
+
+  //Set budget of cache in bytes, drop all cached chunks
+  void Init(size_t MaxBytes);
+
+  //Returns true and copies Bytes from Offset of chunk to pBuffer if chunk is cached
+  bool Lookup(
+      IN  unsigned char Vol,
+      IN  UINT64        Inode,
+      IN  UINT64        Chunk,
+      IN  size_t        Offset,
+      IN  size_t        Bytes,
+      OUT void*         pBuffer
+      );
+
+  //Add decompressed chunk to the cache
+  void Insert(
+      IN  unsigned char Vol,
+      IN  UINT64        Inode,
+      IN  UINT64        Chunk,
+      IN  const void*   pData,
+      IN  size_t        Bytes
+      );
+
+  //Free all chunks
+  void Clear();
+
+  size_t GetCount() const { return m_Tree.Count; }
+  size_t GetSize() const { return m_AllocatedEntries * (sizeof(Entry) + APFS_UNCOMPRESS_BUFFER_SIZE); }
+};
+
+} // namespace apfs
+
+} // namespace UFSD
+
+#endif
@@ -0,0 +1,267 @@
+// <copyright file="apfsdentrycache.cpp" company="Paragon Software Group">
+//
+// Copyright (c) 2002-2019 Paragon Software Group, All rights reserved.
+//
+// The license for this file is defined in a separate document "LICENSE.txt"
+// located at the root of the project.
+//
+// </copyright>
+/////////////////////////////////////////////////////////////////////////////
+//
+// Revision History :
+//
+//     17-October-2026 - created.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "../h/versions.h"
+
+#ifdef UFSD_APFS
+
+#ifdef UFSD_TRACE_ERROR
+static const char s_pFileName[] = __FILE__ ",$Revision: 1 $";
+#endif
+
+#include <ufsd.h>
+
+#include "../h/utrace.h"
+#include "../h/assert.h"
+#include "../h/uerrors.h"
+#include "../h/uavl.h"
+
+#include "apfsdentrycache.h"
+
+namespace UFSD
+{
+
+namespace apfs
+{
+
+/////////////////////////////////////////////////////////////////////////////
+//FNV-1a, it is enough to spread names of one directory in the tree
+static unsigned int
+NameHash(
+    IN const unsigned char* Name,
+    IN size_t               Len
+    )
+{
+  unsigned int h = 0x811c9dc5;
+  for (size_t i = 0; i < Len; i++)
+    h = (h ^ Name[i]) * 0x01000193;
+  return h;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+static int
+CompareNames(
+    IN const unsigned char* Name1,
+    IN const unsigned char* Name2,
+    IN size_t               Len
+    )
+{
+  for (size_t i = 0; i < Len; i++)
+  {
+    if (Name1[i] != Name2[i])
+      return Name1[i] < Name2[i] ? -1 : 1;
+  }
+  return 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+bool
+CApfsDentryCache::DentryKey::operator == (const DentryKey& k) const
+{
+  return m_Parent == k.m_Parent && m_Hash == k.m_Hash && m_Len == k.m_Len && m_Type == k.m_Type
+      && CompareNames(m_Name, k.m_Name, m_Len) == 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+bool
+CApfsDentryCache::DentryKey::operator < (const DentryKey& k) const
+{
+  if (m_Parent != k.m_Parent)
+    return m_Parent < k.m_Parent;
+  if (m_Hash != k.m_Hash)
+    return m_Hash < k.m_Hash;
+  if (m_Len != k.m_Len)
+    return m_Len < k.m_Len;
+  if (m_Type != k.m_Type)
+    return m_Type < k.m_Type;
+  return CompareNames(m_Name, k.m_Name, m_Len) < 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+CApfsDentryCache::CApfsDentryCache(api::IBaseMemoryManager* Mm)
+  : UMemBased<CApfsDentryCache>(Mm)
+  , m_MaxBytes(0)
+  , m_UsedBytes(0)
+  , m_Hits(0)
+  , m_NegativeHits(0)
+  , m_Misses(0)
+{
+  m_LruList.init();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void
+CApfsDentryCache::Init(size_t MaxBytes)
+{
+  Clear();
+  m_MaxBytes = MaxBytes;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+int
+CApfsDentryCache::Lookup(
+    IN  UINT64        Parent,
+    IN  api::STRType  Type,
+    IN  const void*   Name,
+    IN  size_t        NameBytes,
+    OUT FileInfo*     Info
+    )
+{
+  DentryKey Key;
+  Key.m_Parent = Parent;
+  Key.m_Name   = reinterpret_cast<const unsigned char*>(Name);
+  Key.m_Len    = NameBytes;
+  Key.m_Hash   = NameHash(Key.m_Name, NameBytes);
+  Key.m_Type   = Type;
+
+  avl_linkT<DentryKey>* n = avl_lookup(&m_Tree, Key);
+  if (n == NULL)
+  {
+    ++m_Misses;
+    return ERR_NOTFOUND;
+  }
+
+  Entry* e = avl_entry(n, Entry, m_TreeEntry);
+
+  //Move to the head of lru list
+  e->m_LruEntry.remove();
+  e->m_LruEntry.insert_after(&m_LruList);
+
+  if (e->m_bNegative)
+  {
+    ++m_NegativeHits;
+    return ERR_NOFILEEXISTS;
+  }
+
+  Memzero2(Info, sizeof(FileInfo));
+  Info->Id      = e->m_Id;
+  Info->Attrib  = e->m_Attrib;
+  Info->NameLen = e->m_NameLen;
+#ifndef UFSD_DRIVER_LINUX
+  Info->NameType = static_cast<api::STRType>(e->m_NameType);
+#endif
+  Memcpy2(Info->Name, Add2Ptr(e, sizeof(Entry) + NameBytes), e->m_NameBytes);
+
+  ++m_Hits;
+  return ERR_NOERROR;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void
+CApfsDentryCache::Insert(
+    IN  UINT64          Parent,
+    IN  api::STRType    Type,
+    IN  const void*     Name,
+    IN  size_t          NameBytes,
+    IN  const FileInfo* Info,
+    IN  size_t          InfoNameBytes
+    )
+{
+  if (Info == NULL)
+    InfoNameBytes = 0;
+
+  size_t Bytes = sizeof(Entry) + NameBytes + InfoNameBytes;
+  if (Bytes > m_MaxBytes || InfoNameBytes > sizeof(Info->Name))
+    return;
+
+  DentryKey Key;
+  Key.m_Parent = Parent;
+  Key.m_Name   = reinterpret_cast<const unsigned char*>(Name);
+  Key.m_Len    = NameBytes;
+  Key.m_Hash   = NameHash(Key.m_Name, NameBytes);
+  Key.m_Type   = Type;
+
+  avl_linkT<DentryKey>* n = avl_lookup(&m_Tree, Key);
+  if (n != NULL)
+    Delete(avl_entry(n, Entry, m_TreeEntry));
+
+  //Free the least recently used entries
+  while (m_UsedBytes + Bytes > m_MaxBytes && !m_LruList.is_empty())
+    Delete(list_entry(m_LruList.prev, Entry, m_LruEntry));
+
+  Entry* e = reinterpret_cast<Entry*>(Malloc2(Bytes));
+  if (e == NULL)
+    return;
+
+  unsigned char* KeyName = reinterpret_cast<unsigned char*>(Add2Ptr(e, sizeof(Entry)));
+  Memcpy2(KeyName, Name, NameBytes);
+  Key.m_Name = KeyName;
+
+  e->m_Bytes     = Bytes;
+  e->m_bNegative = Info == NULL;
+  e->m_Id        = 0;
+  e->m_Attrib    = 0;
+  e->m_NameType  = 0;
+  e->m_NameLen   = 0;
+  e->m_NameBytes = InfoNameBytes;
+
+  if (Info != NULL)
+  {
+    e->m_Id      = Info->Id;
+    e->m_Attrib  = Info->Attrib;
+    e->m_NameLen = Info->NameLen;
+#ifndef UFSD_DRIVER_LINUX
+    e->m_NameType = Info->NameType;
+#endif
+    Memcpy2(KeyName + NameBytes, Info->Name, InfoNameBytes);
+  }
+
+  e->m_TreeEntry.key = Key;
+  avl_insert(&m_Tree, &e->m_TreeEntry);
+  e->m_LruEntry.insert_after(&m_LruList);
+  m_UsedBytes += Bytes;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void
+CApfsDentryCache::Delete(Entry* e)
+{
+  e->m_LruEntry.remove();
+  m_Tree.remove(&e->m_TreeEntry);
+  m_UsedBytes -= e->m_Bytes;
+  Free2(e);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void
+CApfsDentryCache::Clear()
+{
+  while (!m_LruList.is_empty())
+  {
+    Entry* e = list_entry(m_LruList.next, Entry, m_LruEntry);
+    e->m_LruEntry.remove();
+    Free2(e);
+  }
+
+  m_Tree.init();
+  m_UsedBytes = 0;
+}
+
+} // namespace apfs
+
+} // namespace UFSD
+
+#endif
@@ -0,0 +1,115 @@
+// <copyright file="apfsdentrycache.h" company="Paragon Software Group">
+//
+// Copyright (c) 2002-2019 Paragon Software Group, All rights reserved.
+//
+// The license for this file is defined in a separate document "LICENSE.txt"
+// located at the root of the project.
+//
+// </copyright>
+/////////////////////////////////////////////////////////////////////////////
+//
+// Revision History :
+//
+//     17-October-2026 - created.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef __UFSD_APFS_DENTRY_CACHE_H
+#define __UFSD_APFS_DENTRY_CACHE_H
+
+namespace UFSD
+{
+
+namespace apfs
+{
+
+//Default memory budget of directory entries cache for every volume
+#ifndef UFSD_SMALL_CACHE
+#define APFS_DENTRY_CACHE_SIZE      0x80000
+#else
+#define APFS_DENTRY_CACHE_SIZE      0x8000
+#endif
+
+//Cache of directory lookups: (parent id, name as requested) -> (found id, attributes, found name)
+//Names are compared byte by byte, so every spelling of a name which is equal
+//on case insensitive volume has own entry and gets exactly the result of the real lookup.
+//Negative entries remember names which were not found.
+class CApfsDentryCache : public UMemBased<CApfsDentryCache>
+{
+  struct DentryKey
+  {
+    UINT64                    m_Parent;
+    const unsigned char*      m_Name;
+    size_t                    m_Len;                  //Name length in bytes
+    unsigned int              m_Hash;
+    unsigned int              m_Type;                 //api::STRType of m_Name
+
+    bool operator == (const DentryKey& k) const;
+    bool operator < (const DentryKey& k) const;
+  };
+
+  struct Entry
+  {
+    avl_linkT<DentryKey>      m_TreeEntry;
+    list_head                 m_LruEntry;             //position in m_LruList
+    size_t                    m_Bytes;                //Memory used by entry
+    UINT64                    m_Id;                   //Found id
+    unsigned int              m_Attrib;               //Found attributes
+    unsigned int              m_NameType;             //api::STRType of found name
+    unsigned short            m_NameLen;              //Found name length in characters
+    size_t                    m_NameBytes;            //Found name length in bytes
+    bool                      m_bNegative;            //Name was not found
+    //Key name and found name follow the entry
+  };
+
+  size_t                 m_MaxBytes;                 //Memory budget
+  size_t                 m_UsedBytes;                //Memory used by entries
+  avl_tree               m_Tree;                     //Entries sorted by key
+  list_head              m_LruList;                  //Entries, most recently used first
+
+  void Delete(Entry* e);
+
+public:
+  UINT64                 m_Hits;
+  UINT64                 m_NegativeHits;
+  UINT64                 m_Misses;
+
+  CApfsDentryCache(api::IBaseMemoryManager* Mm);
+  ~CApfsDentryCache() { Clear(); }
+
+  //Set memory budget in bytes, drop all entries
+  void Init(size_t MaxBytes);
+
+  //Returns ERR_NOERROR and fills Id, Attrib and name of Info (other fields are zeroed) if entry is cached,
+  //ERR_NOFILEEXISTS if name is known to be missing, ERR_NOTFOUND if name is not cached
+  int Lookup(
+      IN  UINT64        Parent,
+      IN  api::STRType  Type,
+      IN  const void*   Name,
+      IN  size_t        NameBytes,
+      OUT FileInfo*     Info
+      );
+
+  //Add result of lookup. Info == NULL adds negative entry
+  void Insert(
+      IN  UINT64          Parent,
+      IN  api::STRType    Type,
+      IN  const void*     Name,
+      IN  size_t          NameBytes,
+      IN  const FileInfo* Info,
+      IN  size_t          InfoNameBytes
+      );
+
+  //Forget all entries
+  void Clear();
+
+  size_t GetCount() const { return m_Tree.Count; }
+  size_t GetSize() const { return m_UsedBytes; }
+};
+
+} // namespace apfs
+
+} // namespace UFSD
+
+#endif
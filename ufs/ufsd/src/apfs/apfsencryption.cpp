@@ -248,21 +248,9 @@ CApfsSuperBlock::DecryptSectors(
     IN  size_t        NumSectors
     ) const
 {
-  size_t size = NumSectors << APFS_ENCRYPT_PORTION_LOG;
-  int Status = ERR_NOERROR;
-
-  for (size_t k = 0; k < size; k += APFS_ENCRYPT_PORTION)
-  {
-    unsigned char iv[16] = { 0 };
-    Memcpy2(iv, &StartSector, sizeof(UINT64));
-
-    if (!UFSD_SUCCESS(Status = pAes->Decrypt(Add2Ptr(pBuffer, k), APFS_ENCRYPT_PORTION, Add2Ptr(pBuffer, k), NULL, iv)))
-      break;
-
-    ++StartSector;
-  }
-
-  return Status;
+  // One call for the whole run: the provider keeps its keyed context
+  // and only advances the tweak for each sector
+  return pAes->DecryptUnits(pBuffer, pBuffer, APFS_ENCRYPT_PORTION, NumSectors, StartSector);
 }
 
 
@@ -218,7 +218,14 @@ int CApfsEntryNumerator::FindEntry(
 
     ULOG_DEBUG1((GetLog(), "Found: '%s' (%x), r=%" PLL "x, hash=%#08x", entry->name, entry->name_len, Info.Id, entry->name_hash));
 
-    m_Position = m_Position2++;
+    if (m_bMatchAll)
+    {
+      //Position in the tree enumerator can be restored by one tree search
+      m_Position = pTreeEnum->GetEntryPosition();
+      m_Position2 = m_Position + 1;
+    }
+    else
+      m_Position = m_Position2++;
     BE_ONLY(SwapBytesInPlace(x));
   }
 
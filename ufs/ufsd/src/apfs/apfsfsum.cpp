@@ -0,0 +1,403 @@
+// <copyright file="apfsfsum.cpp" company="Paragon Software Group">
+//
+// Copyright (c) 2002-2019 Paragon Software Group, All rights reserved.
+//
+// The license for this file is defined in a separate document "LICENSE.txt"
+// located at the root of the project.
+//
+// </copyright>
+/////////////////////////////////////////////////////////////////////////////
+//
+// Revision History :
+//
+//     17-October-2026 - created.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "../h/versions.h"
+
+#ifdef UFSD_APFS
+
+#ifdef UFSD_TRACE_ERROR
+static const char s_pFileName[] = __FILE__ ",$Revision: 1 $";
+#endif
+
+#include <ufsd.h>
+
+#include "../h/assert.h"
+
+#include "apfsfsum.h"
+
+//
+// Vector units are not allowed in kernel without saving fpu state
+//
+#if !defined UFSD_DRIVER_LINUX && !defined KERNEL && (defined __x86_64__ || defined _M_X64)
+  #define UFSD_APFS_FSUM_SSE2
+  #include <emmintrin.h>
+  #if defined __clang__ || (defined __GNUC__ && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+    #define UFSD_APFS_FSUM_AVX2
+    #include <immintrin.h>
+  #endif
+#endif
+
+namespace UFSD
+{
+
+namespace apfs
+{
+
+//
+// Scalar loop keeps sum1 in [0, 0xffffffff) and accumulates sum2 without reduction.
+// The final reduction truncates to 32 bit, so every variant has to produce
+// exactly the same sum2, not only the same value modulo 0xffffffff.
+//
+// Vector variants split data into chunks. Inside a chunk inclusive prefix sums E[k]
+// are calculated exactly (without carry), then sum1 after word k is fold(sum1 + E[k]).
+// Only the carry of sum1 between chunks is serial.
+//
+
+#define APFS_MOD_VALUE (unsigned int)(-1)
+
+static unsigned int mod_u64_to_0xffffffff(UINT64 Val)
+{
+  unsigned int r = (Val >> 32) + (Val & APFS_MOD_VALUE);
+  return (r != APFS_MOD_VALUE) ? r : 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Returns canonical residue of Val modulo 0xffffffff, Val < 2^40
+static inline UINT64 FoldSum(UINT64 Val)
+{
+  UINT64 u = (Val >> 32) + (Val & APFS_MOD_VALUE);
+  //u < 2^32 + 2^8: subtract 0xffffffff once if u >= 0xffffffff
+  return (u + ((u + 1) >> 32)) & APFS_MOD_VALUE;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+static inline UINT64 FinalSum(UINT64 sum1, UINT64 sum2)
+{
+  sum2 = mod_u64_to_0xffffffff(sum2);
+  sum1 = APFS_MOD_VALUE - mod_u64_to_0xffffffff(sum1 + sum2);
+
+  return (sum2 << 32) | sum1;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+UINT64 ApfsFletcher64Scalar(
+    IN const void* pData,
+    IN size_t      Size
+    )
+{
+  const unsigned int* p = reinterpret_cast<const unsigned int*>(pData);
+  Size /= 4;
+
+  UINT64 sum1 = 0;
+  UINT64 sum2 = 0;
+
+  for(size_t i = 2; i < Size; ++i)//skip first 8 bytes for checksumm
+  {
+    if((sum1 += p[i]) >= APFS_MOD_VALUE)
+      //normalization
+      sum1 -= APFS_MOD_VALUE;
+    sum2 += sum1;
+  }
+
+  return FinalSum(sum1, sum2);
+}
+
+
+#ifndef UFSD_APFS_FSUM_SSE2
+/////////////////////////////////////////////////////////////////////////////
+// Portable variant: 8 words per chunk, no serial dependency inside chunk
+static UINT64 Fletcher64Chunked(
+    IN const void* pData,
+    IN size_t      Size
+    )
+{
+  const unsigned int* p = reinterpret_cast<const unsigned int*>(pData);
+  size_t n = Size / 4;
+  size_t i = 2;
+
+  UINT64 sum1 = 0;
+  UINT64 sum2 = 0;
+
+  for (; i < n && (i & 7); ++i)
+  {
+    sum1 = FoldSum(sum1 + p[i]);
+    sum2 += sum1;
+  }
+
+  for (; i + 8 <= n; i += 8)
+  {
+    UINT64 e0 = p[i];
+    UINT64 e1 = e0 + p[i + 1];
+    UINT64 e2 = e1 + p[i + 2];
+    UINT64 e3 = e2 + p[i + 3];
+    UINT64 e4 = e3 + p[i + 4];
+    UINT64 e5 = e4 + p[i + 5];
+    UINT64 e6 = e5 + p[i + 6];
+    UINT64 e7 = e6 + p[i + 7];
+
+    sum2 += FoldSum(sum1 + e0) + FoldSum(sum1 + e1) + FoldSum(sum1 + e2) + FoldSum(sum1 + e3)
+          + FoldSum(sum1 + e4) + FoldSum(sum1 + e5) + FoldSum(sum1 + e6);
+    sum1 = FoldSum(sum1 + e7);
+    sum2 += sum1;
+  }
+
+  for (; i < n; ++i)
+  {
+    sum1 = FoldSum(sum1 + p[i]);
+    sum2 += sum1;
+  }
+
+  return FinalSum(sum1, sum2);
+}
+#endif
+
+
+#ifdef UFSD_APFS_FSUM_SSE2
+/////////////////////////////////////////////////////////////////////////////
+static inline __m128i FoldSum2(__m128i Val)
+{
+  const __m128i Mask = _mm_set1_epi64x(APFS_MOD_VALUE);
+  const __m128i One  = _mm_set1_epi64x(1);
+  __m128i u = _mm_add_epi64(_mm_srli_epi64(Val, 32), _mm_and_si128(Val, Mask));
+  return _mm_and_si128(_mm_add_epi64(u, _mm_srli_epi64(_mm_add_epi64(u, One), 32)), Mask);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// SSE2 variant: 8 words per chunk in four 2x64 vectors
+static UINT64 Fletcher64Sse2(
+    IN const void* pData,
+    IN size_t      Size
+    )
+{
+  const unsigned int* p = reinterpret_cast<const unsigned int*>(pData);
+  size_t n = Size / 4;
+  size_t i = 2;
+
+  UINT64 sum1 = 0;
+  UINT64 sum2 = 0;
+
+  for (; i < n && (i & 7); ++i)
+  {
+    sum1 = FoldSum(sum1 + p[i]);
+    sum2 += sum1;
+  }
+
+  const __m128i Zero = _mm_setzero_si128();
+  __m128i Carry = _mm_set1_epi64x(sum1);
+  __m128i Sum2  = Zero;
+
+  for (; i + 8 <= n; i += 8)
+  {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 4));
+    __m128i v0 = _mm_unpacklo_epi32(a, Zero);
+    __m128i v1 = _mm_unpackhi_epi32(a, Zero);
+    __m128i v2 = _mm_unpacklo_epi32(b, Zero);
+    __m128i v3 = _mm_unpackhi_epi32(b, Zero);
+
+    //prefix sums inside vectors
+    v0 = _mm_add_epi64(v0, _mm_slli_si128(v0, 8));
+    v1 = _mm_add_epi64(v1, _mm_slli_si128(v1, 8));
+    v2 = _mm_add_epi64(v2, _mm_slli_si128(v2, 8));
+    v3 = _mm_add_epi64(v3, _mm_slli_si128(v3, 8));
+
+    //prefix sums across vectors
+    v1 = _mm_add_epi64(v1, _mm_unpackhi_epi64(v0, v0));
+    v3 = _mm_add_epi64(v3, _mm_unpackhi_epi64(v2, v2));
+    __m128i t = _mm_unpackhi_epi64(v1, v1);
+    v2 = _mm_add_epi64(v2, t);
+    v3 = _mm_add_epi64(v3, t);
+
+    __m128i r0 = FoldSum2(_mm_add_epi64(Carry, v0));
+    __m128i r1 = FoldSum2(_mm_add_epi64(Carry, v1));
+    __m128i r2 = FoldSum2(_mm_add_epi64(Carry, v2));
+    __m128i r3 = FoldSum2(_mm_add_epi64(Carry, v3));
+
+    Sum2  = _mm_add_epi64(Sum2, _mm_add_epi64(_mm_add_epi64(r0, r1), _mm_add_epi64(r2, r3)));
+    Carry = _mm_unpackhi_epi64(r3, r3);
+  }
+
+  UINT64 Tmp[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(Tmp), Sum2);
+  sum2 += Tmp[0] + Tmp[1];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(Tmp), Carry);
+  sum1 = Tmp[0];
+
+  for (; i < n; ++i)
+  {
+    sum1 = FoldSum(sum1 + p[i]);
+    sum2 += sum1;
+  }
+
+  return FinalSum(sum1, sum2);
+}
+#endif
+
+
+#ifdef UFSD_APFS_FSUM_AVX2
+/////////////////////////////////////////////////////////////////////////////
+__attribute__((target("avx2")))
+static inline __m256i FoldSum4(__m256i Val)
+{
+  const __m256i Mask = _mm256_set1_epi64x(APFS_MOD_VALUE);
+  const __m256i One  = _mm256_set1_epi64x(1);
+  __m256i u = _mm256_add_epi64(_mm256_srli_epi64(Val, 32), _mm256_and_si256(Val, Mask));
+  return _mm256_and_si256(_mm256_add_epi64(u, _mm256_srli_epi64(_mm256_add_epi64(u, One), 32)), Mask);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// Loads 4 words and returns their inclusive prefix sums
+__attribute__((target("avx2")))
+static inline __m256i PrefixSum4(const unsigned int* p)
+{
+  __m256i v = _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+  v = _mm256_add_epi64(v, _mm256_slli_si256(v, 8));      // [a, a+b | c, c+d]
+  __m256i h = _mm256_permute4x64_epi64(v, 0x55);         // a+b in all lanes
+  return _mm256_add_epi64(v, _mm256_blend_epi32(_mm256_setzero_si256(), h, 0xF0));
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// AVX2 variant: 16 words per chunk in four 4x64 vectors
+__attribute__((target("avx2")))
+static UINT64 Fletcher64Avx2(
+    IN const void* pData,
+    IN size_t      Size
+    )
+{
+  const unsigned int* p = reinterpret_cast<const unsigned int*>(pData);
+  size_t n = Size / 4;
+  size_t i = 2;
+
+  UINT64 sum1 = 0;
+  UINT64 sum2 = 0;
+
+  for (; i < n && (i & 15); ++i)
+  {
+    sum1 = FoldSum(sum1 + p[i]);
+    sum2 += sum1;
+  }
+
+  __m256i Carry = _mm256_set1_epi64x(sum1);
+  __m256i Sum2  = _mm256_setzero_si256();
+
+  for (; i + 16 <= n; i += 16)
+  {
+    __m256i v0 = PrefixSum4(p + i);
+    __m256i v1 = PrefixSum4(p + i + 4);
+    __m256i v2 = PrefixSum4(p + i + 8);
+    __m256i v3 = PrefixSum4(p + i + 12);
+
+    //prefix sums across vectors
+    v1 = _mm256_add_epi64(v1, _mm256_permute4x64_epi64(v0, 0xFF));
+    v3 = _mm256_add_epi64(v3, _mm256_permute4x64_epi64(v2, 0xFF));
+    __m256i t = _mm256_permute4x64_epi64(v1, 0xFF);
+    v2 = _mm256_add_epi64(v2, t);
+    v3 = _mm256_add_epi64(v3, t);
+
+    __m256i r0 = FoldSum4(_mm256_add_epi64(Carry, v0));
+    __m256i r1 = FoldSum4(_mm256_add_epi64(Carry, v1));
+    __m256i r2 = FoldSum4(_mm256_add_epi64(Carry, v2));
+    __m256i r3 = FoldSum4(_mm256_add_epi64(Carry, v3));
+
+    Sum2  = _mm256_add_epi64(Sum2, _mm256_add_epi64(_mm256_add_epi64(r0, r1), _mm256_add_epi64(r2, r3)));
+    Carry = _mm256_permute4x64_epi64(r3, 0xFF);
+  }
+
+  UINT64 Tmp[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(Tmp), Sum2);
+  sum2 += Tmp[0] + Tmp[1] + Tmp[2] + Tmp[3];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(Tmp), Carry);
+  sum1 = Tmp[0];
+
+  for (; i < n; ++i)
+  {
+    sum1 = FoldSum(sum1 + p[i]);
+    sum2 += sum1;
+  }
+
+  return FinalSum(sum1, sum2);
+}
+#endif
+
+
+typedef UINT64 (*Fletcher64Func)(const void*, size_t);
+
+#ifdef UFSD_APFS_FSUM_AVX2
+/////////////////////////////////////////////////////////////////////////////
+static Fletcher64Func SelectFletcher64()
+{
+  //Selection runs from static initializers, cpu features may be not detected yet
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? Fletcher64Avx2 : Fletcher64Sse2;
+}
+
+//Selected once on load of module, before any thread calculates checksums
+static const Fletcher64Func s_Fletcher64 = SelectFletcher64();
+#elif defined UFSD_APFS_FSUM_SSE2
+static const Fletcher64Func s_Fletcher64 = Fletcher64Sse2;
+#else
+static const Fletcher64Func s_Fletcher64 = Fletcher64Chunked;
+#endif
+
+
+/////////////////////////////////////////////////////////////////////////////
+UINT64 ApfsFletcher64(
+    IN const void* pData,
+    IN size_t      Size
+    )
+{
+  return (*s_Fletcher64)(pData, Size);
+}
+
+
+#ifdef UFSD_APFS_SELFTEST
+/////////////////////////////////////////////////////////////////////////////
+const char* ApfsFletcher64Variant(
+    IN  unsigned int        Index,
+    OUT ApfsFletcher64Func* Func
+    )
+{
+  static const struct
+  {
+    const char*     Name;
+    Fletcher64Func  Func;
+  } Variants[] =
+  {
+#ifdef UFSD_APFS_FSUM_SSE2
+    { "sse2", Fletcher64Sse2 },
+#else
+    { "chunked", Fletcher64Chunked },
+#endif
+#ifdef UFSD_APFS_FSUM_AVX2
+    { "avx2", Fletcher64Avx2 },
+#endif
+  };
+
+  if (Index >= ARRSIZE(Variants))
+    return NULL;
+
+#ifdef UFSD_APFS_FSUM_AVX2
+  if (Variants[Index].Func == Fletcher64Avx2 && !__builtin_cpu_supports("avx2"))
+    return NULL;
+#endif
+
+  *Func = Variants[Index].Func;
+  return Variants[Index].Name;
+}
+#endif
+
+} // namespace apfs
+
+} // namespace UFSD
+
+#endif
@@ -0,0 +1,56 @@
+// <copyright file="apfsfsum.h" company="Paragon Software Group">
+//
+// Copyright (c) 2002-2019 Paragon Software Group, All rights reserved.
+//
+// The license for this file is defined in a separate document "LICENSE.txt"
+// located at the root of the project.
+//
+// </copyright>
+/////////////////////////////////////////////////////////////////////////////
+//
+// Revision History :
+//
+//     17-October-2026 - created.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef __UFSD_APFS_FSUM_H
+#define __UFSD_APFS_FSUM_H
+
+namespace UFSD
+{
+
+namespace apfs
+{
+
+//Fletcher-64 of 32-bit words of object, first 8 bytes (stored checksum) are skipped
+//Returns value to be stored in object header
+//Vectorized variant is selected once on load of module according to cpu features
+UINT64 ApfsFletcher64(
+    IN const void* pData,
+    IN size_t      Size
+    );
+
+//Reference scalar implementation (bit-exact with any variant selected by ApfsFletcher64)
+UINT64 ApfsFletcher64Scalar(
+    IN const void* pData,
+    IN size_t      Size
+    );
+
+#ifdef UFSD_APFS_SELFTEST
+typedef UINT64 (*ApfsFletcher64Func)(const void*, size_t);
+
+//Variants of ApfsFletcher64 built in and supported by this cpu, for self tests
+//Returns name of variant Index and sets its function, NULL after the last variant
+const char* ApfsFletcher64Variant(
+    IN  unsigned int        Index,
+    OUT ApfsFletcher64Func* Func
+    );
+#endif
+
+} // namespace apfs
+
+} // namespace UFSD
+
+#endif
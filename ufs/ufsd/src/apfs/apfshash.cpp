@@ -188,20 +188,68 @@ static unsigned int lowercase_offset(unsigned int cp)
 
 
 ///////////////////////////////////////////////////////////
-int NormalizeAndCalcHash(
+// Returns true if 16 bytes are ascii characters without zero
+static inline bool IsPlainAscii16(const unsigned char* p)
+{
+  //Written without early exit to let compiler check all bytes at once
+  unsigned char Hi = 0;
+  unsigned char Nul = 0;
+  for (size_t i = 0; i < 16; ++i)
+  {
+    Hi  |= p[i];
+    Nul |= p[i] == 0;
+  }
+  return Hi < 0x80 && Nul == 0;
+}
+
+
+///////////////////////////////////////////////////////////
+// Hash of normalized name. If bAscii16 then runs of 16 ascii bytes are folded at once
+// On error *Hash keeps crc32c of batches hashed before the bad character.
+// Batches end at other characters with and without bAscii16, so this partial
+// value may differ between them by design. It is safe because callers drop it:
+// CApfsEntryNumerator::GetNameHash returns 0, CEntrySearchKey::Init returns the error
+static inline int CalcNameHash(
     IN  const unsigned char* Name,
     IN  size_t               NameLen,
     IN  bool                 CaseSensitive,
-    OUT unsigned int*        Hash
+    OUT unsigned int*        Hash,
+    IN  bool                 bAscii16
     )
 {
   DRIVER_ONLY(const unsigned char* n0 = Name);
   const unsigned char* NameEnd = Name + NameLen;
   unsigned int databuf[4] = { 0 };
   size_t bytes;
+  //Code points are hashed in batches, crc32c of the batch equals chain of crc32c of every code point
+  unsigned int hashbuf[64];
+  size_t hashed = 0;
 
   while (Name < NameEnd)
   {
+    //Ascii characters have no decomposition, fold them directly
+    if (bAscii16 && PtrOffset(Name, NameEnd) >= 16 && IsPlainAscii16(Name))
+    {
+      if (hashed + 16 > ARRSIZE(hashbuf))
+      {
+        *Hash = crc32c(*Hash, hashbuf, 4 * hashed);
+        hashed = 0;
+      }
+
+      for (size_t i = 0; i < 16; ++i)
+      {
+        unsigned int c = Name[i];
+        hashbuf[hashed + i] = CaseSensitive || static_cast<unsigned char>(c - 0x41) >= 0x1A ? c : (c + 0x20);
+#ifdef BASE_BIGENDIAN
+        SwapBytesInPlace(&hashbuf[hashed + i]);
+#endif
+      }
+
+      hashed += 16;
+      Name += 16;
+      continue;
+    }
+
     const unsigned char* s = Name++;
 
     if (*s == 0)
@@ -247,12 +295,48 @@ int NormalizeAndCalcHash(
       SwapBytesInPlace(&databuf[i]);
 #endif
 
-    *Hash = crc32c(*Hash, databuf, 4 * bytes);
+    if (hashed + bytes > ARRSIZE(hashbuf))
+    {
+      *Hash = crc32c(*Hash, hashbuf, 4 * hashed);
+      hashed = 0;
+    }
+
+    for (size_t i = 0; i < bytes; ++i)
+      hashbuf[hashed++] = databuf[i];
   }
+
+  if (hashed != 0)
+    *Hash = crc32c(*Hash, hashbuf, 4 * hashed);
   return ERR_NOERROR;
 }
 
 
+///////////////////////////////////////////////////////////
+int NormalizeAndCalcHash(
+    IN  const unsigned char* Name,
+    IN  size_t               NameLen,
+    IN  bool                 CaseSensitive,
+    OUT unsigned int*        Hash
+    )
+{
+  return CalcNameHash(Name, NameLen, CaseSensitive, Hash, true);
+}
+
+
+#ifdef UFSD_APFS_SELFTEST
+///////////////////////////////////////////////////////////
+int NormalizeAndCalcHashScalar(
+    IN  const unsigned char* Name,
+    IN  size_t               NameLen,
+    IN  bool                 CaseSensitive,
+    OUT unsigned int*        Hash
+    )
+{
+  return CalcNameHash(Name, NameLen, CaseSensitive, Hash, false);
+}
+#endif
+
+
 /////////////////////////////////////////////////////////////////////////////
 static int NamesCmp(
     IN  const unsigned char*  Name1,
@@ -1288,6 +1288,16 @@ int NormalizeAndCalcHash(
     IN unsigned int*        Hash
     );
 
+#ifdef UFSD_APFS_SELFTEST
+//NormalizeAndCalcHash without 16 byte ascii runs, reference for self tests
+int NormalizeAndCalcHashScalar(
+    IN const unsigned char* Name,
+    IN size_t               NameLen,
+    IN bool                 CaseSensitive,
+    IN unsigned int*        Hash
+    );
+#endif
+
 bool IsNamesEqual(
     IN  const unsigned char*  Name1,
     IN  size_t                NameLen1,
@@ -45,6 +45,7 @@ static const char s_pFileName[] = __FILE__ ",$Revision: 331632 $";
 #include "apfsinode.h"
 #include "apfstable.h"
 #include "apfsbplustree.h"
+#include "apfschunkcache.h"
 
 
 namespace UFSD
@@ -69,6 +70,15 @@ CApfsInode::CApfsInode(api::IBaseMemoryManager* Mm)
   , m_CompressedAttrLen(0)
   , m_bClonedData(false)
   , m_bClonedFlagsValid(false)
+#ifdef UFSD_APFS_RO
+  , m_pExtentMap(NULL)
+  , m_ExtentMapCount(0)
+  , m_ExtentMapBytes(0)
+  , m_NextVcn(0)
+  , m_bNoExtentMap(false)
+  , m_bExtentMapMiss(false)
+  , m_ExtentMapMissFreed(0)
+#endif
 {
   m_EAList.init();
 }
@@ -89,6 +99,9 @@ CApfsInode::~CApfsInode()
     delete x;
   }
 
+#ifdef UFSD_APFS_RO
+  FreeExtentMap();
+#endif
   Free2(m_pInode);
   Free2(m_pCmpAttr);
 }
@@ -686,11 +699,12 @@ int CApfsInode::GetSubVolumeInfo(
 
 /////////////////////////////////////////////////////////////////////////////
 int CApfsInode::ReadData(
-  IN  UINT64   Offset,
-  OUT size_t*  OutLen,
-  OUT void*    pBuffer,
-  IN  size_t   BufSize,
-  IN  bool     bFork
+  IN  UINT64          Offset,
+  OUT size_t*         OutLen,
+  OUT void*           pBuffer,
+  IN  size_t          BufSize,
+  IN  bool            bFork,
+  IN  CUnixReadQueue* pQueue
   )
 {
   if (U_ISLNK(GetMode()))
@@ -719,26 +733,60 @@ int CApfsInode::ReadData(
   size_t OutSize = 0;
   int Status = ERR_NOERROR;
   unsigned int BlockSize = m_pSuper->GetBlockSize();
+  size_t MaxIoLen = reinterpret_cast<CApfsSuperBlock*>(m_pSuper)->GetMaxIoSize() >> m_pSuper->m_Log2OfCluster;
+  CUnixExtent Next;
+  bool bNext = false;
+  //Plain extents but the last one are read in parallel, the queue waits for them on return.
+  //Queue of the caller gets all plain extents and is not waited
+  CUnixReadQueue LocalQueue(m_pSuper);
+  CUnixReadQueue& Queue = pQueue != NULL ? *pQueue : LocalQueue;
 
   while (BufSize)
   {
     unsigned int BlockOffset = static_cast<unsigned>(mod_u64(Offset, BlockSize));
     size_t MaxLen = CEIL_UP(BlockOffset + BufSize, BlockSize);
+    UINT64 Vcn = CEIL_DOWN64(Offset, BlockSize);
 
     CUnixExtent Extent;
-    CHECK_CALL(LoadBlocks(CEIL_DOWN64(Offset, BlockSize), MaxLen, &Extent, bFork, false));
+    if (bNext)
+    {
+      //Extent is already loaded while merging the previous one
+      Extent = Next;
+      bNext = false;
+    }
+    else
+      CHECK_CALL(LoadBlocks(Vcn, MaxLen, &Extent, bFork, false));
 
     if (Extent.Len == 0)
       break;
 
     assert(Extent.Len <= MaxLen);
+
+    //Merge following extents adjacent on disk (and by crypto id) into one read
+    while (Extent.Lcn != SPARSE_LCN && Extent.Len < MaxLen && Extent.Len < MaxIoLen)
+    {
+      CHECK_CALL(LoadBlocks(Vcn + Extent.Len, MaxLen - Extent.Len, &Next, bFork, false));
+
+      if (Next.Len == 0)
+        break;
+
+      bNext = true;
+      if (Next.Lcn != Extent.Lcn + Extent.Len || Extent.Len + Next.Len > MaxIoLen || Next.IsEncrypted != Extent.IsEncrypted
+        || (Extent.IsEncrypted && Next.CryptoId != Extent.CryptoId + Extent.Len))
+        break;
+
+      Extent.Len += Next.Len;
+      bNext = false;
+    }
     UINT64 LastByte = static_cast<UINT64>(Extent.Len) << m_pSuper->m_Log2OfCluster;
     size_t Bytes = LastByte - BlockOffset > BufSize ? BufSize : static_cast<size_t>(LastByte - BlockOffset);
 
-    if (Extent.Lcn != SPARSE_LCN)
-      CHECK_CALL(m_pVol->ReadData((Extent.Lcn << m_pSuper->m_Log2OfCluster) + BlockOffset, pBuffer, Bytes, Extent.IsEncrypted, Extent.CryptoId));
-    else
+    if (Extent.Lcn == SPARSE_LCN)
       Memzero2(pBuffer, Bytes);
+    else if ((pQueue != NULL || Bytes < BufSize) && (!Extent.IsEncrypted || !m_pVol->IsEncrypted()))
+      CHECK_CALL(Queue.Read((Extent.Lcn << m_pSuper->m_Log2OfCluster) + BlockOffset, pBuffer, Bytes));
+    else
+      CHECK_CALL(m_pVol->ReadData((Extent.Lcn << m_pSuper->m_Log2OfCluster) + BlockOffset, pBuffer, Bytes, Extent.IsEncrypted, Extent.CryptoId));
 
     pBuffer = Add2Ptr(pBuffer, Bytes);
     BufSize -= Bytes;
@@ -746,6 +794,9 @@ int CApfsInode::ReadData(
     OutSize += Bytes;
   }
 
+  if (pQueue == NULL)
+    CHECK_CALL(Queue.Wait());
+
   if (OutLen)
     *OutLen = OutSize;
   return Status;
@@ -779,6 +830,23 @@ int CApfsInode::ReadWriteData(
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+int CApfsInode::ReadDataAsync(
+    IN UINT64           Offset,
+    IN size_t*          OutLen,
+    IN void*            pBuffer,
+    IN size_t           BufSize,
+    IN CUnixReadQueue*  pQueue,
+    IN bool             bFork
+    )
+{
+  if (pBuffer == NULL)
+    return ERR_BADPARAMS;
+
+  return ReadData(Offset, OutLen, pBuffer, BufSize, bFork, pQueue);
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 int CApfsInode::GetExtent(
     IN  UINT64        Id,
@@ -946,7 +1014,16 @@ int CApfsInode::FindExtent(
   ULOG_TRACE((GetLog(), "FindExtent r=%" PLL "x: Vcn=%" PLL "x, Len=%" PZZ "x%s", Id, Vcn, Len, bAllocate ? ", alloc":""));
 
   CUnixExtent Extent;
+#ifdef UFSD_APFS_RO
+  //Random reads of data stream are mapped by extent map, sequential ones go through the current leaf of the tree
+  const bool bDataStream = Id == m_pInode->ai_extent_id;
+  if (bDataStream && (Vcn > m_NextVcn || Vcn + 1 < m_NextVcn) && CanLoadExtentMap())
+    CHECK_CALL(LoadExtentMap());
+
+  int Status = bDataStream && m_pExtentMap != NULL ? GetMappedExtent(Vcn, Extent) : GetExtent(Id, Vcn << m_pSuper->m_Log2OfCluster, Extent);
+#else
   int Status = GetExtent(Id, Vcn << m_pSuper->m_Log2OfCluster, Extent);
+#endif
 
   if (UFSD_SUCCESS(Status))
   {
@@ -964,7 +1041,7 @@ int CApfsInode::FindExtent(
       {
         if (!bAllocate)
         {
-          pOutExtent->Len = Len > 0 ? MIN(Extent.Len, Len) : static_cast<size_t>(ExtentEnd - Vcn);
+          pOutExtent->Len = Len > 0 ? static_cast<size_t>(MIN(ExtentEnd - Vcn, Len)) : static_cast<size_t>(ExtentEnd - Vcn);
           pOutExtent->Lcn = SPARSE_LCN;
         }
 #ifndef UFSD_APFS_RO
@@ -1011,12 +1088,172 @@ int CApfsInode::FindExtent(
     Status = ERR_NOERROR;
   }
 
+#ifdef UFSD_APFS_RO
+  if (bDataStream)
+    m_NextVcn = Vcn + pOutExtent->Len;
+#endif
+
   ULOG_TRACE((GetLog(), "FindExtent -> Lcn=%" PLL "x,%s Len=%" PZZ "x", pOutExtent->Lcn, pOutExtent->IsAllocated? "new":"", pOutExtent->Len));
 
   return Status;
 }
 
 
+#ifdef UFSD_APFS_RO
+/////////////////////////////////////////////////////////////////////////////
+int CApfsInode::LoadExtentMap()
+{
+  CApfsSuperBlock* Super = reinterpret_cast<CApfsSuperBlock*>(m_pSuper);
+  CSimpleSearchKey Key(m_Mm, m_pInode->ai_extent_id, ApfsExtent);
+  apfs_extent_key* k;
+  apfs_extent_data* d;
+  int Status;
+
+  CApfsTreeEnum* pEnum = new(m_Mm) CApfsTreeEnum(Super);
+  CHECK_PTR(pEnum);
+  CHECK_CALL_EXIT(pEnum->Init(GetTree()));
+  CHECK_CALL_EXIT(pEnum->StartEnumByKey(&Key, SEARCH_KEY_EQ));
+
+  while (UFSD_SUCCESS(Status = pEnum->EnumNextPtrByKey((void**)&k, (void**)&d)))
+  {
+    if (m_ExtentMapCount * sizeof(ApfsMappedExtent) == m_ExtentMapBytes)
+    {
+      //Grow the map twice
+      size_t Bytes = m_ExtentMapBytes ? 2 * m_ExtentMapBytes : 16 * sizeof(ApfsMappedExtent);
+      ApfsMappedExtent* pMap = NULL;
+
+      if (Super->ReserveExtentMap(Bytes))
+      {
+        pMap = reinterpret_cast<ApfsMappedExtent*>(Malloc2(Bytes));
+        if (pMap == NULL)
+          Super->ReleaseExtentMap(Bytes);
+      }
+
+      if (pMap == NULL)
+      {
+        ULOG_DEBUG1((GetLog(), "r=%" PLL "x: no memory for extent map of %" PZZ "u extents", m_Id, m_ExtentMapCount));
+        FreeExtentMap();
+        m_bExtentMapMiss = true;
+        m_ExtentMapMissFreed = Super->m_ExtentMapsFreed;
+        Status = ERR_NOERROR;
+        goto Exit;
+      }
+
+      if (m_pExtentMap != NULL)
+        Memcpy2(pMap, m_pExtentMap, m_ExtentMapBytes);
+      Free2(m_pExtentMap);
+      Super->ReleaseExtentMap(m_ExtentMapBytes);
+      m_pExtentMap = pMap;
+      m_ExtentMapBytes = Bytes;
+    }
+
+    ApfsMappedExtent* e = m_pExtentMap + m_ExtentMapCount++;
+    e->Vcn = CPU2LE(k->file_offset) >> m_pSuper->m_Log2OfCluster;
+    e->Lcn = CPU2LE(d->ed_block);
+    e->CryptoId = CPU2LE(d->ed_crypto_id);
+    e->Len = CPU2LE(d->ed_size) >> m_pSuper->m_Log2OfCluster;
+    if (FlagOn(CPU2LE(d->ed_flags), EXTENT_FLAG_ENCRYPTED))
+      SetFlag(e->Len, APFS_MAPPED_EXTENT_ENCRYPTED);
+  }
+
+  if (Status == ERR_NOTFOUND)
+    Status = ERR_NOERROR;
+
+Exit:
+  delete pEnum;
+
+  if (!UFSD_SUCCESS(Status))
+    FreeExtentMap();
+  else if (m_pExtentMap != NULL)
+  {
+    ++Super->m_ExtentMapsLoaded;
+    m_bExtentMapMiss = false;
+  }
+  else if (!m_bExtentMapMiss)
+    m_bNoExtentMap = true;              //no extents
+
+  return Status;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void CApfsInode::FreeExtentMap()
+{
+  if (m_pExtentMap == NULL)
+    return;
+
+  CApfsSuperBlock* Super = reinterpret_cast<CApfsSuperBlock*>(m_pSuper);
+  Free2(m_pExtentMap);
+  Super->ReleaseExtentMap(m_ExtentMapBytes);
+  ++Super->m_ExtentMapsFreed;
+  m_pExtentMap = NULL;
+  m_ExtentMapCount = m_ExtentMapBytes = 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+bool CApfsInode::CanLoadExtentMap() const
+{
+  if (m_pExtentMap != NULL || m_bNoExtentMap)
+    return false;
+
+  return !m_bExtentMapMiss || m_ExtentMapMissFreed != reinterpret_cast<CApfsSuperBlock*>(m_pSuper)->m_ExtentMapsFreed;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void CApfsInode::Release()
+{
+  //Parked inodes (up to INODES_CACHE_LIM) must not hold the budget, next open loads the map again
+  if (GetRefCount() == 1)
+  {
+    FreeExtentMap();
+    m_bNoExtentMap = m_bExtentMapMiss = false;
+  }
+
+  CUnixInode::Release();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+int CApfsInode::GetMappedExtent(
+    IN  UINT64        Vcn,
+    OUT CUnixExtent&  Extent
+    ) const
+{
+  //Find last extent with e->Vcn <= Vcn
+  size_t Lo = 0;
+  size_t Hi = m_ExtentMapCount;
+
+  while (Lo < Hi)
+  {
+    size_t Mid = (Lo + Hi) / 2;
+    if (m_pExtentMap[Mid].Vcn <= Vcn)
+      Lo = Mid + 1;
+    else
+      Hi = Mid;
+  }
+
+  if (Lo == 0)
+    return ERR_NOTFOUND;
+
+  const ApfsMappedExtent* e = m_pExtentMap + Lo - 1;
+  ++reinterpret_cast<CApfsSuperBlock*>(m_pSuper)->m_ExtentMapHits;
+
+  Extent.Id  = m_pInode->ai_extent_id;
+  Extent.Vcn = e->Vcn;
+  Extent.Lcn = e->Lcn;
+  Extent.Len = static_cast<size_t>(e->Len & ~APFS_MAPPED_EXTENT_ENCRYPTED);
+  Extent.CryptoId    = e->CryptoId;
+  Extent.IsAllocated = false;
+  Extent.IsEncrypted = FlagOn(e->Len, APFS_MAPPED_EXTENT_ENCRYPTED);
+  Extent.pData       = NULL;
+
+  return ERR_NOERROR;
+}
+#endif
+
+
 /////////////////////////////////////////////////////////////////////////////
 int CApfsInode::ReadCompressedData(
     IN  UINT64  Offset,
@@ -1172,19 +1409,9 @@ int CApfsInode::ReadResourceCompressedData(
   int Status = ERR_NOERROR;
 
   InodeXAttr* xData = NULL;
-  CHECK_CALL(GetXAttr(XATTR_FORK, XATTR_FORK_LEN, &xData));
-
-  if (m_pCmpAttr->type == ResourceForkZlibData)
-    CHECK_CALL(ReadZlibBlockInfo(xData, &Blocks, &Entries, &CmpBufSize));
-  else if (m_pCmpAttr->type == ResourceForkLZData)
-    CHECK_CALL(ReadLZBlockInfo(xData, &Blocks, &Entries, &CmpBufSize));
-  else
-  {
-    assert(!"Unknown compression type");
-    return ERR_NOTIMPLEMENTED;
-  }
-
-  assert(0 != CmpBufSize);
+  void* DecmpBuf = NULL;
+  void* CmpBuf = NULL;
+  CApfsChunkCache* Cache = reinterpret_cast<CApfsSuperBlock*>(m_pSuper)->GetChunkCache();
 
   UINT64 FirstBlock = CEIL_DOWN64(off, APFS_UNCOMPRESS_BUFFER_SIZE);
   UINT64 WantedBlocks = CEIL_UP64(off + Size, APFS_UNCOMPRESS_BUFFER_SIZE) - FirstBlock;
@@ -1192,16 +1419,47 @@ int CApfsInode::ReadResourceCompressedData(
   size_t BlockOffset = static_cast<size_t>(mod_u64(off, APFS_UNCOMPRESS_BUFFER_SIZE));
   size_t offset = 0;
 
-  void* DecmpBuf = Malloc2(APFS_UNCOMPRESS_BUFFER_SIZE);
-  void* CmpBuf = Malloc2(CmpBufSize);
-  CHECK_PTR_EXIT(DecmpBuf);
-  CHECK_PTR_EXIT(CmpBuf);
-
   while ((CurBlock < FirstBlock + WantedBlocks) &&
-         (CurBlock <= Entries))
+         (Blocks == NULL || CurBlock <= Entries))
   {
     size_t CmpBlockOffset, CmpBlockSize = 0;
     size_t Bytes;
+    size_t BytesToCopy = (Size - offset > APFS_UNCOMPRESS_BUFFER_SIZE - BlockOffset) ?
+      APFS_UNCOMPRESS_BUFFER_SIZE - BlockOffset :
+      Size - offset;
+
+    if (Cache && Cache->Lookup(m_VolId, GetInodeId(), CurBlock, BlockOffset, BytesToCopy, Add2Ptr(pBuffer, offset)))
+    {
+      BlockOffset = 0;
+      ++CurBlock;
+      offset += BytesToCopy;
+      continue;
+    }
+
+    //Block table and buffers are needed only when some chunk is not cached
+    if (Blocks == NULL)
+    {
+      CHECK_CALL_EXIT(GetXAttr(XATTR_FORK, XATTR_FORK_LEN, &xData));
+
+      if (m_pCmpAttr->type == ResourceForkZlibData)
+        CHECK_CALL_EXIT(ReadZlibBlockInfo(xData, &Blocks, &Entries, &CmpBufSize));
+      else if (m_pCmpAttr->type == ResourceForkLZData)
+        CHECK_CALL_EXIT(ReadLZBlockInfo(xData, &Blocks, &Entries, &CmpBufSize));
+      else
+      {
+        assert(!"Unknown compression type");
+        Status = ERR_NOTIMPLEMENTED;
+        goto Exit;
+      }
+
+      assert(0 != CmpBufSize);
+
+      CHECK_PTR_EXIT(DecmpBuf = Malloc2(APFS_UNCOMPRESS_BUFFER_SIZE));
+      CHECK_PTR_EXIT(CmpBuf = Malloc2(CmpBufSize));
+
+      if (CurBlock > Entries)
+        break;
+    }
 
     if (m_pCmpAttr->type == ResourceForkZlibData)
     {
@@ -1254,11 +1512,9 @@ int CApfsInode::ReadResourceCompressedData(
       *(unsigned int*)OutPtr = APFS_LZFSE_ENDOFSTREAM_BLOCK_MAGIC;
     }
 
-    size_t BytesToCopy = (Size - offset > APFS_UNCOMPRESS_BUFFER_SIZE - BlockOffset) ?
-      APFS_UNCOMPRESS_BUFFER_SIZE - BlockOffset :
-      Size - offset;
-
     CHECK_CALL_EXIT(Compressor->Decompress(CmpBuf, CmpBlockSize, DecmpBuf, APFS_UNCOMPRESS_BUFFER_SIZE, &Bytes));
+    if (Cache)
+      Cache->Insert(m_VolId, GetInodeId(), CurBlock, DecmpBuf, Bytes);
     Memcpy2(Add2Ptr(pBuffer, offset), Add2Ptr(DecmpBuf, BlockOffset), BytesToCopy);
 
     BlockOffset = 0;
@@ -25,6 +25,29 @@ namespace UFSD
 namespace apfs
 {
 
+//Default max size of one data read merged from adjacent extents
+#define APFS_MAX_IO_SIZE            0x100000
+
+#ifdef UFSD_APFS_RO
+//Default memory budget of extent maps of all inodes for every mount
+#ifndef UFSD_SMALL_CACHE
+#define APFS_EXTENT_MAP_SIZE        0x1000000
+#else
+#define APFS_EXTENT_MAP_SIZE        0x100000
+#endif
+
+//Extent of data stream in extent map of inode
+struct ApfsMappedExtent
+{
+  UINT64          Vcn;
+  UINT64          Lcn;            //0 for sparse extent
+  UINT64          CryptoId;
+  UINT64          Len;            //Length in blocks and APFS_MAPPED_EXTENT_ENCRYPTED flag
+};
+
+#define APFS_MAPPED_EXTENT_ENCRYPTED  PU64(0x8000000000000000)
+#endif
+
 //XAttr for inode cache
 struct InodeXAttr : UMemBased<InodeXAttr>
 {
@@ -96,6 +119,16 @@ class CApfsInode : public CUnixInode
   mutable bool          m_bClonedData;         //data is cloned
   mutable bool          m_bClonedFlagsValid;   //m_bClonedData and xAttr->m_bCloned flags for all ea are valid
 
+#ifdef UFSD_APFS_RO
+  ApfsMappedExtent*     m_pExtentMap;          //All extents of data stream sorted by Vcn. Loaded on first random read
+  size_t                m_ExtentMapCount;      //Number of extents in m_pExtentMap
+  size_t                m_ExtentMapBytes;      //Bytes of m_pExtentMap charged to the mount budget
+  UINT64                m_NextVcn;             //Vcn next to the last mapped one (to detect random reads)
+  bool                  m_bNoExtentMap;        //Data stream has no extents to map
+  bool                  m_bExtentMapMiss;      //Extent map can't be loaded (budget is exhausted)
+  size_t                m_ExtentMapMissFreed;  //Super->m_ExtentMapsFreed at the last budget miss
+#endif
+
 public:
   CApfsInode(api::IBaseMemoryManager* Mm);
   virtual ~CApfsInode();
@@ -107,6 +140,11 @@ public:
       bool                fCreate = false
       );
 
+#ifdef UFSD_APFS_RO
+  //Return extent map to the budget before the inode is parked in m_InodesRankList
+  virtual void Release();
+#endif
+
   int InitCompression();
 
   CApfsVolumeSb* GetVolume() const { return m_pVol; }
@@ -122,6 +160,15 @@ public:
       IN  bool      bFork = false
       );
 
+  virtual int ReadDataAsync(
+      IN  UINT64          Offset,
+      OUT size_t*         OutLen,
+      OUT void*           pBuffer,
+      IN  size_t          Size,
+      IN  CUnixReadQueue* pQueue,
+      IN  bool            bFork = false
+      );
+
   virtual int LoadBlocks(
       IN  UINT64    Vcn,
       IN  size_t    Len,
@@ -275,12 +322,14 @@ public:
   }
 
 private:
+  //Plain extents are left in flight in pQueue if it is set
   int ReadData(
-      IN  UINT64    Offset,
-      OUT size_t*   OutLen,
-      OUT void*     pBuffer,
-      IN  size_t    Size,
-      IN  bool      bFork = false
+      IN  UINT64          Offset,
+      OUT size_t*         OutLen,
+      OUT void*           pBuffer,
+      IN  size_t          Size,
+      IN  bool            bFork = false,
+      IN  CUnixReadQueue* pQueue = NULL
       );
 
   bool IsClonedInternal(UINT64 ExtentId) const;
@@ -308,6 +357,23 @@ private:
       IN  bool            bAllocate
       );
 
+#ifdef UFSD_APFS_RO
+  //Load all extents of data stream into m_pExtentMap if the budget allows
+  int LoadExtentMap();
+
+  //Free m_pExtentMap and return its memory to the budget
+  void FreeExtentMap();
+
+  //Extent map is not loaded but may be. After a budget miss it is retried once another map is freed
+  bool CanLoadExtentMap() const;
+
+  //GetExtent for data stream by m_pExtentMap
+  int GetMappedExtent(
+      IN  UINT64          Vcn,
+      OUT CUnixExtent&    Extent
+      ) const;
+#endif
+
   int GetExtentId(
       OUT UINT64*  Id,
       IN  bool     bFork = false
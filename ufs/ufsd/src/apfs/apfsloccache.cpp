@@ -0,0 +1,185 @@
+// <copyright file="apfsloccache.cpp" company="Paragon Software Group">
+//
+// Copyright (c) 2002-2019 Paragon Software Group, All rights reserved.
+//
+// The license for this file is defined in a separate document "LICENSE.txt"
+// located at the root of the project.
+//
+// </copyright>
+/////////////////////////////////////////////////////////////////////////////
+//
+// Revision History :
+//
+//     17-October-2026 - created.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "../h/versions.h"
+
+#ifdef UFSD_APFS
+
+#ifdef UFSD_TRACE_ERROR
+static const char s_pFileName[] = __FILE__ ",$Revision: 1 $";
+#endif
+
+#include <ufsd.h>
+
+#include "../h/utrace.h"
+#include "../h/assert.h"
+#include "../h/uerrors.h"
+#include "../h/uavl.h"
+
+#include "apfs_struct.h"
+#include "apfsloccache.h"
+
+namespace UFSD
+{
+
+namespace apfs
+{
+
+
+/////////////////////////////////////////////////////////////////////////////
+CApfsLocationCache::CApfsLocationCache(api::IBaseMemoryManager* Mm)
+  : UMemBased<CApfsLocationCache>(Mm)
+  , m_pEntries(NULL)
+  , m_MaxEntries(0)
+  , m_UsedEntries(0)
+  , m_Hits(0)
+  , m_Misses(0)
+{
+  m_LruList.init();
+  m_FreeList.init();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+CApfsLocationCache::~CApfsLocationCache()
+{
+  Free2(m_pEntries);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+int
+CApfsLocationCache::Init(size_t MaxBytes)
+{
+  Clear();
+  Free2(m_pEntries);
+  m_pEntries = NULL;
+
+  m_MaxEntries = MaxBytes / sizeof(Entry);
+  if (m_MaxEntries == 0)
+    return ERR_NOERROR;
+
+  CHECK_PTR(m_pEntries = reinterpret_cast<Entry*>(Malloc2(m_MaxEntries * sizeof(Entry))));
+
+  return ERR_NOERROR;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+bool
+CApfsLocationCache::Lookup(UINT64 Id, apfs_location_table_key* Key, apfs_location_table_data* Data)
+{
+  avl_link* n = avl_lookup(&m_Tree, Id);
+
+  if (n == NULL)
+  {
+    ++m_Misses;
+    return false;
+  }
+
+  Entry* e = avl_entry(n, Entry, m_TreeEntry);
+
+  //Move to the head of lru list
+  e->m_LruEntry.remove();
+  e->m_LruEntry.insert_after(&m_LruList);
+
+  if (Data)
+    Memcpy2(Data, &e->m_Data, sizeof(apfs_location_table_data));
+  if (Key)
+  {
+    Key->ltk_id = Id;
+    Key->ltk_checkpoint = e->m_Checkpoint;
+  }
+
+  ++m_Hits;
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void
+CApfsLocationCache::Insert(UINT64 Id, UINT64 Checkpoint, const apfs_location_table_data* Data)
+{
+  if (m_MaxEntries == 0)
+    return;
+
+  Entry* e;
+  avl_link* n = avl_lookup(&m_Tree, Id);
+
+  if (n != NULL)
+  {
+    e = avl_entry(n, Entry, m_TreeEntry);
+    e->m_LruEntry.remove();
+  }
+  else
+  {
+    if (!m_FreeList.is_empty())
+    {
+      e = list_entry(m_FreeList.next, Entry, m_LruEntry);
+      e->m_LruEntry.remove();
+    }
+    else if (m_UsedEntries < m_MaxEntries)
+      e = m_pEntries + m_UsedEntries++;
+    else
+    {
+      //Reuse the least recently used entry
+      e = list_entry(m_LruList.prev, Entry, m_LruEntry);
+      e->m_LruEntry.remove();
+      m_Tree.remove(&e->m_TreeEntry);
+    }
+
+    e->m_TreeEntry.key = Id;
+    avl_insert(&m_Tree, &e->m_TreeEntry);
+  }
+
+  e->m_Checkpoint = Checkpoint;
+  Memcpy2(&e->m_Data, Data, sizeof(apfs_location_table_data));
+  e->m_LruEntry.insert_after(&m_LruList);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void
+CApfsLocationCache::Remove(UINT64 Id)
+{
+  avl_link* n = avl_lookup(&m_Tree, Id);
+
+  if (n != NULL)
+  {
+    Entry* e = avl_entry(n, Entry, m_TreeEntry);
+    e->m_LruEntry.remove();
+    m_Tree.remove(n);
+    e->m_LruEntry.insert_after(&m_FreeList);
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void
+CApfsLocationCache::Clear()
+{
+  m_Tree.init();
+  m_LruList.init();
+  m_FreeList.init();
+  m_UsedEntries = 0;
+}
+
+} // namespace apfs
+
+} // namespace UFSD
+
+#endif
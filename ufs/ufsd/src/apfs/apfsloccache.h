@@ -0,0 +1,83 @@
+// <copyright file="apfsloccache.h" company="Paragon Software Group">
+//
+// Copyright (c) 2002-2019 Paragon Software Group, All rights reserved.
+//
+// The license for this file is defined in a separate document "LICENSE.txt"
+// located at the root of the project.
+//
+// </copyright>
+/////////////////////////////////////////////////////////////////////////////
+//
+// Revision History :
+//
+//     17-October-2026 - created.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef __UFSD_APFS_LOC_CACHE_H
+#define __UFSD_APFS_LOC_CACHE_H
+
+namespace UFSD
+{
+
+namespace apfs
+{
+
+//Default memory budget of location cache for every volume
+#ifndef UFSD_SMALL_CACHE
+#define APFS_LOCATION_CACHE_SIZE    0x100000
+#else
+#define APFS_LOCATION_CACHE_SIZE    0x10000
+#endif
+
+//Cache of resolved object ids: oid -> (checkpoint, location) with max checkpoint
+//Entries are preallocated once, the least recently used one is reused when cache is full
+class CApfsLocationCache : public UMemBased<CApfsLocationCache>
+{
+  struct Entry
+  {
+    avl_link64                m_TreeEntry;            //key is object id
+    list_head                 m_LruEntry;             //position in m_LruList
+    UINT64                    m_Checkpoint;
+    apfs_location_table_data  m_Data;
+  };
+
+  Entry*                 m_pEntries;                 //Array of all entries
+  size_t                 m_MaxEntries;               //Number of entries in m_pEntries
+  size_t                 m_UsedEntries;              //Number of entries ever taken from m_pEntries
+  avl_tree               m_Tree;                     //Used entries sorted by object id
+  list_head              m_LruList;                  //Used entries, most recently used first
+  list_head              m_FreeList;                 //Entries released by Remove
+
+public:
+  UINT64                 m_Hits;
+  UINT64                 m_Misses;
+
+  CApfsLocationCache(api::IBaseMemoryManager* Mm);
+  ~CApfsLocationCache();
+
+  //Allocate entries which fit into MaxBytes
+  int Init(size_t MaxBytes);
+
+  //Returns true and fills Key/Data (cpu order) if Id is cached
+  bool Lookup(UINT64 Id, apfs_location_table_key* Key, apfs_location_table_data* Data);
+
+  //Add or update location of Id (cpu order)
+  void Insert(UINT64 Id, UINT64 Checkpoint, const apfs_location_table_data* Data);
+
+  //Forget location of Id
+  void Remove(UINT64 Id);
+
+  //Forget all locations
+  void Clear();
+
+  size_t GetCount() const { return m_Tree.Count; }
+  size_t GetSize() const { return m_MaxEntries * sizeof(Entry); }
+};
+
+} // namespace apfs
+
+} // namespace UFSD
+
+#endif
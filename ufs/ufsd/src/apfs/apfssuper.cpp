@@ -43,6 +43,8 @@ static const char s_pFileName[] = __FILE__ ",$Revision: 332054 $";
 #include "apfs.h"
 #include "apfstable.h"
 #include "apfsbplustree.h"
+#include "apfsfsum.h"
+#include "apfschunkcache.h"
 #ifdef BASE_BIGENDIAN
 #include "apfsbe.h"
 #endif
@@ -63,14 +65,31 @@ CApfsSuperBlock::CApfsSuperBlock(IN api::IBaseMemoryManager* mm, IN api::IBaseLo
   , m_MountedVolumesCount(0)
   , m_TotalVolumesCount(0)
   , m_pVolSuper(NULL)
+  , m_pChunkCache(NULL)
 #ifndef UFSD_APFS_RO
   , m_pBlockBitmap(NULL)
 #endif
   , m_SBMapBlockNumber(0)
   , m_CSBBlockNumber(0)
+  , m_MaxIoSize(APFS_MAX_IO_SIZE)
+#ifdef UFSD_APFS_RO
+  , m_bTreePin(false)
+  , m_TreePinLevels(0)
+  , m_TreePinBytes(0)
+  , m_TreePinnedBytes(0)
+  , m_ExtentMapSize(APFS_EXTENT_MAP_SIZE)
+  , m_ExtentMapBytes(0)
+#endif
   , m_pFs(NULL)
   , m_Cf(NULL)
   , m_bNeedFixup(false)
+#ifdef UFSD_APFS_RO
+  , m_TreePinnedTables(0)
+  , m_TreePinHits(0)
+  , m_ExtentMapsLoaded(0)
+  , m_ExtentMapsFreed(0)
+  , m_ExtentMapHits(0)
+#endif
 {
 }
 
@@ -78,6 +97,25 @@ CApfsSuperBlock::CApfsSuperBlock(IN api::IBaseMemoryManager* mm, IN api::IBaseLo
 /////////////////////////////////////////////////////////////////////////////
 int CApfsSuperBlock::Dtor()
 {
+  //Released inodes refer to volumes, delete them first
+  ULOG_TRACE((GetLog(), "Inode cache: %u released inodes, %" PLL "u hits, %" PLL "u misses",
+    m_InodesCount, m_InodesHits, m_InodesMisses));
+  size_t BlocksBytes;
+  unsigned int BlocksCount;
+  UINT64 BlocksHits, BlocksMisses, BlocksEvictions;
+  GetBlockCacheCounters(&BlocksBytes, &BlocksCount, &BlocksHits, &BlocksMisses, &BlocksEvictions);
+  ULOG_TRACE((GetLog(), "Block cache: %" PZZ "u of %" PZZ "u bytes, %" PLL "u hits, %" PLL "u misses, %" PLL "u evictions, %" PLL "u buffers from %" PLL "u slabs",
+    BlocksBytes, GetBlockCacheSize(), BlocksHits, BlocksMisses, BlocksEvictions, m_BlockSlab.m_Allocs, m_BlockSlab.m_SlabAllocs));
+#ifdef UFSD_APFS_RO
+  if (m_bTreePin)
+    ULOG_TRACE((GetLog(), "Pinned tree tables: %" PZZ "u tables, %" PZZ "u bytes, %" PLL "u hits",
+      m_TreePinnedTables, m_TreePinnedBytes, m_TreePinHits));
+  if (m_ExtentMapsLoaded != 0)
+    ULOG_TRACE((GetLog(), "Extent maps: %" PZZ "u loaded, %" PZZ "u bytes now, %" PLL "u hits",
+      m_ExtentMapsLoaded, m_ExtentMapBytes, m_ExtentMapHits));
+#endif
+  DropReleasedInodes();
+
   int Status = Flush();
 #ifndef UFSD_APFS_RO
   CheckpointFixup(3);
@@ -87,9 +125,22 @@ int CApfsSuperBlock::Dtor()
   Free2(m_pCSB);
   Free2(m_pSBEntry);
 
-  for (unsigned int i = 0; i < m_TotalVolumesCount; i++)
-    m_pVolSuper[i].Destroy();
-  Free2(m_pVolSuper);
+  if (m_pVolSuper)
+  {
+    for (unsigned int i = 0; i < m_TotalVolumesCount; i++)
+    {
+      m_pVolSuper[i].Destroy();
+      m_pVolSuper[i].~CApfsVolumeSb();
+    }
+    Free2(m_pVolSuper);
+  }
+
+  if (m_pChunkCache)
+  {
+    ULOG_TRACE((GetLog(), "Chunk cache: %" PZZ "u chunks, %" PLL "u hits, %" PLL "u misses",
+      m_pChunkCache->GetCount(), m_pChunkCache->m_Hits, m_pChunkCache->m_Misses));
+    delete m_pChunkCache;
+  }
 
 #ifndef UFSD_APFS_RO
   delete m_pBlockBitmap;
@@ -107,6 +158,9 @@ int CApfsSuperBlock::Init(
 {
   m_bInited = false;
 
+  //ReInit may select another checkpoint: inodes kept after release hold records of the previous one
+  DropReleasedInodes();
+
   m_Rw      = pFs->m_Rw;
   m_Strings = pFs->m_Strings;
   m_Time    = pFs->m_Time;
@@ -270,7 +324,10 @@ int CApfsSuperBlock::Init(
     CHECK_PTR(m_pVolSuper = reinterpret_cast<CApfsVolumeSb*>(Malloc2(m_TotalVolumesCount * sizeof(CApfsVolumeSb))));
 
     for (unsigned char i = 0; i < m_TotalVolumesCount; i++)
+    {
+      new(m_pVolSuper + i) CApfsVolumeSb();
       m_pVolSuper[i].Init(this, i);
+    }
   }
 
   apfs_location_table_data* VolData;
@@ -313,9 +370,48 @@ int CApfsSuperBlock::Init(
   if (!m_bInited && bHasEncryptedVolumes && m_pCSB->sb_keybag_block != 0 && m_pCSB->sb_keybag_count != 0)
     CHECK_CALL( LoadEncryptionKeys(&m_pFs->m_Params, Flags) );
 
+  if (m_pFs->m_Params.MaxIoSize != 0)
+    m_MaxIoSize = m_pFs->m_Params.MaxIoSize;
+
+#ifdef UFSD_APFS_RO
+  //Upper levels of trees are pinned on first lookups, so budget is set before trees
+  m_TreePinLevels = m_pFs->m_Params.TreePinLevels;
+  m_TreePinBytes = m_pFs->m_Params.TreePinBytes;
+  m_bTreePin = m_TreePinLevels != 0 || m_TreePinBytes != 0;
+
+  if (m_pFs->m_Params.ExtentMapSize != 0)
+    m_ExtentMapSize = m_pFs->m_Params.ExtentMapSize;
+#endif
+
   for (unsigned char i = 0; i < m_MountedVolumesCount; i++)
     CHECK_CALL(m_pVolSuper[i].InitTrees());
 
+  if (m_pFs->m_Params.InodeCacheLimit != 0)
+    m_InodesCacheLimit = m_pFs->m_Params.InodeCacheLimit;
+
+  if (m_pFs->m_Params.ReadAheadMin != 0)
+    m_ReadAheadMin = m_pFs->m_Params.ReadAheadMin;
+  if (m_pFs->m_Params.ReadAheadMax != 0)
+    m_ReadAheadMax = m_pFs->m_Params.ReadAheadMax;
+  if (m_pFs->m_Params.ReadAheadSize != 0)
+    m_ReadAheadSize = m_pFs->m_Params.ReadAheadSize;
+
+  if (m_pFs->m_Params.IoQueueDepth != 0)
+    SetAsyncIoDepth(m_pFs->m_Params.IoQueueDepth);
+
+  CHECK_CALL(SetBlockCachePolicy(m_pFs->m_Params.BlockCachePolicy));
+  if (m_pFs->m_Params.BlockCacheSize != 0)
+    CHECK_CALL(SetBlockCacheSize(m_pFs->m_Params.BlockCacheSize));
+
+  //Decompressed chunks are dropped on every (re)init
+  size_t ChunkCacheSize = m_pFs->m_Params.ChunkCacheSize;
+  if (ChunkCacheSize == 0)
+    ChunkCacheSize = APFS_CHUNK_CACHE_SIZE;
+
+  if (m_pChunkCache == NULL)
+    CHECK_PTR(m_pChunkCache = new(m_Mm) CApfsChunkCache(m_Mm));
+  m_pChunkCache->Init(ChunkCacheSize);
+
 #ifdef UFSD_APFS_TRACE
   //TraceApfs();
 #endif
@@ -569,7 +665,7 @@ int CApfsSuperBlock::CreateCacheBlock(
   {
     TRACE_ONLY(apfs_block_header* header = reinterpret_cast<apfs_block_header*>(pBlock->GetBuffer()));
     ULOG_ERROR((GetLog(), ERR_NOFSINTEGRITY, "Wrong checksum: BlockNum=0x%" PLL "x, Id=0x%" PLL "x, Checkpoint=0x%" PLL "x", Block, header->id, header->checkpoint_id));
-    pBlock->Release();
+    pBlock->DecReffCount();
     delete pBlock;
     return ERR_NOFSINTEGRITY;
   }
@@ -579,39 +675,14 @@ int CApfsSuperBlock::CreateCacheBlock(
 }
 
 
-/////////////////////////////////////////////////////////////////////////////
-#define APFS_MOD_VALUE (unsigned int)(-1)
-
-static unsigned int mod_u64_to_0xffffffff(UINT64 Val)
-{
-  unsigned int r = (Val >> 32) + (Val & APFS_MOD_VALUE);
-  return (r != APFS_MOD_VALUE) ? r : 0;
-}
-
 /////////////////////////////////////////////////////////////////////////////
 UINT64 CApfsSuperBlock::CreateFSum(
     IN void*  pData,
     IN size_t Size
     )
 {
-  register unsigned int* p = reinterpret_cast<unsigned int*>(pData);
-  Size /= 4;
-
-  volatile UINT64 sum1 = 0;
-  volatile UINT64 sum2 = 0;
-
-  for(size_t i = 2; i < Size; ++i)//skip first 8 bytes for checksumm
-  {
-    if((sum1 += p[i]) >= APFS_MOD_VALUE)
-      //normalization
-      sum1 -= APFS_MOD_VALUE;
-    sum2 += sum1;
-  }
-
-  sum2 = mod_u64_to_0xffffffff(sum2);
-  sum1 = APFS_MOD_VALUE - mod_u64_to_0xffffffff(sum1 + sum2);
-
-  UINT64 cs = (sum2 << 32) | sum1;
+  UINT64 cs = ApfsFletcher64(pData, Size);
+  assert(cs == ApfsFletcher64Scalar(pData, Size));
   return *(UINT64*)pData = cs;  // write new checksum
 }
 
@@ -48,6 +48,7 @@ namespace apfs
 #define APFS_MAX_SIZE_IN_BLOCKS    0xFFFFFFFF
 
 class CApfsFileSystem;
+class CApfsChunkCache;
 
 class CApfsSuperBlock : public CUnixSuperBlock
 {
@@ -58,6 +59,9 @@ class CApfsSuperBlock : public CUnixSuperBlock
 #ifdef UFSD_APFS_CHECK
   friend struct CCheckApfs;
 #endif
+#ifdef UFSD_APFS_SELFTEST
+  friend struct CApfsSelfTest;
+#endif
 
   apfs_sb*               m_pMSB;                     //Main superblock
   apfs_sb*               m_pCSB;                     //Current checkpoint superblock
@@ -68,6 +72,7 @@ class CApfsSuperBlock : public CUnixSuperBlock
   unsigned char          m_MountedVolumesCount;      //Number of mounted subvolumes
   unsigned char          m_TotalVolumesCount;        //Number of all volumes (mounted and not mounted)
   CApfsVolumeSb*         m_pVolSuper;                //Array of volume superblocks
+  CApfsChunkCache*       m_pChunkCache;              //Cache of decompressed chunks of compressed files
 
 #ifndef UFSD_APFS_RO
   CApfsBitmap*           m_pBlockBitmap;             //Block bitmap for apfs
@@ -75,6 +80,17 @@ class CApfsSuperBlock : public CUnixSuperBlock
 
   UINT64                 m_SBMapBlockNumber;         //Block number of current checkpoint superblock map
   UINT64                 m_CSBBlockNumber;           //Block number of current checkpoint superblock
+  size_t                 m_MaxIoSize;                //Max bytes of one data read merged from adjacent extents
+
+#ifdef UFSD_APFS_RO
+  bool                   m_bTreePin;                 //Keep upper levels of trees pinned in memory
+  unsigned int           m_TreePinLevels;            //Number of upper levels of trees kept pinned, root included (0 - not limited)
+  size_t                 m_TreePinBytes;             //Max bytes of pinned tables (0 - not limited)
+  size_t                 m_TreePinnedBytes;          //Bytes of tables pinned now
+
+  size_t                 m_ExtentMapSize;            //Max bytes of extent maps of all inodes
+  size_t                 m_ExtentMapBytes;           //Bytes of extent maps loaded now
+#endif
 
 public:
   CApfsFileSystem*       m_pFs;                      //Pointer to filesystem object
@@ -243,6 +259,52 @@ public:
   }
   unsigned char GetMountedVolumesCount() const { return m_MountedVolumesCount; }
   unsigned char GetTotalVolumesCount() const { return m_TotalVolumesCount; }
+  CApfsChunkCache* GetChunkCache() const { return m_pChunkCache; }
+  size_t GetMaxIoSize() const { return m_MaxIoSize; }
+
+#ifdef UFSD_APFS_RO
+  size_t                 m_TreePinnedTables;         //Number of tables pinned now
+  UINT64                 m_TreePinHits;              //Number of tree nodes served by pinned tables
+
+  //Checks if tables of Level are pinned in the tree with root on RootLevel
+  bool IsTreeLevelPinned(unsigned short RootLevel, unsigned short Level) const
+  {
+    return m_bTreePin && (m_TreePinLevels == 0 || static_cast<unsigned int>(RootLevel - Level) < m_TreePinLevels);
+  }
+
+  //Charge one more pinned table to the budget. Returns false if the budget is exhausted
+  bool ReserveTreePin()
+  {
+    if (m_TreePinBytes != 0 && m_TreePinnedBytes + GetBlockSize() > m_TreePinBytes)
+      return false;
+    m_TreePinnedBytes += GetBlockSize();
+    ++m_TreePinnedTables;
+    return true;
+  }
+
+  //Return pinned table to the budget
+  void ReleaseTreePin()
+  {
+    m_TreePinnedBytes -= GetBlockSize();
+    --m_TreePinnedTables;
+  }
+
+  size_t                 m_ExtentMapsLoaded;         //Number of extent maps loaded since mount
+  size_t                 m_ExtentMapsFreed;          //Number of extent maps freed since mount (budget misses are retried after it changes)
+  UINT64                 m_ExtentMapHits;            //Number of extents found in extent maps
+
+  //Charge Bytes of extent map to the budget. Returns false if the budget is exhausted
+  bool ReserveExtentMap(size_t Bytes)
+  {
+    if (m_ExtentMapBytes + Bytes > m_ExtentMapSize)
+      return false;
+    m_ExtentMapBytes += Bytes;
+    return true;
+  }
+
+  //Return Bytes of extent map to the budget
+  void ReleaseExtentMap(size_t Bytes) { m_ExtentMapBytes -= Bytes; }
+#endif
 
   virtual int ReadBytes(
       IN  UINT64  Offset,
@@ -251,7 +313,10 @@ public:
       ) const
   {
     assert(Offset + Bytes <= m_pCSB->sb_total_blocks << m_Log2OfCluster);
-    return m_Rw->ReadBytes(Offset, pBuffer, Bytes);
+    m_DeviceLock.Lock();
+    int Status = m_Rw->ReadBytes(Offset, pBuffer, Bytes);
+    m_DeviceLock.Unlock();
+    return Status;
   }
 
   virtual int ReadBytes(
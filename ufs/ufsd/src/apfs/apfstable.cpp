@@ -41,6 +41,15 @@ static const char s_pFileName[] = __FILE__ ",$Revision: 331853 $";
 #include "apfstable.h"
 #include "apfsbplustree.h"
 
+//
+// Vector units are not allowed in kernel without saving fpu state
+//
+#if !defined UFSD_DRIVER_LINUX && !defined KERNEL && (defined __x86_64__ || defined _M_X64) \
+  && (defined __clang__ || (defined __GNUC__ && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+  #define UFSD_APFS_OMAP_AVX2
+  #include <immintrin.h>
+#endif
+
 
 namespace UFSD
 {
@@ -86,6 +95,7 @@ CApfsTable::CApfsTable(CApfsTreeInternal *pTree)
     , m_bOrdered(false)
     , m_VolIndex(BLOCK_BELONGS_TO_CONTAINER)
 {
+  m_PinListEntry.init();
 }
 
 
@@ -209,6 +219,437 @@ void CApfsTable::GetItem(
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+//Comparators of raw disk keys for CApfsTable::FindDataIndexT
+//k1 and k2 are left and right operands of the same operators of CCommonSearchKey
+//heirs, so search results are the same as with virtual keys
+/////////////////////////////////////////////////////////////////////////////
+struct CKeyCmp
+{
+  api::IBaseMemoryManager*  m_Mm;
+  bool                      m_bCaseSensitive;
+
+  CKeyCmp(api::IBaseMemoryManager* Mm, bool bCaseSensitive)
+    : m_Mm(Mm)
+    , m_bCaseSensitive(bCaseSensitive)
+  {
+  }
+
+  //Same sign as StrCompare, but compares common part at once
+  int NameCompare(const unsigned char* str1, unsigned int len1, const unsigned char* str2, unsigned int len2) const
+  {
+    assert(MIN(len1, len2) != 0);
+    int Res = Memcmp2(str1, str2, MIN(len1, len2));
+    return Res != 0 ? Res : static_cast<int>(len1) - static_cast<int>(len2);
+  }
+};
+
+//CSimpleSearchKey (inodes and other records found by id only)
+struct CSimpleKeyCmp : CKeyCmp
+{
+  CSimpleKeyCmp(api::IBaseMemoryManager* Mm, bool bCaseSensitive) : CKeyCmp(Mm, bCaseSensitive) {}
+
+  bool Eq(const apfs_key* k1, const apfs_key* k2) const { return k1->id == CPU2LE(k2->id); }
+  bool Le(const apfs_key* k1, const apfs_key* k2) const { return IS_ID_LE(k1->id, k2->id); }
+  bool Gt(const apfs_key* k1, const apfs_key* k2) const { return IS_ID_GREATER(k1->id, k2->id); }
+
+  //Order of omap keys as pair (Hi, Lo): id with type in low bits, checkpoint is ignored
+  static const bool HasCheckpoint = false;
+  static UINT64 Hi(UINT64 Id) { return (GET_ID(Id) << 4) | GET_TYPE(Id); }
+};
+
+//CLocationSearchKey (omap)
+struct CLocationKeyCmp : CKeyCmp
+{
+  CLocationKeyCmp(api::IBaseMemoryManager* Mm, bool bCaseSensitive) : CKeyCmp(Mm, bCaseSensitive) {}
+
+  bool Eq(const apfs_key* k1, const apfs_key* k2) const
+  {
+    return k1->location.ltk_id == CPU2LE(k2->location.ltk_id) && k1->location.ltk_checkpoint == CPU2LE(k2->location.ltk_checkpoint);
+  }
+  bool Le(const apfs_key* k1, const apfs_key* k2) const
+  {
+    return k1->location.ltk_id < CPU2LE(k2->location.ltk_id) ||
+          (k1->location.ltk_id == CPU2LE(k2->location.ltk_id) && k1->location.ltk_checkpoint <= CPU2LE(k2->location.ltk_checkpoint));
+  }
+  bool Gt(const apfs_key* k1, const apfs_key* k2) const
+  {
+    return k1->location.ltk_id > CPU2LE(k2->location.ltk_id) ||
+          (k1->location.ltk_id == CPU2LE(k2->location.ltk_id) && k1->location.ltk_checkpoint > CPU2LE(k2->location.ltk_checkpoint));
+  }
+
+  //Order of omap keys as pair (Hi, Lo): id and checkpoint
+  static const bool HasCheckpoint = true;
+  static UINT64 Hi(UINT64 Id) { return Id; }
+};
+
+//CEntrySearchKey (directory entries). Names are compared only if hashes are equal
+struct CEntryKeyCmp : CKeyCmp
+{
+  CEntryKeyCmp(api::IBaseMemoryManager* Mm, bool bCaseSensitive) : CKeyCmp(Mm, bCaseSensitive) {}
+
+  bool Eq(const apfs_key* k1, const apfs_key* k2) const
+  {
+    const apfs_direntry_key* e1 = &k1->direntry;
+    const apfs_direntry_key* e2 = &k2->direntry;
+
+    if (e1->id != CPU2LE(e2->id) || e1->name_hash != e2->name_hash)
+      return false;
+
+    if (e1->name_len == 0 || e2->name_len == 0)
+      return true;
+
+    return e1->name_len == e2->name_len &&
+           IsNamesEqual(e1->name, e1->name_len - 1, e2->name, e2->name_len - 1, m_bCaseSensitive);
+  }
+  bool Le(const apfs_key* k1, const apfs_key* k2) const
+  {
+    const apfs_direntry_key* e1 = &k1->direntry;
+    const apfs_direntry_key* e2 = &k2->direntry;
+
+    if (e1->name_len == 0 || e2->name_len == 0)
+      return IS_ID_GREATER(CPU2LE(e2->id), e1->id) || (e1->id == CPU2LE(e2->id) && e1->name_hash <= static_cast<unsigned int>(e2->name_hash));
+
+    return IS_ID_GREATER(CPU2LE(e2->id), e1->id) || (e1->id == CPU2LE(e2->id) && (e1->name_hash < e2->name_hash ||
+      (e1->name_hash == e2->name_hash && NameCompare(e1->name, e1->name_len, e2->name, e2->name_len) <= 0)));
+  }
+  bool Gt(const apfs_key* k1, const apfs_key* k2) const
+  {
+    const apfs_direntry_key* e1 = &k1->direntry;
+    const apfs_direntry_key* e2 = &k2->direntry;
+
+    if (e1->name_len == 0 || e2->name_len == 0)
+      return IS_ID_GREATER(e1->id, CPU2LE(e2->id)) || (e1->id == CPU2LE(e2->id) && e1->name_hash > static_cast<unsigned int>(e2->name_hash));
+
+    return IS_ID_GREATER(e1->id, CPU2LE(e2->id)) || (e1->id == CPU2LE(e2->id) && (e1->name_hash > e2->name_hash ||
+      (e1->name_hash == e2->name_hash && NameCompare(e1->name, e1->name_len, e2->name, e2->name_len) > 0)));
+  }
+};
+
+//CExtentSearchKey (file extents)
+struct CExtentKeyCmp : CKeyCmp
+{
+  CExtentKeyCmp(api::IBaseMemoryManager* Mm, bool bCaseSensitive) : CKeyCmp(Mm, bCaseSensitive) {}
+
+  bool Eq(const apfs_key* k1, const apfs_key* k2) const
+  {
+    return k1->extent.id == CPU2LE(k2->extent.id) && k1->extent.file_offset == CPU2LE(k2->extent.file_offset);
+  }
+  bool Le(const apfs_key* k1, const apfs_key* k2) const
+  {
+    return IS_ID_GREATER(CPU2LE(k2->extent.id), k1->extent.id) ||
+           (k1->extent.id == CPU2LE(k2->extent.id) && k1->extent.file_offset <= CPU2LE(k2->extent.file_offset));
+  }
+  bool Gt(const apfs_key* k1, const apfs_key* k2) const
+  {
+    return IS_ID_GREATER(k1->extent.id, CPU2LE(k2->extent.id)) ||
+           (k1->extent.id == CPU2LE(k2->extent.id) && k1->extent.file_offset > CPU2LE(k2->extent.file_offset));
+  }
+};
+
+//CXAttrSearchKey (extended attributes)
+struct CXAttrKeyCmp : CKeyCmp
+{
+  CXAttrKeyCmp(api::IBaseMemoryManager* Mm, bool bCaseSensitive) : CKeyCmp(Mm, bCaseSensitive) {}
+
+  bool Eq(const apfs_key* k1, const apfs_key* k2) const
+  {
+    return k1->xattr.id == CPU2LE(k2->xattr.id) && k1->xattr.name_len == CPU2LE(k2->xattr.name_len)
+        && NameCompare(k1->xattr.name, k1->xattr.name_len, k2->xattr.name, k2->xattr.name_len) == 0;
+  }
+  bool Le(const apfs_key* k1, const apfs_key* k2) const
+  {
+    return IS_ID_GREATER(CPU2LE(k2->xattr.id), k1->xattr.id) || (k1->xattr.id == CPU2LE(k2->xattr.id)
+        && NameCompare(k1->xattr.name, k1->xattr.name_len, k2->xattr.name, k2->xattr.name_len) <= 0);
+  }
+  bool Gt(const apfs_key* k1, const apfs_key* k2) const
+  {
+    return IS_ID_GREATER(k1->xattr.id, CPU2LE(k2->xattr.id)) || (k1->xattr.id == CPU2LE(k2->xattr.id)
+        && NameCompare(k1->xattr.name, k1->xattr.name_len, k2->xattr.name, k2->xattr.name_len) > 0);
+  }
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+//Omap nodes have fixed items and 16 byte keys (oid, xid). Binary search
+//narrows the range to APFS_OMAP_SCAN_WINDOW keys without branches,
+//then keys less than search key are counted in one pass
+/////////////////////////////////////////////////////////////////////////////
+#define APFS_OMAP_SCAN_WINDOW 8
+
+typedef unsigned int (*OmapCountLessFunc)(const void*, const void*, unsigned int, UINT64, UINT64, bool);
+
+//1 if (KeyHi, KeyLo) < (Hi, Lo). Bit operations keep compilers from branching here
+static inline unsigned int OmapKeyLess(UINT64 KeyHi, UINT64 KeyLo, UINT64 Hi, UINT64 Lo)
+{
+  return static_cast<unsigned int>(KeyHi < Hi) | (static_cast<unsigned int>(KeyHi == Hi) & static_cast<unsigned int>(KeyLo < Lo));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+static unsigned int OmapCountLess(
+    IN const void*  pItems,
+    IN const void*  pKeys,
+    IN unsigned int Count,
+    IN UINT64       Hi,
+    IN UINT64       Lo,
+    IN bool         bCheckpoint
+    )
+{
+  const apfs_table_fixed_item* items = reinterpret_cast<const apfs_table_fixed_item*>(pItems);
+  unsigned int Less = 0;
+
+  for (unsigned int i = 0; i < Count; i++)
+  {
+    const apfs_location_table_key* k = reinterpret_cast<const apfs_location_table_key*>(Add2Ptr(pKeys, CPU2LE(items[i].key_offset)));
+    const UINT64 KeyHi = bCheckpoint ? CPU2LE(k->ltk_id) : CSimpleKeyCmp::Hi(CPU2LE(k->ltk_id));
+    const UINT64 KeyLo = bCheckpoint ? CPU2LE(k->ltk_checkpoint) : 0;
+    Less += OmapKeyLess(KeyHi, KeyLo, Hi, Lo);
+  }
+
+  return Less;
+}
+
+
+#ifdef UFSD_APFS_OMAP_AVX2
+/////////////////////////////////////////////////////////////////////////////
+//Keys are gathered by 4 using their offsets. Unsigned compare is done as signed one with flipped high bits
+__attribute__((target("avx2")))
+static unsigned int OmapCountLessAvx2(
+    IN const void*  pItems,
+    IN const void*  pKeys,
+    IN unsigned int Count,
+    IN UINT64       Hi,
+    IN UINT64       Lo,
+    IN bool         bCheckpoint
+    )
+{
+  C_ASSERT(APFS_OMAP_SCAN_WINDOW % 4 == 0 && sizeof(apfs_table_fixed_item) == 4);
+  assert(Count <= APFS_OMAP_SCAN_WINDOW);
+
+  const __m256i Sign = _mm256_set1_epi64x(static_cast<long long>(0x8000000000000000ULL));
+  const __m256i SearchHi = _mm256_set1_epi64x(static_cast<long long>(Hi));
+  const __m256i SearchHiSigned = _mm256_xor_si256(SearchHi, Sign);
+  const __m256i SearchLoSigned = _mm256_set1_epi64x(static_cast<long long>(Lo ^ 0x8000000000000000ULL));
+  const long long* pIds = reinterpret_cast<const long long*>(pKeys);
+  const int* pOffsets = reinterpret_cast<const int*>(pItems);
+  unsigned int Less = 0;
+
+  for (unsigned int i = 0; i < Count; i += 4)
+  {
+    //Items behind Count may be beyond the index area: they are neither loaded nor gathered
+    const __m128i Mask32 = _mm_cmpgt_epi32(_mm_set1_epi32(static_cast<int>(Count - i)), _mm_setr_epi32(0, 1, 2, 3));
+    const __m128i Offsets = _mm_and_si128(_mm_maskload_epi32(pOffsets + i, Mask32), _mm_set1_epi32(0xFFFF));
+    const __m256i Mask = _mm256_cvtepi32_epi64(Mask32);
+
+    __m256i Ids = _mm256_mask_i32gather_epi64(_mm256_setzero_si256(), pIds, Offsets, Mask, 1);
+    if (!bCheckpoint)
+      Ids = _mm256_or_si256(_mm256_slli_epi64(Ids, 4), _mm256_srli_epi64(Ids, TYPE_SHIFT));
+
+    __m256i KeyLess = _mm256_cmpgt_epi64(SearchHiSigned, _mm256_xor_si256(Ids, Sign));
+    if (bCheckpoint)
+    {
+      const __m256i Xids = _mm256_mask_i32gather_epi64(_mm256_setzero_si256(), pIds + 1, Offsets, Mask, 1);
+      const __m256i XidLess = _mm256_cmpgt_epi64(SearchLoSigned, _mm256_xor_si256(Xids, Sign));
+      KeyLess = _mm256_or_si256(KeyLess, _mm256_and_si256(_mm256_cmpeq_epi64(Ids, SearchHi), XidLess));
+    }
+
+    KeyLess = _mm256_and_si256(KeyLess, Mask);
+    Less += static_cast<unsigned int>(__builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(KeyLess))));
+  }
+
+  return Less;
+}
+#endif
+
+
+#ifdef UFSD_APFS_OMAP_AVX2
+/////////////////////////////////////////////////////////////////////////////
+static OmapCountLessFunc SelectOmapCountLess()
+{
+  //Selection runs from static initializers, cpu features may be not detected yet
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? OmapCountLessAvx2 : OmapCountLess;
+}
+
+#define OMAP_COUNT_LESS_SELECTED  SelectOmapCountLess()
+#else
+#define OMAP_COUNT_LESS_SELECTED  OmapCountLess
+#endif
+
+#ifndef UFSD_APFS_SELFTEST
+//Selected once on load of module, before any thread searches trees
+static const OmapCountLessFunc s_OmapCountLess = OMAP_COUNT_LESS_SELECTED;
+#else
+//Self tests switch counters in CApfsTable::FindDataIndexBy
+static OmapCountLessFunc s_OmapCountLess = OMAP_COUNT_LESS_SELECTED;
+#endif
+
+
+/////////////////////////////////////////////////////////////////////////////
+template <class T>
+int CApfsTable::FindOmapIndexT(
+    IN const apfs_key*  pSearchKey,
+    IN const T&         Cmp,
+    IN unsigned short   SearchRegime
+    )
+{
+  assert(m_bLenFixed && m_Count > 1);
+  const apfs_table_fixed_item* items = reinterpret_cast<const apfs_table_fixed_item*>(m_pIndexArea);
+  const void* keys = GetKeyArea();
+  const UINT64 Hi = T::Hi(pSearchKey->location.ltk_id);
+  //Simple search key has no checkpoint
+  const UINT64 Lo = T::HasCheckpoint ? pSearchKey->location.ltk_checkpoint : 0;
+
+  //Lower bound: first index with key >= SearchKey is in [Base, Base + Len]
+  unsigned int Base = 0, Len = m_Count;
+  while (Len > APFS_OMAP_SCAN_WINDOW)
+  {
+    const unsigned int Half = Len >> 1;
+    const apfs_location_table_key* k = reinterpret_cast<const apfs_location_table_key*>(Add2Ptr(keys, CPU2LE(items[Base + Half - 1].key_offset)));
+    const UINT64 KeyLo = T::HasCheckpoint ? CPU2LE(k->ltk_checkpoint) : 0;
+    Base += Half & (0u - OmapKeyLess(T::Hi(CPU2LE(k->ltk_id)), KeyLo, Hi, Lo));
+    Len -= Half;
+  }
+
+  const unsigned int Lower = Base + (*s_OmapCountLess)(items + Base, keys, Len, Hi, Lo, T::HasCheckpoint);
+  const apfs_key* pLowerKey = Lower < m_Count ? reinterpret_cast<const apfs_key*>(Add2Ptr(keys, CPU2LE(items[Lower].key_offset))) : NULL;
+  const bool bEqual = pLowerKey != NULL && Cmp.Eq(pSearchKey, pLowerKey);
+
+  //The same results as FindDataIndexT gives for this position
+  if (FlagOn(SearchRegime, SEARCH_KEY_LOW))
+  {
+    if (Lower != 0)
+      return Lower - 1;
+    return bEqual ? FIRST_INDEX_ON_LOW_SEARCH : FIRST_INDEX_IS_GREATER;
+  }
+
+  if (bEqual)
+  {
+    //Keys equal to simple search key may differ by checkpoint: return the one
+    //binary search of FindDataIndexT meets first in [Lower, Upper)
+    unsigned int Upper = Lower + 1;
+    while (Upper < m_Count && Cmp.Eq(pSearchKey, reinterpret_cast<const apfs_key*>(Add2Ptr(keys, CPU2LE(items[Upper].key_offset)))))
+      Upper += 1;
+
+    unsigned int first = 0, last = m_Count - 1;
+    for (;;)
+    {
+      const unsigned int mid = first + ((last - first) >> 1);
+      if (mid >= Lower && mid < Upper)
+        return mid;
+      if (mid < Lower)
+        first = mid + 1;
+      else
+        last = mid;
+    }
+  }
+
+  if (Lower == 0)
+    return FIRST_INDEX_IS_GREATER;
+
+  if (FlagOn(SearchRegime, SEARCH_KEY_LE) || m_Level != 0)
+  {
+    const apfs_key* pPrevKey = reinterpret_cast<const apfs_key*>(Add2Ptr(keys, CPU2LE(items[Lower - 1].key_offset)));
+    if (m_Level > 0 || FlagOn(SearchRegime, SEARCH_ALL_TYPES) || GET_TYPE(pPrevKey->id) == GET_TYPE(pSearchKey->id))
+      return Lower - 1;
+  }
+
+  return INDEX_NOT_FOUND;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+template <class T>
+int CApfsTable::FindDataIndexT(
+    IN const apfs_key*  pSearchKey,
+    IN const T&         Cmp,
+    IN unsigned short   SearchRegime
+    )
+{
+  void* keys = GetKeyArea();
+  const UINT64 SearchType = GET_TYPE(pSearchKey->id);
+
+  //If SearchKey not in this leaf return INDEX_NOT_FOUND (compare with first key)
+  const apfs_key* pFirstKey = reinterpret_cast<const apfs_key*>(Add2Ptr(keys, CPU2LE(*(reinterpret_cast<unsigned short*>(m_pIndexArea)))));
+
+  if (Cmp.Gt(pFirstKey, pSearchKey))
+    return FIRST_INDEX_IS_GREATER;
+
+  //Check situation if only one item in the leaf
+  if (m_Count == 1)
+  {
+    if (((FlagOn(SearchRegime, SEARCH_KEY_LOW) || FlagOn(SearchRegime, SEARCH_KEY_LE) || m_Level != 0) && Cmp.Gt(pSearchKey, pFirstKey)) ||
+      ((FlagOn(SearchRegime, SEARCH_KEY_LE) || FlagOn(SearchRegime, SEARCH_KEY_EQ)) && Cmp.Eq(pFirstKey, pSearchKey)))
+      return 0;
+    if (FlagOn(SearchRegime, SEARCH_KEY_LOW) && Cmp.Eq(pFirstKey, pSearchKey))
+      return FIRST_INDEX_ON_LOW_SEARCH;
+    return INDEX_NOT_FOUND;
+  }
+
+  //Binary search cycle
+  unsigned int first = 0, last = m_Count - 1;
+  while (first <= last)
+  {
+    const unsigned int mid = first + ((last - first) >> 1);
+    unsigned short KeyOffset, NextKeyOffset;
+
+    if (m_bLenFixed)
+    {
+      apfs_table_fixed_item* offsets = reinterpret_cast<apfs_table_fixed_item*>(m_pIndexArea);
+      KeyOffset = CPU2LE(offsets[mid].key_offset);
+      NextKeyOffset = GetNextKeyOffset(offsets, mid);
+    }
+    else
+    {
+      apfs_table_var_item* offsets = reinterpret_cast<apfs_table_var_item*>(m_pIndexArea);
+      KeyOffset = CPU2LE(offsets[mid].key_offset);
+      NextKeyOffset = GetNextKeyOffset(offsets, mid);
+    }
+
+    const apfs_key* pCurKey = reinterpret_cast<const apfs_key*>(Add2Ptr(keys, KeyOffset));
+    const apfs_key* pNextKey = NextKeyOffset != NEXT_KEY_NOT_FOUND ? reinterpret_cast<const apfs_key*>(Add2Ptr(keys, NextKeyOffset)) : NULL;
+
+    bool bCurKeyLtSearchKey = Cmp.Gt(pSearchKey, pCurKey);
+
+    if (FlagOn(SearchRegime, SEARCH_KEY_LOW))    //search low
+    {
+      //Check if CurKey < SearchKey && NextKey >= SearchKey
+      if ( bCurKeyLtSearchKey && (pNextKey == NULL || Cmp.Le(pSearchKey, pNextKey)) )
+        return mid;
+      if ( mid == 0 && Cmp.Eq(pSearchKey, pCurKey) )     //SEARCH_KEY_LOW, but 1st item in the tree is equal
+        return FIRST_INDEX_ON_LOW_SEARCH;
+    }
+    else
+    {
+      bool bSameType = GET_TYPE(pCurKey->id) == SearchType;
+      bool bKeysAreEqual = bSameType && Cmp.Eq(pSearchKey, pCurKey);
+
+      if ( bKeysAreEqual )     //SEARCH_KEY_EQ or SEARCH_KEY_LE
+        return mid;
+
+      if (FlagOn(SearchRegime, SEARCH_KEY_LE) || m_Level != 0)    //search low or equal
+      {
+        //Check if CurKey <= SearchKey && NextKey > SearchKey
+        if ( bCurKeyLtSearchKey
+          && (m_Level > 0 || FlagOn(SearchRegime, SEARCH_ALL_TYPES) || bSameType)
+          && (pNextKey == NULL || Cmp.Gt(pNextKey, pSearchKey)) )
+          return mid;
+      }
+    }
+
+    if (first == last)
+      break;
+
+    if ( bCurKeyLtSearchKey )
+      first = mid + 1;
+    else
+      last = mid;
+  }
+
+  return INDEX_NOT_FOUND;
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 int CApfsTable::FindDataIndex(
     IN const CCommonSearchKey*  pSearchKey,
@@ -222,6 +663,34 @@ int CApfsTable::FindDataIndex(
 
   C_ASSERT(offsetof(apfs_table_fixed_item, key_offset) == 0);
 
+  //Known kinds of keys are compared in place without virtual calls
+  const apfs_key* pKey = reinterpret_cast<const apfs_key*>(pSearchKey->GetKey());
+  const bool bCaseSensitive = pSearchKey->m_bCaseSensitive;
+
+  //Omap nodes: fixed items and (oid, xid) keys
+  const bool bOmap = m_bLenFixed && m_ContentType == APFS_CONTENT_LOCATION && m_Count > 1;
+
+  switch (pSearchKey->m_Type)
+  {
+  case ApfsDefaultKey:
+  case ApfsSimpleKey:
+    if (bOmap)
+      return FindOmapIndexT(pKey, CSimpleKeyCmp(m_Mm, bCaseSensitive), SearchRegime);
+    return FindDataIndexT(pKey, CSimpleKeyCmp(m_Mm, bCaseSensitive), SearchRegime);
+  case ApfsLocationKey:
+    if (bOmap)
+      return FindOmapIndexT(pKey, CLocationKeyCmp(m_Mm, bCaseSensitive), SearchRegime);
+    return FindDataIndexT(pKey, CLocationKeyCmp(m_Mm, bCaseSensitive), SearchRegime);
+  case ApfsEntryKey:
+    return FindDataIndexT(pKey, CEntryKeyCmp(m_Mm, bCaseSensitive), SearchRegime);
+  case ApfsExtentKey:
+    return FindDataIndexT(pKey, CExtentKeyCmp(m_Mm, bCaseSensitive), SearchRegime);
+  case ApfsXattrKey:
+    return FindDataIndexT(pKey, CXAttrKeyCmp(m_Mm, bCaseSensitive), SearchRegime);
+  default:
+    break;
+  }
+
   void* keys = GetKeyArea();
 
   //If SearchKey not in this leaf return INDEX_NOT_FOUND (co,pare with first key)
@@ -323,6 +792,37 @@ int CApfsTable::FindDataIndex(
 }
 
 
+#ifdef UFSD_APFS_SELFTEST
+/////////////////////////////////////////////////////////////////////////////
+int CApfsTable::FindDataIndexBy(
+    IN const CCommonSearchKey*  pSearchKey,
+    IN unsigned short           SearchRegime,
+    IN int                      Path
+    )
+{
+  const apfs_key* pKey = reinterpret_cast<const apfs_key*>(pSearchKey->GetKey());
+  const bool bCaseSensitive = pSearchKey->m_bCaseSensitive;
+
+  if (Path == SELFTEST_SEARCH_GENERIC && m_Count != 0)
+  {
+    if (pSearchKey->m_Type == ApfsDefaultKey || pSearchKey->m_Type == ApfsSimpleKey)
+      return FindDataIndexT(pKey, CSimpleKeyCmp(m_Mm, bCaseSensitive), SearchRegime);
+    if (pSearchKey->m_Type == ApfsLocationKey)
+      return FindDataIndexT(pKey, CLocationKeyCmp(m_Mm, bCaseSensitive), SearchRegime);
+  }
+
+  //Self tests are single threaded: counter is switched for this call only
+  const OmapCountLessFunc Selected = s_OmapCountLess;
+  if (Path == SELFTEST_SEARCH_OMAP_SCALAR)
+    s_OmapCountLess = OmapCountLess;
+
+  int Index = FindDataIndex(pSearchKey, SearchRegime);
+  s_OmapCountLess = Selected;
+  return Index;
+}
+#endif
+
+
 /////////////////////////////////////////////////////////////////////////////
 void CApfsTable::GetOffsetsAndSizes(
     IN unsigned int     Index,
@@ -44,6 +44,13 @@ namespace apfs
 #define FIRST_INDEX_IS_GREATER        0xFFFFFFFD
 #define IS_INDEX_NOT_FOUND(index)     ((index) == INDEX_NOT_FOUND || (index) == FIRST_INDEX_ON_LOW_SEARCH || (index) == FIRST_INDEX_IS_GREATER)
 
+#ifdef UFSD_APFS_SELFTEST
+//Search paths of FindDataIndex compared by self tests
+#define SELFTEST_SEARCH_GENERIC       0   //binary search of FindDataIndexT
+#define SELFTEST_SEARCH_OMAP_SCALAR   1   //FindOmapIndexT with scalar key counter
+#define SELFTEST_SEARCH_OMAP          2   //FindOmapIndexT with key counter selected for this cpu
+#endif
+
 //macros for key id and type
 #define ID_MASK                       ((1ULL << TYPE_SHIFT) - 1)
 #define GET_ID(id)                    ((id) & ID_MASK)
@@ -607,6 +614,10 @@ class CApfsTreeInternal;
 //Apfs table class
 class CApfsTable: public UMemBased<CApfsTable>
 {
+#ifdef UFSD_APFS_SELFTEST
+  friend struct CApfsSelfTest;
+#endif
+
   CApfsTreeInternal*     m_pTree;            //Pointer to the tree which contains this table
   CApfsSuperBlock*       m_pSuper;           //Pointer to sb
   apfs_table*            m_pTable;           //Pointer to table block buffer
@@ -626,6 +637,9 @@ class CApfsTable: public UMemBased<CApfsTable>
   unsigned char          m_VolIndex;         //Volume index which this tree belongs to
 
 public:
+  avl_link64             m_PinTreeEntry;     //Entry for CApfsTree::m_PinnedTables (key is object id from parent node)
+  list_head              m_PinListEntry;     //Entry for CApfsTree::m_PinnedList
+
   CApfsTable(CApfsTreeInternal *pTree);
 
   //Read table from disk and init class members
@@ -744,6 +758,31 @@ private:
   //Returns size of index
   unsigned short GetIndexSize() const { return m_bLenFixed ? sizeof(apfs_table_fixed_item) : sizeof(apfs_table_var_item); }
 
+  //FindDataIndex for raw disk keys of one kind. Cmp compares keys like operators of CCommonSearchKey
+  template <class T>
+  int FindDataIndexT(
+      IN const apfs_key*  pSearchKey,
+      IN const T&         Cmp,
+      IN unsigned short   SearchRegime
+      );
+
+  //FindDataIndexT for omap nodes (fixed items, location keys), m_Count > 1
+  template <class T>
+  int FindOmapIndexT(
+      IN const apfs_key*  pSearchKey,
+      IN const T&         Cmp,
+      IN unsigned short   SearchRegime
+      );
+
+#ifdef UFSD_APFS_SELFTEST
+  //FindDataIndex through one of SELFTEST_SEARCH_xxx paths
+  int FindDataIndexBy(
+      IN const CCommonSearchKey*  pSearchKey,
+      IN unsigned short           SearchRegime,
+      IN int                      Path
+      );
+#endif
+
 #ifndef UFSD_APFS_RO
   //Calc footer->tf_unknown_0x00 field
   static unsigned int SetFlags(IN unsigned short ContentType);
@@ -39,6 +39,9 @@ static const char s_pFileName[] = __FILE__ ",$Revision: 332054 $";
 #include "apfsvolsb.h"
 #include "apfssuper.h"
 #include "apfsbplustree.h"
+#include "apfsloccache.h"
+#include "apfsdentrycache.h"
+#include "apfs.h"
 #ifdef BASE_BIGENDIAN
 #include "apfsbe.h"
 #endif
@@ -57,6 +60,8 @@ CApfsVolumeSb::CApfsVolumeSb()
     , m_BlockNumber(0)
     , m_pVSB(NULL)
     , m_pLocationTree(NULL)
+    , m_pLocationCache(NULL)
+    , m_pDentryCache(NULL)
     , m_pObjectTree(NULL)
     , m_pExtentTree(NULL)
     , m_ObjectTreeRootBlock(0)
@@ -79,6 +84,8 @@ CApfsVolumeSb::Init(CApfsSuperBlock* sb, unsigned char VolIndex)
   m_BlockNumber = 0;
   m_pVSB = NULL;
   m_pLocationTree = NULL;
+  m_pLocationCache = NULL;
+  m_pDentryCache = NULL;
   m_pObjectTree = NULL;
   m_pExtentTree = NULL;
   m_ObjectTreeRootBlock = 0;
@@ -97,6 +104,18 @@ void
 CApfsVolumeSb::Destroy() const
 {
   Free2(m_pVSB);
+  if (m_pLocationCache)
+  {
+    ULOG_TRACE((GetLog(), "Volume #%x location cache: %" PZZ "u entries, %" PLL "u hits, %" PLL "u misses",
+      m_VolIndex, m_pLocationCache->GetCount(), m_pLocationCache->m_Hits, m_pLocationCache->m_Misses));
+    delete m_pLocationCache;
+  }
+  if (m_pDentryCache)
+  {
+    ULOG_TRACE((GetLog(), "Volume #%x dentry cache: %" PZZ "u entries, %" PLL "u hits, %" PLL "u negative hits, %" PLL "u misses",
+      m_VolIndex, m_pDentryCache->GetCount(), m_pDentryCache->m_Hits, m_pDentryCache->m_NegativeHits, m_pDentryCache->m_Misses));
+    delete m_pDentryCache;
+  }
   delete m_pLocationTree;
   delete m_pObjectTree;
   delete m_pExtentTree;
@@ -133,6 +152,25 @@ CApfsVolumeSb::Load(UINT64 BlockNumber)
     CHECK_PTR(m_pLocationTree = new(m_Mm) CApfsTree(m_pSuper));
   CHECK_CALL(m_pLocationTree->Init(m_pVSB->vsb_btom_root, m_VolIndex, true));
 
+  //Cache of resolved locations, it is valid while location tree is not reloaded
+  size_t CacheSize = m_pSuper->m_pFs->m_Params.LocationCacheSize;
+  if (CacheSize == 0)
+    CacheSize = APFS_LOCATION_CACHE_SIZE;
+
+  if (m_pLocationCache == NULL)
+    CHECK_PTR(m_pLocationCache = new(m_Mm) CApfsLocationCache(m_Mm));
+  CHECK_CALL(m_pLocationCache->Init(CacheSize));
+  m_pLocationTree->SetLocationCache(m_pLocationCache);
+
+  //Cache of directory lookups, it is used only while volume is readonly
+  size_t DentryCacheSize = m_pSuper->m_pFs->m_Params.DentryCacheSize;
+  if (DentryCacheSize == 0)
+    DentryCacheSize = APFS_DENTRY_CACHE_SIZE;
+
+  if (m_pDentryCache == NULL)
+    CHECK_PTR(m_pDentryCache = new(m_Mm) CApfsDentryCache(m_Mm));
+  m_pDentryCache->Init(DentryCacheSize);
+
   //Read B-Tree Catalog Root Node (BTRN)
   apfs_location_table_data val;
   CHECK_CALL(m_pLocationTree->GetActualLocation(m_pVSB->vsb_root_node_id, NULL, &val));
@@ -188,6 +226,69 @@ CApfsVolumeSb::InitTrees()
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+//Copies inode records found by GetDataBatch
+class CInodeRecordSink : public CApfsBatchSink
+{
+  api::IBaseMemoryManager* m_Mm;
+  apfs_inode**           m_ppRecords;
+
+public:
+  CInodeRecordSink(api::IBaseMemoryManager* Mm, apfs_inode** ppRecords)
+    : m_Mm(Mm)
+    , m_ppRecords(ppRecords)
+  {}
+
+  virtual int OnItem(size_t KeyIndex, void* /*Key*/, void* Data, unsigned short /*KeyLen*/, unsigned short DataLen)
+  {
+    apfs_inode* pInode = reinterpret_cast<apfs_inode*>(Malloc2(DataLen));
+    CHECK_PTR(pInode);
+    Memcpy2(pInode, Data, DataLen);
+    BE_ONLY(ConvertInode(pInode));
+    m_ppRecords[KeyIndex] = pInode;
+    return ERR_NOERROR;
+  }
+};
+
+
+/////////////////////////////////////////////////////////////////////////////
+int
+CApfsVolumeSb::GetInodeRecords(const UINT64* InodeIds, size_t Count, apfs_inode** ppRecords) const
+{
+  if (m_pObjectTree == NULL)
+    return ERR_BADPARAMS;
+
+  for (size_t i = 0; i < Count; i++)
+    ppRecords[i] = NULL;
+
+  //Keys and pointers to them in one buffer
+  CSimpleSearchKey* pKeys = reinterpret_cast<CSimpleSearchKey*>(Malloc2(Count * (sizeof(CSimpleSearchKey) + sizeof(CCommonSearchKey*))));
+  CHECK_PTR(pKeys);
+  CCommonSearchKey** ppKeys = reinterpret_cast<CCommonSearchKey**>(pKeys + Count);
+
+  for (size_t i = 0; i < Count; i++)
+    ppKeys[i] = new(pKeys + i) CSimpleSearchKey(m_Mm, InodeIds[i], ApfsInode);
+
+  CInodeRecordSink Sink(m_Mm, ppRecords);
+  int Status = m_pObjectTree->GetDataBatch(ppKeys, Count, SEARCH_KEY_EQ, &Sink);
+
+  for (size_t i = 0; i < Count; i++)
+    pKeys[i].~CSimpleSearchKey();
+  Free2(pKeys);
+
+  if (!UFSD_SUCCESS(Status))
+  {
+    for (size_t i = 0; i < Count; i++)
+    {
+      Free2(ppRecords[i]);
+      ppRecords[i] = NULL;
+    }
+  }
+
+  return Status;
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 int
 CApfsVolumeSb::ReadMetaData(UINT64 Offset, void* pBuffer, size_t Bytes) const
@@ -200,9 +301,12 @@ CApfsVolumeSb::ReadMetaData(UINT64 Offset, void* pBuffer, size_t Bytes) const
 
   assert((Bytes & (m_pSuper->GetBlockSize() - 1)) == 0);
   CHECK_CALL(m_pSuper->ReadBytes(Offset, pBuffer, Bytes));
-  CHECK_CALL(m_pSuper->DecryptBlocks(m_pAES, Offset >> m_pSuper->m_Log2OfCluster, pBuffer, Bytes >> m_pSuper->m_Log2OfCluster));
 
-  return ERR_NOERROR;
+  m_CipherLock.Lock();
+  int Status = m_pSuper->DecryptBlocks(m_pAES, Offset >> m_pSuper->m_Log2OfCluster, pBuffer, Bytes >> m_pSuper->m_Log2OfCluster);
+  m_CipherLock.Unlock();
+
+  return Status;
 }
 
 
@@ -215,6 +319,18 @@ CApfsVolumeSb::ReadData(UINT64 Offset, void* pBuffer, size_t Bytes, bool bEncryp
   if (m_pAES == NULL)
     return ERR_BADPARAMS;
 
+  m_CipherLock.Lock();
+  int Status = ReadEncryptedData(Offset, pBuffer, Bytes, CryptoId);
+  m_CipherLock.Unlock();
+
+  return Status;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+int
+CApfsVolumeSb::ReadEncryptedData(UINT64 Offset, void* pBuffer, size_t Bytes, UINT64 CryptoId)
+{
   if (m_pEncryptedTempBuffer == NULL)
     CHECK_PTR(m_pEncryptedTempBuffer = Malloc2(APFS_ENCRYPT_PORTION));
 
@@ -247,7 +363,7 @@ CApfsVolumeSb::ReadData(UINT64 Offset, void* pBuffer, size_t Bytes, bool bEncryp
     size_t BytesToRead = SectorsToRead << APFS_ENCRYPT_PORTION_LOG;
     CHECK_CALL(m_pSuper->ReadBytes(Offset, pBuffer, BytesToRead));
 
-#if 0//__WORDSIZE >= 64
+#if __WORDSIZE >= 64 && !defined UFSD_DRIVER_LINUX
     CHECK_CALL(m_pSuper->DecryptSectors(m_pAES, CryptoId, pBuffer, SectorsToRead));
     pBuffer = Add2Ptr(pBuffer, BytesToRead);
     CryptoId += SectorsToRead;
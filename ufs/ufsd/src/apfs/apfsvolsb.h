@@ -26,6 +26,8 @@ namespace apfs
 
 class CApfsSuperBlock;
 class CApfsTree;
+class CApfsLocationCache;
+class CApfsDentryCache;
 
 class CApfsVolumeSb
 {
@@ -39,6 +41,8 @@ class CApfsVolumeSb
   UINT64                 m_BlockNumber;              //Block number where volume sb stored
   struct apfs_vsb*       m_pVSB;                     //Disk structure of volume superblock
   CApfsTree*             m_pLocationTree;            //Location tree (or BTOM - BTree Object Map)
+  CApfsLocationCache*    m_pLocationCache;           //Cache of object locations resolved by m_pLocationTree
+  CApfsDentryCache*      m_pDentryCache;             //Cache of directory lookups in this volume
   CApfsTree*             m_pObjectTree;              //Common tree for direntries, inodes, extents, ea and etc
   CApfsTree*             m_pExtentTree;              //Extent tree for volume
   UINT64                 m_ObjectTreeRootBlock;      //Root Block of m_pObjectTree
@@ -51,16 +55,25 @@ class CApfsVolumeSb
   void*                  m_pEncryptedTempBuffer;
 
   api::ICipher*          m_pAES;                      //Object for encrypting/decrypting
+  mutable CUnixLock      m_CipherLock;                //serializes m_pAES (keeps keyed context) and m_pEncryptedTempBuffer
+
+  //Read encrypted data and decrypt it (under m_CipherLock)
+  int ReadEncryptedData(UINT64 Offset, void* pBuffer, size_t Bytes, UINT64 CryptoId);
 
 public:
   CApfsVolumeSb();
 
+  //Inplace operator new: volumes are constructed in array allocated by CApfsSuperBlock
+  static void* __cdecl operator new(size_t, void* p) throw() { return p; }
+
   void Init(CApfsSuperBlock* sb, unsigned char VolIndex);
   int Load(UINT64 BlockNumber);
   void Destroy() const;
 
   apfs_vsb* GetVolumeSb() const { return m_pVSB; }
   CApfsTree* GetLocationTree()const { return m_pLocationTree; }
+  CApfsLocationCache* GetLocationCache() const { return m_pLocationCache; }
+  CApfsDentryCache* GetDentryCache() const { return m_pDentryCache; }
   CApfsTree* GetObjectTree()const { return m_pObjectTree; }
   CApfsTree* GetExtentTree()const { return m_pExtentTree; }
   char* GetName() const{ return m_pVSB->vsb_volname; }
@@ -100,6 +113,10 @@ public:
   //Init volume tree and location tree
   int InitTrees();
 
+  //Read inode records of Count inodes of this volume in one pass over the object tree
+  //ppRecords[i] gets copy of record for InodeIds[i] (free it with Free2) or NULL if the record is not found
+  int GetInodeRecords(const UINT64* InodeIds, size_t Count, apfs_inode** ppRecords) const;
+
   void SetDirty(bool f = true) { m_bDirty = f; }
 
 private:
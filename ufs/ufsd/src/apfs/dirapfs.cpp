@@ -45,6 +45,7 @@ static const char s_pFileName[] = __FILE__ ",$Revision: 331860 $";
 #include "apfs.h"
 #include "apfsinode.h"
 #include "apfsenum.h"
+#include "apfsdentrycache.h"
 
 namespace UFSD
 {
@@ -147,28 +148,11 @@ int CApfsDir::FindNext(
 
     if (Status == ERR_FILEEXISTS)
     {
-      Status = ERR_NOERROR;
-
-      if (!FlagOn(e->m_Options, UFSD_ENUM_NAME_ID_ATTR_ONLY))
-      {
-        CUnixInode* i;
-
-        if (pInode == NULL)
-          pInode = &i;
-
-        CHECK_CALL_EXIT(m_pFS->m_pSuper->GetInode(Info.Id, pInode));
-
-        Status = (*pInode)->GetObjectInfo(&Info, false);
-
-        if (pInode == &i)
-          (*pInode)->Release();
-      }
-
+      Status = GetEntryInfo(e->m_Options, Info, pInode);
       break;
     }
   }
 
-Exit:
   if (e->m_bMatchAll && !UFSD_SUCCESS(Status))
     e->SetPosition(EOD_POS);
 
@@ -195,8 +179,92 @@ int CApfsDir::FindDirEntry(
     )
 {
   size_t EnumOptions = FlagOn(m_pFS->m_Options, UFSD_OPTIONS_MOUNT_ALL_VOLUMES) ? APFS_ENUM_ALL_VOLUMES : 0;
+  CApfsDentryCache* pCache = GetDentryCache();
+
+  if (pCache == NULL)
+  {
+    CHECK_CALL_SILENT(m_pEnum->Init(m_pFS, EnumOptions, m_pInode, Type, Name, NameLen));
+    return FindNext(m_pEnum, *pInfo, pInode);
+  }
+
+  UINT64 Parent = m_pInode->Id();
+  size_t NameBytes = NameLen * api::IBaseStringManager::GetCharSize(Type);
+
+  int Status = pCache->Lookup(Parent, Type, Name, NameBytes, pInfo);
+  if (Status == ERR_NOERROR)
+    return GetEntryInfo(EnumOptions, *pInfo, pInode);
+  if (Status == ERR_NOFILEEXISTS)
+    return ERR_NOFILEEXISTS;
+
   CHECK_CALL_SILENT(m_pEnum->Init(m_pFS, EnumOptions, m_pInode, Type, Name, NameLen));
-  return FindNext(m_pEnum, *pInfo, pInode);
+
+  Memzero2(pInfo, sizeof(FileInfo));
+  Status = reinterpret_cast<CApfsEntryNumerator*>(m_pEnum)->FindEntry(*pInfo, NULL);
+
+  if (Status == ERR_FILEEXISTS)
+  {
+    //Emulated volumes dir has no stable attributes
+    if (APFS_GET_INODE_ID(pInfo->Id) != APFS_VOLUMES_DIR_ID)
+    {
+#ifdef UFSD_DRIVER_LINUX
+      size_t InfoNameBytes = pInfo->NameLen * sizeof(pInfo->Name[0]);
+#else
+      size_t InfoNameBytes = pInfo->NameLen * api::IBaseStringManager::GetCharSize(pInfo->NameType);
+#endif
+      pCache->Insert(Parent, Type, Name, NameBytes, pInfo, InfoNameBytes);
+    }
+
+    return GetEntryInfo(EnumOptions, *pInfo, pInode);
+  }
+
+  if (Status == ERR_NOFILEEXISTS || Status == ERR_NOTFOUND)
+  {
+    pCache->Insert(Parent, Type, Name, NameBytes, NULL, 0);
+    return ERR_NOFILEEXISTS;
+  }
+
+  return Status;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+int CApfsDir::GetEntryInfo(
+    IN  size_t          Options,
+    OUT FileInfo&       Info,
+    OUT CUnixInode**    pInode
+    )
+{
+  if (FlagOn(Options, UFSD_ENUM_NAME_ID_ATTR_ONLY))
+    return ERR_NOERROR;
+
+  CUnixInode* i;
+
+  if (pInode == NULL)
+    pInode = &i;
+
+  CHECK_CALL(m_pFS->m_pSuper->GetInode(Info.Id, pInode));
+
+  int Status = (*pInode)->GetObjectInfo(&Info, false);
+
+  if (pInode == &i)
+    (*pInode)->Release();
+
+  return Status;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+CApfsDentryCache* CApfsDir::GetDentryCache()
+{
+  //Nothing invalidates cached lookups, so they are cached only on readonly volumes
+  if (m_pInode == NULL || GetObjectID() == APFS_VOLUMES_DIR_ID || !m_pFS->IsReadOnly(m_pInode->Id()))
+    return NULL;
+
+  if (reinterpret_cast<CApfsInode*>(m_pInode)->GetTree() == NULL)
+    return NULL;
+
+  CApfsVolumeSb* pVol = reinterpret_cast<CApfsSuperBlock*>(m_pFS->m_pSuper)->GetVolume(APFS_GET_TREE_ID(m_pInode->Id()));
+  return pVol != NULL && pVol->CanDecrypt() ? pVol->GetDentryCache() : NULL;
 }
 
 
@@ -25,6 +25,8 @@ namespace UFSD
 namespace apfs
 {
 
+class CApfsDentryCache;
+
 class CApfsDir : public CUnixDir
 {
   CEntryTreeEnum*       m_pEntryEnum;
@@ -86,6 +88,16 @@ private:
       OUT CUnixInode**    pInode
       );
 
+  //Fill Info of found entry from its inode
+  int GetEntryInfo(
+      IN  size_t          Options,
+      OUT FileInfo&       Info,
+      OUT CUnixInode**    pInode
+      );
+
+  //Returns cache for lookups in this dir or NULL if lookups can't be cached
+  CApfsDentryCache* GetDentryCache();
+
   virtual void CreateFsObject(
       IN  const FileInfo* pInfo,
       OUT CUnixDir**      pDir
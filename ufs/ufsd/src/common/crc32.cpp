@@ -18,6 +18,26 @@
 #include <ufsd.h>   // size_t
 #include "../h/crc32.h"
 
+//
+// crc32c instructions work with general purpose registers,
+// but cpu features can be checked only in user mode
+//
+#if !defined UFSD_DRIVER_LINUX && !defined KERNEL
+  #if (defined __x86_64__ || defined __i386__) \
+    && (defined __clang__ || (defined __GNUC__ && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+    #define UFSD_CRC32C_SSE42
+    #include <nmmintrin.h>
+  #elif defined __aarch64__ && !defined __AARCH64EB__ && defined __linux__ \
+    && (defined __clang__ || (defined __GNUC__ && __GNUC__ >= 6))
+    #define UFSD_CRC32C_ARMV8
+    #include <arm_acle.h>
+    #include <sys/auxv.h>
+    #ifndef HWCAP_CRC32
+      #define HWCAP_CRC32 (1 << 7)
+    #endif
+  #endif
+#endif
+
 namespace UFSD {
 
 static unsigned short const tbl16[256] = {
@@ -144,11 +164,103 @@ unsigned short crc16( unsigned short crc, const void* pBuffer, size_t BufSize )
 }
 
 
-unsigned int crc32c(unsigned int crc, const void *pBuffer, size_t BufSize)
+static unsigned int crc32c_tbl(unsigned int crc, const void *pBuffer, size_t BufSize)
 {
   return DoCrc( crc, tbl32, pBuffer, BufSize );
 }
 
+
+#ifdef UFSD_CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static unsigned int crc32c_sse42(unsigned int crc, const void *pBuffer, size_t BufSize)
+{
+  const unsigned char* buf = reinterpret_cast<const unsigned char*>(pBuffer);
+
+  for ( ; BufSize != 0 && (reinterpret_cast<size_t>(buf) & 3); BufSize-- )
+    crc = _mm_crc32_u8( crc, *buf++ );
+
+#ifdef __x86_64__
+  if ( BufSize >= 8 && (reinterpret_cast<size_t>(buf) & 4) )
+  {
+    crc = _mm_crc32_u32( crc, *reinterpret_cast<const unsigned int*>(buf) );
+    buf += 4;
+    BufSize -= 4;
+  }
+
+  UINT64 crc64 = crc;
+  for ( ; BufSize >= 8; BufSize -= 8, buf += 8 )
+    crc64 = _mm_crc32_u64( crc64, *reinterpret_cast<const UINT64*>(buf) );
+  crc = static_cast<unsigned int>(crc64);
+#endif
+
+  for ( ; BufSize >= 4; BufSize -= 4, buf += 4 )
+    crc = _mm_crc32_u32( crc, *reinterpret_cast<const unsigned int*>(buf) );
+
+  while ( BufSize-- != 0 )
+    crc = _mm_crc32_u8( crc, *buf++ );
+
+  return crc;
+}
+#endif
+
+
+#ifdef UFSD_CRC32C_ARMV8
+__attribute__((target("+crc")))
+static unsigned int crc32c_armv8(unsigned int crc, const void *pBuffer, size_t BufSize)
+{
+  const unsigned char* buf = reinterpret_cast<const unsigned char*>(pBuffer);
+
+  for ( ; BufSize != 0 && (reinterpret_cast<size_t>(buf) & 7); BufSize-- )
+    crc = __crc32cb( crc, *buf++ );
+
+  for ( ; BufSize >= 8; BufSize -= 8, buf += 8 )
+    crc = __crc32cd( crc, *reinterpret_cast<const UINT64*>(buf) );
+
+  if ( BufSize >= 4 )
+  {
+    crc = __crc32cw( crc, *reinterpret_cast<const unsigned int*>(buf) );
+    buf += 4;
+    BufSize -= 4;
+  }
+
+  while ( BufSize-- != 0 )
+    crc = __crc32cb( crc, *buf++ );
+
+  return crc;
+}
+#endif
+
+
+typedef unsigned int (*Crc32cFunc)(unsigned int, const void*, size_t);
+
+#if defined UFSD_CRC32C_SSE42 || defined UFSD_CRC32C_ARMV8
+static Crc32cFunc SelectCrc32c()
+{
+#ifdef UFSD_CRC32C_SSE42
+  //Selection runs from static initializers, cpu features may be not detected yet
+  __builtin_cpu_init();
+  if ( __builtin_cpu_supports( "sse4.2" ) )
+    return crc32c_sse42;
+#endif
+#ifdef UFSD_CRC32C_ARMV8
+  if ( getauxval( AT_HWCAP ) & HWCAP_CRC32 )
+    return crc32c_armv8;
+#endif
+  return crc32c_tbl;
+}
+
+//Selected once on load of module, before any thread hashes names
+static const Crc32cFunc s_Crc32c = SelectCrc32c();
+#else
+static const Crc32cFunc s_Crc32c = crc32c_tbl;
+#endif
+
+
+unsigned int crc32c(unsigned int crc, const void *pBuffer, size_t BufSize)
+{
+  return (*s_Crc32c)( crc, pBuffer, BufSize );
+}
+
 };
 
 #endif
@@ -56,8 +56,11 @@ int CUnixBlock::Init(
   if (m_pBuffer == NULL || fCreate)
   {
     assert(m_pBuffer == NULL);
-    Free2(m_pBuffer);
-    CHECK_PTR(m_pBuffer = Zalloc2(BlockSize));
+    if (m_pBuffer)
+      m_pSuper->FreeBlockBuffer(m_pBuffer, m_bSlabBuffer);
+    //Only new block needs zeroes, others are read from disk
+    CHECK_PTR(m_pBuffer = m_pSuper->AllocBlockBuffer(BlockSize, fCreate, &m_bSlabBuffer));
+    m_BufferSize = BlockSize;
   }
 
   if (!fCreate)
@@ -76,11 +79,14 @@ int CUnixBlock::Init(
 CUnixBlock::CUnixBlock(api::IBaseMemoryManager* mm)
   : UMemBased<CUnixBlock>(mm)
   , m_pBuffer(NULL)
+  , m_BufferSize(0)
+  , m_bSlabBuffer(false)
   , m_bDirty(false)
   , m_VolIndex(0)
   , m_ReffCounter(0)
   , m_pSuper(NULL)
   , m_bCalcCrc(false)
+  , m_bHot(false)
 {
   m_Entry.init();
   m_RankEntry.init();
@@ -96,7 +102,8 @@ int CUnixBlock::Dtor()
 
   m_Entry.remove();
   m_RankEntry.remove();
-  Free2(m_pBuffer);
+  if (m_pBuffer)
+    m_pSuper->FreeBlockBuffer(m_pBuffer, m_bSlabBuffer);
 
   return Status;
 }
@@ -106,9 +113,9 @@ int CUnixBlock::Dtor()
 int CUnixBlock::Release()
 {
   assert(m_ReffCounter > 0);
-  m_ReffCounter--;
 
-  if (m_ReffCounter == 0)
+  //Only the last reference needs lock of cache to close block
+  if (!UnixAtomicDecNotLast(&m_ReffCounter))
     CHECK_CALL( m_pSuper->ReleaseBlock(this) );
   return ERR_NOERROR;
 }
@@ -27,10 +27,12 @@ namespace UFSD
 class CUnixBlock : public UMemBased<CUnixBlock>
 {
   void*             m_pBuffer;        //Block data
+  unsigned int      m_BufferSize;     //Size of m_pBuffer in bytes
+  bool              m_bSlabBuffer;    //m_pBuffer is from CUnixSuperBlock::m_BlockSlab
 
   bool              m_bDirty;         //block needs to flush on disk
   unsigned char     m_VolIndex;       //Number of encrypted volume. m_VolIndex = BLOCK_BELONGS_TO_CONTAINER if block is not encrypted
-  unsigned int      m_ReffCounter;    //number of usages of block
+  unsigned int      m_ReffCounter;    //number of usages of block (atomic, becomes 0 only under shard lock)
 
 protected:
   CUnixSuperBlock*  m_pSuper;
@@ -38,7 +40,8 @@ protected:
 
 public:
   struct list_head  m_Entry;          //Entry for m_BlocksList
-  struct list_head  m_RankEntry;      //Entry for m_BlocksRankList
+  struct list_head  m_RankEntry;      //Entry for CUnixBlockShard::m_BlocksRankList or m_BlocksHotList
+  bool              m_bHot;           //Block is kept in CUnixBlockShard::m_BlocksHotList when closed
   avl_link64        m_TreeEntry;      //Entry of tree
 
   CUnixBlock(api::IBaseMemoryManager* mm);
@@ -62,12 +65,16 @@ public:
   virtual int Flush();
 
   void* GetBuffer() const { return m_pBuffer; }
+  unsigned int GetBufferSize() const { return m_BufferSize; }
 
   bool IsDirty() const { return m_bDirty; }
   virtual void SetDirty(bool bDirty = true) { m_bDirty = bDirty; }
 
   unsigned int GetReffCounter() const { return m_ReffCounter; }
-  void IncReffCount(unsigned short N = 1) { m_ReffCounter += N; }
+  //Add references, called under shard lock
+  void IncReffCount(unsigned short N = 1) { UnixAtomicAdd(&m_ReffCounter, N); }
+  //Drop reference and return the rest. The last reference of cached block is dropped by ReleaseBlock
+  unsigned int DecReffCount() { assert(m_ReffCounter > 0); return UnixAtomicAdd(&m_ReffCounter, -1); }
 
   virtual ~CUnixBlock() { Dtor(); }
 
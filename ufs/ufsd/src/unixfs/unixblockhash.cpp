@@ -0,0 +1,146 @@
+// <copyright file="unixblockhash.cpp" company="Paragon Software Group">
+//
+// Copyright (c) 2002-2019 Paragon Software Group, All rights reserved.
+//
+// The license for this file is defined in a separate document "LICENSE.txt"
+// located at the root of the project.
+//
+// </copyright>
+/////////////////////////////////////////////////////////////////////////////
+//
+// Revision History :
+//
+//     17-October-2026 - created.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "../h/versions.h"
+
+#if defined UFSD_BTRFS || defined UFSD_EXTFS2 || defined UFSD_XFS || defined UFSD_APFS
+
+#ifdef UFSD_TRACE_ERROR
+static const char s_pFileName[] = __FILE__ ",$Revision: 1 $";
+#endif
+
+#include <ufsd.h>
+
+#include "../h/utrace.h"
+#include "../h/assert.h"
+#include "../h/uerrors.h"
+#include "../h/uavl.h"
+
+#include "unixblock.h"
+#include "unixblockhash.h"
+
+namespace UFSD
+{
+
+/////////////////////////////////////////////////////////////////////////////
+CUnixBlockHash::CUnixBlockHash(api::IBaseMemoryManager* Mm)
+  : UMemBased<CUnixBlockHash>(Mm)
+  , m_pSlots(NULL)
+  , m_Mask(0)
+  , m_Shift(64)
+  , m_Count(0)
+{
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+CUnixBlockHash::~CUnixBlockHash()
+{
+  Free2(m_pSlots);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+bool CUnixBlockHash::Resize(size_t Slots)
+{
+  Slot* pSlots = (Slot*)Zalloc2(Slots * sizeof(Slot));
+  if (pSlots == NULL)
+    return false;
+
+  Slot* pOld = m_pSlots;
+  size_t OldSlots = GetSlotsCount();
+
+  m_pSlots = pSlots;
+  m_Mask   = Slots - 1;
+  m_Shift  = 64;
+  for (size_t n = Slots; n > 1; n >>= 1)
+    m_Shift--;
+
+  for (size_t i = 0; i < OldSlots; i++)
+  {
+    if (pOld[i].m_pBlock == NULL)
+      continue;
+
+    size_t j = Home(pOld[i].m_Key);
+    while (m_pSlots[j].m_pBlock != NULL)
+      j = (j + 1) & m_Mask;
+    m_pSlots[j] = pOld[i];
+  }
+
+  Free2(pOld);
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void CUnixBlockHash::Insert(CUnixBlock* pBlock)
+{
+  assert(2 * (m_Count + 1) <= GetSlotsCount());
+
+  UINT64 Key = pBlock->Id();
+  size_t i = Home(Key);
+  while (m_pSlots[i].m_pBlock != NULL)
+  {
+    assert(m_pSlots[i].m_Key != Key);
+    i = (i + 1) & m_Mask;
+  }
+
+  m_pSlots[i].m_Key    = Key;
+  m_pSlots[i].m_pBlock = pBlock;
+  m_Count++;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void CUnixBlockHash::Remove(const CUnixBlock* pBlock)
+{
+  size_t i = Home(pBlock->Id());
+  while (m_pSlots[i].m_pBlock != pBlock)
+  {
+    assert(m_pSlots[i].m_pBlock != NULL);
+    i = (i + 1) & m_Mask;
+  }
+
+  //Shift back following entries of the cluster which may not stay behind the hole
+  for (size_t j = (i + 1) & m_Mask; m_pSlots[j].m_pBlock != NULL; j = (j + 1) & m_Mask)
+  {
+    size_t h = Home(m_pSlots[j].m_Key);
+    if (((j - h) & m_Mask) >= ((j - i) & m_Mask))
+    {
+      m_pSlots[i] = m_pSlots[j];
+      i = j;
+    }
+  }
+
+  m_pSlots[i].m_pBlock = NULL;
+  m_Count--;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void CUnixBlockHash::Clear()
+{
+  Free2(m_pSlots);
+  m_pSlots = NULL;
+  m_Mask   = 0;
+  m_Shift  = 64;
+  m_Count  = 0;
+}
+
+} // namespace UFSD
+
+#endif
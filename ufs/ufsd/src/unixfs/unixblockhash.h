@@ -0,0 +1,93 @@
+// <copyright file="unixblockhash.h" company="Paragon Software Group">
+//
+// Copyright (c) 2002-2019 Paragon Software Group, All rights reserved.
+//
+// The license for this file is defined in a separate document "LICENSE.txt"
+// located at the root of the project.
+//
+// </copyright>
+/////////////////////////////////////////////////////////////////////////////
+//
+// Revision History :
+//
+//     17-October-2026 - created.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef __UFSD_UNIX_BLOCK_HASH_H
+#define __UFSD_UNIX_BLOCK_HASH_H
+
+namespace UFSD
+{
+
+class CUnixBlock;
+
+//Number of slots allocated with the first block
+#define BLOCK_HASH_MIN_SLOTS    256
+
+//Open addressing (linear probing) index of cached blocks by block number
+//Table is kept at most half full and grows twice when needed, it never shrinks
+class CUnixBlockHash : public UMemBased<CUnixBlockHash>
+{
+  struct Slot
+  {
+    UINT64        m_Key;                  //block number
+    CUnixBlock*   m_pBlock;               //NULL if slot is free
+  };
+
+  Slot*                  m_pSlots;
+  size_t                 m_Mask;                     //number of slots - 1
+  unsigned int           m_Shift;                    //64 - log2(number of slots)
+  size_t                 m_Count;
+
+  size_t Home(UINT64 Key) const { return (size_t)((Key * 0x9E3779B97F4A7C15ull) >> m_Shift); }
+
+  //Reallocate table with Slots slots
+  bool Resize(size_t Slots);
+
+public:
+  CUnixBlockHash(api::IBaseMemoryManager* Mm);
+  ~CUnixBlockHash();
+
+  //Returns cached block or NULL
+  CUnixBlock* Find(UINT64 Block) const
+  {
+    if (m_pSlots == NULL)
+      return NULL;
+
+    for (size_t i = Home(Block);; i = (i + 1) & m_Mask)
+    {
+      const Slot* s = m_pSlots + i;
+      if (s->m_pBlock == NULL)
+        return NULL;
+      if (s->m_Key == Block)
+        return s->m_pBlock;
+    }
+  }
+
+  //Make room for one more block. Returns false if there is no memory for the table
+  bool Reserve()
+  {
+    return 2 * (m_Count + 1) <= GetSlotsCount() || Resize(m_pSlots == NULL ? BLOCK_HASH_MIN_SLOTS : 2 * GetSlotsCount());
+  }
+
+  //Add block which is not in index, Reserve() must be called before
+  void Insert(CUnixBlock* pBlock);
+
+  //Remove block from index
+  void Remove(const CUnixBlock* pBlock);
+
+  //Forget all blocks and free table
+  void Clear();
+
+  //Direct access to slots to walk over all blocks (slot may be NULL)
+  size_t GetSlotsCount() const { return m_pSlots == NULL ? 0 : m_Mask + 1; }
+  CUnixBlock* GetSlot(size_t i) const { return m_pSlots[i].m_pBlock; }
+
+  size_t GetCount() const { return m_Count; }
+};
+
+}
+
+#endif   // __UFSD_UNIX_BLOCK_HASH_H
@@ -0,0 +1,255 @@
+// <copyright file="unixblockshard.cpp" company="Paragon Software Group">
+//
+// Copyright (c) 2002-2019 Paragon Software Group, All rights reserved.
+//
+// The license for this file is defined in a separate document "LICENSE.txt"
+// located at the root of the project.
+//
+// </copyright>
+/////////////////////////////////////////////////////////////////////////////
+//
+// Revision History :
+//
+//     17-October-2026 - created.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "../h/versions.h"
+
+#if defined UFSD_BTRFS || defined UFSD_EXTFS2 || defined UFSD_XFS || defined UFSD_APFS
+
+#ifdef UFSD_TRACE_ERROR
+static const char s_pFileName[] = __FILE__ ",$Revision: 1 $";
+#endif
+
+#include <ufsd.h>
+
+#include "../h/utrace.h"
+#include "../h/assert.h"
+#include "../h/uerrors.h"
+#include "../h/uavl.h"
+
+#include "unixblock.h"
+
+namespace UFSD
+{
+
+
+/////////////////////////////////////////////////////////////////////////////
+CUnixBlockShard::CUnixBlockShard(api::IBaseMemoryManager* Mm)
+  : UMemBased<CUnixBlockShard>(Mm)
+#ifdef UFSD_BLOCK_CACHE_HASH
+  , m_BlockCache(Mm)
+#endif
+  , m_BlocksBytes(0)
+  , m_BlocksColdBytes(0)
+  , m_BlocksColdTarget(0)
+  , m_pBlocksGhost(NULL)
+  , m_BlocksGhostMask(0)
+  , m_BlocksCount(0)
+  , m_BlocksHits(0)
+  , m_BlocksMisses(0)
+  , m_BlocksEvictions(0)
+{
+  m_BlocksRankList.init();
+  m_BlocksHotList.init();
+  m_LoadList.init();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+CUnixBlockShard::~CUnixBlockShard()
+{
+  assert(m_LoadList.is_empty());
+
+#ifdef UFSD_BLOCK_CACHE_HASH
+  for (size_t i = 0; i < m_BlockCache.GetSlotsCount(); i++)
+  {
+    CUnixBlock* pBlock = m_BlockCache.GetSlot(i);
+    if (pBlock)
+      pBlock->Destroy();
+  }
+  m_BlockCache.Clear();
+#else
+  while (!m_BlockCache.is_empty())
+  {
+    avl_link* e = m_BlockCache.first();
+    CUnixBlock* pBlock = avl_entry(e, CUnixBlock, m_TreeEntry);
+    m_BlockCache.remove(e);
+    pBlock->Destroy();
+  }
+#endif
+
+  assert(m_BlocksRankList.is_empty());
+  assert(m_BlocksHotList.is_empty());
+  Free2(m_pBlocksGhost);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+CUnixBlock* CUnixBlockShard::FindBlock(IN UINT64 Block) const
+{
+#ifdef UFSD_BLOCK_CACHE_HASH
+  return m_BlockCache.Find(Block);
+#else
+  avl_link* n = avl_lookup(&m_BlockCache, Block);
+  CUnixBlock* pBlock = n ? avl_entry(n, CUnixBlock, m_TreeEntry) : NULL;
+  return pBlock && pBlock->Id() == Block ? pBlock : NULL;
+#endif
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+bool CUnixBlockShard::ReserveBlock()
+{
+#ifdef UFSD_BLOCK_CACHE_HASH
+  return m_BlockCache.Reserve();
+#else
+  return true;
+#endif
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void CUnixBlockShard::InsertBlock(IN CUnixBlock* pBlock)
+{
+#ifdef UFSD_BLOCK_CACHE_HASH
+  m_BlockCache.Insert(pBlock);
+#else
+  avl_insert(&m_BlockCache, &pBlock->m_TreeEntry);
+#endif
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void CUnixBlockShard::RemoveBlock(IN CUnixBlock* pBlock)
+{
+#ifdef UFSD_BLOCK_CACHE_HASH
+  m_BlockCache.Remove(pBlock);
+#else
+  m_BlockCache.remove(&pBlock->m_TreeEntry);
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void CUnixBlockShard::UnlinkClosedBlock(IN CUnixBlock* pBlock)
+{
+  assert(pBlock->GetReffCounter() == 0);
+  pBlock->m_RankEntry.remove();
+  m_BlocksCount--;
+  if (!pBlock->m_bHot)
+    m_BlocksColdBytes -= pBlock->GetBufferSize();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void CUnixBlockShard::ResetHotBlocks()
+{
+  //All closed blocks become cold, hot ones are moved to the head of m_BlocksRankList
+  while (!m_BlocksHotList.is_empty())
+  {
+    CUnixBlock* pBlock = list_entry(m_BlocksHotList.prev, CUnixBlock, m_RankEntry);
+    pBlock->m_RankEntry.remove();
+    pBlock->m_RankEntry.insert_after(&m_BlocksRankList);
+    m_BlocksColdBytes += pBlock->GetBufferSize();
+  }
+
+#ifdef UFSD_BLOCK_CACHE_HASH
+  for (size_t i = 0; i < m_BlockCache.GetSlotsCount(); i++)
+  {
+    if (m_BlockCache.GetSlot(i))
+      m_BlockCache.GetSlot(i)->m_bHot = false;
+  }
+#else
+  avl_link* e;
+  avl_for_each(e, &m_BlockCache)
+    avl_entry(e, CUnixBlock, m_TreeEntry)->m_bHot = false;
+#endif
+
+  m_BlocksColdTarget = 0;
+  Free2(m_pBlocksGhost);
+  m_pBlocksGhost = NULL;
+  m_BlocksGhostMask = 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+CUnixBlockLoad* CUnixBlockShard::FindLoad(IN UINT64 Block) const
+{
+  //There are few reads in progress at once
+  for (list_head* e = m_LoadList.next; e != &m_LoadList; e = e->next)
+  {
+    CUnixBlockLoad* pLoad = list_entry(e, CUnixBlockLoad, m_Entry);
+    if (pLoad->m_Block == Block)
+      return pLoad;
+  }
+  return NULL;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void CUnixBlockShard::ResetGhostBlocks(IN size_t MaxBlocks)
+{
+  //Ghost table keeps ids of about as many blocks as the shard itself
+  size_t Size = 64;
+  while (Size < MaxBlocks)
+    Size <<= 1;
+
+  Free2(m_pBlocksGhost);
+  m_pBlocksGhost = (UINT64*)Zalloc2(2 * Size * sizeof(UINT64));
+  m_BlocksGhostMask = m_pBlocksGhost != NULL ? Size - 1 : 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+static inline size_t GhostSlot(UINT64 Block, size_t Mask)
+{
+  //Bits above the ones which choose the shard
+  return (size_t)((Block * 0x9E3779B97F4A7C15ull) >> 32) & Mask;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void CUnixBlockShard::PutGhostBlock(IN UINT64 Block, IN bool bHot, IN size_t MaxBlocks)
+{
+  if (m_pBlocksGhost == NULL)
+  {
+    ResetGhostBlocks(MaxBlocks);
+    if (m_pBlocksGhost == NULL)
+      return;
+  }
+
+  //Colliding ids simply replace each other
+  size_t Slot = GhostSlot(Block, m_BlocksGhostMask);
+  m_pBlocksGhost[bHot ? m_BlocksGhostMask + 1 + Slot : Slot] = Block;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+int CUnixBlockShard::TakeGhostBlock(IN UINT64 Block)
+{
+  if (m_pBlocksGhost == NULL)
+    return 0;
+
+  size_t Slot = GhostSlot(Block, m_BlocksGhostMask);
+  if (m_pBlocksGhost[Slot] == Block)
+  {
+    m_pBlocksGhost[Slot] = 0;
+    return 1;
+  }
+
+  Slot += m_BlocksGhostMask + 1;
+  if (m_pBlocksGhost[Slot] == Block)
+  {
+    m_pBlocksGhost[Slot] = 0;
+    return 2;
+  }
+
+  return 0;
+}
+
+} //namespace UFSD
+
+#endif
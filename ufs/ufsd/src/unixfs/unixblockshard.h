@@ -0,0 +1,148 @@
+// <copyright file="unixblockshard.h" company="Paragon Software Group">
+//
+// Copyright (c) 2002-2019 Paragon Software Group, All rights reserved.
+//
+// The license for this file is defined in a separate document "LICENSE.txt"
+// located at the root of the project.
+//
+// </copyright>
+/////////////////////////////////////////////////////////////////////////////
+//
+// Revision History :
+//
+//     17-October-2026 - created.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef __UFSD_UNIX_BLOCK_SHARD_H
+#define __UFSD_UNIX_BLOCK_SHARD_H
+
+#include "unixlock.h"
+
+//UFSD_BLOCK_CACHE_HASH replaces sorted tree of cached blocks with hash
+//It is for read-only builds: write-back walks the tree in block order
+#ifdef UFSD_BLOCK_CACHE_HASH
+#include "unixblockhash.h"
+#endif
+
+namespace UFSD
+{
+
+class CUnixBlock;
+
+//Number of independent parts of blocks cache (power of 2)
+#ifdef UFSD_BLOCK_CACHE_MT
+#define BLOCK_CACHE_SHARDS      16
+#else
+#define BLOCK_CACHE_SHARDS      1
+#endif
+
+//Write-back walks m_BlockCache in block order and flushes neighbor blocks while the shard is locked,
+//so read-write builds keep one unlocked shard with sorted tree
+#if (defined UFSD_BLOCK_CACHE_MT || defined UFSD_BLOCK_CACHE_HASH) && !defined UFSD_APFS_RO
+#error "UFSD_BLOCK_CACHE_MT and UFSD_BLOCK_CACHE_HASH are for read-only builds"
+#endif
+
+//Read of block in progress. Other threads missing on the same block wait for it
+struct CUnixBlockLoad
+{
+  struct list_head  m_Entry;          //Entry for CUnixBlockShard::m_LoadList
+  UINT64            m_Block;
+  CUnixBlock*       m_pBlock;         //loaded block referenced once for every waiter
+  int               m_Status;
+  unsigned int      m_Waiters;        //threads waiting for m_bDone or still reading result
+  bool              m_bDone;
+
+  explicit CUnixBlockLoad(UINT64 Block)
+    : m_Block(Block)
+    , m_pBlock(NULL)
+    , m_Status(ERR_NOERROR)
+    , m_Waiters(0)
+    , m_bDone(false)
+  {
+    m_Entry.init();
+  }
+};
+
+//Part of blocks cache with blocks which numbers have the same hash
+//Every field is accessed under m_Lock, closed blocks are counted in shard which keeps them
+class CUnixBlockShard : public UMemBased<CUnixBlockShard>
+{
+public:
+  CUnixLock                     m_Lock;
+#ifdef UFSD_BLOCK_CACHE_HASH
+  CUnixBlockHash                m_BlockCache;       //hash of cached blocks by block number (not sorted)
+#else
+  avl_tree                      m_BlockCache;       //rbtree stored blocks sorted by block number
+#endif
+  struct list_head              m_BlocksRankList;   //list of blocks sorted by access time (only closed blocks, cold blocks for 2Q/ARC)
+  struct list_head              m_BlocksHotList;    //list of closed blocks referenced more than once (2Q/ARC only)
+  struct list_head              m_LoadList;         //blocks being read now (CUnixBlockLoad)
+  size_t                        m_BlocksBytes;      //current bytes of blocks in m_BlockCache
+  size_t                        m_BlocksColdBytes;  //current bytes of blocks in m_BlocksRankList
+  size_t                        m_BlocksColdTarget; //ARC: adaptive target for m_BlocksColdBytes
+  UINT64*                       m_pBlocksGhost;     //ids of recently evicted blocks: cold half then hot half (2Q/ARC)
+  size_t                        m_BlocksGhostMask;  //size of every half of m_pBlocksGhost - 1
+  unsigned int                  m_BlocksCount;      //current size of m_BlocksRankList and m_BlocksHotList
+  UINT64                        m_BlocksHits;       //GetBlock found block in m_BlockCache or waited for its read
+  UINT64                        m_BlocksMisses;     //GetBlock read new block
+  UINT64                        m_BlocksEvictions;  //closed blocks dropped to fit shard budget
+
+  CUnixBlockShard(api::IBaseMemoryManager* Mm);
+
+  //destroy all cached blocks
+  ~CUnixBlockShard();
+
+  //find block in m_BlockCache
+  CUnixBlock* FindBlock(
+    IN UINT64 Block
+  ) const;
+
+  //make room for one more block in m_BlockCache
+  bool ReserveBlock();
+
+  //add new block to m_BlockCache, ReserveBlock() must be called before
+  void InsertBlock(
+    IN CUnixBlock* pBlock
+  );
+
+  //remove block from m_BlockCache
+  void RemoveBlock(
+    IN CUnixBlock* pBlock
+  );
+
+  //remove closed block from m_BlocksRankList or m_BlocksHotList
+  void UnlinkClosedBlock(
+    IN CUnixBlock* pBlock
+  );
+
+  //move all closed blocks to m_BlocksRankList and forget ghosts
+  void ResetHotBlocks();
+
+  //find read of block in progress
+  CUnixBlockLoad* FindLoad(
+    IN UINT64 Block
+  ) const;
+
+  //remember id of evicted block
+  void PutGhostBlock(
+    IN UINT64 Block,
+    IN bool   bHot,
+    IN size_t MaxBlocks
+  );
+
+  //forget id of evicted block. Returns 0 - not found, 1 - was cold, 2 - was hot
+  int TakeGhostBlock(
+    IN UINT64 Block
+  );
+
+  //allocate m_pBlocksGhost for about MaxBlocks ids
+  void ResetGhostBlocks(
+    IN size_t MaxBlocks
+  );
+};
+
+}
+
+#endif   // __UFSD_UNIX_BLOCK_SHARD_H
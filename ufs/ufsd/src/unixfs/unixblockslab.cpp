@@ -0,0 +1,168 @@
+// <copyright file="unixblockslab.cpp" company="Paragon Software Group">
+//
+// Copyright (c) 2002-2019 Paragon Software Group, All rights reserved.
+//
+// The license for this file is defined in a separate document "LICENSE.txt"
+// located at the root of the project.
+//
+// </copyright>
+/////////////////////////////////////////////////////////////////////////////
+//
+// Revision History :
+//
+//     17-October-2026 - created.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#include "../h/versions.h"
+
+#if defined UFSD_BTRFS || defined UFSD_EXTFS2 || defined UFSD_XFS || defined UFSD_APFS
+
+#ifdef UFSD_TRACE_ERROR
+static const char s_pFileName[] = __FILE__ ",$Revision: 1 $";
+#endif
+
+#include <ufsd.h>
+
+#include "../h/utrace.h"
+#include "../h/assert.h"
+#include "../h/uerrors.h"
+#include "../h/uavl.h"
+
+#include "unixblockslab.h"
+
+namespace UFSD
+{
+
+
+/////////////////////////////////////////////////////////////////////////////
+CUnixBlockSlab::CUnixBlockSlab(api::IBaseMemoryManager* Mm)
+  : UMemBased<CUnixBlockSlab>(Mm)
+  , m_BufferSize(0)
+  , m_pEmptySlab(NULL)
+  , m_Allocs(0)
+  , m_SlabAllocs(0)
+{
+  m_PartialList.init();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+CUnixBlockSlab::~CUnixBlockSlab()
+{
+  while (!m_Slabs.is_empty())
+  {
+    Slab* pSlab = avl_entry(m_Slabs.first(), Slab, m_TreeEntry);
+    assert(pSlab->m_FreeCount == BLOCK_SLAB_BUFFERS);
+    DeleteSlab(pSlab);
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void CUnixBlockSlab::Init(unsigned int BufferSize)
+{
+  assert(m_Slabs.is_empty());
+
+  //Free buffer keeps the link to next one
+  m_BufferSize = BufferSize >= sizeof(void*) ? BufferSize : 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+CUnixBlockSlab::Slab* CUnixBlockSlab::NewSlab()
+{
+  //Slab header is followed by buffers aligned to their size
+  size_t Align = m_BufferSize;
+  if (Align & (Align - 1))
+    Align = sizeof(UINT64);
+
+  char* pMem = (char*)Malloc2(sizeof(Slab) + Align + (size_t)BLOCK_SLAB_BUFFERS * m_BufferSize);
+  if (pMem == NULL)
+    return NULL;
+
+  m_SlabAllocs++;
+
+  Slab* pSlab = (Slab*)pMem;
+  size_t Base = ((size_t)(pMem + sizeof(Slab)) + Align - 1) & ~(Align - 1);
+
+  pSlab->m_TreeEntry.key = Base;
+  pSlab->m_pFree = NULL;
+  pSlab->m_FreeCount = BLOCK_SLAB_BUFFERS;
+
+  for (size_t i = BLOCK_SLAB_BUFFERS; i-- > 0;)
+  {
+    void** p = (void**)(Base + i * m_BufferSize);
+    *p = pSlab->m_pFree;
+    pSlab->m_pFree = p;
+  }
+
+  avl_insert(&m_Slabs, &pSlab->m_TreeEntry);
+  pSlab->m_Entry.insert_after(&m_PartialList);
+  return pSlab;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void CUnixBlockSlab::DeleteSlab(Slab* pSlab)
+{
+  if (pSlab == m_pEmptySlab)
+    m_pEmptySlab = NULL;
+  m_Slabs.remove(&pSlab->m_TreeEntry);
+  pSlab->m_Entry.remove();
+  Free2(pSlab);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void* CUnixBlockSlab::Alloc()
+{
+  if (m_BufferSize == 0)
+    return NULL;
+
+  Slab* pSlab;
+  if (!m_PartialList.is_empty())
+    pSlab = list_entry(m_PartialList.next, Slab, m_Entry);
+  else if ((pSlab = NewSlab()) == NULL)
+    return NULL;
+
+  void** p = (void**)pSlab->m_pFree;
+  assert(p != NULL);
+  pSlab->m_pFree = *p;
+  if (--pSlab->m_FreeCount == 0)
+    pSlab->m_Entry.remove();
+  if (pSlab == m_pEmptySlab)
+    m_pEmptySlab = NULL;
+
+  m_Allocs++;
+  return p;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void CUnixBlockSlab::Free(void* p)
+{
+  avl_link* n = avl_lookup_p(&m_Slabs, (UINT64)(size_t)p);
+  assert(n != NULL);
+  Slab* pSlab = avl_entry(n, Slab, m_TreeEntry);
+  assert((size_t)p < (size_t)pSlab->m_TreeEntry.key + (size_t)BLOCK_SLAB_BUFFERS * m_BufferSize);
+
+  *(void**)p = pSlab->m_pFree;
+  pSlab->m_pFree = p;
+
+  //Slab with free buffers is used first next time
+  if (pSlab->m_FreeCount++ == 0)
+    pSlab->m_Entry.insert_after(&m_PartialList);
+
+  if (pSlab->m_FreeCount == BLOCK_SLAB_BUFFERS)
+  {
+    if (m_pEmptySlab != NULL)
+      DeleteSlab(m_pEmptySlab);
+    m_pEmptySlab = pSlab;
+  }
+}
+
+} // namespace UFSD
+
+#endif
@@ -0,0 +1,77 @@
+// <copyright file="unixblockslab.h" company="Paragon Software Group">
+//
+// Copyright (c) 2002-2019 Paragon Software Group, All rights reserved.
+//
+// The license for this file is defined in a separate document "LICENSE.txt"
+// located at the root of the project.
+//
+// </copyright>
+/////////////////////////////////////////////////////////////////////////////
+//
+// Revision History :
+//
+//     17-October-2026 - created.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef __UFSD_UNIX_BLOCK_SLAB_H
+#define __UFSD_UNIX_BLOCK_SLAB_H
+
+namespace UFSD
+{
+
+//Number of block buffers in one slab
+#ifndef UFSD_SMALL_CACHE
+#define BLOCK_SLAB_BUFFERS      64
+#else
+#define BLOCK_SLAB_BUFFERS      16
+#endif
+
+//Allocator of block buffers of one size
+//Buffers are carved from slabs of BLOCK_SLAB_BUFFERS buffers aligned to buffer size and
+//are reused without zeroing. A slab is returned to heap when all its buffers are free
+//and another free slab is already kept
+class CUnixBlockSlab : public UMemBased<CUnixBlockSlab>
+{
+  struct Slab
+  {
+    avl_link64        m_TreeEntry;            //key is address of the first buffer
+    list_head         m_Entry;                //position in m_PartialList
+    void*             m_pFree;                //single linked list of free buffers
+    unsigned int      m_FreeCount;
+  };
+
+  unsigned int           m_BufferSize;               //size of every buffer (0 - not set yet)
+  avl_tree               m_Slabs;                    //all slabs sorted by address
+  list_head              m_PartialList;              //slabs with free buffers
+  Slab*                  m_pEmptySlab;               //free slab kept for reuse
+
+  //allocate new slab and add it to m_PartialList
+  Slab* NewSlab();
+  void DeleteSlab(Slab* pSlab);
+
+public:
+  UINT64                 m_Allocs;                   //buffers given from slabs
+  UINT64                 m_SlabAllocs;               //slabs taken from heap
+
+  CUnixBlockSlab(api::IBaseMemoryManager* Mm);
+  ~CUnixBlockSlab();
+
+  //Set size of buffers once before the first Alloc
+  void Init(unsigned int BufferSize);
+
+  unsigned int GetBufferSize() const { return m_BufferSize; }
+
+  //Returns buffer of GetBufferSize() bytes or NULL
+  void* Alloc();
+
+  //Return buffer got from Alloc
+  void Free(void* p);
+
+  size_t GetSlabsCount() const { return m_Slabs.Count; }
+};
+
+}
+
+#endif   // __UFSD_UNIX_BLOCK_SLAB_H
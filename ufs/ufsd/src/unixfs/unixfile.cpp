@@ -42,6 +42,18 @@ CUnixFile::CUnixFile(IN CUnixFileSystem* vcb, IN bool bFork)
   , m_pFS(vcb)
   , m_pInode(NULL)
   , m_bFork(bFork)
+  , m_pRaMemory(NULL)
+  , m_pRaBuffer(NULL)
+  , m_pRaNext(NULL)
+  , m_RaBufferSize(0)
+  , m_RaBytes(0)
+  , m_RaOffset(0)
+  , m_RaNextBytes(0)
+  , m_RaNextOffset(0)
+  , m_bRaPending(false)
+  , m_pRaQueue(NULL)
+  , m_RaWindow(0)
+  , m_NextOffset(0)
 #ifdef UFSD_DRIVER_LINUX
   , m_aName(NULL)
 #endif
@@ -53,6 +65,8 @@ CUnixFile::CUnixFile(IN CUnixFileSystem* vcb, IN bool bFork)
 CUnixFile::~CUnixFile()
 {
   //ULOG_TRACE(( GetLog(), "~CUnixFile %" PZZ "x", m_pInode->Id() ));
+  //Background read must be completed before its buffer is freed
+  FreeReadAhead();
   if (m_pInode)
     m_pInode->Release();
 #ifdef UFSD_DRIVER_LINUX
@@ -173,11 +187,237 @@ CUnixFile::Read(
     Size = static_cast<size_t>(FileSize - Offset);
 
   Bytes = 0;
+
+  //Data can't be changed under read-ahead window only if file is read-only
+  const CUnixSuperBlock* sb = m_pFS->m_pSuper;
+  if (sb->m_ReadAheadMin != 0 && sb->m_ReadAheadMax >= sb->m_ReadAheadMin && m_pFS->IsReadOnly(m_pInode->Id()))
+    return ReadAhead(Offset, Bytes, pBuffer, Size);
+
   CHECK_CALL(m_pInode->ReadWriteData(Offset, &Bytes, pBuffer, Size, false, m_bFork));
   return ERR_NOERROR;
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+int
+CUnixFile::ReadAhead(
+  IN  UINT64  Offset,
+  OUT size_t& Bytes,
+  OUT void*   pBuffer,
+  IN  size_t  Size
+  )
+{
+  const CUnixSuperBlock* sb = m_pFS->m_pSuper;
+  bool bSequential = Offset == m_NextOffset;
+  m_NextOffset = Offset + Size;
+
+  for ( ;; )
+  {
+    if (m_RaBytes != 0 && Offset >= m_RaOffset && Offset < m_RaOffset + m_RaBytes)
+    {
+      //Head of data is already read ahead
+      size_t Len = static_cast<size_t>(m_RaOffset + m_RaBytes - Offset);
+      if (Len > Size)
+        Len = Size;
+
+      Memcpy2(pBuffer, Add2Ptr(m_pRaBuffer, static_cast<size_t>(Offset - m_RaOffset)), Len);
+      Bytes += Len;
+      Size -= Len;
+      if (Size == 0)
+        return ERR_NOERROR;
+
+      pBuffer = Add2Ptr(pBuffer, Len);
+      Offset += Len;
+      bSequential = true;
+    }
+
+    if (!m_bRaPending || Offset < m_RaNextOffset || Offset >= m_RaNextOffset + m_RaNextBytes)
+      break;
+
+    //Data is in the next window: complete its background read, failed one is repeated synchronously below
+    m_bRaPending = false;
+    if (!UFSD_SUCCESS(m_pRaQueue->Wait()))
+      break;
+
+    void* pNext = m_pRaNext;
+    m_pRaNext = m_pRaBuffer;
+    m_pRaBuffer = pNext;
+    m_RaOffset = m_RaNextOffset;
+    m_RaBytes = m_RaNextBytes;
+
+    //Window grows twice on every refill while budget allows
+    if (m_RaWindow < sb->m_ReadAheadMax)
+    {
+      m_RaWindow = 2 * m_RaWindow < sb->m_ReadAheadMax ? 2 * m_RaWindow : sb->m_ReadAheadMax;
+      if (!AllocReadAhead(m_RaWindow))
+        m_RaWindow = m_RaBufferSize;
+    }
+
+    StartReadAhead(m_RaOffset + m_RaBytes);
+  }
+
+  //Window is opened by sequential read and grows twice on every refill, random read closes it and frees buffers
+  if (!bSequential)
+  {
+    m_RaWindow = 0;
+    FreeReadAhead();
+  }
+  else
+  {
+    DropReadAhead();
+    if (m_RaWindow == 0)
+      m_RaWindow = sb->m_ReadAheadMin;
+    else if (m_RaWindow < sb->m_ReadAheadMax)
+      m_RaWindow = 2 * m_RaWindow < sb->m_ReadAheadMax ? 2 * m_RaWindow : sb->m_ReadAheadMax;
+  }
+
+  //Window starts at block boundary to keep device reads aligned
+  UINT64 Start = Offset & ~static_cast<UINT64>(sb->GetBlockSize() - 1);
+  size_t Skip = static_cast<size_t>(Offset - Start);
+  size_t Len = 0;
+
+  //Window is limited by buffers that budget of superblock allows
+  if (Skip + Size < m_RaWindow && !AllocReadAhead(m_RaWindow))
+    m_RaWindow = m_RaBufferSize;
+
+  if (Skip + Size >= m_RaWindow)
+  {
+    //Read directly: random, large or no memory for window
+    CHECK_CALL(m_pInode->ReadWriteData(Offset, &Len, pBuffer, Size, false, m_bFork));
+    Bytes += Len;
+    return ERR_NOERROR;
+  }
+
+  UINT64 FileSize = m_pInode->GetSize(m_bFork);
+  size_t Window = FileSize - Start < m_RaWindow ? static_cast<size_t>(FileSize - Start) : m_RaWindow;
+
+  m_RaBytes = 0;
+  CHECK_CALL(m_pInode->ReadWriteData(Start, &m_RaBytes, m_pRaBuffer, Window, false, m_bFork));
+  m_RaOffset = Start;
+
+  Len = m_RaBytes <= Skip ? 0 : m_RaBytes - Skip < Size ? m_RaBytes - Skip : Size;
+  Memcpy2(pBuffer, Add2Ptr(m_pRaBuffer, Skip), Len);
+  Bytes += Len;
+
+  //Next window is read while the caller consumes this one
+  StartReadAhead(m_RaOffset + m_RaBytes);
+
+  return ERR_NOERROR;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+bool
+CUnixFile::AllocReadAhead(
+  IN size_t Size
+  )
+{
+  if (Size <= m_RaBufferSize)
+    return true;
+
+  assert(!m_bRaPending);
+  CUnixSuperBlock* sb = m_pFS->m_pSuper;
+  size_t BlockSize = sb->GetBlockSize();
+
+  //Queue of device is held only while the window has buffers
+  if (m_pRaMemory == NULL && m_pRaQueue == NULL)
+    m_pRaQueue = new(m_Mm) CUnixReadQueue(sb, true);
+
+  //Buffer of the next window is needed only if it can be read in background
+  size_t Count = m_pRaQueue != NULL && m_pRaQueue->IsAsync() ? 2 : 1;
+  size_t Charge = Count * (Size - m_RaBufferSize);
+
+  //Aligned buffers let devices that bypass page cache read into them directly
+  void* pMemory = NULL;
+  if (sb->ReserveReadAhead(Charge))
+  {
+    pMemory = Malloc2(Count * Size + BlockSize);
+    if (pMemory == NULL)
+      sb->ReleaseReadAhead(Charge);
+  }
+
+  if (pMemory == NULL)
+  {
+    //Window without buffers does not hold queue of device
+    if (m_pRaMemory == NULL)
+    {
+      delete m_pRaQueue;
+      m_pRaQueue = NULL;
+    }
+    return false;
+  }
+
+  void* pBuffer = reinterpret_cast<void*>((reinterpret_cast<size_t>(pMemory) + BlockSize - 1) & ~static_cast<size_t>(BlockSize - 1));
+  if (m_RaBytes != 0)
+    Memcpy2(pBuffer, m_pRaBuffer, m_RaBytes);
+
+  Free2(m_pRaMemory);
+  m_pRaMemory = pMemory;
+  m_pRaBuffer = pBuffer;
+  m_pRaNext = Count == 2 ? Add2Ptr(pBuffer, Size) : NULL;
+  m_RaBufferSize = Size;
+  return true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void
+CUnixFile::FreeReadAhead()
+{
+  DropReadAhead();
+
+  //Give the queue back to the pool of superblock for windows of other files
+  delete m_pRaQueue;
+  m_pRaQueue = NULL;
+
+  if (m_pRaMemory == NULL)
+    return;
+
+  Free2(m_pRaMemory);
+  m_pFS->m_pSuper->ReleaseReadAhead((m_pRaNext != NULL ? 2 : 1) * m_RaBufferSize);
+  m_pRaMemory = m_pRaBuffer = m_pRaNext = NULL;
+  m_RaBufferSize = m_RaBytes = 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void
+CUnixFile::StartReadAhead(
+  IN UINT64 Start
+  )
+{
+  //Without async reads of device m_pRaNext is not allocated: synchronous read of the next window would only delay the current one
+  UINT64 FileSize = m_pInode->GetSize(m_bFork);
+  if (Start >= FileSize || m_RaWindow == 0 || m_pRaNext == NULL)
+    return;
+
+  size_t Window = FileSize - Start < m_RaWindow ? static_cast<size_t>(FileSize - Start) : m_RaWindow;
+
+  m_RaNextBytes = 0;
+  if (!UFSD_SUCCESS(m_pInode->ReadDataAsync(Start, &m_RaNextBytes, m_pRaNext, Window, m_pRaQueue, m_bFork)))
+  {
+    //Read-ahead is optional: complete reads started before the error and forget them
+    m_pRaQueue->Wait();
+    return;
+  }
+
+  m_RaNextOffset = Start;
+  m_bRaPending = true;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void
+CUnixFile::DropReadAhead()
+{
+  if (!m_bRaPending)
+    return;
+
+  m_bRaPending = false;
+  m_pRaQueue->Wait();
+}
+
+
 //////////////////////////////////////////////////////////////////////////
 int
 CUnixFile::ReadSymLink(
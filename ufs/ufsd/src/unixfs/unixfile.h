@@ -31,6 +31,18 @@ protected:
   CUnixFileSystem* m_pFS;
   CUnixInode*      m_pInode;
   bool             m_bFork;         // file has been opened as a resource fork
+  void*            m_pRaMemory;     // allocation of m_pRaBuffer and m_pRaNext
+  void*            m_pRaBuffer;     // data read ahead for sequential reads (aligned to block size)
+  void*            m_pRaNext;       // next window being read in background (NULL - device has no async reads)
+  size_t           m_RaBufferSize;  // bytes allocated for each of m_pRaBuffer and m_pRaNext
+  size_t           m_RaBytes;       // bytes of valid data in m_pRaBuffer
+  UINT64           m_RaOffset;      // file offset of data in m_pRaBuffer
+  size_t           m_RaNextBytes;   // bytes being read into m_pRaNext
+  UINT64           m_RaNextOffset;  // file offset of data in m_pRaNext
+  bool             m_bRaPending;    // m_pRaNext is being read through m_pRaQueue
+  CUnixReadQueue*  m_pRaQueue;      // queue of background reads (created with the first buffer, freed with the buffers)
+  size_t           m_RaWindow;      // current read-ahead window (0 - reads are not sequential)
+  UINT64           m_NextOffset;    // offset next to the last read (to detect sequential reads)
 #ifdef UFSD_DRIVER_LINUX
   unsigned short*   m_aName;
   unsigned short    m_NameLen;
@@ -43,6 +55,29 @@ public:
 
   api::IBaseLog* GetLog() const { return GetVcbLog( m_pFS ); }
 
+private:
+  //Read through read-ahead window of sequentially read file
+  int ReadAhead(
+    IN  UINT64  Offset,
+    OUT size_t& Bytes,
+    OUT void*   pBuffer,
+    IN  size_t  Size
+  );
+
+  //Grow read-ahead buffers keeping data of m_pRaBuffer. Returns false if no memory or budget of superblock is exhausted
+  bool AllocReadAhead(IN size_t Size);
+
+  //Free read-ahead buffers and give them back to the budget of superblock
+  void FreeReadAhead();
+
+  //Start background read of the next window into m_pRaNext
+  void StartReadAhead(IN UINT64 Start);
+
+  //Wait for background read and forget its data
+  void DropReadAhead();
+
+public:
+
   CUnixInode* GetInode() const { return m_pInode; }
 
   bool IsFork() const { return m_bFork; }
@@ -218,6 +218,46 @@ int CUnixFileSystem::GetVolumeInfo(
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+int CUnixFileSystem::OnGetBlockCacheStats()
+{
+  if (m_IO.OutBufferSize < sizeof(UFSD_BLOCK_CACHE_STATS))
+    return ERR_INSUFFICIENT_BUFFER;
+
+  UFSD_BLOCK_CACHE_STATS* Stats = static_cast<UFSD_BLOCK_CACHE_STATS*>(m_IO.OutBuffer);
+  size_t UsedBytes;
+  unsigned int ClosedBlocks;
+  m_pSuper->GetBlockCacheCounters(&UsedBytes, &ClosedBlocks, &Stats->Hits, &Stats->Misses, &Stats->Evictions);
+  Stats->CacheSize    = m_pSuper->GetBlockCacheSize();
+  Stats->UsedBytes    = UsedBytes;
+  Stats->ClosedBlocks = ClosedBlocks;
+
+  if (m_IO.BytesReturned)
+    *m_IO.BytesReturned = sizeof(UFSD_BLOCK_CACHE_STATS);
+
+  return ERR_NOERROR;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+int CUnixFileSystem::OnSetBlockCacheSize()
+{
+  if (m_IO.InBufferSize < sizeof(UINT64))
+    return ERR_BADPARAMS;
+
+  UINT64 Bytes = *static_cast<const UINT64*>(m_IO.InBuffer);
+  if (Bytes > MINUS_ONE_T)
+    Bytes = MINUS_ONE_T;
+
+  CHECK_CALL(m_pSuper->SetBlockCacheSize(static_cast<size_t>(Bytes)));
+
+  if (m_IO.OutBuffer == NULL)
+    return ERR_NOERROR;
+
+  return OnGetBlockCacheStats();
+}
+
+
 #if (defined UFSD_APFS && defined UFSD_APFS_RO) && !defined UFSD_BTRFS && !defined UFSD_EXTFS2 && !defined UFSD_XFS
 /////////////////////////////////////////////////////////////////////////////
 int CUnixFileSystem::Flush(
@@ -241,14 +281,38 @@ int CUnixFileSystem::SetVolumeInfo(
 }
 
 int CUnixFileSystem::IoControl(
-    IN  size_t      ,
-    IN  const void* ,
-    IN  size_t      ,
-    OUT void*       ,
-    IN  size_t      ,
-    OUT size_t*
+    IN  size_t      FsIoControlCode,
+    IN  const void* InBuffer,
+    IN  size_t      InBufferSize,
+    OUT void*       OutBuffer,
+    IN  size_t      OutBufferSize,
+    OUT size_t*     BytesReturned
     )
 {
+  if (m_pSuper == NULL)
+    return ERR_NOTIMPLEMENTED;
+
+  m_IO.InBuffer       = InBuffer;
+  m_IO.InBufferSize   = InBufferSize;
+  m_IO.OutBuffer      = OutBuffer;
+  m_IO.OutBufferSize  = OutBufferSize;
+  m_IO.BytesReturned  = BytesReturned;
+  m_IO.pObject        = NULL;
+  m_IO.pParent        = NULL;
+
+  if (BytesReturned)
+    *BytesReturned = 0;
+
+  switch (FsIoControlCode)
+  {
+  case IOCTL_GET_BLOCK_CACHE_STATS:
+    return OnGetBlockCacheStats();
+  case IOCTL_SET_BLOCK_CACHE_SIZE:
+    return OnSetBlockCacheSize();
+  case IOCTL_GET_INODE_RECORDS:
+    return OnGetInodeRecords();
+  }
+
   return ERR_NOTIMPLEMENTED;
 }
 
@@ -288,6 +288,15 @@ struct CUnixFileSystem : CFileSystem
   // Handler for IOCTL_ON_GET_INODES_COUNT
   virtual int OnGetInodesCount() { return ERR_NOERROR; }
 
+  // Handler for IOCTL_GET_BLOCK_CACHE_STATS
+  int OnGetBlockCacheStats();
+
+  // Handler for IOCTL_SET_BLOCK_CACHE_SIZE
+  int OnSetBlockCacheSize();
+
+  // Handler for IOCTL_GET_INODE_RECORDS
+  virtual int OnGetInodeRecords() { return ERR_NOTIMPLEMENTED; }
+
   // Handler for IOCTL_GET_COMPRESSION2
   virtual int OnGetCompression() { return UFSD_COMPRESSION_FORMAT_NONE; }
 
@@ -71,11 +71,7 @@ void CUnixInode::Release()
   --m_RefCount;
 
   if (m_RefCount == 0)
-  {
-    m_pSuper->m_InodeCache.remove(&m_TreeEntry);
-
-    delete this;
-  }
+    m_pSuper->ReleaseInode(this);
 }
 
 
@@ -23,6 +23,7 @@ namespace UFSD {
 struct CUnixFileSystem;
 struct CUnixSuperBlock;
 struct CUnixExtent;
+class CUnixReadQueue;
 
 class CUnixInode : public UMemBased<CUnixInode>
 {
@@ -43,6 +44,7 @@ public:
   CUnixSuperBlock*          m_pSuper;
   bool                      m_bHaveChanges;  //directory has changes (used in enum & unlink in linux)
   avl_link64                m_TreeEntry;
+  struct list_head          m_RankEntry;     //Entry for m_InodesRankList
 
   CUnixInode(IN api::IBaseMemoryManager* Mm);
   virtual ~CUnixInode() {}
@@ -88,6 +90,13 @@ public:
   virtual int DeCloneExtents() { return ERR_NOERROR; }
   virtual int DecompressExtents() { return ERR_NOERROR; }
 
+  //Start read of inode data through pQueue, data is valid after pQueue->Wait(). Default read is synchronous
+  virtual int ReadDataAsync(UINT64 Offset, size_t* OutLen, void* pBuffer, size_t Size, CUnixReadQueue* pQueue, bool NotInlineData = false)
+  {
+    UNREFERENCED_PARAMETER(pQueue);
+    return ReadWriteData(Offset, OutLen, pBuffer, Size, false, NotInlineData);
+  }
+
   //=================================================================
   //                   Pure virtual functions
   //=================================================================
@@ -0,0 +1,118 @@
+// <copyright file="unixlock.h" company="Paragon Software Group">
+//
+// Copyright (c) 2002-2019 Paragon Software Group, All rights reserved.
+//
+// The license for this file is defined in a separate document "LICENSE.txt"
+// located at the root of the project.
+//
+// </copyright>
+/////////////////////////////////////////////////////////////////////////////
+//
+// Revision History :
+//
+//     17-October-2026 - created.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef __UFSD_UNIX_LOCK_H
+#define __UFSD_UNIX_LOCK_H
+
+//UFSD_BLOCK_CACHE_MT makes blocks cache safe for concurrent readers
+//It is for user mode read-only builds with pthreads
+#ifdef UFSD_BLOCK_CACHE_MT
+  #if defined UFSD_DRIVER_LINUX || defined KERNEL || defined _WIN32
+    #error "UFSD_BLOCK_CACHE_MT requires pthreads"
+  #endif
+  #ifndef UFSD_APFS_RO
+    #error "UFSD_BLOCK_CACHE_MT is for read-only builds"
+  #endif
+  #include <pthread.h>
+#endif
+
+namespace UFSD
+{
+
+#ifdef UFSD_BLOCK_CACHE_MT
+
+//Mutex with condition to wait for changes made under it
+class CUnixLock
+{
+  pthread_mutex_t   m_Mutex;
+  pthread_cond_t    m_Cond;
+
+  CUnixLock(const CUnixLock&);
+  CUnixLock& operator=(const CUnixLock&);
+
+public:
+  CUnixLock()
+  {
+    pthread_mutex_init(&m_Mutex, NULL);
+    pthread_cond_init(&m_Cond, NULL);
+  }
+
+  ~CUnixLock()
+  {
+    pthread_cond_destroy(&m_Cond);
+    pthread_mutex_destroy(&m_Mutex);
+  }
+
+  void Lock()     { pthread_mutex_lock(&m_Mutex); }
+  void Unlock()   { pthread_mutex_unlock(&m_Mutex); }
+  bool TryLock()  { return pthread_mutex_trylock(&m_Mutex) == 0; }
+
+  //Unlock, sleep until WakeAll() and lock again
+  void Wait()     { pthread_cond_wait(&m_Cond, &m_Mutex); }
+  void WakeAll()  { pthread_cond_broadcast(&m_Cond); }
+};
+
+//Atomically add N to *p and return new value
+static inline unsigned int UnixAtomicAdd(unsigned int* p, int N)
+{
+  return __atomic_add_fetch(p, N, __ATOMIC_ACQ_REL);
+}
+
+//Atomically decrement *p if it is greater than 1. Returns false if *p is 1
+static inline bool UnixAtomicDecNotLast(unsigned int* p)
+{
+  unsigned int n = __atomic_load_n(p, __ATOMIC_RELAXED);
+  while (n > 1)
+  {
+    //On failure n gets current value
+    if (__atomic_compare_exchange_n(p, &n, n - 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      return true;
+  }
+  return false;
+}
+
+#else
+
+//Single threaded build: locks are empty and nobody waits
+class CUnixLock
+{
+public:
+  void Lock()     {}
+  void Unlock()   {}
+  bool TryLock()  { return true; }
+  void Wait()     {}
+  void WakeAll()  {}
+};
+
+static inline unsigned int UnixAtomicAdd(unsigned int* p, int N)
+{
+  return *p += N;
+}
+
+static inline bool UnixAtomicDecNotLast(unsigned int* p)
+{
+  if (*p <= 1)
+    return false;
+  --*p;
+  return true;
+}
+
+#endif
+
+}
+
+#endif   // __UFSD_UNIX_LOCK_H
@@ -46,18 +46,53 @@ CUnixSuperBlock::CUnixSuperBlock(
   , m_Rw(NULL)
   , m_Time(NULL)
   , m_Log(Log)
+#ifdef UFSD_APFS_RO
+  , m_pBlockShards(NULL)
+#endif
   , m_bReadOnly(false)
   , m_BytesPerSector(0)
   , m_SectorsPerBlock(0)
-  , m_BlocksCacheLimit(BLOCKS_CACHE_LIM > 1 ? BLOCKS_CACHE_LIM : 2)
-  , m_BlocksCount(0)
+  , m_BlockSlab(Mm)
+#ifndef UFSD_APFS_RO
+  , m_BlockShard(Mm)
+  , m_pBlockShards(&m_BlockShard)
+  , m_BlockCache(m_BlockShard.m_BlockCache)
+  , m_BlocksRankList(m_BlockShard.m_BlocksRankList)
+  , m_BlocksCount(m_BlockShard.m_BlocksCount)
+  , m_BlocksCacheLimit(BLOCKS_CACHE_LIM)
+#endif
+  , m_BlocksPolicy(UFSD_BLOCK_CACHE_LRU)
+  , m_BlocksCacheSize(0)
+  , m_InodesCacheLimit(INODES_CACHE_LIM)
+  , m_InodesCount(0)
+  , m_InodesHits(0)
+  , m_InodesMisses(0)
+  , m_ReadAheadMin(READ_AHEAD_MIN)
+  , m_ReadAheadMax(READ_AHEAD_MAX)
+  , m_ReadAheadSize(READ_AHEAD_SIZE)
+  , m_ReadAheadBytes(0)
+  , m_pAsyncIo(NULL)
+  , m_AsyncIoDepth(IO_QUEUE_DEPTH)
+  , m_bAsyncIoBusy(false)
+  , m_ReadAheadIoIdle(0)
+  , m_ReadAheadIoCount(0)
   , m_BlockSize(0)
   , m_Log2OfCluster(0)
   , m_InodeSize(0)
   , m_bDirty(false)
   , m_bInited(false)
 {
-  m_BlocksRankList.init();
+  m_InodesRankList.init();
+
+#ifdef UFSD_APFS_RO
+  //GetBlock fails with ERR_NOMEMORY if there are no shards
+  m_pBlockShards = reinterpret_cast<CUnixBlockShard*>(Malloc2(BLOCK_CACHE_SHARDS * sizeof(CUnixBlockShard)));
+  if (m_pBlockShards != NULL)
+  {
+    for (unsigned int i = 0; i < BLOCK_CACHE_SHARDS; i++)
+      new(m_pBlockShards + i) CUnixBlockShard(Mm);
+  }
+#endif
 }
 
 
@@ -76,6 +111,8 @@ CUnixSuperBlock::~CUnixSuperBlock()
 
   avl_link* e;
 
+  DropReleasedInodes();
+
   assert(m_InodeCache.is_empty());
   while (!m_InodeCache.is_empty())
   {
@@ -85,22 +122,325 @@ CUnixSuperBlock::~CUnixSuperBlock()
     pInode->Destroy();
   }
 
-  while (!m_BlockCache.is_empty())
+#ifdef UFSD_APFS_RO
+  if (m_pBlockShards != NULL)
   {
-    e = m_BlockCache.first();
-    CUnixBlock* pBlock = avl_entry(e, CUnixBlock, m_TreeEntry);
-    m_BlockCache.remove(e);
-    pBlock->Destroy();
+    for (unsigned int i = 0; i < BLOCK_CACHE_SHARDS; i++)
+      m_pBlockShards[i].~CUnixBlockShard();
+    Free2(m_pBlockShards);
+  }
+#endif
+
+  assert(!m_bAsyncIoBusy);
+  if (m_pAsyncIo != NULL)
+    m_pAsyncIo->Destroy();
+
+  assert(m_ReadAheadIoIdle == m_ReadAheadIoCount);
+  while (m_ReadAheadIoIdle != 0)
+    m_pReadAheadIo[--m_ReadAheadIoIdle]->Destroy();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+api::IDeviceAsyncIo* CUnixSuperBlock::AcquireAsyncIo()
+{
+  if (m_AsyncIoDepth < 2 || !m_AsyncIoLock.TryLock())
+    return NULL;
+
+  //Single threaded build: queue may be in use by outer reader
+  if (m_bAsyncIoBusy)
+  {
+    m_AsyncIoLock.Unlock();
+    return NULL;
   }
 
-  assert(m_BlocksRankList.is_empty());
+  if (m_pAsyncIo == NULL)
+  {
+    m_pAsyncIo = CreateAsyncIo(m_AsyncIoDepth);
+    if (m_pAsyncIo == NULL)
+    {
+      //Device has no async reads: do not ask again
+      m_AsyncIoDepth = 0;
+      m_AsyncIoLock.Unlock();
+      return NULL;
+    }
+  }
+
+  m_bAsyncIoBusy = true;
+  return m_pAsyncIo;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void CUnixSuperBlock::ReleaseAsyncIo()
+{
+  assert(m_bAsyncIoBusy);
+  m_bAsyncIoBusy = false;
+  m_AsyncIoLock.Unlock();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void CUnixSuperBlock::SetAsyncIoDepth(unsigned int Depth)
+{
+  m_AsyncIoLock.Lock();
+  assert(!m_bAsyncIoBusy);
+  if (m_pAsyncIo != NULL && m_pAsyncIo->GetQueueDepth() != Depth)
+  {
+    m_pAsyncIo->Destroy();
+    m_pAsyncIo = NULL;
+  }
+  m_AsyncIoDepth = Depth;
+  m_AsyncIoLock.Unlock();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+api::IDeviceAsyncIo* CUnixSuperBlock::CreateAsyncIo(unsigned int Depth)
+{
+  if (m_AsyncIoDepth < 2 || Depth < 2)
+    return NULL;
+
+  if (Depth > IO_QUEUE_MAX)
+    Depth = IO_QUEUE_MAX;
+
+  api::IDeviceAsyncIo* pAsyncIo = NULL;
+  if (!UFSD_SUCCESS(m_Rw->IoControl(RWB_IOCTL_CREATE_ASYNC_IO, &Depth, sizeof(Depth), &pAsyncIo, sizeof(pAsyncIo))))
+    return NULL;
+
+  return pAsyncIo;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+api::IDeviceAsyncIo* CUnixSuperBlock::AcquireReadAheadIo()
+{
+  api::IDeviceAsyncIo* pAsyncIo = NULL;
+
+  if (m_AsyncIoDepth < 2)
+    return NULL;
+
+  m_ReadAheadIoLock.Lock();
+  if (m_ReadAheadIoIdle != 0)
+    pAsyncIo = m_pReadAheadIo[--m_ReadAheadIoIdle];
+  else if (m_ReadAheadIoCount < READ_AHEAD_QUEUE_MAX)
+  {
+    //Engines of device (rings or threads) are created on demand and kept until unmount
+    pAsyncIo = CreateAsyncIo(READ_AHEAD_QUEUE_DEPTH);
+    if (pAsyncIo != NULL)
+      m_ReadAheadIoCount++;
+  }
+  m_ReadAheadIoLock.Unlock();
+
+  return pAsyncIo;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void CUnixSuperBlock::ReleaseReadAheadIo(api::IDeviceAsyncIo* pAsyncIo)
+{
+  m_ReadAheadIoLock.Lock();
+  assert(m_ReadAheadIoIdle < m_ReadAheadIoCount);
+  m_pReadAheadIo[m_ReadAheadIoIdle++] = pAsyncIo;
+  m_ReadAheadIoLock.Unlock();
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+CUnixReadQueue::CUnixReadQueue(CUnixSuperBlock* pSuper)
+  : UMemBased<CUnixReadQueue>(pSuper->m_Mm)
+  , m_pSuper(pSuper)
+  , m_pAsyncIo(NULL)
+  , m_bReadAhead(false)
+  , m_FreeCount(0)
+  , m_Depth(0)
+  , m_Status(ERR_NOERROR)
+  , m_bAcquired(false)
+{
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+CUnixReadQueue::CUnixReadQueue(CUnixSuperBlock* pSuper, bool bReadAhead)
+  : UMemBased<CUnixReadQueue>(pSuper->m_Mm)
+  , m_pSuper(pSuper)
+  , m_pAsyncIo(NULL)
+  , m_bReadAhead(bReadAhead)
+  , m_FreeCount(0)
+  , m_Depth(0)
+  , m_Status(ERR_NOERROR)
+  , m_bAcquired(false)
+{
+  //Queue is taken at once to let the owner know whether reads are asynchronous
+  m_bAcquired = true;
+  m_pAsyncIo = bReadAhead ? pSuper->AcquireReadAheadIo() : pSuper->AcquireAsyncIo();
+  if (m_pAsyncIo != NULL)
+  {
+    m_Depth = m_pAsyncIo->GetQueueDepth();
+    if (m_Depth > IO_QUEUE_MAX)
+      m_Depth = IO_QUEUE_MAX;
+    for (; m_FreeCount < m_Depth; m_FreeCount++)
+      m_Free[m_FreeCount] = m_Requests + m_FreeCount;
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+CUnixReadQueue::~CUnixReadQueue()
+{
+  if (m_pAsyncIo != NULL)
+  {
+    Wait();
+    if (m_bReadAhead)
+      m_pSuper->ReleaseReadAheadIo(m_pAsyncIo);
+    else
+      m_pSuper->ReleaseAsyncIo();
+  }
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+int CUnixReadQueue::Reap(size_t MinCount)
+{
+  api::t_RWBlockAsyncRequest* Completed[IO_QUEUE_MAX];
+  size_t Count;
+
+  CHECK_CALL(m_pAsyncIo->Reap(Completed, m_Depth - m_FreeCount, MinCount, &Count));
+
+  for (size_t i = 0; i < Count; i++)
+  {
+    if (m_Status == ERR_NOERROR && Completed[i]->Status != ERR_NOERROR)
+      m_Status = Completed[i]->Status;
+    m_Free[m_FreeCount++] = Completed[i];
+  }
+
+  return ERR_NOERROR;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+int CUnixReadQueue::Read(
+  IN  UINT64  Offset,
+  OUT void*   pBuffer,
+  IN  size_t  Bytes
+  )
+{
+  if (!m_bAcquired)
+  {
+    m_bAcquired = true;
+    m_pAsyncIo = m_pSuper->AcquireAsyncIo();
+    if (m_pAsyncIo != NULL)
+    {
+      m_Depth = m_pAsyncIo->GetQueueDepth();
+      if (m_Depth > IO_QUEUE_MAX)
+        m_Depth = IO_QUEUE_MAX;
+      for (; m_FreeCount < m_Depth; m_FreeCount++)
+        m_Free[m_FreeCount] = m_Requests + m_FreeCount;
+    }
+  }
+
+  if (m_pAsyncIo == NULL)
+    return m_pSuper->ReadBytes(Offset, pBuffer, Bytes);
+
+  if (m_FreeCount == 0)
+    CHECK_CALL(Reap(1));
+
+  //Do not start new reads after error
+  if (m_Status != ERR_NOERROR)
+    return m_Status;
+
+  api::t_RWBlockAsyncRequest* Req = m_Free[--m_FreeCount];
+  Req->Offset = Offset;
+  Req->Buffer = pBuffer;
+  Req->Bytes  = Bytes;
+  Req->Status = ERR_NOERROR;
+
+  //Submit updates statistics of device
+  m_pSuper->m_DeviceLock.Lock();
+  int Status = m_pAsyncIo->Submit(Req);
+  m_pSuper->m_DeviceLock.Unlock();
+
+  if (!UFSD_SUCCESS(Status))
+  {
+    m_FreeCount++;
+    return m_pSuper->ReadBytes(Offset, pBuffer, Bytes);
+  }
+
+  return ERR_NOERROR;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+int CUnixReadQueue::Wait()
+{
+  if (m_pAsyncIo == NULL)
+    return ERR_NOERROR;
+
+  while (m_FreeCount < m_Depth)
+    CHECK_CALL(Reap(m_Depth - m_FreeCount));
+
+  int Status = m_Status;
+  m_Status = ERR_NOERROR;
+  return Status;
 }
 
 
 //////////////////////////////////////////////////////////////////////////
 int CUnixSuperBlock::ReadBlocks(UINT64 Block, void* pBuff, size_t Count) const
 {
-  return m_Rw->ReadBytes(Block << m_Log2OfCluster, pBuff, Count << m_Log2OfCluster);
+  m_DeviceLock.Lock();
+  int Status = m_Rw->ReadBytes(Block << m_Log2OfCluster, pBuff, Count << m_Log2OfCluster);
+  m_DeviceLock.Unlock();
+  return Status;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void* CUnixSuperBlock::AllocBlockBuffer(
+  IN  unsigned int  Size,
+  IN  bool          bZero,
+  OUT bool*         pbSlab
+  )
+{
+  void* p = NULL;
+
+  //Slab serves blocks of volume block size, others go to heap
+  m_SlabLock.Lock();
+  if (m_BlockSlab.GetBufferSize() == 0 && Size == m_BlockSize)
+    m_BlockSlab.Init(Size);
+
+  *pbSlab = Size == m_BlockSlab.GetBufferSize();
+  if (*pbSlab)
+    p = m_BlockSlab.Alloc();
+  m_SlabLock.Unlock();
+
+  if (*pbSlab)
+  {
+    //Slab buffers are reused as is: block read overwrites them anyway
+    if (p && bZero)
+      Memzero2(p, Size);
+  }
+  else
+    p = bZero ? Zalloc2(Size) : Malloc2(Size);
+
+  return p;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void CUnixSuperBlock::FreeBlockBuffer(
+  IN void*  p,
+  IN bool   bSlab
+  )
+{
+  if (bSlab)
+  {
+    m_SlabLock.Lock();
+    m_BlockSlab.Free(p);
+    m_SlabLock.Unlock();
+  }
+  else
+    Free2(p);
 }
 
 
@@ -138,10 +478,15 @@ int CUnixSuperBlock::GetBlock(
 {
   assert(Block != 0);
 
-  avl_link* n = avl_lookup(&m_BlockCache, Block);
-  CUnixBlock* pBlock = n ? avl_entry(n, CUnixBlock, m_TreeEntry) : NULL;
+  if (m_pBlockShards == NULL)
+    return ERR_NOMEMORY;
+
+  CUnixBlockShard* pShard = GetBlockShard(Block);
+  pShard->m_Lock.Lock();
 
-  if (pBlock && pBlock->Id() == Block)
+  CUnixBlock* pBlock = pShard->FindBlock(Block);
+
+  if (pBlock)
   {
     //if fCreate flag set zero block buffer
     if (fCreate)
@@ -153,42 +498,239 @@ int CUnixSuperBlock::GetBlock(
     //Block found. Remove blocks from the the top of RankList and exit function
     if (pBlock->GetReffCounter() == 0)
     {
+      //ARC treats second reference as frequent, 2Q waits for a reference after eviction.
+      //Reopen of the block just closed is the same access (e.g. walking over one node)
+      bool bPromote = m_BlocksPolicy == UFSD_BLOCK_CACHE_ARC && pShard->m_BlocksRankList.next != &pBlock->m_RankEntry;
+
       //pBlock is in m_BlocksRankList only if it is closed (m_ReffCounter = 0)
-      pBlock->m_RankEntry.remove();
-      m_BlocksCount--;
+      pShard->UnlinkClosedBlock(pBlock);
+      if (bPromote)
+        pBlock->m_bHot = true;
     }
+
     pBlock->IncReffCount();
+    pShard->m_BlocksHits++;
+    pShard->m_Lock.Unlock();
     *ppBlock = pBlock;
     return ERR_NOERROR;
   }
 
+  //Another thread reads this block right now: wait for it instead of reading it twice
+  CUnixBlockLoad* pLoad = pShard->FindLoad(Block);
+  if (pLoad)
+  {
+    pLoad->m_Waiters++;
+    while (!pLoad->m_bDone)
+      pShard->m_Lock.Wait();
+
+    //Block is already referenced for every waiter
+    int Status = pLoad->m_Status;
+    if (UFSD_SUCCESS(Status))
+      *ppBlock = pLoad->m_pBlock;
+    if (--pLoad->m_Waiters == 0)
+      pShard->m_Lock.WakeAll();
+    pShard->m_BlocksHits++;
+    pShard->m_Lock.Unlock();
+    return Status;
+  }
+
+  pShard->m_BlocksMisses++;
+
+  //Block is read without lock
+  CUnixBlockLoad Load(Block);
+  Load.m_Entry.insert_after(&pShard->m_LoadList);
+  pShard->m_Lock.Unlock();
+
   CUnixBlock* pNewBlock = NULL;
-  CHECK_CALL(CreateCacheBlock(Block, &pNewBlock, fCreate, CacheBlockSize, VolIndex, bCalcCrc));
-  *ppBlock = pNewBlock;
+  int Status = CreateCacheBlock(Block, &pNewBlock, fCreate, CacheBlockSize, VolIndex, bCalcCrc);
 
-  avl_insert(&m_BlockCache, &pNewBlock->m_TreeEntry);
+  pShard->m_Lock.Lock();
+  Load.m_Entry.remove();
 
-  return ERR_NOERROR;
+  if (UFSD_SUCCESS(Status) && !pShard->ReserveBlock())
+  {
+    pNewBlock->DecReffCount();
+    pNewBlock->Destroy();
+    Status = ERR_NOMEMORY;
+  }
+
+  if (UFSD_SUCCESS(Status))
+  {
+    AddNewBlock(pShard, pNewBlock);
+    pNewBlock->IncReffCount(static_cast<unsigned short>(Load.m_Waiters));
+    *ppBlock = pNewBlock;
+  }
+
+  Load.m_pBlock = pNewBlock;
+  Load.m_Status = Status;
+  Load.m_bDone  = true;
+
+  //Load lives on this stack: wait until all waiters take the result
+  if (Load.m_Waiters != 0)
+  {
+    pShard->m_Lock.WakeAll();
+    while (Load.m_Waiters != 0)
+      pShard->m_Lock.Wait();
+  }
+
+  pShard->m_Lock.Unlock();
+  return Status;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+void CUnixSuperBlock::AddNewBlock(
+  IN CUnixBlockShard* pShard,
+  IN CUnixBlock*      pBlock
+  )
+{
+  pShard->InsertBlock(pBlock);
+  pShard->m_BlocksBytes += pBlock->GetBufferSize();
+
+  if (m_BlocksPolicy != UFSD_BLOCK_CACHE_LRU)
+  {
+    int Ghost = pShard->TakeGhostBlock(pBlock->Id());
+    if (Ghost != 0)
+      pBlock->m_bHot = true;
+
+    if (m_BlocksPolicy == UFSD_BLOCK_CACHE_ARC)
+    {
+      //Reread of evicted cold block asks for bigger cold queue, of evicted hot block - for smaller one
+      size_t MaxBytes = GetBlockShardSize();
+      size_t Delta    = pBlock->GetBufferSize();
+      size_t& Target  = pShard->m_BlocksColdTarget;
+      if (Ghost == 1)
+        Target = Target + Delta < MaxBytes ? Target + Delta : MaxBytes;
+      else if (Ghost == 2)
+        Target = Target > Delta ? Target - Delta : 0;
+    }
+  }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void CUnixSuperBlock::ReleaseInode(IN CUnixInode *pInode)
+{
+  assert(pInode->GetRefCount() == 0);
+
+  //Inodes to be deleted and changed inodes are not kept
+  if (m_InodesCacheLimit == 0 || pInode->IsDelOnClose() || pInode->IsDirty())
+  {
+    m_InodeCache.remove(&pInode->m_TreeEntry);
+    pInode->Destroy();
+    return;
+  }
+
+  pInode->m_RankEntry.insert_after(&m_InodesRankList);
+  m_InodesCount++;
+
+  if (m_InodesCount > m_InodesCacheLimit)
+  {
+    CUnixInode* pDelInode = list_entry(m_InodesRankList.prev, CUnixInode, m_RankEntry);
+    pDelInode->m_RankEntry.remove();
+    m_InodesCount--;
+    m_InodeCache.remove(&pDelInode->m_TreeEntry);
+    pDelInode->Destroy();
+  }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void CUnixSuperBlock::DropReleasedInodes()
+{
+  while (!m_InodesRankList.is_empty())
+  {
+    CUnixInode* pInode = list_entry(m_InodesRankList.next, CUnixInode, m_RankEntry);
+    pInode->m_RankEntry.remove();
+    m_InodeCache.remove(&pInode->m_TreeEntry);
+    pInode->Destroy();
+  }
+
+  m_InodesCount = 0;
 }
 
 
 //////////////////////////////////////////////////////////////////////////
 int CUnixSuperBlock::ReleaseBlock(IN CUnixBlock *pClosedBlock)
 {
-  assert(pClosedBlock->GetReffCounter() == 0);
-  assert(m_BlocksCacheLimit >= 2);
+  CUnixBlockShard* pShard = GetBlockShard(pClosedBlock->Id());
+  int Status = ERR_NOERROR;
 
-  pClosedBlock->m_RankEntry.insert_after(&m_BlocksRankList);
-  m_BlocksCount++;
+  pShard->m_Lock.Lock();
 
+  //Block may be referenced again by other thread before the lock
+  if (pClosedBlock->DecReffCount() == 0)
+  {
+    if (pClosedBlock->m_bHot)
+      pClosedBlock->m_RankEntry.insert_after(&pShard->m_BlocksHotList);
+    else
+    {
+      pClosedBlock->m_RankEntry.insert_after(&pShard->m_BlocksRankList);
+      pShard->m_BlocksColdBytes += pClosedBlock->GetBufferSize();
+    }
+    pShard->m_BlocksCount++;
+
+    //Just closed block is kept even if it alone exceeds the shard size
+    Status = ShrinkBlockShard(pShard, pClosedBlock);
+  }
+
+  pShard->m_Lock.Unlock();
+  return Status;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+static inline size_t GetGhostBlocks(const CUnixSuperBlock* pSuper)
+{
+  //Ghost table of shard keeps ids of about as many blocks as the shard itself
+  return pSuper->GetBlockSize() != 0 ? pSuper->GetBlockShardSize() / pSuper->GetBlockSize() : BLOCKS_CACHE_LIM / BLOCK_CACHE_SHARDS;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+int CUnixSuperBlock::ShrinkBlockShard(
+  IN CUnixBlockShard*   pShard,
+  IN const CUnixBlock*  pKeep
+  )
+{
   int Status = ERR_NOERROR;
-  if (m_BlocksCount >= m_BlocksCacheLimit)
+  size_t MaxBytes = GetBlockShardSize();
+
+  while (pShard->m_BlocksBytes > MaxBytes)
   {
-    CUnixBlock* pDelBlock = list_entry(m_BlocksRankList.prev, CUnixBlock, m_RankEntry);
-    assert(pDelBlock != pClosedBlock);          //not normal case because size of blocks cache >= 2
-    m_BlocksCount--;
-    Status = SmartFlushBlock(pDelBlock);
-    m_BlockCache.remove(&pDelBlock->m_TreeEntry);
+    //Choose the queue to evict from: 2Q keeps cold queue at 1/4 of cache, ARC adapts it
+    bool bCold = true;
+    if (m_BlocksPolicy == UFSD_BLOCK_CACHE_2Q)
+      bCold = pShard->m_BlocksColdBytes > MaxBytes / 4;
+    else if (m_BlocksPolicy == UFSD_BLOCK_CACHE_ARC)
+      bCold = pShard->m_BlocksColdBytes > pShard->m_BlocksColdTarget;
+
+    list_head* pList  = bCold ? &pShard->m_BlocksRankList : &pShard->m_BlocksHotList;
+    list_head* pOther = bCold ? &pShard->m_BlocksHotList : &pShard->m_BlocksRankList;
+    if (pList->is_empty() || list_entry(pList->prev, CUnixBlock, m_RankEntry) == pKeep)
+      pList = pOther;
+    if (pList->is_empty())
+      break;
+
+    CUnixBlock* pDelBlock = list_entry(pList->prev, CUnixBlock, m_RankEntry);
+    if (pDelBlock == pKeep)
+      break;
+
+    if (pDelBlock->IsDirty())
+    {
+      int Status2 = SmartFlushBlock(pDelBlock);
+      if (UFSD_SUCCESS(Status))
+        Status = Status2;
+    }
+
+    //2Q remembers only blocks evicted from the cold queue
+    if (m_BlocksPolicy == UFSD_BLOCK_CACHE_ARC || (m_BlocksPolicy == UFSD_BLOCK_CACHE_2Q && !pDelBlock->m_bHot))
+      pShard->PutGhostBlock(pDelBlock->Id(), pDelBlock->m_bHot, GetGhostBlocks(this));
+
+    pShard->UnlinkClosedBlock(pDelBlock);
+    pShard->m_BlocksBytes -= pDelBlock->GetBufferSize();
+    pShard->m_BlocksEvictions++;
+    pShard->RemoveBlock(pDelBlock);
     pDelBlock->Destroy();
   }
 
@@ -196,15 +738,110 @@ int CUnixSuperBlock::ReleaseBlock(IN CUnixBlock *pClosedBlock)
 }
 
 
+//////////////////////////////////////////////////////////////////////////
+int CUnixSuperBlock::ShrinkBlockCache()
+{
+  int Status = ERR_NOERROR;
+
+  for (unsigned int i = 0; m_pBlockShards != NULL && i < BLOCK_CACHE_SHARDS; i++)
+  {
+    CUnixBlockShard* pShard = m_pBlockShards + i;
+    pShard->m_Lock.Lock();
+    int Status2 = ShrinkBlockShard(pShard, NULL);
+    pShard->m_Lock.Unlock();
+    if (UFSD_SUCCESS(Status))
+      Status = Status2;
+  }
+
+  return Status;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+int CUnixSuperBlock::SetBlockCacheSize(IN size_t Bytes)
+{
+  m_BlocksCacheSize = Bytes;
+#ifndef UFSD_APFS_RO
+  m_BlocksCacheLimit = Bytes != 0 && m_BlockSize != 0 ? static_cast<unsigned int>(Bytes / m_BlockSize) : BLOCKS_CACHE_LIM;
+#endif
+
+  for (unsigned int i = 0; m_pBlockShards != NULL && i < BLOCK_CACHE_SHARDS; i++)
+  {
+    CUnixBlockShard* pShard = m_pBlockShards + i;
+    pShard->m_Lock.Lock();
+    if (pShard->m_BlocksColdTarget > GetBlockShardSize())
+      pShard->m_BlocksColdTarget = GetBlockShardSize();
+    if (pShard->m_pBlocksGhost != NULL)
+      pShard->ResetGhostBlocks(GetGhostBlocks(this));
+    pShard->m_Lock.Unlock();
+  }
+
+  return ShrinkBlockCache();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+int CUnixSuperBlock::SetBlockCachePolicy(IN unsigned int Policy)
+{
+  if (Policy != UFSD_BLOCK_CACHE_LRU && Policy != UFSD_BLOCK_CACHE_2Q && Policy != UFSD_BLOCK_CACHE_ARC)
+    return ERR_BADPARAMS;
+
+  if (Policy == m_BlocksPolicy)
+    return ERR_NOERROR;
+
+  for (unsigned int i = 0; m_pBlockShards != NULL && i < BLOCK_CACHE_SHARDS; i++)
+  {
+    CUnixBlockShard* pShard = m_pBlockShards + i;
+    pShard->m_Lock.Lock();
+    pShard->ResetHotBlocks();
+    pShard->m_Lock.Unlock();
+  }
+
+  m_BlocksPolicy = Policy;
+  return ERR_NOERROR;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void CUnixSuperBlock::GetBlockCacheCounters(
+  OUT size_t*       pBytes,
+  OUT unsigned int* pClosedBlocks,
+  OUT UINT64*       pHits,
+  OUT UINT64*       pMisses,
+  OUT UINT64*       pEvictions
+  )
+{
+  *pBytes = *pClosedBlocks = 0;
+  *pHits = *pMisses = *pEvictions = 0;
+
+  for (unsigned int i = 0; m_pBlockShards != NULL && i < BLOCK_CACHE_SHARDS; i++)
+  {
+    CUnixBlockShard* pShard = m_pBlockShards + i;
+    pShard->m_Lock.Lock();
+    *pBytes         += pShard->m_BlocksBytes;
+    *pClosedBlocks  += pShard->m_BlocksCount;
+    *pHits          += pShard->m_BlocksHits;
+    *pMisses        += pShard->m_BlocksMisses;
+    *pEvictions     += pShard->m_BlocksEvictions;
+    pShard->m_Lock.Unlock();
+  }
+}
+
+
 //////////////////////////////////////////////////////////////////////////
 int CUnixSuperBlock::DeleteBlockFromCache(IN UINT64 Block)
 {
   assert(Block != 0);
 
-  avl_link* n = avl_lookup(&m_BlockCache, Block);
-  CUnixBlock* pBlock = n ? avl_entry(n, CUnixBlock, m_TreeEntry) : NULL;
+  if (m_pBlockShards == NULL)
+    return ERR_NOERROR;
+
+  CUnixBlockShard* pShard = GetBlockShard(Block);
+  pShard->m_Lock.Lock();
+
+  CUnixBlock* pBlock = pShard->FindBlock(Block);
 
-  if (pBlock && pBlock->Id() == Block)
+  if (pBlock)
   {
     //Block found. Remove it from cache
     pBlock->SetDirty(false);            //we don't need to flush this block, because it will be cleared
@@ -212,14 +849,17 @@ int CUnixSuperBlock::DeleteBlockFromCache(IN UINT64 Block)
     if (pBlock->GetReffCounter() > 0)
     {
       assert(0);
+      pShard->m_Lock.Unlock();
       return ERR_NOERROR;// ERR_BADPARAMS;
     }
-    m_BlocksCount--;
+    pShard->UnlinkClosedBlock(pBlock);
+    pShard->m_BlocksBytes -= pBlock->GetBufferSize();
 
-    m_BlockCache.remove(&pBlock->m_TreeEntry);
+    pShard->RemoveBlock(pBlock);
     pBlock->Destroy();
   }
 
+  pShard->m_Lock.Unlock();
   return ERR_NOERROR;
 }
 
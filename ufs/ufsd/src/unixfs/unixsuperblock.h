@@ -32,14 +32,46 @@ Revision History:
 #include "../h/uint64.h"
 
 #include "unixinode.h"
+#include "unixblockslab.h"
+#include "unixblockshard.h"
 
-//max number of blocks in cache
+//default size of blocks cache in blocks of GetBlockSize() bytes
 #ifndef UFSD_SMALL_CACHE
 #define BLOCKS_CACHE_LIM        0x2000
 #else
 #define BLOCKS_CACHE_LIM        0x100
 #endif
 
+//max number of released inodes kept in cache
+#ifndef UFSD_SMALL_CACHE
+#define INODES_CACHE_LIM        0x400
+#else
+#define INODES_CACHE_LIM        0x20
+#endif
+
+//default windows of read-ahead of sequentially read files and max bytes of their buffers
+#ifndef UFSD_SMALL_CACHE
+#define READ_AHEAD_MIN          0x10000
+#define READ_AHEAD_MAX          0x100000
+#define READ_AHEAD_SIZE         0x1000000
+#else
+#define READ_AHEAD_MIN          0x4000
+#define READ_AHEAD_MAX          0x20000
+#define READ_AHEAD_SIZE         0x100000
+#endif
+
+//default and max number of data reads in flight
+#ifndef UFSD_SMALL_CACHE
+#define IO_QUEUE_DEPTH          16
+#else
+#define IO_QUEUE_DEPTH          4
+#endif
+#define IO_QUEUE_MAX            64
+//number of reads in flight of read-ahead window of one file
+#define READ_AHEAD_QUEUE_DEPTH  4
+//max async queues of device shared by read-ahead windows of all open files
+#define READ_AHEAD_QUEUE_MAX    4
+
 //Max number of blocks for flush in SmartFlushBlock
 #define MAX_FLUSH_BLOCKS_PORTION  256
 
@@ -145,16 +177,50 @@ struct CUnixSuperBlock : UMemBased<CUnixSuperBlock>
   api::ITime*                   m_Time;
   api::IBaseLog*                m_Log;
 
-  avl_tree                      m_BlockCache;      //rbtree stored inodes sorted by id
-  avl_tree                      m_InodeCache;      //rbtree stored blocks sorted by block number
+#ifdef UFSD_APFS_RO
+  CUnixBlockShard*              m_pBlockShards;    //BLOCK_CACHE_SHARDS parts of blocks cache (NULL if no memory)
+#endif
+  avl_tree                      m_InodeCache;      //rbtree stored inodes sorted by id
 
   bool                          m_bReadOnly;
   unsigned int                  m_BytesPerSector;
   unsigned int                  m_SectorsPerBlock;
 
-  struct list_head              m_BlocksRankList;   //list of blocks sorted by access time (only closed blocks)
-  unsigned int                  m_BlocksCacheLimit; //max size of m_BlocksRankList
-  unsigned int                  m_BlocksCount;      //current size of m_BlocksRankList
+  mutable CUnixLock             m_DeviceLock;       //serializes reads of m_Rw (device keeps read-ahead and bounce buffers)
+  CUnixLock                     m_SlabLock;         //protects m_BlockSlab
+  CUnixBlockSlab                m_BlockSlab;        //buffers of blocks with m_BlockSize bytes
+#ifndef UFSD_APFS_RO
+  //Read-write build keeps the only shard here (destroyed before m_BlockSlab), write-back code uses its fields by the old names
+  CUnixBlockShard               m_BlockShard;
+  CUnixBlockShard*              m_pBlockShards;     //&m_BlockShard
+  avl_tree&                     m_BlockCache;       //rbtree stored blocks sorted by block number
+  struct list_head&             m_BlocksRankList;   //list of closed blocks sorted by access time
+  unsigned int&                 m_BlocksCount;      //current size of m_BlocksRankList and hot list
+  unsigned int                  m_BlocksCacheLimit; //max number of blocks of GetBlockCacheSize() bytes
+#endif
+  unsigned int                  m_BlocksPolicy;     //replacement policy UFSD_BLOCK_CACHE_XXX
+  size_t                        m_BlocksCacheSize;  //max bytes of blocks in all shards (0 - BLOCKS_CACHE_LIM blocks)
+
+  struct list_head              m_InodesRankList;   //list of released inodes sorted by release time (m_RefCount = 0)
+  unsigned int                  m_InodesCacheLimit; //max size of m_InodesRankList (0 - do not keep released inodes)
+  unsigned int                  m_InodesCount;      //current size of m_InodesRankList
+  UINT64                        m_InodesHits;       //GetInodeT found inode in m_InodeCache
+  UINT64                        m_InodesMisses;     //GetInodeT initialized new inode
+
+  size_t                        m_ReadAheadMin;     //first read-ahead window of sequentially read file
+  size_t                        m_ReadAheadMax;     //max read-ahead window (less than m_ReadAheadMin - no read-ahead)
+  size_t                        m_ReadAheadSize;    //max bytes of read-ahead buffers of all open files
+  size_t                        m_ReadAheadBytes;   //bytes of read-ahead buffers allocated now
+
+  CUnixLock                     m_AsyncIoLock;      //held by CUnixReadQueue that uses m_pAsyncIo
+  api::IDeviceAsyncIo*          m_pAsyncIo;         //queue of data reads of device (created on first use)
+  unsigned int                  m_AsyncIoDepth;     //max data reads in flight (less than 2 - synchronous reads)
+  bool                          m_bAsyncIoBusy;     //m_pAsyncIo is used by CUnixReadQueue
+
+  CUnixLock                     m_ReadAheadIoLock;  //protects pool of queues of read-ahead windows
+  api::IDeviceAsyncIo*          m_pReadAheadIo[READ_AHEAD_QUEUE_MAX]; //idle queues of read-ahead windows
+  unsigned int                  m_ReadAheadIoIdle;  //number of idle queues in m_pReadAheadIo
+  unsigned int                  m_ReadAheadIoCount; //queues created for read-ahead windows (idle and used)
 
   unsigned int                  m_BlockSize;
   unsigned int                  m_Log2OfCluster;
@@ -253,7 +319,10 @@ struct CUnixSuperBlock : UMemBased<CUnixSuperBlock>
 
   virtual int ReadBytes(UINT64 Offset, void* pBuff, size_t Bytes) const
   {
-    return m_Rw->ReadBytes(Offset, pBuff, Bytes);
+    m_DeviceLock.Lock();
+    int Status = m_Rw->ReadBytes(Offset, pBuff, Bytes);
+    m_DeviceLock.Unlock();
+    return Status;
   }
 
   virtual int ReadBytes(UINT64 Offset, void* pBuff, size_t Bytes, unsigned char VolumeIndex, bool bMetaData) const
@@ -268,6 +337,32 @@ struct CUnixSuperBlock : UMemBased<CUnixSuperBlock>
     return m_Rw->WriteBytes(Offset, pBuff, Bytes);
   }
 
+  //Returns async queue of device for the caller only (NULL - use synchronous reads)
+  api::IDeviceAsyncIo* AcquireAsyncIo();
+  void ReleaseAsyncIo();
+
+  //Set max number of data reads in flight. Queue is recreated on next use
+  void SetAsyncIoDepth(unsigned int Depth);
+
+  //Create async queue of device owned by the caller (NULL - use synchronous reads)
+  api::IDeviceAsyncIo* CreateAsyncIo(unsigned int Depth);
+
+  //Take async queue of device for read-ahead window from the pool (NULL - pool is exhausted, use synchronous reads)
+  api::IDeviceAsyncIo* AcquireReadAheadIo();
+  void ReleaseReadAheadIo(api::IDeviceAsyncIo* pAsyncIo);
+
+  //Charge Bytes of read-ahead buffers to the budget. Returns false if the budget is exhausted
+  bool ReserveReadAhead(size_t Bytes)
+  {
+    if (m_ReadAheadBytes + Bytes > m_ReadAheadSize)
+      return false;
+    m_ReadAheadBytes += Bytes;
+    return true;
+  }
+
+  //Return Bytes of read-ahead buffers to the budget
+  void ReleaseReadAhead(size_t Bytes) { m_ReadAheadBytes -= Bytes; }
+
   //Create and initialize cache block
   virtual int CreateCacheBlock(
     IN  UINT64        Block,
@@ -373,11 +468,20 @@ struct CUnixSuperBlock : UMemBased<CUnixSuperBlock>
       //inode found
       if (fCreate)
         ULOG_WARNING((m_Log, "fCreate flag ignored because inode already existing in cache"));
+      if (pInode->GetRefCount() == 0)
+      {
+        //pInode is in m_InodesRankList only if it is released
+        pInode->m_RankEntry.remove();
+        m_InodesCount--;
+      }
       *ppInode = pInode;
       pInode->IncRefCount();
+      m_InodesHits++;
       return ERR_NOERROR;
     }
 
+    m_InodesMisses++;
+
     T* pNewInode = new(m_Mm) T(m_Mm);
     CHECK_PTR(pNewInode);
 
@@ -405,7 +509,15 @@ struct CUnixSuperBlock : UMemBased<CUnixSuperBlock>
     bool              bCalcCrc
   );
 
-  //close block, add it to m_BlocksRankList
+  //inode is not used anymore, add it to m_InodesRankList or delete it
+  void ReleaseInode(
+    IN CUnixInode *pInode
+  );
+
+  //delete all inodes from m_InodesRankList
+  void DropReleasedInodes();
+
+  //drop the last reference of block, add closed block to rank list of its shard
   int ReleaseBlock(
     IN CUnixBlock *pClosedBlock
   );
@@ -419,6 +531,119 @@ struct CUnixSuperBlock : UMemBased<CUnixSuperBlock>
   int DeleteBlockFromCache(
     IN UINT64 Block
   );
+
+  //max bytes of blocks in cache
+  size_t GetBlockCacheSize() const
+  {
+    return m_BlocksCacheSize != 0 ? m_BlocksCacheSize : (size_t)BLOCKS_CACHE_LIM * m_BlockSize;
+  }
+
+  //change max bytes of blocks in cache (0 - default size) and drop closed blocks above it
+  int SetBlockCacheSize(
+    IN size_t Bytes
+  );
+
+  //max bytes of blocks in one shard
+  size_t GetBlockShardSize() const
+  {
+    return GetBlockCacheSize() / BLOCK_CACHE_SHARDS;
+  }
+
+  //change replacement policy of blocks cache (UFSD_BLOCK_CACHE_XXX)
+  //Policy is changed while no other thread uses the cache (e.g. on mount)
+  int SetBlockCachePolicy(
+    IN unsigned int Policy
+  );
+
+  //drop closed blocks chosen by m_BlocksPolicy until every shard fits GetBlockShardSize()
+  int ShrinkBlockCache();
+
+  //drop closed blocks (except pKeep) of locked shard until it fits GetBlockShardSize()
+  int ShrinkBlockShard(
+    IN CUnixBlockShard*   pShard,
+    IN const CUnixBlock*  pKeep
+  );
+
+  //shard which keeps block
+  CUnixBlockShard* GetBlockShard(
+    IN UINT64 Block
+  ) const
+  {
+    //Bits below the ones used by CUnixBlockHash and ghost table
+    return m_pBlockShards + ((size_t)((Block * 0x9E3779B97F4A7C15ull) >> 28) & (BLOCK_CACHE_SHARDS - 1));
+  }
+
+  //sum counters of all shards
+  void GetBlockCacheCounters(
+    OUT size_t*       pBytes,
+    OUT unsigned int* pClosedBlocks,
+    OUT UINT64*       pHits,
+    OUT UINT64*       pMisses,
+    OUT UINT64*       pEvictions
+  );
+
+  //allocate buffer for cache block, *pbSlab is set if buffer is from m_BlockSlab
+  void* AllocBlockBuffer(
+    IN  unsigned int  Size,
+    IN  bool          bZero,
+    OUT bool*         pbSlab
+  );
+
+  //free buffer got from AllocBlockBuffer
+  void FreeBlockBuffer(
+    IN void*  p,
+    IN bool   bSlab
+  );
+
+  //add block just read to locked shard
+  void AddNewBlock(
+    IN CUnixBlockShard* pShard,
+    IN CUnixBlock*      pBlock
+  );
+};
+
+
+//Data reads kept in flight through async queue of device
+//Reads are synchronous if the queue is not available (not supported, used by other reader or depth < 2)
+//The queue is taken on first read and given back by destructor
+//Buffers of reads must live until Wait() or destructor
+class CUnixReadQueue : public UMemBased<CUnixReadQueue>
+{
+  CUnixSuperBlock*              m_pSuper;
+  api::IDeviceAsyncIo*          m_pAsyncIo;
+  bool                          m_bReadAhead;          //m_pAsyncIo is taken from pool of read-ahead windows
+  api::t_RWBlockAsyncRequest    m_Requests[IO_QUEUE_MAX];
+  api::t_RWBlockAsyncRequest*   m_Free[IO_QUEUE_MAX];  //requests not in flight
+  unsigned int                  m_FreeCount;
+  unsigned int                  m_Depth;
+  int                           m_Status;              //first error of reaped reads
+  bool                          m_bAcquired;           //m_pAsyncIo is asked on first read
+
+  CUnixReadQueue(const CUnixReadQueue&);
+  CUnixReadQueue& operator=(const CUnixReadQueue&);
+
+  //Wait for at least MinCount reads in flight
+  int Reap(size_t MinCount);
+
+public:
+  explicit CUnixReadQueue(CUnixSuperBlock* pSuper);
+  //Queue of read-ahead window, reads may stay in flight between calls of the owner
+  //Async queue of device is taken from pool of superblock at once and given back by destructor
+  CUnixReadQueue(CUnixSuperBlock* pSuper, bool bReadAhead);
+  ~CUnixReadQueue();
+
+  //Start read of device bytes
+  int Read(
+    IN  UINT64  Offset,
+    OUT void*   pBuffer,
+    IN  size_t  Bytes
+  );
+
+  //Wait for all reads in flight. Returns the first error of reads since previous Wait
+  int Wait();
+
+  //Reads are really asynchronous (shared queue is known after the first read)
+  bool IsAsync() const { return m_pAsyncIo != NULL; }
 };
 
 